@@ -6,12 +6,8 @@ map<int, int> Client::shuffledQuestionMap;
 vector<vector<int>> Client::shuffledOptionMap;
 vector<string> Client::shuffledQuestions;
 vector<vector<string>> Client::shuffledOptions;
-vector<ExamInfo> availableExams;
+PaperCache Client::paperCache;
 
-int lastIndex = 0;
-auto lastTime = steady_clock::now();
-bool Client::timeUp = false;
-pthread_mutex_t Client::timerMutex = PTHREAD_MUTEX_INITIALIZER;
 
 Client::Client(const string& server_ip, int server_port) {
     sock = socket(AF_INET, SOCK_STREAM, 0);
@@ -29,24 +25,16 @@ Client::Client(const string& server_ip, int server_port) {
         cerr << "Error: Connection to server failed\n";
         exit(EXIT_FAILURE);
     }
-}
-
-void Client::xorEncryptDecrypt(const string& filePath, char key) {
-    fstream file(filePath, ios::in | ios::out | ios::binary);
-    if (!file) {
-        cerr << "Error: Unable to open file for encryption: " << filePath << "\n";
-        return;
-    }
 
-    vector<char> fileData((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
-
-    for (char &c : fileData) {
-        c ^= key;
+    // Offer compression for large responses; the server answers with the codec it picked
+    string hello = string("HELLO ") + CODEC_LZ1;
+    send(sock, hello.c_str(), hello.size(), 0);
+    char reply[64] = {0};
+    if (recv(sock, reply, sizeof(reply) - 1, 0) <= 0) {
+        cerr << "Error: Connection to server failed\n";
+        exit(EXIT_FAILURE);
     }
-
-    file.seekp(0);
-    file.write(fileData.data(), fileData.size());
-    file.close();
+    compression = string(reply) == string("HELLO ") + CODEC_LZ1;
 }
 
 void Client::decryptAndPrepareExam(const string& filePath, char key) {
@@ -137,48 +125,6 @@ void Client::decryptAndPrepareExam(const string& filePath, char key) {
     }
 }
 
-void* examTimer(void* arg) {
-    int duration = *(int*)arg;
-    int total = duration;
-
-    for (int i = 0; i < total; ++i) {
-        sleep(1);
-
-        // Progress bar
-        int percent = (100 * i) / total;
-        int barWidth = 50;
-        int pos = (barWidth * i) / total;
-
-        cout << "\033[s"; // Save cursor position
-        cout << "\033[1;1H"; // Move cursor to top-left
-        cout << "[";
-        for (int j = 0; j < barWidth; ++j) {
-            if (j < pos) cout << "=";
-            else if (j == pos) cout << ">";
-            else cout << " ";
-        }
-        cout << "] " << percent << "% " << (total - i) << "s left";
-        cout << "\033[u"; // Restore cursor position
-        cout.flush();
-
-        // Check if user already submitted
-        pthread_mutex_lock(&Client::timerMutex);
-        if (Client::timeUp) {
-            pthread_mutex_unlock(&Client::timerMutex);
-            return nullptr; // Exit early if user submitted
-        }
-        pthread_mutex_unlock(&Client::timerMutex);
-    }
-
-    pthread_mutex_lock(&Client::timerMutex);
-    Client::timeUp = true;
-    pthread_mutex_unlock(&Client::timerMutex);
-
-    cout << "\n[!] Time is up. Submitting the exam...\n";
-    cout << "[!] Please enter 0...\n";
-    return nullptr;
-}
-
 void Client::displayPreparedQuestion(int index) {
     cout << "\n\n--------------------------------QUESTION "<<index+1<<"-------------------------------\n";
     if (index < 0 || index >= shuffledQuestions.size()) {
@@ -194,154 +140,271 @@ void Client::displayPreparedQuestion(int index) {
     cout << "-----------------------------QUESTION END--------------------------------\n";
 }
 
-void Client::manageExam(int durationMinutes, Client* client) {
-    int durationSeconds = durationMinutes * 60;
-    vector<int> studentAnswers(shuffledQuestions.size(), -1);
-    vector<int> timeSpent(shuffledQuestions.size(), 0); // in seconds
+void Client::drawExam(const ExamState& exam, const string& bar) {
+    UI_elements::clearScreen();
+    cout << bar << "\n";
+    displayPreparedQuestion(exam.current);
+    if (!exam.message.empty()) cout << "\n" << exam.message << "\n";
 
-    Client::timeSpentPerQuestion.clear();
+    if (exam.prompt == PROMPT_ANSWER) cout << "\n✏️  Enter your answer (A/B/C/D): ";
+    else if (exam.prompt == PROMPT_JUMP) cout << "\n🔢 Enter question number (1 to " << shuffledQuestions.size() << "): ";
+    else UI_elements::displayExamOptions();
+}
 
-    int currentIndex = 0;
-    auto questionStartTime = chrono::steady_clock::now();
+// Autosave: stream a question's answer and time to the server
+void Client::sendAnswer(const ExamState& exam, int index, Client* client) {
+    ostringstream event;
+    event << "EVENT " << shuffledQuestionMap[index] << "," << exam.answers[index] << "," << exam.timeSpent[index] << "\n";
+    string eventData = event.str();
+    send(client->sock, eventData.c_str(), eventData.size(), 0);
+}
 
-    // Start timer thread
-    pthread_t timerThread;
-    pthread_create(&timerThread, nullptr, examTimer, &durationSeconds);
+// One line typed during the exam. Returns true when the student submits.
+bool Client::examInput(ExamState& exam, const string& line, Client* client) {
+    istringstream input(line);
+    string word;
+    if (!(input >> word)) return false;  // blank lines are skipped, as cin did
+
+    // Track time spent on the current question
+    auto now = steady_clock::now();
+    exam.timeSpent[exam.current] += duration_cast<seconds>(now - exam.questionStart).count();
+    exam.questionStart = now;
+    exam.damage |= DAMAGE_SCREEN;
+    exam.message.clear();
+
+    int last = shuffledQuestions.size() - 1;
+    int touchedIndex = exam.current;
+
+    if (exam.prompt == PROMPT_ANSWER) {
+        exam.prompt = PROMPT_CHOICE;
+        char answer = toupper(word[0]);
+        if (word.size() == 1 && answer >= 'A' && answer <= 'D') {
+            exam.answers[exam.current] = shuffledOptionMap[exam.current][answer - 'A'];
+            exam.message = "[✔] Answer recorded successfully.";
+            if (exam.current < last) exam.current++;
+            else exam.message += "\n[!] You are on the last question.";
+        } else {
+            exam.message = "[✖] Invalid choice. Please enter A/B/C/D.";
+        }
+        sendAnswer(exam, touchedIndex, client);
+        return false;
+    }
 
-    system("clear");
-    cout << "\n📘 Exam started. Good luck!\n";
+    int number;
+    bool numeric = (istringstream(word) >> number) ? true : false;
 
-    while (true) {
-        // Check for timeout
-        pthread_mutex_lock(&timerMutex);
-        if (timeUp) {
-            pthread_mutex_unlock(&timerMutex);
+    if (exam.prompt == PROMPT_JUMP) {
+        exam.prompt = PROMPT_CHOICE;
+        if (numeric && number >= 1 && number <= last + 1) exam.current = number - 1;
+        else exam.message = "[✖] Invalid question number.";
+        sendAnswer(exam, touchedIndex, client);
+        return false;
+    }
+
+    if (!numeric) {
+        exam.message = "[✖] Invalid input. Please enter a number between 1 and 6.";
+        return false;
+    }
+
+    switch (number) {
+        case 1: // Next question
+            if (exam.current < last) exam.current++;
+            else exam.message = "[!] You are on the last question.";
             break;
-        }
-        pthread_mutex_unlock(&timerMutex);
-
-        displayPreparedQuestion(currentIndex);
-        UI_elements::displayExamOptions();
-
-        int opt;
-        while (true) {
-            cout << "\n➡️  Enter your choice (1-6): ";
-            cin >> opt;
-            if (cin.fail()) {
-                cin.clear();
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                cout << "[✖] Invalid input. Please enter a number between 1 and 6.\n";
-            } else {
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                break;
-            }
-        }
 
-        // Track time spent on current question
-        auto now = chrono::steady_clock::now();
-        timeSpent[currentIndex] += chrono::duration_cast<chrono::seconds>(now - questionStartTime).count();
+        case 2: // Previous question
+            if (exam.current > 0) exam.current--;
+            else exam.message = "[!] You are on the first question.";
+            break;
 
-        switch (opt) {
-            case 1: // Next question
-                if (currentIndex < shuffledQuestions.size() - 1) currentIndex++;
-                else cout << "\n[!] You are on the last question.\n";
-                break;
+        case 3: // Answer, on the next line
+            exam.prompt = PROMPT_ANSWER;
+            return false;
 
-            case 2: // Previous question
-                if (currentIndex > 0) currentIndex--;
-                else cout << "\n[!] You are on the first question.\n";
-                break;
+        case 4: // Clear answer
+            exam.answers[exam.current] = -1;
+            exam.message = "[✔] Answer cleared.";
+            break;
 
-            case 3: { // Attempt/Answer
-                cout << "\n✏️  Enter your answer (A/B/C/D): ";
-                char answer;
-                cin >> answer;
-                answer = toupper(answer);
+        case 5: // Jump to question, on the next line
+            exam.prompt = PROMPT_JUMP;
+            return false;
 
-                if (answer >= 'A' && answer <= 'D') {
-                    int shuffledIndex = answer - 'A';
-                    int originalOptionIndex = shuffledOptionMap[currentIndex][shuffledIndex];
-                    studentAnswers[currentIndex] = originalOptionIndex;
+        case 6: // Submit exam
+            sendAnswer(exam, touchedIndex, client);
+            return true;
 
-                    cout << "📌 Selected option index: " << originalOptionIndex << "\n";
-                    cout << "[✔] Answer recorded successfully.\n";
+        default:
+            exam.message = "[✖] Invalid choice. Try again.";
+            break;
+    }
+    sendAnswer(exam, touchedIndex, client);
+    return false;
+}
 
-                    if (currentIndex < shuffledQuestions.size() - 1) currentIndex++;
-                    else cout << "\n[!] You are on the last question.\n";
-                } else {
-                    cout << "[✖] Invalid choice. Please enter A/B/C/D.\n";
-                }
-                break;
-            }
+// The exam runs on one poll loop over the terminal, a one-second timerfd
+// and the server socket. Each wakeup handles whatever is ready and marks
+// damage; the screen is then painted once, and a tick that does not change
+// the progress bar paints nothing.
+void Client::manageExam(int durationMinutes, Client* client) {
+    int durationSeconds = durationMinutes * 60;
+    ExamState exam;
+    exam.answers.assign(shuffledQuestions.size(), -1);
+    exam.timeSpent.assign(shuffledQuestions.size(), 0);
 
-            case 4: // Clear answer
-                studentAnswers[currentIndex] = -1;
-                cout << "[✔] Answer cleared.\n";
-                break;
+    Client::timeSpentPerQuestion.clear();
 
-            case 5: { // Jump to question
-                int qno;
-                cout << "\n🔢 Enter question number (1 to " << shuffledQuestions.size() << "): ";
-                cin >> qno;
-                if (qno >= 1 && qno <= shuffledQuestions.size()) {
-                    currentIndex = qno - 1;
-                } else {
-                    cout << "[✖] Invalid question number.\n";
-                }
+    // The server replies with any answers saved from an interrupted attempt
+    string resume;
+    if (!Wire::recvFrame(client->sock, resume)) {
+        cerr << "[✖] Error: Failed to start exam session\n";
+        return;
+    }
+    istringstream resumeStream(resume);
+    string saved;
+    int restored = 0;
+    while (getline(resumeStream, saved)) {
+        int q, option, seconds;
+        char delim;
+        istringstream savedStream(saved);
+        if (!(savedStream >> q >> delim >> option >> delim >> seconds)) continue;
+        for (int i = 0; i < exam.answers.size(); ++i) {
+            if (shuffledQuestionMap[i] == q) {
+                exam.answers[i] = option;
+                exam.timeSpent[i] = seconds;
+                restored++;
                 break;
             }
+        }
+    }
 
-            case 6: // Submit exam
-                cout << "\n📝 Submitting your exam...\n";
-                pthread_mutex_lock(&timerMutex);
-                timeUp = true;
-                pthread_mutex_unlock(&timerMutex);
-                break;
+    exam.message = "📘 Exam started. Good luck!";
+    if (restored > 0) exam.message += "\n[+] Restored " + to_string(restored) + " saved answers from your previous session.";
 
-            default:
-                cout << "[✖] Invalid choice. Try again.\n";
-                break;
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    itimerspec tick{{1, 0}, {1, 0}};
+    if (timer == -1 || timerfd_settime(timer, 0, &tick, nullptr) == -1) {
+        cerr << "[✖] Error: Failed to start exam timer\n";
+        if (timer != -1) close(timer);
+        return;
+    }
+
+    auto startedAt = steady_clock::now();
+    exam.questionStart = startedAt;
+    pollfd fds[3] = {{STDIN_FILENO, POLLIN, 0}, {timer, POLLIN, 0}, {client->sock, POLLIN, 0}};
+    string typed, bar, serverReply;
+    bool submit = false, serverEnded = false;
+
+    while (!submit) {
+        int elapsed = min<int>(duration_cast<seconds>(steady_clock::now() - startedAt).count(), durationSeconds);
+        if (elapsed >= durationSeconds) {
+            cout << "\n[!] Time is up. Submitting the exam...\n";
+            break;
         }
 
-        // Restart timer for next question
-        questionStartTime = chrono::steady_clock::now();
+        string nextBar = UI_elements::progressBar(elapsed, durationSeconds);
+        if (exam.damage & DAMAGE_SCREEN) {
+            drawExam(exam, nextBar);
+        } else if ((exam.damage & DAMAGE_TIMER) && nextBar != bar) {
+            // Top row only; the cursor stays in the prompt
+            cout << "\033[s\033[1;1H" << nextBar << "\033[K\033[u";
+        }
+        bar = nextBar;
+        exam.damage = 0;
+        cout.flush();
 
-        pthread_mutex_lock(&timerMutex);
-        if (timeUp) {
-            pthread_mutex_unlock(&timerMutex);
+        if (poll(fds, 3, -1) == -1) {
+            if (errno == EINTR) continue;
             break;
         }
-        pthread_mutex_unlock(&timerMutex);
-    }
 
-    pthread_join(timerThread, nullptr);
-    timeUp = false;
+        if (fds[1].revents & POLLIN) {
+            uint64_t expirations;
+            if (read(timer, &expirations, sizeof(expirations)) > 0) exam.damage |= DAMAGE_TIMER;
+        }
+
+        // The server only writes during an exam when it ended it at the
+        // deadline (with a receipt), or when the connection is gone
+        if (fds[2].revents) {
+            Wire::recvLine(client->sock, serverReply);
+            serverEnded = true;
+            break;
+        }
 
+        if (fds[0].revents) {
+            char chunk[256];
+            ssize_t n = read(STDIN_FILENO, chunk, sizeof(chunk));
+            if (n <= 0) {
+                cout << "\n[!] Input closed. Submitting the exam...\n";
+                break;
+            }
+            typed.append(chunk, n);
+            size_t newline;
+            while (!submit && (newline = typed.find('\n')) != string::npos) {
+                string line = typed.substr(0, newline);
+                typed.erase(0, newline + 1);
+                submit = examInput(exam, line, client);
+            }
+        }
+    }
+    close(timer);
+
+    if (submit) cout << "\n📝 Submitting your exam...\n";
     cout << "\n✅ Exam session ended.\n";
 
-    // Prepare exam submission
-    ostringstream dataToSend;
-    dataToSend << "ANSWERS\n";
-    for (int i = 0; i < studentAnswers.size(); ++i) {
-        int originalIndex = shuffledQuestionMap[i];
-        dataToSend << originalIndex << "," << studentAnswers[i] << "," << timeSpent[i] << "\n";
+    if (serverEnded) {
+        if (serverReply.rfind("RECEIPT ", 0) == 0)
+            cout << "[!] Time is up on the server, your saved answers were submitted. Receipt #" << serverReply.substr(8) << "\n";
+        else
+            cout << "[✖] Connection to server lost.\n";
+        return;
+    }
+    if (!submit) {
+        // Time or input ran out mid-question: save where the student was
+        exam.timeSpent[exam.current] += duration_cast<seconds>(steady_clock::now() - exam.questionStart).count();
+        sendAnswer(exam, exam.current, client);
     }
 
-    // Send data to server
-    string finalData = dataToSend.str();
-    send(client->sock, finalData.c_str(), finalData.size(), 0);
+    // Every answer is already saved on the server, submitting only commits them
+    string commit = "COMMIT\n";
+    send(client->sock, commit.c_str(), commit.size(), 0);
+
+    string reply;
+    if (!Wire::recvLine(client->sock, reply) || reply.rfind("RECEIPT ", 0) != 0) {
+        cout << "[✖] " << (reply.empty() ? "No response from server." : reply) << "\n";
+        return;
+    }
+    string receipt = reply.substr(8);
+    cout << "[✔] Submission received. Receipt #" << receipt << "\n";
+
+    // Grading runs in the background on the server; wait briefly for the score
+    for (int poll = 0; poll < 10; ++poll) {
+        string request = "RESULT " + receipt + "\n";
+        send(client->sock, request.c_str(), request.size(), 0);
+        if (!Wire::recvLine(client->sock, reply)) return;
+
+        istringstream status(reply);
+        string state;
+        int marks, total;
+        status >> state >> marks >> total;
+        if (state == "GRADED") {
+            cout << "[✔] Score: " << marks << " / " << total << "\n";
+            return;
+        }
+        if (state != "PENDING") break;
+        usleep(300000);
+    }
+    cout << "[!] Your result is still being processed, check the dashboard later.\n";
 }
 
 void Client::dashboard(Client * client) {
     int sockfd = client->sock;
-    char buffer[5120];
+    string screen;
 
     while (true) {
-        memset(buffer, 0, sizeof(buffer));
-        recv(sockfd, buffer, sizeof(buffer), 0);
-        system("clear");
-        usleep(200000);
-        cout << buffer;
+        if (!Wire::recvFrame(sockfd, screen)) break;
+        UI_elements::clearScreen();
+        cout << screen;
 
         int input;
         cin >> input;
@@ -351,9 +414,8 @@ void Client::dashboard(Client * client) {
         if (input == 0) break;
     
         // Wait for attempt list or exam details
-        memset(buffer, 0, sizeof(buffer));
-        recv(sockfd, buffer, sizeof(buffer), 0);
-        cout << buffer;
+        if (!Wire::recvFrame(sockfd, screen)) break;
+        cout << screen;
 
         cin >> input;
         examSelection = to_string(input);
@@ -361,12 +423,10 @@ void Client::dashboard(Client * client) {
 
         if (input == 0) continue;
 
-        memset(buffer, 0, sizeof(buffer));
-        recv(sockfd, buffer, sizeof(buffer), 0);
-        system("clear");
-        usleep(200000);
+        if (!Wire::recvFrame(sockfd, screen)) break;
+        UI_elements::clearScreen();
         // here write logic for displaying exam paper which is stored in e
-        cout << buffer;
+        cout << screen;
 
         cin >> input;
         examSelection = to_string(input);
@@ -374,9 +434,8 @@ void Client::dashboard(Client * client) {
 
         if (input == 0) continue;
 
-        memset(buffer, 0, sizeof(buffer));
-        recv(sockfd, buffer, sizeof(buffer), 0);
-        cout << buffer;
+        if (!Wire::recvFrame(sockfd, screen)) break;
+        cout << screen;
         cout <<"\npress any key...\n";
         cin.get();
         cin.ignore();
@@ -384,82 +443,54 @@ void Client::dashboard(Client * client) {
     }
 }
 
-void Client::parseAvailableExams(const string& examData) {
-    availableExams.clear();  // Clear old data
-    istringstream iss(examData);
-    string line;
-
-    while (getline(iss, line)) {
-        if (line.empty()) continue;
-
-        size_t pos1 = line.find("Exam Name:");
-        size_t pos2 = line.find("| Duration (minutes):");
-        size_t pos3 = line.find("| Total Questions:");
-        size_t pos4 = line.find("| Instructor:");
-
-        if (pos1 != string::npos && pos2 != string::npos && pos3 != string::npos && pos4 != string::npos) {
-            string name = line.substr(pos1 + 10, pos2 - (pos1 + 10));
-            int duration = stoi(line.substr(pos2 + 22, pos3 - (pos2 + 22)));
-            int totalQ = stoi(line.substr(pos3 + 18, pos4 - (pos3 + 18)));
-            string instructor = line.substr(pos4 + 13);
-            availableExams.emplace_back(name, duration, totalQ, instructor);
-        }
+void Client::showExamCatalog(const ExamCatalog& catalog, bool withInstructor) {
+    for (size_t i = 0; i < catalog.exams.size(); ++i) {
+        const ExamEntry& ex = catalog.exams[i];
+        printf("%2zu. %-25.*s | Duration: %3u min | Questions: %2u", i + 1, (int)ex.name.size(), ex.name.data(),
+               ex.durationMinutes, ex.questions);
+        if (withInstructor) printf(" | Instructor: %.*s", (int)ex.instructor.size(), ex.instructor.data());
+        printf("\n");
     }
+    fflush(stdout);
 }
 
 void Client::handleExamSelection(Client* client, int& choice) {
-    char buffer[4096];
-    memset(buffer, 0, sizeof(buffer));
-    int bytes_read = recv(client->sock, buffer, sizeof(buffer), 0);
-
-    if (bytes_read <= 0) {
+    ExamCatalog catalog;
+    if (!Codec::recv(client->sock, client->messageBuffer, catalog)) {
         cerr << "[✖] Error: Failed to read data from server\n";
         close(client->sock);
         return;
     }
 
-    string examData(buffer);
-
-    if (examData == "No exams available.") {
+    if (catalog.exams.empty()) {
         cout << "\n[!] No exams available at the moment.\n\n";
         return;
     }
 
-    parseAvailableExams(examData);
-
     // Display exams in neat format
     cout << "\n================================== Available Exams =================================\n";
-    for (size_t i = 0; i < availableExams.size(); ++i) {
-        const ExamInfo& ex = availableExams[i];
-        printf("%2zu. %-25s | Duration: %3d min | Questions: %2d | Instructor: %s\n",
-               i + 1, ex.name.c_str(), ex.duration, ex.totalQuestions, ex.instructor.c_str());
-    }
+    showExamCatalog(catalog, true);
     cout << "------------------------------------------------------------------------------------\n";
     cout << "Select exam number to start the exam (press 0 to go back): ";
     cin >> choice;
 
-    while (choice < 0 || choice > availableExams.size()) {
+    while (choice < 0 || choice > catalog.exams.size()) {
         cout << "[✖] Please enter a valid exam number: ";
         cin >> choice;
     }
 
     if (choice == 0) {
-        string examSelection = to_string(choice);
-        send(client->sock, examSelection.c_str(), examSelection.size(), 0);
+        ExamSelection selection;
+        Codec::send(client->sock, selection);
         return;
     }
 
-    const ExamInfo& selectedExam = availableExams[choice - 1];
-    string filePath = "./exams/exam_" + to_string(choice) + ".txt";
-
-    string fileName = "./exams/exam_" + to_string(choice) + ".txt";
-    ifstream file(fileName);
-    if(!file.good()){
-        receiveAndStoreExamQuestions(client->sock, choice);
-    }
-    else{
-        string examSelection = to_string(-1);
-        send(client->sock, examSelection.c_str(), examSelection.size(), 0);
+    const ExamEntry& entry = catalog.exams[choice - 1];
+    ExamInfo selectedExam(string(entry.name), entry.durationMinutes, entry.questions, string(entry.instructor));
+    string filePath = fetchExamPaper(client->sock, choice, selectedExam.name);
+    if (filePath.empty()) {
+        cout << "Returning to student menu.\n";
+        return;
     }
     
     decryptAndPrepareExam(filePath, 'X');
@@ -512,40 +543,54 @@ void* Client::studentHandler(void* arg) {
     return nullptr;
 }
 
-void Client::receiveAndStoreExamQuestions(int sock, int examNumber) {
-    char buffer[4096] = {0};
-
-    string examSelection = to_string(examNumber);
-    send(sock, examSelection.c_str(), examSelection.size(), 0);
-
-    int bytesReceived = recv(sock, buffer, sizeof(buffer) - 1, 0);
-    if (bytesReceived <= 0) {
+// Asks the server for the paper, sending the version we already hold. Returns
+// the path of the (encrypted) cached paper, or "" if the server refused.
+string Client::fetchExamPaper(int sock, int examNumber, const string& examName) {
+    string cachedVersion = paperCache.cachedVersion(examName);
+    ExamSelection selection;
+    selection.number = examNumber;
+    selection.cachedVersion = cachedVersion;
+    Codec::send(sock, selection);
+
+    string reply;
+    if (!Wire::recvLine(sock, reply)) {
         cerr << "Error: Failed to receive exam questions from server.\n";
-        return;
+        return "";
+    }
+
+    if (reply.rfind("Error:", 0) == 0) {
+        cout << "[+] " << reply << endl;
+        return "";
     }
 
-    string server_reply(buffer);
+    istringstream header(reply);
+    string status, version;
+    header >> status >> version;
 
-    if (server_reply == "Error: Invalid exam selection") {
-        cout << "[+] " << server_reply << endl;
-        return;
+    if (status == "NOT_MODIFIED") {
+        paperCache.touch(examName, version);
+        cout << "[+] Question paper is up to date\n";
+        return paperCache.pathFor(examName, version);
     }
-    
-    buffer[bytesReceived] = '\0';
-    string fileName = "./exams/exam_" + to_string(examNumber) + ".txt";
 
-    ofstream outFile(fileName);
-    if (!outFile) {
-        cerr << "Error: Unable to create file " << fileName << "\n";
-        return;
+    string paper;
+    if (status != "PAPER" || !Wire::recvFrame(sock, paper)) {
+        cerr << "Error: Failed to receive exam questions from server.\n";
+        return "";
     }
-    outFile << buffer;
-    outFile.close();
-    memset(buffer,0,sizeof(buffer));
-    // Encrypt the file
-    xorEncryptDecrypt(fileName, 'X');  // 'X' is the XOR key
+
+    if (!paperCache.store(examName, version, paper, 'X')) return "";  // 'X' is the XOR key
 
     cout << "[+] Question paper received successfully\n";
+    return paperCache.pathFor(examName, version);
+}
+
+// "YYYY-MM-DD HH:MM" in local time, or 0
+time_t Client::parseLocalTime(const string& text) {
+    tm local{};
+    if (!strptime(text.c_str(), "%Y-%m-%d %H:%M", &local)) return 0;
+    local.tm_isdst = -1;
+    return mktime(&local);
 }
 
 void* Client::instructorHandler(void* arg) {
@@ -576,17 +621,122 @@ void* Client::instructorHandler(void* arg) {
             cin >> fileName;
             cout << "-------------------------------------------------\n";
 
-            examName += "|" + duration + "|" + fileName;
-            send(client->sock, examName.c_str(), examName.size(), 0);
+            ExamUpload upload;
+            upload.name = examName;
+            upload.durationMinutes = max(atoi(duration.c_str()), 0);
+            upload.fileName = fileName;
+            Codec::send(client->sock, upload);
 
             memset(buffer, 0, sizeof(buffer));
             recv(client->sock, buffer, sizeof(buffer), 0);
             cout <<buffer << endl;
-        } else if (choice >= 2 && choice <= 4) {
+        } else if (choice == 3) {
+            string summary;
+            if (!Wire::recvFrame(client->sock, summary)) {
+                cout << "[✖] No response from server.\n";
+                continue;
+            }
+            cout << summary;
+            cout << "-----------------------------------------------------------------------------------------------\n";
+        } else if (choice == 6) {
+            string path;
+            cout << "Enter CSV file path (username,password per line): ";
+            cin >> path;
+
+            // An unreadable file is sent as an empty import so the server is not left waiting
+            ifstream csvFile(path, ios::binary);
+            string csv((istreambuf_iterator<char>(csvFile)), istreambuf_iterator<char>());
+            if (!csvFile.is_open()) cout << "[✖] Could not open " << path << "\n";
+
+            string report;
+            if (!Wire::sendFrame(client->sock, csv, client->compression) || !Wire::recvFrame(client->sock, report)) {
+                cout << "[✖] No response from server.\n";
+                continue;
+            }
+            cout << report;
+        } else if (choice == 7) {
+            while ((getchar()) != '\n');
+            string examName, format, path;
+            cout << "Enter Exam Name: ";
+            getline(cin, examName);
+            cout << "Format (csv or columnar): ";
+            cin >> format;
+            cout << "Save to file: ";
+            cin >> path;
+
+            // The export arrives as frames until an empty one; each is written
+            // out as it comes, so nothing is held in memory
+            string request = format + "|" + examName;
+            send(client->sock, request.c_str(), request.size(), 0);
+            ofstream out(path, ios::binary);
+            if (!out.is_open()) cout << "[✖] Could not open " << path << ", discarding the export\n";
+            string chunk, report;
+            bool received = true;
+            while ((received = Wire::recvFrame(client->sock, chunk)) && !chunk.empty()) out.write(chunk.data(), chunk.size());
+            out.close();
+            if (!received || !Wire::recvFrame(client->sock, report)) {
+                cout << "[✖] No response from server.\n";
+                continue;
+            }
+            cout << report;
+        } else if (choice == 8) {
+            while ((getchar()) != '\n');
+            // Updates are pushed until Enter is pressed; after STOP the
+            // server finishes with an empty frame
+            pollfd fds[2] = {{client->sock, POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+            string view;
+            bool received = true, stopping = false;
+            while (received) {
+                if (poll(fds, stopping ? 1 : 2, -1) <= 0) continue;
+                if (fds[0].revents) {
+                    if (!(received = Wire::recvFrame(client->sock, view)) || view.empty()) break;
+                    cout << view << flush;
+                }
+                if (!stopping && fds[1].revents) {
+                    string line;
+                    getline(cin, line);
+                    send(client->sock, "STOP", 4, 0);
+                    stopping = true;
+                }
+            }
+            if (!received) cout << "[✖] No response from server.\n";
+        } else if (choice == 9) {
+            while ((getchar()) != '\n');
+            string kind, names, from, to;
+            cout << "Search by (1) exam or (2) students: ";
+            getline(cin, kind);
+            cout << (kind == "2" ? "Usernames (comma separated): " : "Exam Name: ");
+            getline(cin, names);
+            cout << "From (YYYY-MM-DD HH:MM): ";
+            getline(cin, from);
+            cout << "To (YYYY-MM-DD HH:MM): ";
+            getline(cin, to);
+
+            // An unreadable time is sent as an empty range, which the server rejects
+            AttemptQuery query;
+            query.kind = kind == "2" ? QUERY_BY_STUDENT : QUERY_BY_EXAM;
+            query.names = names;
+            query.from = parseLocalTime(from);
+            query.to = parseLocalTime(to);
+            string report;
+            if (!Codec::send(client->sock, query) || !Wire::recvFrame(client->sock, report)) {
+                cout << "[✖] No response from server.\n";
+                continue;
+            }
+            cout << report;
+        } else if (choice == 2) {
             memset(buffer, 0, sizeof(buffer));
             recv(client->sock, buffer, sizeof(buffer), 0);
+            cout << buffer << endl;
+        } else if (choice == 4) {
+            ExamCatalog catalog;
+            if (!Codec::recv(client->sock, client->messageBuffer, catalog)) {
+                cout << "[✖] No response from server.\n";
+                continue;
+            }
             cout << "\n\n=====================================Your uploaded exams=====================================\n";
-            cout << buffer;
+            if (catalog.exams.empty()) cout << "No exams available for this instructor.\n";
+            showExamCatalog(catalog, false);
             cout << "-----------------------------------------------------------------------------------------------\n";
         } else {
             cout << "Invalid choice! Please select a valid option.\n";
@@ -597,8 +747,7 @@ void* Client::instructorHandler(void* arg) {
 
 void Client::authenticate() {
     int choice;
-    system("clear");
-    usleep(200000);
+    UI_elements::clearScreen();
     UI_elements::displayHeader("Welcome to the Exam System");
 
     while (true) {
@@ -625,21 +774,20 @@ void Client::authenticate() {
         cout << "Enter username: "; cin >> username;
         cout << "Enter password: "; cin >> password;
 
-        string user_type = (role == "s") ? "student" : "instructor";
-        string request = (choice == 1) ? "LOGIN " : "REGISTER ";
-        request += user_type + " " + username + " " + password;
-        send(sock, request.c_str(), request.length(), 0);
+        AuthRequest request;
+        request.command = (choice == 1) ? AUTH_LOGIN : AUTH_REGISTER;
+        request.role = (role == "s") ? ROLE_STUDENT : ROLE_INSTRUCTOR;
+        request.username = username;
+        request.password = password;
 
-        char response[128] = {0};
-        int bytes_read = recv(sock, response, sizeof(response), 0);
-        if (bytes_read <= 0) {
+        AuthReply reply;
+        if (!Codec::send(sock, request) || !Codec::recv(sock, messageBuffer, reply)) {
             cout << "[✖] Error: Failed to read data from server."<<endl;
             close(sock);
             return;
         }
-        string server_reply(response);
-        if (server_reply == "AUTHENTICATION_SUCCESS" || server_reply == "REGISTER_SUCCESS"){
-            cout <<"[✔] " <<server_reply <<endl;
+        if (reply.ok){
+            cout << "[✔] " << (choice == 1 ? "Logged in" : "Registered") << " as " << username << endl;
             usleep(1200000);
             break;
         } 
@@ -648,14 +796,11 @@ void Client::authenticate() {
 }
 
 void Client::start() {
+    // The exam and live-monitor loops poll the terminal's fd directly, so no
+    // input may sit unseen in stdio's buffer
+    setvbuf(stdin, nullptr, _IONBF, 0);
     authenticate();
-    system("clear");
-    usleep(200000);
-    pthread_t thread;
-    if (role == "s") {
-        pthread_create(&thread, nullptr, studentHandler, this);
-    } else {
-        pthread_create(&thread, nullptr, instructorHandler, this);
-    }
-    pthread_join(thread, nullptr);
+    UI_elements::clearScreen();
+    if (role == "s") studentHandler(this);
+    else instructorHandler(this);
 }
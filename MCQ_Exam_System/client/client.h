@@ -3,7 +3,6 @@
 
 #include <iostream>
 #include <string>
-#include <pthread.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -16,10 +15,36 @@
 #include <iomanip>
 #include <fstream>
 #include <chrono>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <cerrno>
+#include <ctime>
+
+#include "paper_cache.h"
+#include "wire.h"
+#include "messages.h"
 
 using namespace std;
 using namespace std::chrono;
 
+// Parts of the exam screen that need repainting; input, timer ticks and
+// server messages only mark damage, the event loop paints once per wakeup
+#define DAMAGE_TIMER 1   // the progress bar on the top row
+#define DAMAGE_SCREEN 2  // everything
+
+enum ExamPrompt { PROMPT_CHOICE, PROMPT_ANSWER, PROMPT_JUMP };
+
+// A running exam, owned by the event loop in manageExam
+struct ExamState {
+    vector<int> answers;    // original option index, -1 if not answered
+    vector<int> timeSpent;  // seconds per question
+    int current = 0;
+    ExamPrompt prompt = PROMPT_CHOICE;
+    string message;         // shown above the prompt until the next input
+    steady_clock::time_point questionStart;
+    int damage = DAMAGE_SCREEN;
+};
+
 class ExamInfo {
     public:
         string name;
@@ -32,7 +57,9 @@ class ExamInfo {
 class Client {
 private:
     int sock;
+    bool compression = false;  // server accepted "HELLO lz1"
     string role, username, password;
+    string messageBuffer;  // received messages are decoded in place here
 
     static map<int, int> shuffledQuestionMap; 
     static vector<vector<int>> shuffledOptionMap; 
@@ -44,19 +71,22 @@ private:
     static void* instructorHandler(void* arg);
 
     static void manageExam(int duration, Client* client);
+    static void drawExam(const ExamState& exam, const string& bar);
+    static bool examInput(ExamState& exam, const string& line, Client* client);
+    static void sendAnswer(const ExamState& exam, int index, Client* client);
     static void decryptAndPrepareExam(const string& filePath, char key);
-    static void xorEncryptDecrypt(const string& filePath, char key);
-    static void receiveAndStoreExamQuestions(int sock, int examNumber); 
+    static PaperCache paperCache;
+
+    static string fetchExamPaper(int sock, int examNumber, const string& examName);
     static void dashboard(Client * client);
     static void displayPreparedQuestion(int index);
     static void handleExamSelection(Client* client, int& choice);
-    static void parseAvailableExams(const string& examData);
+    static void showExamCatalog(const ExamCatalog& catalog, bool withInstructor);
+    static time_t parseLocalTime(const string& text);
 
     void authenticate();
 
 public:
-    static bool timeUp;
-    static pthread_mutex_t timerMutex;
     Client(const string& ip, int port);
     void start();
 };
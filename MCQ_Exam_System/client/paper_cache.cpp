@@ -0,0 +1,125 @@
+#include "paper_cache.h"
+
+PaperCache::PaperCache(const string& dir, size_t maxEntries, size_t maxBytes)
+    : dir(dir), maxEntries(maxEntries), maxBytes(maxBytes) {
+    mkdir(dir.c_str(), 0755);
+    loadIndex();
+}
+
+string PaperCache::indexPath() const {
+    return dir + "/cache_index.txt";
+}
+
+string PaperCache::pathFor(const string& examName, const string& version) const {
+    // Exam names are free text, so the file name only uses a hash of it
+    unsigned long long h = 1469598103934665603ULL;
+    for (unsigned char c : examName) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    ostringstream oss;
+    oss << dir << "/paper_" << hex << h << "_" << version << ".txt";
+    return oss.str();
+}
+
+// Index lines: "<version>|<bytes>|<last used>|<exam name>". Lines that do
+// not parse are dropped and the index is rewritten without them; those
+// papers are just downloaded again.
+void PaperCache::loadIndex() {
+    entries.clear();
+    ifstream in(indexPath());
+    string line;
+    bool dropped = false;
+    while (getline(in, line)) {
+        istringstream iss(line);
+        string version, bytes, lastUsed, examName;
+        char* bytesEnd;
+        char* lastUsedEnd;
+        if (!getline(iss, version, '|') || !getline(iss, bytes, '|') ||
+            !getline(iss, lastUsed, '|') || !getline(iss, examName)) {
+            dropped = true;
+            continue;
+        }
+        Entry e{examName, version, strtoul(bytes.c_str(), &bytesEnd, 10), strtol(lastUsed.c_str(), &lastUsedEnd, 10)};
+        if (version.empty() || bytes.empty() || *bytesEnd || lastUsed.empty() || *lastUsedEnd ||
+            access(pathFor(e.examName, e.version).c_str(), R_OK) != 0) {
+            dropped = true;
+            continue;
+        }
+        clock = max(clock, e.lastUsed);
+        entries.push_back(e);
+    }
+    in.close();
+    if (dropped) saveIndex();
+}
+
+void PaperCache::saveIndex() const {
+    string tmpPath = indexPath() + ".tmp";
+    ofstream out(tmpPath, ios::trunc);
+    if (!out) {
+        cerr << "Error: Unable to write paper cache index\n";
+        return;
+    }
+    for (const Entry& e : entries)
+        out << e.version << "|" << e.bytes << "|" << e.lastUsed << "|" << e.examName << "\n";
+    out.close();
+    rename(tmpPath.c_str(), indexPath().c_str());
+}
+
+string PaperCache::cachedVersion(const string& examName) const {
+    for (const Entry& e : entries)
+        if (e.examName == examName) return e.version;
+    return "0";
+}
+
+void PaperCache::touch(const string& examName, const string& version) {
+    for (Entry& e : entries) {
+        if (e.examName == examName && e.version == version) {
+            e.lastUsed = ++clock;
+            saveIndex();
+            return;
+        }
+    }
+}
+
+void PaperCache::removeEntry(size_t idx) {
+    unlink(pathFor(entries[idx].examName, entries[idx].version).c_str());
+    entries.erase(entries.begin() + idx);
+}
+
+void PaperCache::evict() {
+    size_t totalBytes = 0;
+    for (const Entry& e : entries) totalBytes += e.bytes;
+
+    while (!entries.empty() && (entries.size() > maxEntries || totalBytes > maxBytes)) {
+        size_t lru = 0;
+        for (size_t i = 1; i < entries.size(); ++i)
+            if (entries[i].lastUsed < entries[lru].lastUsed) lru = i;
+        totalBytes -= entries[lru].bytes;
+        removeEntry(lru);
+    }
+}
+
+bool PaperCache::store(const string& examName, const string& version, const string& content, char key) {
+    // Only the newest version of a paper is worth keeping
+    for (size_t i = 0; i < entries.size();) {
+        if (entries[i].examName == examName) removeEntry(i);
+        else ++i;
+    }
+
+    string filePath = pathFor(examName, version);
+    ofstream outFile(filePath, ios::binary | ios::trunc);
+    if (!outFile) {
+        cerr << "Error: Unable to create file " << filePath << "\n";
+        return false;
+    }
+    string encrypted = content;
+    for (char &c : encrypted) c ^= key;
+    outFile.write(encrypted.data(), encrypted.size());
+    outFile.close();
+
+    entries.push_back({examName, version, content.size(), ++clock});
+    evict();
+    saveIndex();
+    return true;
+}
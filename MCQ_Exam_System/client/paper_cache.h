@@ -0,0 +1,52 @@
+#ifndef PAPER_CACHE_H
+#define PAPER_CACHE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define PAPER_CACHE_DIR "./exams"
+#define PAPER_CACHE_MAX_ENTRIES 16
+#define PAPER_CACHE_MAX_BYTES (4 * 1024 * 1024)
+
+// Local store of downloaded question papers, keyed by exam name and paper
+// version (content hash sent by the server). Least recently used papers are
+// evicted once the entry or byte limit is exceeded.
+class PaperCache {
+private:
+    struct Entry {
+        string examName;
+        string version;
+        size_t bytes;
+        long lastUsed;
+    };
+
+    string dir;
+    size_t maxEntries, maxBytes;
+    vector<Entry> entries;
+    long clock = 0;
+
+    string indexPath() const;
+    void loadIndex();
+    void saveIndex() const;
+    void removeEntry(size_t idx);
+    void evict();
+
+public:
+    PaperCache(const string& dir = PAPER_CACHE_DIR, size_t maxEntries = PAPER_CACHE_MAX_ENTRIES, size_t maxBytes = PAPER_CACHE_MAX_BYTES);
+    string pathFor(const string& examName, const string& version) const;
+    string cachedVersion(const string& examName) const;
+    void touch(const string& examName, const string& version);
+    bool store(const string& examName, const string& version, const string& content, char key);
+};
+
+#endif
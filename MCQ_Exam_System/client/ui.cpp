@@ -36,6 +36,10 @@ void UI_elements::displayInstructorMenu() {
     cout << "3. Show Student Performance\n";
     cout << "4. View Uploaded Exams\n";
     cout << "5. Logout\n";
+    cout << "6. Import Students (CSV)\n";
+    cout << "7. Export Exam Results\n";
+    cout << "8. Monitor Live Exams\n";
+    cout << "9. Attempt History\n";
     cout << "------------------------------\n";
     cout << "Choose an option: ";
 }
@@ -50,4 +54,23 @@ void UI_elements::displayExamOptions(){
     cout << "6. Submit Exam";
     cout << "\n--------------------------------\n";
     cout << "Enter your choice: ";
-}
\ No newline at end of file
+}
+
+// ANSI clear and home; cheaper than running clear(1) through a shell
+void UI_elements::clearScreen() {
+    cout << "\033[2J\033[H";
+}
+
+string UI_elements::progressBar(int elapsed, int total) {
+    int percent = (100 * elapsed) / total;
+    int barWidth = 50;
+    int pos = (barWidth * elapsed) / total;
+
+    string bar = "[";
+    for (int j = 0; j < barWidth; ++j) {
+        if (j < pos) bar += "=";
+        else if (j == pos) bar += ">";
+        else bar += " ";
+    }
+    return bar + "] " + to_string(percent) + "% " + to_string(total - elapsed) + "s left";
+}
@@ -19,6 +19,8 @@ class UI_elements{
     static void displayExamOptions();
     static void displayStudentMenu();
     static void displayInstructorMenu(); 
+    static void clearScreen();
+    static string progressBar(int elapsed, int total);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,196 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <sys/socket.h>
+
+#include "wire.h"
+
+using namespace std;
+
+// A binary message is MESSAGE_MARK, a type byte and the u32 body length,
+// then the body. Text commands never start with MESSAGE_MARK, so a reader
+// can tell the two apart from the first byte.
+#define MESSAGE_MARK 0x01
+#define MESSAGE_HEADER_SIZE 6
+#define MAX_MESSAGE_SIZE (1024 * 1024)
+#define MESSAGE_STACK_BYTES 512  // messages up to this size are sent without allocating
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "the message codec writes integers in host order, which must be little-endian"
+#endif
+
+// Declares a message's fields once, in wire order. Integers and enums are
+// fixed width; string_view is a u32 length and the bytes; vector<T> of a
+// struct with MESSAGE_FIELDS is a u32 count and the elements.
+#define MESSAGE_FIELDS(...) \
+    template <typename F> void fields(F&& visit) { visit(__VA_ARGS__); } \
+    template <typename F> void fields(F&& visit) const { visit(__VA_ARGS__); }
+
+// Encoders and decoders generated from MESSAGE_FIELDS. Encoding writes
+// straight into the caller's buffer. Decoding copies nothing: string_view
+// fields point into the received bytes, so they are valid while that
+// buffer is, and vector fields reuse their capacity from call to call.
+class Codec {
+private:
+    template <typename T> struct IsList : false_type {};
+    template <typename T> struct IsList<vector<T>> : true_type {};
+
+    template <typename T> static size_t fieldSize(const T& value) {
+        if constexpr (is_integral_v<T> || is_enum_v<T>) {
+            return sizeof(T);
+        } else if constexpr (is_same_v<T, string_view>) {
+            return sizeof(uint32_t) + value.size();
+        } else if constexpr (IsList<T>::value) {
+            size_t size = sizeof(uint32_t);
+            for (const auto& item : value) size += bodySize(item);
+            return size;
+        } else {
+            return bodySize(value);
+        }
+    }
+
+    template <typename M> static size_t bodySize(const M& message) {
+        size_t size = 0;
+        message.fields([&](const auto&... field) { size = (fieldSize(field) + ... + 0); });
+        return size;
+    }
+
+    template <typename T> static char* put(char* out, const T& value) {
+        if constexpr (is_integral_v<T> || is_enum_v<T>) {
+            memcpy(out, &value, sizeof(T));
+            return out + sizeof(T);
+        } else if constexpr (is_same_v<T, string_view>) {
+            out = put<uint32_t>(out, value.size());
+            memcpy(out, value.data(), value.size());
+            return out + value.size();
+        } else if constexpr (IsList<T>::value) {
+            out = put<uint32_t>(out, value.size());
+            for (const auto& item : value) out = putBody(out, item);
+            return out;
+        } else {
+            return putBody(out, value);
+        }
+    }
+
+    template <typename M> static char* putBody(char* out, const M& message) {
+        message.fields([&](const auto&... field) { ((out = put(out, field)), ...); });
+        return out;
+    }
+
+    template <typename T> static bool get(const char*& p, const char* end, T& value) {
+        if constexpr (is_integral_v<T> || is_enum_v<T>) {
+            if (static_cast<size_t>(end - p) < sizeof(T)) return false;
+            memcpy(&value, p, sizeof(T));
+            p += sizeof(T);
+            return true;
+        } else if constexpr (is_same_v<T, string_view>) {
+            uint32_t length;
+            if (!get(p, end, length) || static_cast<size_t>(end - p) < length) return false;
+            value = string_view(p, length);
+            p += length;
+            return true;
+        } else if constexpr (IsList<T>::value) {
+            uint32_t count;
+            // Each element takes at least a byte, which bounds the resize
+            if (!get(p, end, count) || count > static_cast<size_t>(end - p)) return false;
+            value.resize(count);
+            for (auto& item : value) {
+                if (!getBody(p, end, item)) return false;
+            }
+            return true;
+        } else {
+            return getBody(p, end, value);
+        }
+    }
+
+    template <typename M> static bool getBody(const char*& p, const char* end, M& message) {
+        bool ok = true;
+        message.fields([&](auto&... field) { ok = (get(p, end, field) && ...); });
+        return ok;
+    }
+
+    static bool recvAll(int sock, char* data, size_t length) {
+        while (length > 0) {
+            ssize_t n = Wire::receive(sock, data, length, MSG_WAITALL);
+            if (n <= 0) return false;
+            data += n;
+            length -= n;
+        }
+        return true;
+    }
+
+public:
+    template <typename M> static size_t size(const M& message) {
+        return MESSAGE_HEADER_SIZE + bodySize(message);
+    }
+
+    // `out` must hold size(message) bytes
+    template <typename M> static size_t encode(const M& message, char* out) {
+        uint32_t body = bodySize(message);
+        char* p = out;
+        *p++ = MESSAGE_MARK;
+        *p++ = M::TYPE;
+        p = put(p, body);
+        return putBody(p, message) - out;
+    }
+
+    template <typename M> static void append(const M& message, string& out) {
+        size_t at = out.size();
+        out.resize(at + size(message));
+        encode(message, &out[at]);
+    }
+
+    // A whole message, header included. False if it is cut short, has
+    // bytes left over or is of another type.
+    template <typename M> static bool decode(const char* data, size_t length, M& message) {
+        uint32_t body;
+        const char* p = data + 2;
+        const char* end = data + length;
+        if (length < MESSAGE_HEADER_SIZE || data[0] != MESSAGE_MARK || static_cast<uint8_t>(data[1]) != M::TYPE ||
+            !get(p, end, body) || body != length - MESSAGE_HEADER_SIZE)
+            return false;
+        return getBody(p, end, message) && p == end;
+    }
+
+    template <typename M> static bool send(int sock, const M& message) {
+        char stack[MESSAGE_STACK_BYTES];
+        size_t length = size(message);
+        string heap;
+        char* out = stack;
+        if (length > sizeof(stack)) {
+            heap.resize(length);
+            out = &heap[0];
+        }
+        encode(message, out);
+        return Wire::sendAll(sock, out, length);
+    }
+
+    // Reads one message into `buffer` (kept by the caller, and reused so
+    // steady traffic does not allocate) and decodes it from there.
+    template <typename M> static bool recv(int sock, string& buffer, M& message) {
+        char header[MESSAGE_HEADER_SIZE];
+        if (!recvAll(sock, header, sizeof(header))) return false;
+        uint32_t body;
+        memcpy(&body, header + 2, sizeof(body));
+        if (header[0] != MESSAGE_MARK || body > MAX_MESSAGE_SIZE) return false;
+        buffer.resize(MESSAGE_HEADER_SIZE + body);
+        memcpy(&buffer[0], header, sizeof(header));
+        if (!recvAll(sock, &buffer[MESSAGE_HEADER_SIZE], body)) return false;
+        return decode(buffer.data(), buffer.size(), message);
+    }
+
+    // Blocks until something arrives; true if it is a binary message
+    static bool messageNext(int sock, bool& closed) {
+        char first;
+        closed = ::recv(sock, &first, 1, MSG_PEEK) <= 0;
+        return !closed && first == MESSAGE_MARK;
+    }
+};
+
+#endif
@@ -0,0 +1,110 @@
+#include "compress.h"
+
+static inline uint32_t read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+void Compressor::writeLength(string& out, size_t len) {
+    while (len >= 255) {
+        out += static_cast<char>(255);
+        len -= 255;
+    }
+    out += static_cast<char>(len);
+}
+
+// Sequence: token (literal length << 4 | match length - 4), extra literal
+// length bytes, literals, 2 byte little endian offset, extra match length
+// bytes. The final sequence carries literals only.
+string Compressor::compress(const string& input) {
+    const unsigned char* src = reinterpret_cast<const unsigned char*>(input.data());
+    const size_t n = input.size();
+    string out;
+    out.reserve(n / 2 + 16);
+
+    vector<int> table(1 << HASH_BITS, -1);
+    size_t anchor = 0, i = 0;
+    size_t limit = n > LAST_LITERALS ? n - LAST_LITERALS : 0;
+
+    while (i + MIN_MATCH <= limit) {
+        uint32_t seq = read32(src + i);
+        uint32_t h = (seq * 2654435761u) >> (32 - HASH_BITS);
+        int candidate = table[h];
+        table[h] = static_cast<int>(i);
+
+        if (candidate < 0 || i - candidate > MAX_OFFSET || read32(src + candidate) != seq) {
+            ++i;
+            continue;
+        }
+
+        size_t matchLen = MIN_MATCH;
+        while (i + matchLen < limit && src[candidate + matchLen] == src[i + matchLen]) ++matchLen;
+
+        size_t litLen = i - anchor;
+        size_t extraMatch = matchLen - MIN_MATCH;
+        out += static_cast<char>(((litLen < 15 ? litLen : 15) << 4) | (extraMatch < 15 ? extraMatch : 15));
+        if (litLen >= 15) writeLength(out, litLen - 15);
+        out.append(input, anchor, litLen);
+
+        size_t offset = i - candidate;
+        out += static_cast<char>(offset & 0xff);
+        out += static_cast<char>(offset >> 8);
+        if (extraMatch >= 15) writeLength(out, extraMatch - 15);
+
+        i += matchLen;
+        anchor = i;
+    }
+
+    size_t litLen = n - anchor;
+    out += static_cast<char>((litLen < 15 ? litLen : 15) << 4);
+    if (litLen >= 15) writeLength(out, litLen - 15);
+    out.append(input, anchor, litLen);
+    return out;
+}
+
+bool Compressor::decompress(const string& input, size_t rawSize, string& output) {
+    const unsigned char* ip = reinterpret_cast<const unsigned char*>(input.data());
+    const unsigned char* end = ip + input.size();
+    output.clear();
+    output.reserve(rawSize);
+
+    while (ip < end) {
+        unsigned token = *ip++;
+
+        size_t litLen = token >> 4;
+        if (litLen == 15) {
+            unsigned char b;
+            do {
+                if (ip >= end) return false;
+                b = *ip++;
+                litLen += b;
+            } while (b == 255);
+        }
+        if (litLen > static_cast<size_t>(end - ip) || output.size() + litLen > rawSize) return false;
+        output.append(reinterpret_cast<const char*>(ip), litLen);
+        ip += litLen;
+
+        if (ip == end) break;  // last sequence has no match
+
+        if (end - ip < 2) return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        size_t matchLen = (token & 0x0f);
+        if (matchLen == 15) {
+            unsigned char b;
+            do {
+                if (ip >= end) return false;
+                b = *ip++;
+                matchLen += b;
+            } while (b == 255);
+        }
+        matchLen += MIN_MATCH;
+
+        if (offset == 0 || offset > output.size() || output.size() + matchLen > rawSize) return false;
+        size_t from = output.size() - offset;
+        for (size_t k = 0; k < matchLen; ++k) output += output[from + k];  // may overlap
+    }
+    return output.size() == rawSize;
+}
@@ -0,0 +1,31 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+
+using namespace std;
+
+#define CODEC_RAW "raw"
+#define CODEC_LZ1 "lz1"
+
+// Small self-contained LZ77 codec (LZ4-style sequences: token, literals,
+// 16 bit back reference). Exam papers and reports are plain text with a lot
+// of repeated option labels, padding and table rows, which it handles well.
+class Compressor {
+private:
+    static const int HASH_BITS = 14;
+    static const size_t MIN_MATCH = 4;
+    static const size_t LAST_LITERALS = 5;
+    static const size_t MAX_OFFSET = 65535;
+
+    static void writeLength(string& out, size_t len);
+
+public:
+    static string compress(const string& input);
+    static bool decompress(const string& input, size_t rawSize, string& output);
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef MESSAGES_H
+#define MESSAGES_H
+
+#include "codec.h"
+
+// Binary messages shared by server and client. Type numbers are part of the
+// protocol: add new ones at the end and never reuse a number.
+enum MessageType : uint8_t {
+    MSG_AUTH_REQUEST = 1,
+    MSG_AUTH_REPLY = 2,
+    MSG_EXAM_UPLOAD = 3,
+    MSG_EXAM_CATALOG = 4,
+    MSG_EXAM_SELECTION = 5,
+    MSG_ATTEMPT_QUERY = 6,
+};
+
+enum AuthCommand : uint8_t { AUTH_LOGIN = 1, AUTH_REGISTER = 2 };
+enum AuthRole : uint8_t { ROLE_STUDENT = 1, ROLE_INSTRUCTOR = 2 };
+enum AttemptQueryKind : uint8_t { QUERY_BY_EXAM = 1, QUERY_BY_STUDENT = 2 };
+
+// Client -> server, before anything else but HELLO
+struct AuthRequest {
+    static constexpr uint8_t TYPE = MSG_AUTH_REQUEST;
+    AuthCommand command = AUTH_LOGIN;
+    AuthRole role = ROLE_STUDENT;
+    string_view username, password;
+    MESSAGE_FIELDS(command, role, username, password)
+};
+
+struct AuthReply {
+    static constexpr uint8_t TYPE = MSG_AUTH_REPLY;
+    AuthCommand command = AUTH_LOGIN;
+    uint8_t ok = 0;
+    MESSAGE_FIELDS(command, ok)
+};
+
+// Instructor menu 1; the file is looked up under data/exams/
+struct ExamUpload {
+    static constexpr uint8_t TYPE = MSG_EXAM_UPLOAD;
+    string_view name;
+    uint32_t durationMinutes = 0;
+    string_view fileName;
+    MESSAGE_FIELDS(name, durationMinutes, fileName)
+};
+
+struct ExamEntry {
+    string_view name;
+    uint32_t durationMinutes = 0;
+    uint32_t questions = 0;
+    string_view instructor;
+    MESSAGE_FIELDS(name, durationMinutes, questions, instructor)
+};
+
+// Student menu 1 (every exam) and instructor menu 4 (the instructor's own)
+struct ExamCatalog {
+    static constexpr uint8_t TYPE = MSG_EXAM_CATALOG;
+    vector<ExamEntry> exams;
+    MESSAGE_FIELDS(exams)
+};
+
+// Reply to a student's catalog: 1-based exam number, 0 to go back, and the
+// version of the paper the client has cached ("0" for none)
+struct ExamSelection {
+    static constexpr uint8_t TYPE = MSG_EXAM_SELECTION;
+    uint32_t number = 0;
+    string_view cachedVersion;
+    MESSAGE_FIELDS(number, cachedVersion)
+};
+
+// Instructor menu 9: attempts at one exam, or by a comma separated list of
+// students, submitted in [from, to) (unix seconds)
+struct AttemptQuery {
+    static constexpr uint8_t TYPE = MSG_ATTEMPT_QUERY;
+    AttemptQueryKind kind = QUERY_BY_EXAM;
+    string_view names;
+    int64_t from = 0, to = 0;
+    MESSAGE_FIELDS(kind, names, from, to)
+};
+
+#endif
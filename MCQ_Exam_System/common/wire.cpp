@@ -0,0 +1,114 @@
+#include "wire.h"
+
+TrafficTap Wire::tap = nullptr;
+atomic<long long> Wire::sendTimeouts(0);
+
+// recv(2) that shows what it consumed to the tap
+ssize_t Wire::receive(int sock, void* buffer, size_t length, int flags) {
+    ssize_t got = recv(sock, buffer, length, flags);
+    if (got > 0 && tap && !(flags & MSG_PEEK)) tap(sock, static_cast<const char*>(buffer), got, true);
+    return got;
+}
+
+bool Wire::sendAll(int sock, const char* data, size_t len) {
+    if (tap) tap(sock, data, len, false);
+    while (len > 0) {
+        ssize_t sent = send(sock, data, len, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) sendTimeouts++;
+            return false;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+bool Wire::sendAll(int sock, const string& data) {
+    return sendAll(sock, data.data(), data.size());
+}
+
+// Reads one '\n' terminated line without consuming anything after it.
+bool Wire::recvLine(int sock, string& line) {
+    line.clear();
+    char buffer[256];
+    while (true) {
+        ssize_t peeked = recv(sock, buffer, sizeof(buffer), MSG_PEEK);
+        if (peeked <= 0) return false;
+
+        void* nl = memchr(buffer, '\n', peeked);
+        size_t take = nl ? static_cast<char*>(nl) - buffer + 1 : peeked;
+        ssize_t got = receive(sock, buffer, take, 0);
+        if (got <= 0) return false;
+        line.append(buffer, got);
+
+        if (nl) {
+            line.pop_back();
+            return true;
+        }
+        if (line.size() > 4096) return false;
+    }
+}
+
+bool Wire::recvExact(int sock, size_t len, string& data) {
+    data.clear();
+    data.reserve(len);
+    char buffer[8192];
+    while (data.size() < len) {
+        size_t want = min(sizeof(buffer), len - data.size());
+        ssize_t got = receive(sock, buffer, want, 0);
+        if (got <= 0) return false;
+        data.append(buffer, got);
+    }
+    return true;
+}
+
+string Wire::frameHeader(const string& codec, size_t rawSize, size_t wireSize) {
+    return codec + " " + to_string(rawSize) + " " + to_string(wireSize) + "\n";
+}
+
+// A whole frame as bytes, for callers that queue it instead of sending now
+string Wire::encodeFrame(const string& payload, bool allowCompression) {
+    if (allowCompression && payload.size() >= COMPRESSION_THRESHOLD) {
+        string compressed = Compressor::compress(payload);
+        if (compressed.size() < payload.size())
+            return frameHeader(CODEC_LZ1, payload.size(), compressed.size()) + compressed;
+    }
+    return frameHeader(CODEC_RAW, payload.size(), payload.size()) + payload;
+}
+
+bool Wire::sendFrame(int sock, const string& payload, bool allowCompression) {
+    if (allowCompression && payload.size() >= COMPRESSION_THRESHOLD) {
+        string compressed = Compressor::compress(payload);
+        if (compressed.size() < payload.size())
+            return sendCompressedFrame(sock, payload.size(), compressed);
+    }
+    return sendAll(sock, frameHeader(CODEC_RAW, payload.size(), payload.size())) &&
+           sendAll(sock, payload);
+}
+
+bool Wire::sendCompressedFrame(int sock, size_t rawSize, const string& compressed) {
+    return sendAll(sock, frameHeader(CODEC_LZ1, rawSize, compressed.size())) &&
+           sendAll(sock, compressed);
+}
+
+bool Wire::recvFrame(int sock, string& payload) {
+    string header;
+    if (!recvLine(sock, header)) return false;
+
+    istringstream iss(header);
+    string codec;
+    size_t rawSize = 0, wireSize = 0;
+    if (!(iss >> codec >> rawSize >> wireSize) || rawSize > MAX_FRAME_SIZE || wireSize > MAX_FRAME_SIZE)
+        return false;
+
+    string body;
+    if (!recvExact(sock, wireSize, body)) return false;
+
+    if (codec == CODEC_RAW) {
+        payload = body;
+        return true;
+    }
+    if (codec == CODEC_LZ1) return Compressor::decompress(body, rawSize, payload);
+    return false;
+}
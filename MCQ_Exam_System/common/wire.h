@@ -0,0 +1,44 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "compress.h"
+
+using namespace std;
+
+// Responses at or above this size are compressed when the connection
+// negotiated it with "HELLO lz1".
+#define COMPRESSION_THRESHOLD 512
+#define MAX_FRAME_SIZE (64 * 1024 * 1024)
+
+// Sees the bytes a process reads and writes through Wire; the server sets
+// it while recording traffic (see TrafficCapture).
+typedef void (*TrafficTap)(int sock, const char* data, size_t length, bool inbound);
+
+// Framed payloads are "<codec> <raw bytes> <wire bytes>\n" followed by the body.
+class Wire {
+public:
+    static TrafficTap tap;
+    static atomic<long long> sendTimeouts;  // sends given up under SO_SNDTIMEO
+
+    static ssize_t receive(int sock, void* buffer, size_t length, int flags);
+    static bool sendAll(int sock, const char* data, size_t len);
+    static bool sendAll(int sock, const string& data);
+    static bool recvLine(int sock, string& line);
+    static bool recvExact(int sock, size_t len, string& data);
+
+    static string frameHeader(const string& codec, size_t rawSize, size_t wireSize);
+    static string encodeFrame(const string& payload, bool allowCompression);
+    static bool sendFrame(int sock, const string& payload, bool allowCompression);
+    static bool sendCompressedFrame(int sock, size_t rawSize, const string& compressed);
+    static bool recvFrame(int sock, string& payload);
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include "attempt_index.h"
+#include "replication.h"
+#include "metrics.h"
+#include <sstream>
+#include <algorithm>
+#include <tuple>
+
+set<string> AttemptIndex::listedDays;
+string AttemptIndex::today;
+pthread_mutex_t AttemptIndex::indexMutex = PTHREAD_MUTEX_INITIALIZER;
+
+string AttemptIndex::dayOf(time_t when) {
+    tm local{};
+    localtime_r(&when, &local);
+    char day[16];
+    strftime(day, sizeof(day), "%Y%m%d", &local);
+    return day;
+}
+
+string AttemptIndex::partitionPath(AttemptQueryKind kind, const string& name, const string& day) {
+    return string(RESULTS_DIR) + (kind == QUERY_BY_EXAM ? "attempts_exam_" : "attempts_student_") + name + "_" + day + ".txt";
+}
+
+string AttemptIndex::daysPath(AttemptQueryKind kind, const string& name) {
+    return partitionPath(kind, name, "days");
+}
+
+void AttemptIndex::add(AttemptQueryKind kind, const string& name, const string& day, const string& line,
+                       vector<AppendOp>& writes) {
+    writes.push_back({partitionPath(kind, name, day), line});
+    string days = daysPath(kind, name);
+    pthread_mutex_lock(&indexMutex);
+    // Only today's are remembered: that is where nearly every attempt lands
+    if (day > today) {
+        today = day;
+        listedDays.clear();
+    }
+    bool listed = day == today && !listedDays.insert(days).second;
+    pthread_mutex_unlock(&indexMutex);
+    if (!listed) writes.push_back({days, day + "\n"});
+}
+
+void AttemptIndex::record(const string& studentId, const string& examName, time_t at, int marks, int totalMarks,
+                          vector<AppendOp>& writes) {
+    string day = dayOf(at);
+    string line = to_string(at) + "|" + studentId + "|" + examName + "|" + to_string(marks) + "|" + to_string(totalMarks) + "\n";
+    add(QUERY_BY_EXAM, examName, day, line, writes);
+    add(QUERY_BY_STUDENT, studentId, day, line, writes);
+}
+
+// Attempts of one exam or one student with from <= time < to, oldest first
+bool AttemptIndex::query(AttemptQueryKind kind, const string& name, time_t from, time_t to, vector<AttemptRecord>& out) {
+    string listing;
+    if (from >= to || !ResultStore::read(daysPath(kind, name), listing)) return false;
+    string first = dayOf(from), last = dayOf(to - 1);
+    set<string> days;
+    istringstream lines(listing);
+    string day;
+    while (getline(lines, day)) {
+        if (day >= first && day <= last) days.insert(day);
+    }
+
+    size_t start = out.size();
+    string partition;
+    for (const string& selected : days) {
+        partition.clear();
+        if (!ResultStore::read(partitionPath(kind, name, selected), partition)) continue;
+        Metrics::add("attempt_index_partitions_read_total");
+        istringstream records(partition);
+        string line;
+        while (getline(records, line)) {
+            AttemptRecord record;
+            string at, marks, total;
+            istringstream fields(line);
+            if (!getline(fields, at, '|') || !getline(fields, record.student, '|') || !getline(fields, record.exam, '|') ||
+                !getline(fields, marks, '|') || !getline(fields, total))
+                continue;
+            record.at = atoll(at.c_str());
+            record.marks = atoi(marks.c_str());
+            record.totalMarks = atoi(total.c_str());
+            if (record.at >= from && record.at < to) out.push_back(record);
+        }
+    }
+
+    // Oldest first; a backfilled copy of an attempt that was also indexed
+    // when graded sorts after it and is dropped
+    auto key = [](const AttemptRecord& r) { return make_tuple(r.at, r.student, r.exam, -r.totalMarks); };
+    sort(out.begin() + start, out.end(), [&](const AttemptRecord& a, const AttemptRecord& b) { return key(a) < key(b); });
+    out.erase(unique(out.begin() + start, out.end(), [](const AttemptRecord& a, const AttemptRecord& b) {
+        return a.at == b.at && a.student == b.student && a.exam == b.exam;
+    }), out.end());
+    return true;
+}
+
+// Indexes the attempts graded before the index existed, once, from
+// exam_log.txt ("<student>: <exam>: <YYYY-MM-DD HH:MM:SS>" lines). Run by
+// one process at startup before it grades anything.
+void AttemptIndex::backfill() {
+    string marker, log;
+    if (ResultStore::read(ATTEMPT_BACKFILL_FILE, marker)) return;
+    ResultStore::read(EXAM_LOG_FILE, log);
+
+    vector<AppendOp> writes;
+    long long attempts = 0;
+    istringstream lines(log);
+    string line;
+    while (getline(lines, line)) {
+        size_t first = line.find(": "), last = line.rfind(": ");
+        if (first == string::npos || first == last) continue;
+        tm local{};
+        if (!strptime(line.c_str() + last + 2, "%Y-%m-%d %H:%M:%S", &local)) continue;
+        local.tm_isdst = -1;
+        record(line.substr(0, first), line.substr(first + 2, last - first - 2), mktime(&local), -1, -1, writes);
+        attempts++;
+    }
+    writes.push_back({ATTEMPT_BACKFILL_FILE, to_string(attempts) + " attempts from exam_log.txt\n"});
+    if (!ResultStore::appendBatch(writes)) {
+        // Today's days lines were not written after all
+        pthread_mutex_lock(&indexMutex);
+        listedDays.clear();
+        pthread_mutex_unlock(&indexMutex);
+        cerr << "[!] Could not index past attempts, will retry on the next start.\n";
+        return;
+    }
+    Replicator::ship(writes);
+    cout << "[+] Indexed " << attempts << " past attempts from exam_log.txt.\n";
+}
@@ -0,0 +1,55 @@
+#ifndef ATTEMPT_INDEX_H
+#define ATTEMPT_INDEX_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <ctime>
+#include <pthread.h>
+
+#include "result_store.h"
+#include "messages.h"
+
+using namespace std;
+
+#define ATTEMPT_BACKFILL_FILE RESULTS_DIR "attempts_backfilled.txt"
+
+struct AttemptRecord {
+    time_t at;
+    string student;
+    string exam;
+    int marks;       // -1 with totalMarks -1: backfilled from exam_log.txt,
+    int totalMarks;  // which never had the score
+};
+
+// Graded attempts by exam and by student, partitioned by local day. Each
+// attempt is one "<unix time>|<student>|<exam>|<marks>|<total>" line in
+// two ResultStore keys, attempts_exam_<exam>_<YYYYMMDD>.txt and
+// attempts_student_<student>_<YYYYMMDD>.txt, and each exam and student has
+// an attempts_<kind>_<name>_days.txt listing the days it has partitions for.
+// A range query reads that list and then only the partitions of the days
+// in range, so its cost follows the attempts it returns, not the history.
+//
+// The lines are written in the same batch as the rest of the results, so
+// they are replicated and compacted with them. A day can be listed twice
+// (a restart, two shards on the same day); readers ignore repeats.
+class AttemptIndex {
+private:
+    static set<string> listedDays;  // days keys this process has listed today
+    static string today;
+    static pthread_mutex_t indexMutex;
+
+    static string dayOf(time_t when);
+    static string partitionPath(AttemptQueryKind kind, const string& name, const string& day);
+    static string daysPath(AttemptQueryKind kind, const string& name);
+    static void add(AttemptQueryKind kind, const string& name, const string& day, const string& line, vector<AppendOp>& writes);
+
+public:
+    static void record(const string& studentId, const string& examName, time_t at, int marks, int totalMarks,
+                       vector<AppendOp>& writes);
+    static bool query(AttemptQueryKind kind, const string& name, time_t from, time_t to, vector<AttemptRecord>& out);
+    static void backfill();
+};
+
+#endif
@@ -1,50 +1,18 @@
 #include "auth.h"
+#include "replication.h"
 
-unordered_map<string, string> AuthManager::student_db;
-unordered_map<string, string> AuthManager::instructor_db;
+UserStore AuthManager::student_db("../data/students.txt");
+UserStore AuthManager::instructor_db("../data/instructors.txt");
 
 string AuthManager::hash_password(const string& password) {
     hash<string> hasher;
     return to_string(hasher(password));
 }
 
-void AuthManager::load_users(const string& filename, unordered_map<string, string>& user_db) {
-    int fd = open(filename.c_str(), O_RDONLY);
-
-    if (fd == -1) {
-        cerr << "Warning: " << filename << " not found. Creating a new one." << endl;
-        fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
-        if (fd == -1) {
-            cerr << "Error: Unable to create file " << filename << endl;
-            return;
-        }
-        close(fd);
-        return;
-    }
-    
-
-    char buffer[2048];
-    int bytes_read = read(fd, buffer, sizeof(buffer) - 1);
-    close(fd);
-
-    if (bytes_read <= 0) return;
-
-    buffer[bytes_read] = '\0';
-    stringstream file_content(buffer);
-    string line, username, password;
-
-    while (getline(file_content, line)) {
-        istringstream iss(line);
-        if (iss >> username >> password) {
-            user_db[username] = password;
-        }
-    }
-}
-
 AuthManager::AuthManager() {
     cout << "[+] loading user data..." << endl;
-    load_users("../data/students.txt", student_db);
-    load_users("../data/instructors.txt", instructor_db);
+    student_db.open();
+    instructor_db.open();
 }
 
 bool AuthManager::save_user(const string& filename, const string& username, const string& password) {
@@ -57,40 +25,183 @@ bool AuthManager::save_user(const string& filename, const string& username, cons
     string entry = username + " " + password + "\n";
     write(fd, entry.c_str(), entry.length());
     close(fd);
+    Replicator::append(filename, entry);
     return true;
 }
 
+// Each user is one "name hash" line, and names end up in result file names
+// and '|' or ',' separated records, so none of those separators may appear
+bool AuthManager::valid_username(const string& username) {
+    return !username.empty() && username.find_first_of(" \t\r\n\v\f|,/") == string::npos;
+}
+
+// Other server processes may have registered users since we loaded the
+// files, so the duplicate check re-reads the file under an exclusive lock.
 bool AuthManager::register_user(const string& username, const string& password, const string& user_type) {
+    if (!valid_username(username)) {
+        cerr << "Error: Invalid username!" << endl;
+        return false;
+    }
     string hashed_pass = hash_password(password);
-    if (user_type == "student") {
-        if (student_db.find(username) != student_db.end()) {
-            cerr << "Error: Student already exists!" << endl;
-            return false;
+    if (user_type != "student" && user_type != "instructor") {
+        cerr << "Error: Invalid user type!" << endl;
+        return false;
+    }
+    const string filename = user_type == "student" ? "../data/students.txt" : "../data/instructors.txt";
+    UserStore& user_db = user_type == "student" ? student_db : instructor_db;
+
+    int lockFd = open(filename.c_str(), O_RDONLY | O_CREAT, 0644);
+    if (lockFd != -1) flock(lockFd, LOCK_EX);
+    user_db.refresh();
+    bool exists = user_db.taken(username);
+
+    bool saved = false;
+    if (exists)
+        cerr << "Error: " << (user_type == "student" ? "Student" : "Instructor") << " already exists!" << endl;
+    else if ((saved = save_user(filename, username, hashed_pass)))
+        user_db.insert(username, strtoull(hashed_pass.c_str(), nullptr, 10));
+    if (lockFd != -1) close(lockFd);
+    return saved;
+}
+
+struct HashJob {
+    vector<pair<string, string>>* rows;
+    size_t begin, end;
+};
+
+void* AuthManager::hash_rows(void* arg) {
+    HashJob* job = static_cast<HashJob*>(arg);
+    for (size_t i = job->begin; i < job->end; ++i)
+        (*job->rows)[i].second = hash_password((*job->rows)[i].second);
+    return nullptr;
+}
+
+// "username,password" per line, with an optional header line. Passwords are
+// hashed in parallel before any lock is taken; duplicates (against the file
+// and within the CSV) are found in one pass under the file lock, and all new
+// users are appended with a single write, which is undone if it fails.
+bool AuthManager::import_students(const string& csv, ImportReport& report) {
+    long long started = Metrics::nowMs();
+    const string filename = "../data/students.txt";
+
+    vector<pair<string, string>> rows;
+    rows.reserve(count(csv.begin(), csv.end(), '\n') + 1);
+    istringstream lines(csv);
+    string line;
+    while (getline(lines, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.find_first_not_of(" \t") == string::npos) continue;
+        report.rows++;
+
+        size_t comma = line.find(',');
+        string username = line.substr(0, comma);
+        string password = comma == string::npos ? "" : line.substr(comma + 1);
+        username.erase(0, username.find_first_not_of(" \t"));
+        username.erase(username.find_last_not_of(" \t") + 1);
+        password.erase(0, password.find_first_not_of(" \t"));
+        password.erase(password.find_last_not_of(" \t") + 1);
+
+        if (report.rows == 1 && username == "username") {
+            report.rows--;
+            continue;
         }
-        student_db[username] = hashed_pass;
-        return save_user("../data/students.txt", username, hashed_pass);
-    } else if (user_type == "instructor") {
-        if (instructor_db.find(username) != instructor_db.end()) {
-            cerr << "Error: Instructor already exists!" << endl;
-            return false;
+        // Both are sent whitespace separated at login, so neither may contain any
+        if (!valid_username(username) || password.empty() ||
+            password.find_first_of(" \t") != string::npos) {
+            report.invalid++;
+            continue;
         }
-        instructor_db[username] = hashed_pass;
-        return save_user("../data/instructors.txt", username, hashed_pass);
+        rows.emplace_back(username, password);
     }
 
-    cerr << "Error: Invalid user type!" << endl;
-    return false;
+    long cpus = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+    size_t threads = min<size_t>(cpus, rows.size() / IMPORT_ROWS_PER_THREAD);
+    if (threads > 1) {
+        vector<pthread_t> workers(threads);
+        vector<HashJob> jobs(threads);
+        size_t chunk = (rows.size() + threads - 1) / threads;
+        for (size_t t = 0; t < threads; ++t) {
+            jobs[t] = HashJob{&rows, t * chunk, min(rows.size(), (t + 1) * chunk)};
+        }
+        // A chunk whose thread could not be started is hashed here instead
+        vector<bool> started(threads, false);
+        for (size_t t = 0; t < threads; ++t) {
+            started[t] = pthread_create(&workers[t], nullptr, hash_rows, &jobs[t]) == 0;
+            if (!started[t]) hash_rows(&jobs[t]);
+        }
+        for (size_t t = 0; t < threads; ++t) {
+            if (started[t]) pthread_join(workers[t], nullptr);
+        }
+    } else {
+        HashJob job{&rows, 0, rows.size()};
+        hash_rows(&job);
+    }
+
+    int fd = open(filename.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd == -1) {
+        cerr << "Error: Unable to open file " << filename << endl;
+        return false;
+    }
+    flock(fd, LOCK_EX);
+
+    // Users only become visible once their lines are on disk
+    string batch;
+    batch.reserve(rows.size() * 32);
+    vector<size_t> added;
+    unordered_set<uint64_t> keys;
+    student_db.refresh();
+    for (size_t i = 0; i < rows.size(); ++i) {
+        if (student_db.taken(rows[i].first) || !keys.insert(UserStore::keyOf(rows[i].first)).second) {
+            report.duplicates++;
+            continue;
+        }
+        batch += rows[i].first + " " + rows[i].second + "\n";
+        added.push_back(i);
+    }
+
+    struct stat st;
+    bool sized = fstat(fd, &st) == 0, ok = sized;
+    for (size_t written = 0; ok && written < batch.size();) {
+        ssize_t n = write(fd, batch.data() + written, batch.size() - written);
+        ok = n > 0;
+        if (ok) written += n;
+    }
+    if (!ok) {
+        // A torn last line would swallow the next user appended after it
+        if (sized && ftruncate(fd, st.st_size) != 0)
+            cerr << "Error: Failed to undo a partial write to " << filename << endl;
+        close(fd);
+        cerr << "Error: Failed to write imported students to " << filename << endl;
+        return false;
+    }
+    student_db.reserve(added.size());
+    for (size_t i : added) student_db.insert(rows[i].first, strtoull(rows[i].second.c_str(), nullptr, 10));
+    close(fd);
+    report.imported = added.size();
+    Replicator::append(filename, batch);
+    Metrics::add("users_imported_total", report.imported);
+
+    report.elapsedMs = Metrics::nowMs() - started;
+    cout << "[+] Imported " << report.imported << " students (" << report.duplicates << " duplicates, "
+         << report.invalid << " invalid) in " << report.elapsedMs << " ms.\n";
+    return true;
 }
 
 bool AuthManager::authenticate_user(const string& username, const string& password, const string& user_type) {
     string hashed_pass = hash_password(password);
-
-    if (user_type == "student") {
-        return (student_db.find(username) != student_db.end() && student_db[username] == hashed_pass);
-    } else if (user_type == "instructor") {
-        return (instructor_db.find(username) != instructor_db.end() && instructor_db[username] == hashed_pass);
+    if (user_type != "student" && user_type != "instructor") {
+        cerr << "Error: Invalid user type!" << endl;
+        return false;
     }
-
-    cerr << "Error: Invalid user type!" << endl;
-    return false;
-}
\ No newline at end of file
+    const string filename = user_type == "student" ? "../data/students.txt" : "../data/instructors.txt";
+    UserStore& user_db = user_type == "student" ? student_db : instructor_db;
+
+    uint64_t stored;
+    bool found = user_db.find(username, stored);
+    if (!found) {
+        // May have registered through another server process
+        user_db.refresh();
+        found = user_db.find(username, stored);
+    }
+    return found && to_string(stored) == hashed_pass;
+}
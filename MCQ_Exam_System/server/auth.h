@@ -3,27 +3,47 @@
 
 #include <iostream>
 #include <unordered_map>
+#include <unordered_set>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <fcntl.h>     
 #include <unistd.h>   
 #include <sstream>   
 #include <functional> 
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "user_store.h"
 
 using namespace std;
 
+#define IMPORT_ROWS_PER_THREAD 4096
+
+struct ImportReport {
+    size_t rows = 0;
+    size_t imported = 0;
+    size_t duplicates = 0;
+    size_t invalid = 0;
+    long long elapsedMs = 0;
+};
+
 class AuthManager {
 private:
-    static unordered_map<string, string> student_db;
-    static unordered_map<string, string> instructor_db;
+    static UserStore student_db;
+    static UserStore instructor_db;
 
     static string hash_password(const string& password);
-    static void load_users(const string& filename, unordered_map<string, string>& user_db);
     static bool save_user(const string& filename, const string& username, const string& password);
+    static void* hash_rows(void* job);
 
 public:
     AuthManager(); // Constructor
+    static bool valid_username(const string& username);
     static bool register_user(const string& username, const string& password, const string& user_type);
     static bool authenticate_user(const string& username, const string& password, const string& user_type);
+    static bool import_students(const string& csv, ImportReport& report);
 };
 
 #endif
@@ -0,0 +1,206 @@
+#include "collusion_scan.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <cmath>
+#include <unistd.h>
+#include "metrics.h"
+#include "symbols.h"
+
+vector<CollusionScan::Attempt> CollusionScan::attempts;
+vector<uint64_t> CollusionScan::planes;
+int CollusionScan::words = 0;
+double CollusionScan::sameWrongRate = 0;
+double CollusionScan::sameTimeRate = 0;
+vector<pair<uint32_t, uint32_t>> CollusionScan::tiles;
+atomic<size_t> CollusionScan::nextTile(0);
+size_t CollusionScan::top = COLLUSION_DEFAULT_TOP;
+
+// 0s, 1s, 2-3s, 4-7s, ... 64s and over
+int CollusionScan::timeBucket(int seconds) {
+    int bucket = 0;
+    while (seconds > 0 && bucket < (1 << COLLUSION_TIME_PLANES) - 1) {
+        seconds >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// Packs every attempt and works out how often a random pair agrees. With
+// no question count from the catalog the longest attempt decides.
+bool CollusionScan::load(const string& examName, int questions) {
+    vector<vector<int8_t>> answers, buckets;
+    vector<vector<bool>> wrong;
+    bool ok = ResultExport::forEachAttempt(examName, [&](const ExportRow& row) {
+        attempts.push_back(Attempt{row.student, row.submittedAt, Symbols::users.intern(row.student)});
+        answers.emplace_back(row.questionAnswers.begin(), row.questionAnswers.end());
+        wrong.emplace_back();
+        buckets.emplace_back();
+        for (size_t q = 0; q < row.questionMarks.size(); ++q) {
+            wrong.back().push_back(row.questionAnswers[q] >= 0 && row.questionMarks[q] < 0);
+            buckets.back().push_back(timeBucket(row.questionTimes[q]));
+        }
+        questions = max<int>(questions, row.questionMarks.size());
+        return true;
+    });
+    if (!ok) return false;
+
+    words = (questions + 63) / 64;
+    planes.assign(attempts.size() * PLANES * words, 0);
+    vector<long long> wrongOptions(questions * 4, 0), times(questions << COLLUSION_TIME_PLANES, 0);
+    for (size_t i = 0; i < attempts.size(); ++i) {
+        uint64_t* plane = &planes[i * PLANES * words];
+        for (size_t q = 0; q < answers[i].size(); ++q) {
+            int answer = answers[i][q];
+            if (answer < 0 || answer > 3) continue;
+            uint64_t bit = 1ULL << (q % 64);
+            size_t w = q / 64;
+            plane[PLANE_ANSWERED * words + w] |= bit;
+            if (answer & 1) plane[PLANE_ANSWER_LOW * words + w] |= bit;
+            if (answer & 2) plane[PLANE_ANSWER_HIGH * words + w] |= bit;
+            if (wrong[i][q]) {
+                plane[PLANE_WRONG * words + w] |= bit;
+                wrongOptions[q * 4 + answer]++;
+            }
+            for (int b = 0; b < COLLUSION_TIME_PLANES; ++b) {
+                if (buckets[i][q] & (1 << b)) plane[(PLANE_TIME + b) * words + w] |= bit;
+            }
+            times[(q << COLLUSION_TIME_PLANES) + buckets[i][q]]++;
+        }
+    }
+
+    // Chance that two attempts wrong on the same question picked the same
+    // option, and that two answering it took equally long, over all questions
+    auto rate = [](const vector<long long>& counts, int perQuestion) {
+        double same = 0, pairs = 0;
+        for (size_t q = 0; q < counts.size(); q += perQuestion) {
+            long long total = 0;
+            for (int k = 0; k < perQuestion; ++k) {
+                total += counts[q + k];
+                same += (double)counts[q + k] * (counts[q + k] - 1);
+            }
+            pairs += (double)total * (total - 1);
+        }
+        return pairs > 0 ? same / pairs : 0;
+    };
+    sameWrongRate = rate(wrongOptions, 4);
+    sameTimeRate = rate(times, 1 << COLLUSION_TIME_PLANES);
+    return true;
+}
+
+// How far `hits` out of `trials` is above what `rate` predicts, in standard deviations
+double CollusionScan::zScore(int trials, int hits, double rate) {
+    double variance = trials * rate * (1 - rate);
+    return variance > 0 ? (hits - trials * rate) / sqrt(variance) : 0;
+}
+
+// Keeps the `top` best pairs in a min-heap on score
+void CollusionScan::compare(uint32_t a, uint32_t b, vector<CollusionPair>& heap) {
+    if (attempts[a].studentId == attempts[b].studentId) return;
+    const uint64_t* x = &planes[size_t(a) * PLANES * words];
+    const uint64_t* y = &planes[size_t(b) * PLANES * words];
+    int bothWrong = 0, sameWrong = 0, bothAnswered = 0, sameTime = 0;
+    for (int w = 0; w < words; ++w) {
+        uint64_t both = x[PLANE_ANSWERED * words + w] & y[PLANE_ANSWERED * words + w];
+        uint64_t sameAnswer = ~((x[PLANE_ANSWER_LOW * words + w] ^ y[PLANE_ANSWER_LOW * words + w]) |
+                                (x[PLANE_ANSWER_HIGH * words + w] ^ y[PLANE_ANSWER_HIGH * words + w]));
+        uint64_t timeDiffers = 0;
+        for (int t = 0; t < COLLUSION_TIME_PLANES; ++t)
+            timeDiffers |= x[(PLANE_TIME + t) * words + w] ^ y[(PLANE_TIME + t) * words + w];
+        uint64_t bothWrongBits = x[PLANE_WRONG * words + w] & y[PLANE_WRONG * words + w];
+        bothWrong += __builtin_popcountll(bothWrongBits);
+        sameWrong += __builtin_popcountll(bothWrongBits & sameAnswer);
+        bothAnswered += __builtin_popcountll(both);
+        sameTime += __builtin_popcountll(both & ~timeDiffers);
+    }
+
+    double zWrong = zScore(bothWrong, sameWrong, sameWrongRate);
+    double zTime = zScore(bothAnswered, sameTime, sameTimeRate);
+    double score = zWrong + zTime;
+    auto lower = [](const CollusionPair& p, const CollusionPair& q) { return p.score > q.score; };
+    if (score < COLLUSION_MIN_SCORE || (heap.size() == top && score <= heap.front().score)) return;
+    if (heap.size() == top) {
+        pop_heap(heap.begin(), heap.end(), lower);
+        heap.pop_back();
+    }
+    heap.push_back(CollusionPair{a, b, bothWrong, sameWrong, bothAnswered, sameTime, zWrong, zTime, score});
+    push_heap(heap.begin(), heap.end(), lower);
+}
+
+void* CollusionScan::work(void* arg) {
+    vector<CollusionPair>* heap = new vector<CollusionPair>();
+    uint32_t count = attempts.size();
+    for (size_t t = nextTile++; t < tiles.size(); t = nextTile++) {
+        uint32_t rowEnd = min(count, tiles[t].first + COLLUSION_TILE);
+        uint32_t columnEnd = min(count, tiles[t].second + COLLUSION_TILE);
+        for (uint32_t a = tiles[t].first; a < rowEnd; ++a) {
+            for (uint32_t b = max(tiles[t].second, a + 1); b < columnEnd; ++b) compare(a, b, *heap);
+        }
+    }
+    return heap;
+}
+
+// Writes the `count` most suspicious pairs as CSV to `path` (stdout if
+// empty), most suspicious first
+bool CollusionScan::run(const string& examName, int questions, size_t count, const string& path) {
+    long long started = Metrics::nowMs();
+    top = max<size_t>(count, 1);
+    if (!load(examName, max(questions, 0))) {
+        cerr << "[!] Could not read the results of '" << examName << "'.\n";
+        return false;
+    }
+    long long loaded = Metrics::nowMs();
+
+    for (uint32_t row = 0; row < attempts.size(); row += COLLUSION_TILE) {
+        for (uint32_t column = row; column < attempts.size(); column += COLLUSION_TILE) tiles.push_back(make_pair(row, column));
+    }
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threadCount = max<size_t>(1, min<size_t>(cores > 0 ? cores : 1, tiles.size()));
+    // This thread is one of the workers
+    vector<pthread_t> threads;
+    for (size_t t = 1; t < threadCount; ++t) {
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, work, nullptr) != 0) break;
+        threads.push_back(thread);
+    }
+    // Takes on the tiles of any thread that failed to start
+    vector<void*> results = {work(nullptr)};
+    for (pthread_t thread : threads) {
+        results.push_back(nullptr);
+        pthread_join(thread, &results.back());
+    }
+    vector<CollusionPair> pairs;
+    for (void* result : results) {
+        vector<CollusionPair>* heap = static_cast<vector<CollusionPair>*>(result);
+        pairs.insert(pairs.end(), heap->begin(), heap->end());
+        delete heap;
+    }
+    sort(pairs.begin(), pairs.end(), [](const CollusionPair& p, const CollusionPair& q) { return p.score > q.score; });
+    if (pairs.size() > top) pairs.resize(top);
+
+    ofstream file;
+    if (!path.empty()) file.open(path);
+    if (!path.empty() && !file) {
+        cerr << "[!] Cannot write " << path << ".\n";
+        return false;
+    }
+    ostream& out = path.empty() ? cout : file;
+    out << fixed << setprecision(2);
+    out << "rank,score,student_a,submitted_a,student_b,submitted_b,same_wrong,both_wrong,z_wrong,"
+           "same_time,both_answered,z_time\n";
+    for (size_t i = 0; i < pairs.size(); ++i) {
+        const CollusionPair& flagged = pairs[i];
+        const Attempt& a = attempts[flagged.a];
+        const Attempt& b = attempts[flagged.b];
+        out << i + 1 << "," << flagged.score << "," << a.student << "," << a.submittedAt << "," << b.student << ","
+            << b.submittedAt << "," << flagged.sameWrong << "," << flagged.bothWrong << "," << flagged.zWrong << ","
+            << flagged.sameTime << "," << flagged.bothAnswered << "," << flagged.zTime << "\n";
+    }
+    out.flush();
+
+    long long n = attempts.size();
+    cerr << "[+] Compared " << n * (n - 1) / 2 << " pairs of " << n << " attempts at '" << examName << "' on "
+         << threads.size() + 1 << " threads in " << Metrics::nowMs() - loaded << " ms (" << loaded - started
+         << " ms to load), " << pairs.size() << " flagged." << endl;
+    return static_cast<bool>(out);
+}
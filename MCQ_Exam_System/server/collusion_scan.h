@@ -0,0 +1,70 @@
+#ifndef COLLUSION_SCAN_H
+#define COLLUSION_SCAN_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <pthread.h>
+
+#include "result_export.h"
+
+using namespace std;
+
+#define COLLUSION_TILE 64         // attempts per side of a tile of pairs
+#define COLLUSION_TIME_PLANES 3   // per-question time as a log2 bucket, 0..7
+#define COLLUSION_MIN_SCORE 4.0   // pairs below this are never reported
+#define COLLUSION_DEFAULT_TOP 50
+
+// Bit-planes per attempt, one bit per question in each
+#define PLANE_ANSWERED 0
+#define PLANE_WRONG 1
+#define PLANE_ANSWER_LOW 2   // option index, low bit
+#define PLANE_ANSWER_HIGH 3  // option index, high bit
+#define PLANE_TIME 4         // COLLUSION_TIME_PLANES bits of the time bucket
+#define PLANES (PLANE_TIME + COLLUSION_TIME_PLANES)
+
+struct CollusionPair {
+    uint32_t a, b;  // attempt indexes
+    int bothWrong, sameWrong;
+    int bothAnswered, sameTime;
+    double zWrong, zTime, score;
+};
+
+// Pairs of attempts at one exam that agree more than chance allows: on
+// which wrong option they picked, and on how long they took per question.
+//
+// Each attempt is packed into bit-planes with one bit per question, so a
+// pair is compared with a few ANDs, XORs and popcounts per 64 questions.
+// Both counts are turned into z-scores against the rates of a random pair
+// (from the per-question spread of wrong options and time buckets over the
+// whole exam), and a pair's score is their sum. Pairs are compared tile by
+// tile so both tiles' planes stay in cache, and tiles are shared out to
+// one thread per core, each keeping its own top list.
+class CollusionScan {
+private:
+    struct Attempt {
+        string student, submittedAt;
+        uint32_t studentId;
+    };
+
+    static vector<Attempt> attempts;
+    static vector<uint64_t> planes;  // PLANES * words per attempt, attempt after attempt
+    static int words;
+    static double sameWrongRate, sameTimeRate;
+    static vector<pair<uint32_t, uint32_t>> tiles;
+    static atomic<size_t> nextTile;
+    static size_t top;
+
+    static int timeBucket(int seconds);
+    static bool load(const string& examName, int questions);
+    static double zScore(int trials, int hits, double rate);
+    static void compare(uint32_t a, uint32_t b, vector<CollusionPair>& heap);
+    static void* work(void* arg);
+
+public:
+    static bool run(const string& examName, int questions, size_t count, const string& path);
+};
+
+#endif
@@ -1,4 +1,9 @@
 #include "exam_manager.h"
+#include "replication.h"
+#include <iomanip>
+
+unordered_map<uint32_t, ExamPaper> ExamManager::paperCache;
+pthread_mutex_t ExamManager::paperMutex = PTHREAD_MUTEX_INITIALIZER;
 
 bool ExamManager::parse_exam(const string& input_file, const string& exam_name, const string& instructor, int duration) {
     
@@ -77,11 +82,16 @@ bool ExamManager::parse_exam(const string& input_file, const string& exam_name,
         answerFile << a << "\n";
     }
     answerFile.close();
+    invalidatePaper(exam_name);
+    Replicator::putFile(metadataFile);
+    Replicator::putFile(questionsFile);
+    Replicator::putFile(answersFile);
 
     // Add exam entry to a central list
     ofstream examList("../data/exams/exam_list.txt", ios::app);
     examList << exam_name << "|" << metadataFile << "\n";
     examList.close();
+    Replicator::append("../data/exams/exam_list.txt", exam_name + "|" + metadataFile + "\n");
 
     cout << "[+] Exam successfully parsed and stored!\n";
     return true;
@@ -166,35 +176,87 @@ string ExamManager::getQuestionsFilePath(const string& metadataPath) {
     return questionFilePath;
 }
 
-void ExamManager::sendExamQuestions(int sock, const string& examName) {
-    string metadataPath = getMetadataFilePath(examName);
-    if (metadataPath.empty()) {
-        string errorMsg = "Error: Exam not found.\n";
-        send(sock, errorMsg.c_str(), errorMsg.size(), 0);
-        return;
+string ExamManager::hashContent(const string& content) {
+    // FNV-1a, 64 bit
+    unsigned long long h = 1469598103934665603ULL;
+    for (unsigned char c : content) {
+        h ^= c;
+        h *= 1099511628211ULL;
     }
+    ostringstream oss;
+    oss << hex << setw(16) << setfill('0') << h;
+    return oss.str();
+}
+
+bool ExamManager::loadPaper(const string& examName, ExamPaper& paper) {
+    string metadataPath = getMetadataFilePath(examName);
+    if (metadataPath.empty()) return false;
 
     string questionFilePath = getQuestionsFilePath(metadataPath);
-    if (questionFilePath.empty()) {
-        string errorMsg = "Error: No questions file found.\n";
-        send(sock, errorMsg.c_str(), errorMsg.size(), 0);
-        return;
+    if (questionFilePath.empty()) return false;
+
+    struct stat st;
+    if (stat(questionFilePath.c_str(), &st) == -1) return false;
+
+    uint32_t examId = Symbols::exams.intern(examName);
+    pthread_mutex_lock(&paperMutex);
+    auto it = paperCache.find(examId);
+    if (examId != SYMBOL_NONE && it != paperCache.end() && it->second.mtime == st.st_mtime && it->second.size == st.st_size) {
+        paper = it->second;
+        pthread_mutex_unlock(&paperMutex);
+        return true;
     }
+    pthread_mutex_unlock(&paperMutex);
 
     ifstream questionFile(questionFilePath);
-    if (!questionFile) {
-        string errorMsg = "Error: Unable to open questions file.\n";
-        send(sock, errorMsg.c_str(), errorMsg.size(), 0);
-        return;
-    }
+    if (!questionFile) return false;
 
     string questionData, line;
     while (getline(questionFile, line)) {
         questionData += line + "\n";
     }
-    
-    if (questionData.empty()) {
-        questionData = "Error: Questions file is empty.\n";
+    questionFile.close();
+    if (questionData.empty()) return false;
+
+    paper.content = questionData;
+    paper.version = hashContent(questionData);
+    paper.compressed = Compressor::compress(questionData);
+    paper.mtime = st.st_mtime;
+    paper.size = st.st_size;
+
+    if (examId == SYMBOL_NONE) return true;  // not cached
+    pthread_mutex_lock(&paperMutex);
+    paperCache[examId] = paper;
+    pthread_mutex_unlock(&paperMutex);
+    return true;
+}
+
+void ExamManager::invalidatePaper(const string& examName) {
+    uint32_t examId = Symbols::exams.find(examName);
+    if (examId == SYMBOL_NONE) return;
+    pthread_mutex_lock(&paperMutex);
+    paperCache.erase(examId);
+    pthread_mutex_unlock(&paperMutex);
+}
+
+// Replies "NOT_MODIFIED <version>" when the client already holds the current
+// paper, otherwise "PAPER <version>" followed by the paper as a frame.
+bool ExamManager::sendExamQuestions(int sock, const string& examName, const string& clientVersion, bool allowCompression) {
+    ExamPaper paper;
+    if (!loadPaper(examName, paper)) {
+        string errorMsg = "Error: Unable to load questions for exam.\n";
+        Wire::sendAll(sock, errorMsg);
+        return false;
     }
-    send(sock, questionData.c_str(), questionData.size(), 0);
+
+    if (paper.version == clientVersion) {
+        cout << "[+] question paper for '" << examName << "' is up to date on client\n";
+        return Wire::sendAll(sock, "NOT_MODIFIED " + paper.version + "\n");
+    }
+    cout << "[+] sending question paper for '" << examName << "' (" << paper.content.size() << " bytes)\n";
+
+    if (!Wire::sendAll(sock, "PAPER " + paper.version + "\n")) return false;
+    if (allowCompression && paper.compressed.size() < paper.content.size())
+        return Wire::sendCompressedFrame(sock, paper.content.size(), paper.compressed);
+    return Wire::sendFrame(sock, paper.content, false);
 }
@@ -10,16 +10,40 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fstream>
+#include <map>
+#include <unordered_map>
+#include <pthread.h>
+
+#include "wire.h"
+#include "symbols.h"
 
 using namespace std;
 
+// Question paper as served to clients. The version is a content hash of the
+// questions file, so clients can cache papers by (exam name, version).
+struct ExamPaper {
+    string version;
+    string content;
+    string compressed;  // content in CODEC_LZ1, built once per version
+    time_t mtime = 0;
+    off_t size = 0;
+};
+
 class ExamManager {
+private:
+    static unordered_map<uint32_t, ExamPaper> paperCache;  // by exam id
+    static pthread_mutex_t paperMutex;
+
+    static string hashContent(const string& content);
+
 public:
     bool parse_exam(const string& input_file, const string& exam_name, const string& instructor, int duration);
     vector<string> load_exam_metadata(const string& exam_list_file);
     string getMetadataFilePath(const string& examName);
     string getQuestionsFilePath(const string& metadataPath) ;
-    void sendExamQuestions(int sock, const string& examName);
+    bool loadPaper(const string& examName, ExamPaper& paper);
+    void invalidatePaper(const string& examName);
+    bool sendExamQuestions(int sock, const string& examName, const string& clientVersion, bool allowCompression);
 };
 
 #endif
@@ -0,0 +1,343 @@
+#include "exam_stats.h"
+#include <sstream>
+#include <cstdio>
+#include "metrics.h"
+#include "result_store.h"
+
+vector<ExamStats::Exam*> ExamStats::exams;
+pthread_mutex_t ExamStats::statsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+string ExamStats::leaderboardPath(const string& examName) {
+    return "../data/results/exam_" + examName + "_leaderboard.txt";
+}
+
+// Leaderboard order within a score: fewer wrong answers, then less time
+bool ExamStats::better(const LeaderboardEntry& a, const LeaderboardEntry& b) {
+    if (a.wrong != b.wrong) return a.wrong < b.wrong;
+    return a.timeSpent < b.timeSpent;
+}
+
+void ExamStats::add(Exam& exam, const LeaderboardEntry& entry) {
+    vector<LeaderboardEntry>& bucket = exam.byScore[entry.marks];
+    bucket.insert(upper_bound(bucket.begin(), bucket.end(), entry, better), entry);
+    count(exam, entry);
+}
+
+// Many entries at once (a cold start, or a large tail): appending and then
+// merging each touched bucket once avoids shifting the bucket per entry.
+void ExamStats::addBatch(Exam& exam, const vector<LeaderboardEntry>& entries) {
+    map<int, size_t> sortedPrefix;
+    for (const LeaderboardEntry& entry : entries) {
+        vector<LeaderboardEntry>& bucket = exam.byScore[entry.marks];
+        sortedPrefix.emplace(entry.marks, bucket.size());
+        bucket.push_back(entry);
+        count(exam, entry);
+    }
+    for (auto& touched : sortedPrefix) {
+        vector<LeaderboardEntry>& bucket = exam.byScore[touched.first];
+        auto middle = bucket.begin() + touched.second;
+        // Both steps are stable, so equal entries stay in file order
+        stable_sort(middle, bucket.end(), better);
+        inplace_merge(bucket.begin(), middle, bucket.end(), better);
+    }
+}
+
+void ExamStats::count(Exam& exam, const LeaderboardEntry& entry) {
+    exam.attempts++;
+    exam.scoreSum += entry.marks;
+
+    auto inserted = exam.best.emplace(entry.student, entry);
+    LeaderboardEntry& best = inserted.first->second;
+    if (!inserted.second && (entry.marks > best.marks || (entry.marks == best.marks && better(entry, best))))
+        best = entry;
+}
+
+// Must be called with statsMutex held
+ExamStats::Exam*& ExamStats::slot(uint32_t examId) {
+    if (examId >= exams.size()) exams.resize(examId + 1, nullptr);
+    return exams[examId];
+}
+
+// Folds in whatever each writer appended to the leaderboard since the last
+// call. Must be called with statsMutex held.
+ExamStats::Exam* ExamStats::refresh(const string& examName) {
+    uint32_t id = Symbols::exams.intern(examName);
+    if (id == SYMBOL_NONE) return nullptr;
+    Exam*& known = slot(id);
+    if (known) materialize(*known);
+    map<int, uint64_t> consumed;
+    if (known) consumed = known->consumed;
+    string tail;
+    if (!ResultStore::readNew(leaderboardPath(examName), consumed, tail)) return known;
+
+    if (!known) known = new Exam();
+    Exam& exam = *known;
+    // Results are appended a batch at a time, so every writer's part ends on a line
+    istringstream lines(tail);
+    string line;
+    vector<LeaderboardEntry> entries;
+    while (getline(lines, line)) {
+        istringstream fields(line);
+        LeaderboardEntry entry;
+        string studentId;
+        int attempted;
+        if (fields >> studentId >> entry.marks >> attempted >> entry.wrong >> entry.timeSpent) {
+            entry.student = Symbols::users.intern(studentId);
+            entries.push_back(entry);
+        }
+    }
+    if (entries.size() == 1) add(exam, entries[0]);
+    else if (!entries.empty()) addBatch(exam, entries);
+    exam.consumed.swap(consumed);
+    return &exam;
+}
+
+// Smallest score with at least q of the attempts at or below it
+int ExamStats::quantile(const Exam& exam, double q) {
+    long long target = max(1LL, (long long)(q * exam.attempts + 0.999999));
+    long long seen = 0;
+    for (auto it = exam.byScore.rbegin(); it != exam.byScore.rend(); ++it) {
+        seen += it->second.size();
+        if (seen >= target) return it->first;
+    }
+    return exam.byScore.empty() ? 0 : exam.byScore.begin()->first;
+}
+
+bool ExamStats::summary(const string& examName, ExamSummary& summary) {
+    pthread_mutex_lock(&statsMutex);
+    Exam* exam = refresh(examName);
+    bool found = exam && exam->attempts > 0;
+    if (found) {
+        summary.attempts = exam->attempts;
+        summary.students = exam->best.size();
+        summary.mean = (double)exam->scoreSum / exam->attempts;
+        summary.max = exam->byScore.begin()->first;
+        summary.min = exam->byScore.rbegin()->first;
+        summary.p25 = quantile(*exam, 0.25);
+        summary.median = quantile(*exam, 0.5);
+        summary.p75 = quantile(*exam, 0.75);
+        summary.p90 = quantile(*exam, 0.9);
+    }
+    pthread_mutex_unlock(&statsMutex);
+    return found;
+}
+
+// Percentile rank of a score: attempts below it plus half of the ties
+double ExamStats::percentile(const string& examName, int marks) {
+    pthread_mutex_lock(&statsMutex);
+    Exam* exam = refresh(examName);
+    double result = 0;
+    if (exam && exam->attempts > 0) {
+        long long below = 0, equal = 0;
+        for (auto& bucket : exam->byScore) {
+            if (bucket.first < marks) below += bucket.second.size();
+            else if (bucket.first == marks) equal = bucket.second.size();
+        }
+        result = 100.0 * (below + equal / 2.0) / exam->attempts;
+    }
+    pthread_mutex_unlock(&statsMutex);
+    return result;
+}
+
+vector<LeaderboardEntry> ExamStats::top(const string& examName, size_t count) {
+    vector<LeaderboardEntry> entries;
+    pthread_mutex_lock(&statsMutex);
+    Exam* exam = refresh(examName);
+    if (exam) {
+        for (auto& bucket : exam->byScore) {
+            for (const LeaderboardEntry& entry : bucket.second) {
+                if (entries.size() == count) break;
+                entries.push_back(entry);
+            }
+            if (entries.size() == count) break;
+        }
+    }
+    pthread_mutex_unlock(&statsMutex);
+    return entries;
+}
+
+// 1 + the number of attempts ranked above the student's best one, or -1
+int ExamStats::rank(const string& examName, uint32_t student) {
+    pthread_mutex_lock(&statsMutex);
+    Exam* exam = refresh(examName);
+    int result = -1;
+    if (exam) {
+        auto it = exam->best.find(student);
+        if (it != exam->best.end()) {
+            const LeaderboardEntry& best = it->second;
+            long long ahead = 0;
+            for (auto& bucket : exam->byScore) {
+                if (bucket.first > best.marks) {
+                    ahead += bucket.second.size();
+                } else {
+                    ahead += lower_bound(bucket.second.begin(), bucket.second.end(), best, better) - bucket.second.begin();
+                    break;
+                }
+            }
+            result = ahead + 1;
+        }
+    }
+    pthread_mutex_unlock(&statsMutex);
+    return result;
+}
+
+// Horizontal bar chart of attempts per score range, marking highlightMarks
+// if highlight is set
+string ExamStats::chart(const string& examName, bool highlight, int highlightMarks) {
+    pthread_mutex_lock(&statsMutex);
+    Exam* exam = refresh(examName);
+    if (!exam || exam->attempts == 0) {
+        pthread_mutex_unlock(&statsMutex);
+        return "";
+    }
+
+    int low = exam->byScore.rbegin()->first, high = exam->byScore.begin()->first;
+    int span = high - low + 1;
+    int binWidth = (span + CHART_BINS - 1) / CHART_BINS;
+    int bins = (span + binWidth - 1) / binWidth;
+    vector<long long> counts(bins, 0);
+    for (auto& bucket : exam->byScore)
+        counts[(bucket.first - low) / binWidth] += bucket.second.size();
+    pthread_mutex_unlock(&statsMutex);
+
+    long long tallest = *max_element(counts.begin(), counts.end());
+    string chart;
+    for (int i = bins - 1; i >= 0; --i) {
+        int from = low + i * binWidth, to = from + binWidth - 1;
+        char label[32];
+        if (binWidth == 1) snprintf(label, sizeof(label), "%9d", from);
+        else snprintf(label, sizeof(label), "%4d..%3d", from, to);
+        int bar = counts[i] ? max(1LL, counts[i] * CHART_WIDTH / tallest) : 0;
+        chart += string(label) + " | " + string(bar, '#') + string(CHART_WIDTH - bar, ' ') + " " + to_string(counts[i]);
+        if (highlight && highlightMarks >= from && highlightMarks <= to) chart += "  <- you";
+        chart += "\n";
+    }
+    return chart;
+}
+
+// Snapshot section: per exam by name, the per-writer positions in the
+// leaderboard it was folded up to and its attempts bucket by bucket in
+// leaderboard order. Exams are restored as these encoded bytes and only
+// decoded on first use (or by the warm-up thread), so startup does not wait
+// for rebuilding every exam's per-student bests; refresh() then folds in
+// whatever each writer appended since.
+void ExamStats::encode(const Exam& exam, string& out) {
+    SnapshotWriter writer(out);
+    writer.u64(exam.consumed.size());
+    for (auto& writerOffset : exam.consumed) {
+        writer.i32(writerOffset.first);
+        writer.u64(writerOffset.second);
+    }
+    writer.u64(exam.attempts);
+    writer.u64(exam.byScore.size());
+    for (auto& bucket : exam.byScore) {
+        writer.i32(bucket.first);
+        writer.u64(bucket.second.size());
+        for (const LeaderboardEntry& entry : bucket.second) {
+            writer.i32(entry.wrong);
+            writer.i32(entry.timeSpent);
+            writer.str(Symbols::users.name(entry.student));
+        }
+    }
+}
+
+bool ExamStats::decode(const string& encoded, Exam& exam) {
+    SnapshotReader reader(encoded);
+    uint64_t writers = reader.u64();
+    for (uint64_t i = 0; i < writers && reader.ok; ++i) {
+        int writer = reader.i32();
+        exam.consumed[writer] = reader.u64();
+    }
+    exam.best.reserve(reader.u64());
+    uint64_t buckets = reader.u64();
+    for (uint64_t b = 0; b < buckets && reader.ok; ++b) {
+        LeaderboardEntry entry;
+        entry.marks = reader.i32();
+        uint64_t size = reader.u64();
+        vector<LeaderboardEntry>& bucket = exam.byScore[entry.marks];
+        for (uint64_t i = 0; i < size && reader.ok; ++i) {
+            entry.wrong = reader.i32();
+            entry.timeSpent = reader.i32();
+            entry.student = Symbols::users.intern(reader.str());
+            bucket.push_back(entry);
+            count(exam, entry);
+        }
+    }
+    return reader.done();
+}
+
+// Decodes a restored exam on first use. Must be called with statsMutex held.
+void ExamStats::materialize(Exam& exam) {
+    if (exam.encoded.empty()) return;
+    string encoded;
+    encoded.swap(exam.encoded);
+    if (!decode(encoded, exam)) exam = Exam();  // rebuilt from the file instead
+}
+
+// One exam at a time, so queries only wait for the exam being encoded.
+// Exams are never freed, so the pointers stay valid.
+void ExamStats::save(SnapshotWriter& out) {
+    vector<pair<uint32_t, Exam*>> current;
+    pthread_mutex_lock(&statsMutex);
+    for (uint32_t id = 0; id < exams.size(); ++id) {
+        if (exams[id]) current.push_back(make_pair(id, exams[id]));
+    }
+    pthread_mutex_unlock(&statsMutex);
+
+    out.u64(current.size());
+    for (auto& known : current) {
+        string encoded;
+        pthread_mutex_lock(&statsMutex);
+        if (!known.second->encoded.empty()) encoded = known.second->encoded;
+        else encode(*known.second, encoded);
+        pthread_mutex_unlock(&statsMutex);
+        out.str(Symbols::exams.name(known.first));
+        out.str(encoded);
+    }
+}
+
+// Runs at startup, before any query
+bool ExamStats::restore(SnapshotReader& in) {
+    vector<pair<uint32_t, string>> restored;
+    uint64_t count = in.u64();
+    for (uint64_t i = 0; i < count && in.ok; ++i) {
+        uint32_t id = Symbols::exams.intern(in.str());
+        restored.push_back(make_pair(id, in.str()));
+    }
+    if (!in.ok) return false;
+    pthread_mutex_lock(&statsMutex);
+    for (auto& known : restored) {
+        Exam*& exam = slot(known.first);
+        if (!exam) exam = new Exam();
+        exam->encoded.swap(known.second);
+    }
+    pthread_mutex_unlock(&statsMutex);
+
+    pthread_t thread;
+    pthread_create(&thread, nullptr, warm, nullptr);
+    pthread_detach(thread);
+    return true;
+}
+
+// Decodes restored exams in the background, one per lock hold, so queries
+// for other exams are not held up behind them.
+void* ExamStats::warm(void* arg) {
+    long long started = Metrics::nowMs();
+    int decoded = 0;
+    while (true) {
+        pthread_mutex_lock(&statsMutex);
+        Exam* next = nullptr;
+        for (Exam* exam : exams) {
+            if (!exam || exam->encoded.empty()) continue;
+            next = exam;
+            break;
+        }
+        if (next) materialize(*next);
+        pthread_mutex_unlock(&statsMutex);
+        if (!next) break;
+        decoded++;
+    }
+    if (decoded > 0)
+        cout << "[+] Warmed " << decoded << " exams from the snapshot in " << Metrics::nowMs() - started << " ms." << endl;
+    return nullptr;
+}
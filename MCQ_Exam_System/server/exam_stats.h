@@ -0,0 +1,85 @@
+#ifndef EXAM_STATS_H
+#define EXAM_STATS_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <functional>
+#include <algorithm>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "symbols.h"
+
+using namespace std;
+
+#define CHART_BINS 10
+#define CHART_WIDTH 30
+
+// One line of an exam's leaderboard file, i.e. one graded attempt.
+struct LeaderboardEntry {
+    int marks;
+    int wrong;
+    int timeSpent;
+    uint32_t student;  // Symbols::users id
+};
+
+struct ExamSummary {
+    long long attempts = 0;
+    long long students = 0;
+    double mean = 0;
+    int min = 0, max = 0;
+    int p25 = 0, median = 0, p75 = 0, p90 = 0;
+};
+
+// Score distribution and leaderboard of every exam, kept in memory and
+// folded forward from the leaderboards in ResultStore. Each query only reads what
+// each writer appended since the last one, so it works the same on the
+// shard that grades an exam, on other shards, and on a freshly promoted
+// standby, however many shards have appended to the leaderboard.
+// Attempts are bucketed by score and each bucket is kept in leaderboard
+// order (fewest wrong, then fastest), so percentiles, the top N and a
+// student's rank cost time in the number of distinct scores, not attempts.
+class ExamStats {
+private:
+    struct Exam {
+        map<int, uint64_t> consumed;  // bytes folded in, per ResultStore writer
+        long long attempts = 0;
+        long long scoreSum = 0;
+        map<int, vector<LeaderboardEntry>, greater<int>> byScore;
+        unordered_map<uint32_t, LeaderboardEntry> best;  // best attempt per student id
+        string encoded;  // restored from a snapshot and not decoded yet
+    };
+
+    static vector<Exam*> exams;  // by Symbols::exams id, null if never queried
+    static pthread_mutex_t statsMutex;
+
+    static string leaderboardPath(const string& examName);
+    static bool better(const LeaderboardEntry& a, const LeaderboardEntry& b);
+    static void add(Exam& exam, const LeaderboardEntry& entry);
+    static void addBatch(Exam& exam, const vector<LeaderboardEntry>& entries);
+    static void count(Exam& exam, const LeaderboardEntry& entry);
+    static Exam*& slot(uint32_t examId);
+    static Exam* refresh(const string& examName);
+    static int quantile(const Exam& exam, double q);
+    static void encode(const Exam& exam, string& out);
+    static bool decode(const string& encoded, Exam& exam);
+    static void materialize(Exam& exam);
+    static void* warm(void* arg);
+
+public:
+    static bool summary(const string& examName, ExamSummary& summary);
+    static double percentile(const string& examName, int marks);
+    static vector<LeaderboardEntry> top(const string& examName, size_t count);
+    static int rank(const string& examName, uint32_t student);
+    static string chart(const string& examName, bool highlight, int highlightMarks = 0);
+    static void save(SnapshotWriter& out);
+    static bool restore(SnapshotReader& in);
+};
+
+#endif
@@ -0,0 +1,239 @@
+#include "io_backend.h"
+#include "submission_queue.h"
+
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+IoBackend* IoBackend::active = nullptr;
+
+bool IoBackend::select(const string& kind) {
+    if (kind == "uring") {
+        UringIoBackend* uring = new UringIoBackend();
+        if (uring->init({SubmissionQueue::log()})) {
+            active = uring;
+            return true;
+        }
+        delete uring;
+        cerr << "[!] io_uring unavailable, falling back to synchronous file I/O\n";
+    } else if (kind != "sync") {
+        cerr << "[!] Unknown I/O backend '" << kind << "', using sync\n";
+    }
+    active = new SyncIoBackend();
+    return kind == "sync";
+}
+
+IoBackend* IoBackend::get() {
+    if (!active) active = new SyncIoBackend();
+    return active;
+}
+
+string IoBackend::stats() {
+    pthread_mutex_lock(&ioMutex);
+    string s = string(name()) + ": " + to_string(appends) + " appends, " + to_string(syscalls) + " syscalls";
+    pthread_mutex_unlock(&ioMutex);
+    return s;
+}
+
+bool SyncIoBackend::appendBatch(const vector<AppendOp>& ops) {
+    bool ok = true;
+    pthread_mutex_lock(&ioMutex);
+    for (const AppendOp& op : ops) {
+        int fd = open(op.path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+        syscalls++;
+        if (fd == -1) {
+            cerr << "Error: Unable to open " << op.path << endl;
+            ok = false;
+            continue;
+        }
+        if (write(fd, op.data.data(), op.data.size()) != (ssize_t)op.data.size()) ok = false;
+        close(fd);
+        syscalls += 2;
+        appends++;
+    }
+    pthread_mutex_unlock(&ioMutex);
+    return ok;
+}
+
+UringIoBackend::~UringIoBackend() {
+    for (auto& entry : openFiles) close(entry.second.first);
+    for (int fd : fixedFds) close(fd);
+    if (arena) munmap(arena, ARENA_SIZE);
+    if (sqes) munmap(sqes, sqesSize);
+    if (cqRing && cqRing != sqRing) munmap(cqRing, cqRingSize);
+    if (sqRing) munmap(sqRing, sqRingSize);
+    if (ringFd != -1) close(ringFd);
+}
+
+bool UringIoBackend::init(const vector<string>& hotPaths) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ringFd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if (ringFd < 0) return false;
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) return false;  // need offset -1 for appends
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap) sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) { sqRing = nullptr; return false; }
+    cqRing = singleMmap ? sqRing
+                        : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    if (cqRing == MAP_FAILED) { cqRing = nullptr; return false; }
+    sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe*)mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) { sqes = nullptr; return false; }
+
+    char* sq = (char*)sqRing;
+    char* cq = (char*)cqRing;
+    sqHead = (unsigned*)(sq + params.sq_off.head);
+    sqTail = (unsigned*)(sq + params.sq_off.tail);
+    sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    sqArray = (unsigned*)(sq + params.sq_off.array);
+    cqHead = (unsigned*)(cq + params.cq_off.head);
+    cqTail = (unsigned*)(cq + params.cq_off.tail);
+    cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    // One registered buffer that every batch is staged in
+    arena = (char*)mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED) { arena = nullptr; return false; }
+    iovec iov{arena, ARENA_SIZE};
+    if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS, &iov, 1) < 0) return false;
+
+    for (const string& path : hotPaths) {
+        int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if (fd == -1) return false;
+        fixedFiles[path] = fixedFds.size();
+        fixedFds.push_back(fd);
+    }
+    if (!fixedFds.empty() &&
+        syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_FILES, fixedFds.data(), fixedFds.size()) < 0)
+        return false;
+
+    cout << "[+] Using io_uring for result files (" << fixedFds.size() << " fixed files)\n";
+    return true;
+}
+
+int UringIoBackend::openCached(const string& path) {
+    auto it = openFiles.find(path);
+    if (it != openFiles.end()) {
+        lruPaths.splice(lruPaths.begin(), lruPaths, it->second.second);
+        return it->second.first;
+    }
+    if (openFiles.size() >= MAX_OPEN_FILES) {
+        const string& victim = lruPaths.back();
+        close(openFiles[victim].first);
+        syscalls++;
+        openFiles.erase(victim);
+        lruPaths.pop_back();
+    }
+    int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    syscalls++;
+    if (fd == -1) return -1;
+    lruPaths.push_front(path);
+    openFiles[path] = make_pair(fd, lruPaths.begin());
+    return fd;
+}
+
+bool UringIoBackend::submitChunk(const vector<pair<string, string>>& writes, size_t begin, size_t end) {
+    size_t offset = 0;
+    unsigned tail = *sqTail;
+    unsigned submitted = 0;
+    vector<size_t> lengths;
+
+    for (size_t i = begin; i < end; ++i) {
+        const string& path = writes[i].first;
+        const string& data = writes[i].second;
+
+        io_uring_sqe* sqe = &sqes[tail & *sqMask];
+        memset(sqe, 0, sizeof(*sqe));
+        auto fixed = fixedFiles.find(path);
+        if (fixed != fixedFiles.end()) {
+            sqe->fd = fixed->second;
+            sqe->flags = IOSQE_FIXED_FILE;
+        } else {
+            sqe->fd = openCached(path);
+            if (sqe->fd == -1) {
+                cerr << "Error: Unable to open " << path << endl;
+                continue;
+            }
+        }
+        memcpy(arena + offset, data.data(), data.size());
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->addr = (unsigned long)(arena + offset);
+        sqe->len = data.size();
+        sqe->off = (__u64)-1;  // current position; O_APPEND makes it the end
+        sqe->buf_index = 0;
+        sqe->user_data = data.size();
+        sqArray[tail & *sqMask] = tail & *sqMask;
+        tail++;
+        submitted++;
+        offset += data.size();
+    }
+    __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+    int rc = syscall(__NR_io_uring_enter, ringFd, submitted, submitted, IORING_ENTER_GETEVENTS, nullptr, 0);
+    syscalls++;
+    if (rc < 0) return false;
+
+    bool ok = true;
+    unsigned reaped = 0;
+    while (reaped < submitted) {
+        unsigned head = *cqHead;
+        if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+            syscall(__NR_io_uring_enter, ringFd, 0, submitted - reaped, IORING_ENTER_GETEVENTS, nullptr, 0);
+            syscalls++;
+            continue;
+        }
+        io_uring_cqe* cqe = &cqes[head & *cqMask];
+        if (cqe->res < 0 || (unsigned long long)cqe->res != cqe->user_data) ok = false;
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        reaped++;
+    }
+    return ok;
+}
+
+bool UringIoBackend::appendBatch(const vector<AppendOp>& ops) {
+    // Coalesce per file so each file gets one write and keeps its order
+    vector<pair<string, string>> writes;
+    map<string, size_t> index;
+    for (const AppendOp& op : ops) {
+        auto it = index.find(op.path);
+        if (it == index.end()) {
+            index[op.path] = writes.size();
+            writes.emplace_back(op.path, op.data);
+        } else {
+            writes[it->second].second += op.data;
+        }
+    }
+
+    bool ok = true;
+    pthread_mutex_lock(&ioMutex);
+    appends += ops.size();
+    size_t begin = 0;
+    while (begin < writes.size()) {
+        // Fill the arena and the ring as far as they go
+        size_t end = begin, bytes = 0;
+        // (RING_ENTRIES < MAX_OPEN_FILES, so the fd cache never closes one still queued)
+        while (end < writes.size() && end - begin < RING_ENTRIES && bytes + writes[end].second.size() <= ARENA_SIZE)
+            bytes += writes[end++].second.size();
+
+        if (end == begin) {
+            // Larger than the arena: write it directly
+            int fd = openCached(writes[begin].first);
+            if (fd == -1 || write(fd, writes[begin].second.data(), writes[begin].second.size()) != (ssize_t)writes[begin].second.size())
+                ok = false;
+            syscalls++;
+            begin++;
+            continue;
+        }
+        if (!submitChunk(writes, begin, end)) ok = false;
+        begin = end;
+    }
+    pthread_mutex_unlock(&ioMutex);
+    return ok;
+}
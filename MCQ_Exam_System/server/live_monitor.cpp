@@ -0,0 +1,239 @@
+#include "live_monitor.h"
+#include "exam_stats.h"
+#include "shard_router.h"
+#include "metrics.h"
+#include <sstream>
+#include <iomanip>
+#include <cerrno>
+#include <ctime>
+
+map<string, LiveExam> LiveMonitor::exams;
+vector<LiveMonitor::Subscriber*> LiveMonitor::subscribers;
+pthread_mutex_t LiveMonitor::liveMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t LiveMonitor::subscriberMutex = PTHREAD_MUTEX_INITIALIZER;
+bool LiveMonitor::publishing = false;
+long long LiveMonitor::startedAt = time(nullptr);
+function<void(map<string, LiveExam>&)> LiveMonitor::sessions;
+function<long long()> LiveMonitor::online;
+function<vector<string>(const string& instructor)> LiveMonitor::examsOf;
+
+void LiveMonitor::configure(function<void(map<string, LiveExam>&)> sessionsProvider, function<long long()> onlineProvider,
+                            function<vector<string>(const string& instructor)> examsProvider) {
+    sessions = sessionsProvider;
+    online = onlineProvider;
+    examsOf = examsProvider;
+}
+
+// Runs on the grading worker: counters only, no I/O
+void LiveMonitor::recordGraded(const string& examName, int marks, const vector<int>& answers) {
+    pthread_mutex_lock(&liveMutex);
+    LiveExam& exam = exams[examName];
+    exam.graded++;
+    exam.scoreSum += marks;
+    if (exam.answers.size() < answers.size()) exam.answers.resize(answers.size(), {});
+    for (size_t q = 0; q < answers.size(); ++q) {
+        int answer = answers[q];
+        exam.answers[q][answer >= 0 && answer < LIVE_OPTIONS ? answer : LIVE_OPTIONS]++;
+    }
+    pthread_mutex_unlock(&liveMutex);
+}
+
+void LiveMonitor::merge(LiveExam& into, const LiveExam& from) {
+    into.inProgress += from.inProgress;
+    into.graded += from.graded;
+    into.scoreSum += from.scoreSum;
+    if (into.answers.size() < from.answers.size()) into.answers.resize(from.answers.size(), {});
+    for (size_t q = 0; q < from.answers.size(); ++q) {
+        for (int option = 0; option <= LIVE_OPTIONS; ++option) into.answers[q][option] += from.answers[q][option];
+    }
+}
+
+// "ONLINE <n>", then per exam "<in progress> <graded> <score sum>
+// <questions> <counts per question...> <exam name>"; the name goes last
+// because it may contain spaces.
+string LiveMonitor::encode(long long studentsOnline, const map<string, LiveExam>& state) {
+    ostringstream out;
+    out << "ONLINE " << studentsOnline << "\n";
+    for (const auto& entry : state) {
+        const LiveExam& exam = entry.second;
+        out << exam.inProgress << " " << exam.graded << " " << exam.scoreSum << " " << exam.answers.size();
+        for (const auto& counts : exam.answers) {
+            for (long long count : counts) out << " " << count;
+        }
+        out << " " << entry.first << "\n";
+    }
+    return out.str();
+}
+
+void LiveMonitor::decode(const string& text, long long& studentsOnline, map<string, LiveExam>& state) {
+    istringstream in(text);
+    string line, word;
+    if (!getline(in, line) || line.rfind("ONLINE ", 0) != 0) return;
+    studentsOnline += atoll(line.c_str() + 7);
+    while (getline(in, line)) {
+        istringstream fields(line);
+        LiveExam exam;
+        size_t questions = 0;
+        if (!(fields >> exam.inProgress >> exam.graded >> exam.scoreSum >> questions) || questions > 10000) continue;
+        exam.answers.resize(questions, {});
+        for (auto& counts : exam.answers) {
+            for (long long& count : counts) fields >> count;
+        }
+        string name;
+        getline(fields, name);
+        if (!fields.fail() && name.size() > 1) merge(state[name.substr(1)], exam);
+    }
+}
+
+// This process's share: graded counters plus the sessions it runs
+string LiveMonitor::localState() {
+    map<string, LiveExam> state;
+    pthread_mutex_lock(&liveMutex);
+    state = exams;
+    pthread_mutex_unlock(&liveMutex);
+    if (sessions) sessions(state);
+    return encode(online ? online() : 0, state);
+}
+
+// Every shard's share. Each exam's sessions and grading live on its owner,
+// so with shards this is one short request per peer per publish.
+void LiveMonitor::collect(long long& studentsOnline, map<string, LiveExam>& state) {
+    studentsOnline = 0;
+    state.clear();
+    decode(localState(), studentsOnline, state);
+    for (int shard = 0; ShardRouter::enabled() && shard < ShardRouter::shards(); ++shard) {
+        string reply;
+        if (shard != ShardRouter::shard() && ShardRouter::forward(shard, "LIVE", reply))
+            decode(reply, studentsOnline, state);
+    }
+}
+
+string LiveMonitor::render(const string& instructor, long long studentsOnline, const map<string, LiveExam>& state) {
+    char since[32];
+    time_t started = startedAt;
+    strftime(since, sizeof(since), "%H:%M:%S", localtime(&started));
+
+    ostringstream out;
+    out << fixed << setprecision(1);
+    out << "\n========== Live Exams ==========\n";
+    out << "Students online: " << studentsOnline << "\n";
+    for (const string& examName : examsOf(instructor)) {
+        auto it = state.find(examName);
+        LiveExam exam = it != state.end() ? it->second : LiveExam();
+        ExamSummary summary;
+        bool any = ExamStats::summary(examName, summary);
+        out << "\n" << examName << "\n";
+        out << "  In progress: " << exam.inProgress << "   Submitted: " << (any ? summary.attempts : 0)
+            << "   Mean score: " << (any ? summary.mean : 0.0) << "\n";
+        if (exam.graded == 0) continue;
+        out << "  Graded since " << since << ": " << exam.graded << " (mean " << (double)exam.scoreSum / exam.graded << ")\n";
+        for (size_t q = 0; q < exam.answers.size(); ++q) {
+            out << "  Q" << left << setw(4) << q + 1 << right;
+            for (int option = 0; option <= LIVE_OPTIONS; ++option) {
+                string label = option < LIVE_OPTIONS ? string(1, 'A' + option) : "--";
+                out << " " << setw(2) << label << setw(4) << exam.answers[q][option] * 100 / exam.graded << "%";
+            }
+            out << "\n";
+        }
+    }
+    out << "\nPress Enter to stop watching.\n";
+    return out.str();
+}
+
+// Writes what the socket takes without waiting. A frame that was started is
+// finished first; the newest frame replaces any that never started.
+void LiveMonitor::flush(Subscriber& subscriber) {
+    while (!subscriber.failed) {
+        if (subscriber.sent == subscriber.pending.size()) {
+            if (subscriber.next.empty()) return;
+            subscriber.pending.swap(subscriber.next);
+            subscriber.next.clear();
+            subscriber.sent = 0;
+        }
+        ssize_t n = send(subscriber.sock, subscriber.pending.data() + subscriber.sent,
+                         subscriber.pending.size() - subscriber.sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n > 0) subscriber.sent += n;
+        else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        else subscriber.failed = true;
+    }
+}
+
+void* LiveMonitor::publisher(void* arg) {
+    while (true) {
+        usleep(LIVE_PUSH_INTERVAL_MS * 1000);
+        pthread_mutex_lock(&subscriberMutex);
+        vector<string> instructors;
+        for (Subscriber* subscriber : subscribers) instructors.push_back(subscriber->instructor);
+        pthread_mutex_unlock(&subscriberMutex);
+        if (instructors.empty()) continue;
+
+        long long studentsOnline;
+        map<string, LiveExam> state;
+        collect(studentsOnline, state);
+        map<string, string> views;
+        for (const string& instructor : instructors) {
+            if (!views.count(instructor)) views[instructor] = render(instructor, studentsOnline, state);
+        }
+
+        pthread_mutex_lock(&subscriberMutex);
+        for (Subscriber* subscriber : subscribers) {
+            auto view = views.find(subscriber->instructor);
+            if (view != views.end() && view->second != subscriber->rendered) {
+                if (!subscriber->next.empty()) Metrics::add("live_updates_coalesced_total");
+                subscriber->rendered = view->second;
+                subscriber->next = Wire::encodeFrame(view->second, subscriber->compress);
+                Metrics::add("live_updates_total");
+            }
+            flush(*subscriber);
+        }
+        pthread_mutex_unlock(&subscriberMutex);
+    }
+    return nullptr;
+}
+
+void LiveMonitor::subscribe(int sock, const string& instructor, bool compress) {
+    Subscriber* subscriber = new Subscriber();
+    subscriber->sock = sock;
+    subscriber->instructor = instructor;
+    subscriber->compress = compress;
+    pthread_mutex_lock(&subscriberMutex);
+    subscribers.push_back(subscriber);
+    Metrics::set("live_subscribers", subscribers.size());
+    if (!publishing) {
+        publishing = true;
+        pthread_t thread;
+        pthread_create(&thread, nullptr, publisher, nullptr);
+        pthread_detach(thread);
+    }
+    pthread_mutex_unlock(&subscriberMutex);
+}
+
+bool LiveMonitor::healthy(int sock) {
+    bool ok = false;
+    pthread_mutex_lock(&subscriberMutex);
+    for (Subscriber* subscriber : subscribers) {
+        if (subscriber->sock == sock) ok = !subscriber->failed;
+    }
+    pthread_mutex_unlock(&subscriberMutex);
+    return ok;
+}
+
+// Returns the rest of a frame that was only partly written; the caller
+// sends it before anything else so the client's framing stays intact.
+bool LiveMonitor::unsubscribe(int sock, string& unsent) {
+    bool ok = false;
+    unsent.clear();
+    pthread_mutex_lock(&subscriberMutex);
+    for (size_t i = 0; i < subscribers.size(); ++i) {
+        Subscriber* subscriber = subscribers[i];
+        if (subscriber->sock != sock) continue;
+        ok = !subscriber->failed;
+        if (subscriber->sent > 0) unsent = subscriber->pending.substr(subscriber->sent);
+        subscribers.erase(subscribers.begin() + i);
+        delete subscriber;
+        break;
+    }
+    Metrics::set("live_subscribers", subscribers.size());
+    pthread_mutex_unlock(&subscriberMutex);
+    return ok;
+}
@@ -0,0 +1,79 @@
+#ifndef LIVE_MONITOR_H
+#define LIVE_MONITOR_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <array>
+#include <functional>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "wire.h"
+
+using namespace std;
+
+#define LIVE_PUSH_INTERVAL_MS 250
+#define LIVE_OPTIONS 4  // answers A-D; one more slot counts "not attempted"
+
+// What an exam looks like right now in one process
+struct LiveExam {
+    long long inProgress = 0;
+    long long graded = 0;  // since the server started
+    long long scoreSum = 0;
+    vector<array<long long, LIVE_OPTIONS + 1>> answers;  // per question
+};
+
+// Live view of exams for instructors who subscribe to it. Grading folds
+// each submission into per-exam counters under a short lock; everything
+// else happens on one publisher thread that wakes every
+// LIVE_PUSH_INTERVAL_MS, collects the counters (from the other shards too),
+// renders each subscriber's exams and queues the frame only if it changed.
+// Frames are written with non-blocking sends; a subscriber that cannot keep
+// up has its unsent frame replaced by the newest one, so updates coalesce
+// and the publisher never waits on a slow connection.
+class LiveMonitor {
+private:
+    struct Subscriber {
+        int sock;
+        string instructor;
+        bool compress;
+        string rendered;   // last view queued
+        string pending;    // frame partly written, must finish first
+        size_t sent = 0;
+        string next;       // newest frame not started yet
+        bool failed = false;
+    };
+
+    static map<string, LiveExam> exams;
+    static vector<Subscriber*> subscribers;
+    static pthread_mutex_t liveMutex;
+    static pthread_mutex_t subscriberMutex;
+    static bool publishing;
+    static long long startedAt;
+
+    static function<void(map<string, LiveExam>&)> sessions;
+    static function<long long()> online;
+    static function<vector<string>(const string& instructor)> examsOf;
+
+    static string encode(long long studentsOnline, const map<string, LiveExam>& state);
+    static void decode(const string& text, long long& studentsOnline, map<string, LiveExam>& state);
+    static void merge(LiveExam& into, const LiveExam& from);
+    static void collect(long long& studentsOnline, map<string, LiveExam>& state);
+    static string render(const string& instructor, long long studentsOnline, const map<string, LiveExam>& state);
+    static void flush(Subscriber& subscriber);
+    static void* publisher(void* arg);
+
+public:
+    static void configure(function<void(map<string, LiveExam>&)> sessions, function<long long()> online,
+                          function<vector<string>(const string& instructor)> examsOf);
+    static void recordGraded(const string& examName, int marks, const vector<int>& answers);
+    static string localState();
+    static void subscribe(int sock, const string& instructor, bool compress);
+    static bool healthy(int sock);
+    static bool unsubscribe(int sock, string& unsent);
+};
+
+#endif
@@ -1,7 +1,93 @@
 #include "server.h"
+#include "traffic_replay.h"
+#include <sys/wait.h>
 
-int main() {
-    Server server(8080);
+#define SERVER_PORT 8080
+
+static void runShard(int port, int shard, int shards, const string& ioBackend, const string& capturePath) {
+    Server server(port, ioBackend, shard, shards);
+    if (!capturePath.empty()) TrafficCapture::start(capturePath + "." + to_string(shard));
     server.start();
+    exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char* argv[]) {
+    // --io=sync (default) or --io=uring selects how result files are written
+    // --shards=N runs N processes sharing the port, each owning a slice of the exams
+    // --replicate=ADDR streams every durable write to a standby ("unix:<path>" or "<host>:<port>"),
+    //   --replication=async (default) or semisync decides whether submissions wait for it
+    // --standby-of=ADDR follows that primary instead of serving, and takes over after
+    //   --promote-after=SECONDS of silence (0: only on SIGUSR1)
+    // --export=EXAM writes that exam's results as --format=csv (default) or columnar
+    //   to --out=PATH (default stdout) and exits
+    // --capture=PATH records client traffic (PATH.<shard> with --shards); an existing
+    //   capture is kept and the next free PATH.1, PATH.2, ... is used instead
+    // --replay=PATH plays a capture against --target=HOST:PORT at --speed=1 (default), 10 or max,
+    //   writing --report=PATH and comparing with --baseline=PATH, then exits
+    // --collusion=EXAM writes that exam's --top=N (default 50) most suspicious pairs of
+    //   attempts as CSV to --out=PATH (default stdout) and exits
+    string ioBackend = "sync", replicateTo, replicationMode = "async", standbyOf;
+    string exportExam, exportFormat = "csv", exportPath, collusionExam;
+    string capturePath, replayPath, replayTarget = "127.0.0.1:8080", replaySpeed = "1", reportPath, baselinePath;
+    int shards = 1, port = SERVER_PORT, promoteAfter = 5, collusionTop = COLLUSION_DEFAULT_TOP;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg.rfind("--io=", 0) == 0) ioBackend = arg.substr(5);
+        else if (arg.rfind("--shards=", 0) == 0) shards = max(1, atoi(arg.c_str() + 9));
+        else if (arg.rfind("--port=", 0) == 0) port = atoi(arg.c_str() + 7);
+        else if (arg.rfind("--replicate=", 0) == 0) replicateTo = arg.substr(12);
+        else if (arg.rfind("--replication=", 0) == 0) replicationMode = arg.substr(14);
+        else if (arg.rfind("--standby-of=", 0) == 0) standbyOf = arg.substr(13);
+        else if (arg.rfind("--promote-after=", 0) == 0) promoteAfter = atoi(arg.c_str() + 16);
+        else if (arg.rfind("--export=", 0) == 0) exportExam = arg.substr(9);
+        else if (arg.rfind("--format=", 0) == 0) exportFormat = arg.substr(9);
+        else if (arg.rfind("--out=", 0) == 0) exportPath = arg.substr(6);
+        else if (arg.rfind("--collusion=", 0) == 0) collusionExam = arg.substr(12);
+        else if (arg.rfind("--top=", 0) == 0) collusionTop = atoi(arg.c_str() + 6);
+        else if (arg.rfind("--capture=", 0) == 0) capturePath = arg.substr(10);
+        else if (arg.rfind("--replay=", 0) == 0) replayPath = arg.substr(9);
+        else if (arg.rfind("--target=", 0) == 0) replayTarget = arg.substr(9);
+        else if (arg.rfind("--speed=", 0) == 0) replaySpeed = arg.substr(8);
+        else if (arg.rfind("--report=", 0) == 0) reportPath = arg.substr(9);
+        else if (arg.rfind("--baseline=", 0) == 0) baselinePath = arg.substr(11);
+    }
+
+    if (!exportExam.empty()) return Server::exportResults(exportExam, exportFormat, exportPath) ? 0 : 1;
+    if (!collusionExam.empty()) return Server::scanCollusion(collusionExam, max(collusionTop, 1), exportPath) ? 0 : 1;
+    if (!replayPath.empty())
+        return TrafficReplay::run(replayPath, replayTarget, replaySpeed, reportPath, baselinePath) ? 0 : 1;
+
+    if (!standbyOf.empty()) Standby::run(standbyOf, promoteAfter * 1000LL, port);
+
+    if (shards == 1) {
+        Server server(port, ioBackend);
+        if (!replicateTo.empty() && !Replicator::start(replicateTo, replicationMode == "semisync"))
+            return 1;
+        if (!capturePath.empty() && !TrafficCapture::start(capturePath)) return 1;
+        server.start();
+        return 0;
+    }
+    if (!replicateTo.empty())
+        cerr << "[!] Replication runs per process and is not available with --shards, ignoring --replicate.\n";
+
+    // The parent only supervises: a shard that dies is started again with
+    // the same number so it recovers its own submission log and sessions.
+    vector<pid_t> pids(shards);
+    for (int shard = 0; shard < shards; ++shard) {
+        pids[shard] = fork();
+        if (pids[shard] == 0) runShard(port, shard, shards, ioBackend, capturePath);
+    }
+    while (true) {
+        int status;
+        pid_t pid = wait(&status);
+        if (pid == -1) break;
+        for (int shard = 0; shard < shards; ++shard) {
+            if (pids[shard] != pid) continue;
+            cerr << "[!] Shard " << shard << " exited, restarting it.\n";
+            sleep(1);
+            pids[shard] = fork();
+            if (pids[shard] == 0) runShard(port, shard, shards, ioBackend, capturePath);
+        }
+    }
     return 0;
 }
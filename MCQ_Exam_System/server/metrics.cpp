@@ -0,0 +1,52 @@
+#include "metrics.h"
+
+map<string, long long> Metrics::values;
+vector<function<void()>> Metrics::collectors;
+pthread_mutex_t Metrics::metricsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+void Metrics::add(const string& name, long long delta) {
+    pthread_mutex_lock(&metricsMutex);
+    values[name] += delta;
+    pthread_mutex_unlock(&metricsMutex);
+}
+
+void Metrics::set(const string& name, long long value) {
+    pthread_mutex_lock(&metricsMutex);
+    values[name] = value;
+    pthread_mutex_unlock(&metricsMutex);
+}
+
+long long Metrics::get(const string& name) {
+    pthread_mutex_lock(&metricsMutex);
+    auto it = values.find(name);
+    long long value = it == values.end() ? 0 : it->second;
+    pthread_mutex_unlock(&metricsMutex);
+    return value;
+}
+
+void Metrics::addCollector(function<void()> collector) {
+    pthread_mutex_lock(&metricsMutex);
+    collectors.push_back(collector);
+    pthread_mutex_unlock(&metricsMutex);
+}
+
+string Metrics::render() {
+    pthread_mutex_lock(&metricsMutex);
+    vector<function<void()>> pending = collectors;
+    pthread_mutex_unlock(&metricsMutex);
+    // Collectors call set(), so they run without the lock held
+    for (auto& collect : pending) collect();
+
+    string text;
+    pthread_mutex_lock(&metricsMutex);
+    for (auto& entry : values)
+        text += entry.first + " " + to_string(entry.second) + "\n";
+    pthread_mutex_unlock(&metricsMutex);
+    return text;
+}
+
+long long Metrics::nowMs() {
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+}
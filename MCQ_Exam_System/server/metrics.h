@@ -0,0 +1,32 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <map>
+#include <vector>
+#include <functional>
+#include <sys/time.h>
+#include <pthread.h>
+
+using namespace std;
+
+// Process-wide counters and gauges, rendered as "<name> <value>" lines for
+// the "METRICS" request. Values that are cheaper to compute on demand than
+// to keep current (lag, queue depth) come from collectors that run just
+// before rendering.
+class Metrics {
+private:
+    static map<string, long long> values;
+    static vector<function<void()>> collectors;
+    static pthread_mutex_t metricsMutex;
+
+public:
+    static void add(const string& name, long long delta = 1);
+    static void set(const string& name, long long value);
+    static long long get(const string& name);
+    static void addCollector(function<void()> collector);
+    static string render();
+    static long long nowMs();
+};
+
+#endif
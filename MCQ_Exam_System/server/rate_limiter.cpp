@@ -0,0 +1,97 @@
+#include "rate_limiter.h"
+#include "metrics.h"
+#include <algorithm>
+
+unordered_map<string, TokenBucket> RateLimiter::buckets;
+vector<TokenBucket> RateLimiter::requests;
+pthread_mutex_t RateLimiter::limiterMutex = PTHREAD_MUTEX_INITIALIZER;
+size_t RateLimiter::pruneAt = RATE_PRUNE_ENTRIES;
+
+void RateLimiter::refill(TokenBucket& bucket, double burst, double perSecond, long long now) {
+    bucket.tokens = min(burst, bucket.tokens + (now - bucket.updatedMs) * perSecond / 1000);
+    bucket.updatedMs = now;
+}
+
+// Called with limiterMutex held. A new bucket starts full. Never erases, so
+// references to other buckets stay valid.
+TokenBucket& RateLimiter::bucket(const string& key, double burst, long long now) {
+    return buckets.emplace(key, TokenBucket{burst, now}).first->second;
+}
+
+// Called with limiterMutex held, before any bucket is looked up. The
+// threshold doubles with what survives, so a map full of buckets still in
+// use is not walked on every call.
+void RateLimiter::maybePrune(long long now) {
+    if (buckets.size() < pruneAt) return;
+    for (auto it = buckets.begin(); it != buckets.end();) {
+        double burst, perSecond;
+        if (it->first[0] == 'c') burst = RATE_CONNECT_BURST, perSecond = RATE_CONNECT_PER_SEC;
+        else if (it->first[0] == 'a') burst = RATE_AUTH_FAIL_ADDRESS_BURST, perSecond = RATE_AUTH_FAIL_ADDRESS_PER_SEC;
+        else burst = RATE_AUTH_FAIL_USER_BURST, perSecond = RATE_AUTH_FAIL_USER_PER_SEC;
+        refill(it->second, burst, perSecond, now);
+        if (it->second.tokens >= burst) it = buckets.erase(it);
+        else ++it;
+    }
+    pruneAt = max<size_t>(RATE_PRUNE_ENTRIES, buckets.size() * 2);
+}
+
+bool RateLimiter::allowConnection(const string& address) {
+    long long now = Metrics::nowMs();
+    pthread_mutex_lock(&limiterMutex);
+    maybePrune(now);
+    TokenBucket& connects = bucket("c:" + address, RATE_CONNECT_BURST, now);
+    refill(connects, RATE_CONNECT_BURST, RATE_CONNECT_PER_SEC, now);
+    bool allowed = connects.tokens >= 1;
+    if (allowed) connects.tokens -= 1;
+    pthread_mutex_unlock(&limiterMutex);
+    if (!allowed) Metrics::add("ratelimit_connections_rejected_total");
+    return allowed;
+}
+
+// Checked before the password is: a blocked client learns nothing from
+// further guesses.
+bool RateLimiter::allowAuth(const string& address, const string& username) {
+    long long now = Metrics::nowMs();
+    pthread_mutex_lock(&limiterMutex);
+    maybePrune(now);
+    TokenBucket& byAddress = bucket("a:" + address, RATE_AUTH_FAIL_ADDRESS_BURST, now);
+    refill(byAddress, RATE_AUTH_FAIL_ADDRESS_BURST, RATE_AUTH_FAIL_ADDRESS_PER_SEC, now);
+    TokenBucket& byUser = bucket("u:" + username, RATE_AUTH_FAIL_USER_BURST, now);
+    refill(byUser, RATE_AUTH_FAIL_USER_BURST, RATE_AUTH_FAIL_USER_PER_SEC, now);
+    bool allowed = byAddress.tokens >= 1 && byUser.tokens >= 1;
+    pthread_mutex_unlock(&limiterMutex);
+    if (!allowed) Metrics::add("ratelimit_auth_blocked_total");
+    return allowed;
+}
+
+void RateLimiter::authFailed(const string& address, const string& username) {
+    long long now = Metrics::nowMs();
+    pthread_mutex_lock(&limiterMutex);
+    maybePrune(now);
+    TokenBucket& byAddress = bucket("a:" + address, RATE_AUTH_FAIL_ADDRESS_BURST, now);
+    refill(byAddress, RATE_AUTH_FAIL_ADDRESS_BURST, RATE_AUTH_FAIL_ADDRESS_PER_SEC, now);
+    byAddress.tokens -= 1;
+    TokenBucket& byUser = bucket("u:" + username, RATE_AUTH_FAIL_USER_BURST, now);
+    refill(byUser, RATE_AUTH_FAIL_USER_BURST, RATE_AUTH_FAIL_USER_PER_SEC, now);
+    byUser.tokens -= 1;
+    pthread_mutex_unlock(&limiterMutex);
+}
+
+// Takes a token and returns how long the request must wait for it to have
+// been earned. Past RATE_MAX_DELAY_MS the token is handed back, since the
+// caller drops the connection instead of waiting.
+long long RateLimiter::requestDelayMs(uint32_t user) {
+    if (user == SYMBOL_NONE) return 0;
+    long long now = Metrics::nowMs();
+    pthread_mutex_lock(&limiterMutex);
+    if (user >= requests.size()) requests.resize(user + 1, TokenBucket{RATE_REQUEST_BURST, now});
+    TokenBucket& bucket = requests[user];
+    refill(bucket, RATE_REQUEST_BURST, RATE_REQUEST_PER_SEC, now);
+    bucket.tokens -= 1;
+    long long delay = bucket.tokens >= 0 ? 0 : (long long)(-bucket.tokens * 1000 / RATE_REQUEST_PER_SEC);
+    if (delay > RATE_MAX_DELAY_MS) bucket.tokens += 1;
+    pthread_mutex_unlock(&limiterMutex);
+    if (delay > RATE_MAX_DELAY_MS) Metrics::add("ratelimit_requests_dropped_total");
+    else if (delay > 0) Metrics::add("ratelimit_requests_delayed_total");
+    return delay;
+}
@@ -0,0 +1,62 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <pthread.h>
+
+#include "symbols.h"
+
+using namespace std;
+
+// New connections per client address. Generous: a lab or campus NAT puts a
+// whole class behind one address at the start of an exam.
+#define RATE_CONNECT_BURST 1024
+#define RATE_CONNECT_PER_SEC 256
+// Failed logins and registrations, per address and per username. Only
+// failures take tokens, so students who get their password right never
+// come near these.
+#define RATE_AUTH_FAIL_ADDRESS_BURST 20
+#define RATE_AUTH_FAIL_ADDRESS_PER_SEC 0.2
+#define RATE_AUTH_FAIL_USER_BURST 5
+#define RATE_AUTH_FAIL_USER_PER_SEC (1.0 / 60)
+// Menu requests per logged in user, over all their connections. Requests
+// over the rate are delayed; past RATE_MAX_DELAY_MS the connection is dropped.
+#define RATE_REQUEST_BURST 60
+#define RATE_REQUEST_PER_SEC 20
+#define RATE_MAX_DELAY_MS 5000
+// Idle buckets are dropped once there are this many, and again each time
+// the map doubles from what was left
+#define RATE_PRUNE_ENTRIES 4096
+
+struct TokenBucket {
+    double tokens;
+    long long updatedMs;
+};
+
+// Token buckets for the connection, login and request limits. Buckets of
+// addresses and attempted usernames are keyed by string, since those come
+// from unauthenticated clients and must not be interned; request buckets
+// are a flat array by user id. A full bucket is the same as none, so
+// buckets that have refilled are dropped when the maps grow.
+class RateLimiter {
+private:
+    static unordered_map<string, TokenBucket> buckets;  // "<kind>:<key>"
+    static vector<TokenBucket> requests;                // by Symbols::users id
+    static pthread_mutex_t limiterMutex;
+    static size_t pruneAt;
+
+    static void refill(TokenBucket& bucket, double burst, double perSecond, long long now);
+    static TokenBucket& bucket(const string& key, double burst, long long now);
+    static void maybePrune(long long now);
+
+public:
+    static bool allowConnection(const string& address);
+    static bool allowAuth(const string& address, const string& username);
+    static void authFailed(const string& address, const string& username);
+    static long long requestDelayMs(uint32_t user);
+};
+
+#endif
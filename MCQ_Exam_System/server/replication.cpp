@@ -0,0 +1,534 @@
+#include "replication.h"
+#include "result_store.h"
+#include <csignal>
+#include <cerrno>
+#include <poll.h>
+#include <sys/time.h>
+
+bool Replicator::enabled = false;
+bool Replicator::semiSync = false;
+bool Replicator::degraded = false;
+bool Replicator::standbyConnected = false;
+unsigned long long Replicator::epoch = 0;
+unsigned long long Replicator::lastSeq = 0;
+unsigned long long Replicator::ackedSeq = 0;
+deque<Replicator::Record> Replicator::backlog;
+size_t Replicator::backlogBytes = 0;
+unsigned long long Replicator::shippedBytes = 0;
+unsigned long long Replicator::semiSyncTimeouts = 0;
+bool Replicator::streamAlive = false;
+int Replicator::listenFd = -1;
+pthread_mutex_t Replicator::replMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t Replicator::replCond = PTHREAD_COND_INITIALIZER;
+
+unsigned long long Standby::epoch = 0;
+unsigned long long Standby::appliedSeq = 0;
+volatile bool Standby::promoteRequested = false;
+int Standby::clientFd = -1;
+int Standby::positionFd = -1;
+
+// "unix:<path>" or "<host>:<port>"
+int Replicator::listenOn(const string& address) {
+    if (address.rfind("unix:", 0) == 0) {
+        string path = address.substr(5);
+        unlink(path.c_str());
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        if (fd == -1 || bind(fd, (sockaddr*)&addr, sizeof(addr)) == -1 || listen(fd, 4) == -1) {
+            if (fd != -1) close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    size_t colon = address.rfind(':');
+    if (colon == string::npos) return -1;
+    addrinfo hints{}, *result = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    string host = address.substr(0, colon);
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), address.substr(colon + 1).c_str(), &hints, &result) != 0) return -1;
+
+    int fd = socket(result->ai_family, result->ai_socktype, 0);
+    int reuse = 1;
+    if (fd != -1) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (fd == -1 || bind(fd, result->ai_addr, result->ai_addrlen) == -1 || listen(fd, 4) == -1) {
+        if (fd != -1) close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+int Replicator::connectTo(const string& address) {
+    if (address.rfind("unix:", 0) == 0) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address.c_str() + 5, sizeof(addr.sun_path) - 1);
+        if (fd != -1 && connect(fd, (sockaddr*)&addr, sizeof(addr)) == -1) {
+            close(fd);
+            fd = -1;
+        }
+        return fd;
+    }
+
+    size_t colon = address.rfind(':');
+    if (colon == string::npos) return -1;
+    addrinfo hints{}, *result = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(address.substr(0, colon).c_str(), address.substr(colon + 1).c_str(), &hints, &result) != 0) return -1;
+
+    int fd = socket(result->ai_family, result->ai_socktype, 0);
+    if (fd != -1 && connect(fd, result->ai_addr, result->ai_addrlen) == -1) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+// "<kind> <bytes> <path>\n<data>" per op
+string Replicator::encode(const vector<ReplicationOp>& ops) {
+    string body;
+    for (const ReplicationOp& op : ops) {
+        body += op.kind;
+        body += " " + to_string(op.data.size()) + " " + op.path + "\n";
+        body += op.data;
+    }
+    return body;
+}
+
+bool Replicator::decode(const string& body, vector<ReplicationOp>& ops) {
+    size_t pos = 0;
+    while (pos < body.size()) {
+        size_t nl = body.find('\n', pos);
+        if (nl == string::npos || nl - pos < 4) return false;
+        ReplicationOp op;
+        op.kind = body[pos];
+        char* end = nullptr;
+        size_t length = strtoull(body.c_str() + pos + 2, &end, 10);
+        if (*end != ' ' || nl + 1 + length > body.size()) return false;
+        op.path = body.substr(end + 1 - body.c_str(), nl - (end + 1 - body.c_str()));
+        op.data = body.substr(nl + 1, length);
+        ops.push_back(op);
+        pos = nl + 1 + length;
+    }
+    return true;
+}
+
+bool Replicator::start(const string& address, bool semi) {
+    listenFd = listenOn(address);
+    if (listenFd == -1) {
+        cerr << "Error: Could not listen for a standby on " << address << endl;
+        return false;
+    }
+    semiSync = semi;
+    epoch = Metrics::nowMs();
+    enabled = true;
+    Metrics::addCollector(collect);
+
+    pthread_t thread;
+    pthread_create(&thread, nullptr, acceptLoop, nullptr);
+    pthread_detach(thread);
+    cout << "[+] Replicating to standby on " << address << " (" << (semiSync ? "semi-sync" : "async") << ")\n";
+    return true;
+}
+
+unsigned long long Replicator::ship(const vector<ReplicationOp>& ops) {
+    if (!enabled || ops.empty()) return 0;
+    string body = encode(ops);
+
+    pthread_mutex_lock(&replMutex);
+    unsigned long long seq = ++lastSeq;
+    shippedBytes += body.size();
+    backlogBytes += body.size();
+    backlog.push_back(Record{seq, Metrics::nowMs(), move(body)});
+    // A standby that falls further behind than this has to be re-seeded
+    while (backlogBytes > REPL_BACKLOG_BYTES && backlog.size() > 1) {
+        backlogBytes -= backlog.front().body.size();
+        backlog.pop_front();
+    }
+    pthread_cond_broadcast(&replCond);
+    pthread_mutex_unlock(&replMutex);
+    return seq;
+}
+
+unsigned long long Replicator::ship(const vector<AppendOp>& appends) {
+    if (!enabled) return 0;
+    vector<ReplicationOp> ops;
+    for (const AppendOp& append : appends) ops.push_back(ReplicationOp{'A', append.path, append.data});
+    return ship(ops);
+}
+
+unsigned long long Replicator::append(const string& path, const string& data) {
+    if (!enabled) return 0;
+    return ship(vector<ReplicationOp>{ReplicationOp{'A', path, data}});
+}
+
+unsigned long long Replicator::putFile(const string& path) {
+    if (!enabled) return 0;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) return 0;
+    string content;
+    char buffer[8192];
+    ssize_t got;
+    while ((got = read(fd, buffer, sizeof(buffer))) > 0) content.append(buffer, got);
+    close(fd);
+    return ship(vector<ReplicationOp>{ReplicationOp{'P', path, content}});
+}
+
+unsigned long long Replicator::remove(const string& path) {
+    if (!enabled) return 0;
+    return ship(vector<ReplicationOp>{ReplicationOp{'U', path, ""}});
+}
+
+// Semi-sync only: blocks until the standby has applied seq. Returns false
+// when the record is (so far) only on the primary.
+bool Replicator::waitForStandby(unsigned long long seq) {
+    if (!enabled || !semiSync || seq == 0) return false;
+
+    pthread_mutex_lock(&replMutex);
+    if (!standbyConnected || degraded) {
+        pthread_mutex_unlock(&replMutex);
+        return false;
+    }
+    timeval now;
+    gettimeofday(&now, nullptr);
+    long long deadlineUs = now.tv_sec * 1000000LL + now.tv_usec + REPL_SEMISYNC_TIMEOUT_MS * 1000LL;
+    timespec deadline{(time_t)(deadlineUs / 1000000), (long)(deadlineUs % 1000000) * 1000};
+
+    while (ackedSeq < seq && standbyConnected) {
+        if (pthread_cond_timedwait(&replCond, &replMutex, &deadline) != 0) break;
+    }
+    bool acked = ackedSeq >= seq;
+    if (!acked && standbyConnected && !degraded) {
+        degraded = true;
+        ++semiSyncTimeouts;
+        cerr << "[!] Standby did not confirm within " << REPL_SEMISYNC_TIMEOUT_MS << " ms, replicating asynchronously until it catches up.\n";
+    }
+    pthread_mutex_unlock(&replMutex);
+    return acked;
+}
+
+// One standby at a time; a second one waits until the first disconnects.
+void* Replicator::acceptLoop(void* arg) {
+    while (true) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd == -1) continue;
+        streamTo(fd);
+        close(fd);
+    }
+    return nullptr;
+}
+
+void* Replicator::ackReader(void* arg) {
+    int fd = *(int*)arg;
+    string line;
+    while (Wire::recvLine(fd, line)) {
+        if (line.rfind("ACK ", 0) != 0) continue;
+        unsigned long long seq = strtoull(line.c_str() + 4, nullptr, 10);
+        pthread_mutex_lock(&replMutex);
+        ackedSeq = max(ackedSeq, seq);
+        if (degraded && ackedSeq >= lastSeq) {
+            degraded = false;
+            cout << "[+] Standby caught up, semi-sync replication resumed.\n";
+        }
+        pthread_cond_broadcast(&replCond);
+        pthread_mutex_unlock(&replMutex);
+    }
+    pthread_mutex_lock(&replMutex);
+    streamAlive = false;
+    pthread_cond_broadcast(&replCond);
+    pthread_mutex_unlock(&replMutex);
+    return nullptr;
+}
+
+// "SUBSCRIBE <epoch> <last applied>" -> "STREAM <epoch> <first seq>", then
+// "REC <seq> <shipped ms>" + frame per record and "PING <last seq>" when idle.
+void Replicator::streamTo(int fd) {
+    string line;
+    if (!Wire::recvLine(fd, line) || line.rfind("SUBSCRIBE ", 0) != 0) return;
+    unsigned long long standbyEpoch = 0, standbySeq = 0;
+    istringstream(line.substr(10)) >> standbyEpoch >> standbySeq;
+
+    pthread_mutex_lock(&replMutex);
+    // A standby from an earlier run of the primary starts over at this run's first record
+    unsigned long long next = standbyEpoch == epoch ? standbySeq + 1 : 1;
+    unsigned long long oldest = backlog.empty() ? lastSeq + 1 : backlog.front().seq;
+    if (next < oldest || next > lastSeq + 1) {
+        pthread_mutex_unlock(&replMutex);
+        Wire::sendAll(fd, "Error: Standby is too far behind, seed it again from a copy of the data directory.\n");
+        cerr << "[!] Rejected standby at record " << standbySeq << ", backlog starts at " << oldest << ".\n";
+        return;
+    }
+    ackedSeq = next - 1;
+    standbyConnected = true;
+    streamAlive = true;
+    degraded = false;
+    pthread_mutex_unlock(&replMutex);
+
+    if (!Wire::sendAll(fd, "STREAM " + to_string(epoch) + " " + to_string(next) + "\n")) return;
+    cout << "[+] Standby connected, streaming from record " << next << ".\n";
+
+    pthread_t reader;
+    pthread_create(&reader, nullptr, ackReader, &fd);
+
+    while (true) {
+        vector<Record> batch;
+        pthread_mutex_lock(&replMutex);
+        if (streamAlive && lastSeq < next) {
+            timeval now;
+            gettimeofday(&now, nullptr);
+            long long deadlineUs = now.tv_sec * 1000000LL + now.tv_usec + REPL_HEARTBEAT_MS * 1000LL;
+            timespec deadline{(time_t)(deadlineUs / 1000000), (long)(deadlineUs % 1000000) * 1000};
+            pthread_cond_timedwait(&replCond, &replMutex, &deadline);
+        }
+        bool alive = streamAlive;
+        bool behind = !backlog.empty() && next < backlog.front().seq;
+        if (alive && !behind && !backlog.empty()) {
+            for (size_t i = next - backlog.front().seq; i < backlog.size() && batch.size() < 256; ++i)
+                batch.push_back(backlog[i]);
+        }
+        unsigned long long head = lastSeq;
+        pthread_mutex_unlock(&replMutex);
+
+        if (!alive) break;
+        if (behind) {
+            Wire::sendAll(fd, "Error: Standby fell out of the replication backlog, seed it again from a copy of the data directory.\n");
+            break;
+        }
+        bool ok = true;
+        if (batch.empty()) {
+            ok = Wire::sendAll(fd, "PING " + to_string(head) + "\n");
+        }
+        for (const Record& record : batch) {
+            ok = Wire::sendAll(fd, "REC " + to_string(record.seq) + " " + to_string(record.shippedMs) + "\n") &&
+                 Wire::sendFrame(fd, record.body, true);
+            if (!ok) break;
+            next = record.seq + 1;
+        }
+        if (!ok) break;
+    }
+
+    shutdown(fd, SHUT_RDWR);
+    pthread_join(reader, nullptr);
+    pthread_mutex_lock(&replMutex);
+    standbyConnected = false;
+    pthread_cond_broadcast(&replCond);
+    pthread_mutex_unlock(&replMutex);
+    cerr << "[!] Standby disconnected at record " << ackedSeq << ".\n";
+}
+
+void Replicator::collect() {
+    pthread_mutex_lock(&replMutex);
+    long long lagMs = 0;
+    if (ackedSeq < lastSeq && !backlog.empty()) {
+        // Age of the oldest record the standby has not confirmed
+        size_t index = ackedSeq + 1 >= backlog.front().seq ? ackedSeq + 1 - backlog.front().seq : 0;
+        if (index < backlog.size()) lagMs = Metrics::nowMs() - backlog[index].shippedMs;
+    }
+    Metrics::set("repl_records_shipped_total", lastSeq);
+    Metrics::set("repl_bytes_shipped_total", shippedBytes);
+    Metrics::set("repl_acked_seq", ackedSeq);
+    Metrics::set("repl_lag_records", lastSeq - ackedSeq);
+    Metrics::set("repl_lag_ms", lagMs);
+    Metrics::set("repl_backlog_bytes", backlogBytes);
+    Metrics::set("repl_standby_connected", standbyConnected);
+    Metrics::set("repl_semisync_degraded", degraded);
+    Metrics::set("repl_semisync_timeouts_total", semiSyncTimeouts);
+    pthread_mutex_unlock(&replMutex);
+}
+
+void Standby::loadPosition() {
+    positionFd = open(REPLICA_POSITION_FILE, O_RDWR | O_CREAT, 0644);
+    char buffer[64] = {0};
+    if (positionFd != -1 && pread(positionFd, buffer, sizeof(buffer) - 1, 0) > 0)
+        istringstream(buffer) >> epoch >> appliedSeq;
+}
+
+// Fixed width so every update is a single overwrite in place
+void Standby::savePosition() {
+    char buffer[64];
+    int length = snprintf(buffer, sizeof(buffer), "%020llu %020llu\n", epoch, appliedSeq);
+    if (positionFd != -1) pwrite(positionFd, buffer, length, 0);
+}
+
+// Only files under ../data, never outside it
+bool Standby::safePath(const string& path) {
+    return path.rfind("../data/", 0) == 0 && path.find("/..", 7) == string::npos && path.find('\0') == string::npos;
+}
+
+bool Standby::apply(const ReplicationOp& op) {
+    if (!safePath(op.path)) {
+        cerr << "[!] Ignoring replicated change outside the data directory: " << op.path << endl;
+        return false;
+    }
+    string dir = op.path.substr(0, op.path.rfind('/'));
+    mkdir(dir.c_str(), 0755);
+
+    if (op.kind == 'U') return unlink(op.path.c_str()) == 0 || errno == ENOENT;
+    if (op.kind == 'A' && ResultStore::owns(op.path)) return ResultStore::appendBatch({AppendOp{op.path, op.data}});
+
+    string target = op.kind == 'P' ? op.path + ".repl" : op.path;
+    int flags = O_WRONLY | O_CREAT | (op.kind == 'P' ? O_TRUNC : O_APPEND);
+    int fd = open(target.c_str(), flags, 0644);
+    if (fd == -1) return false;
+    bool ok = true;
+    for (size_t written = 0; ok && written < op.data.size();) {
+        ssize_t n = write(fd, op.data.data() + written, op.data.size() - written);
+        ok = n > 0;
+        if (ok) written += n;
+    }
+    close(fd);
+    if (op.kind == 'P') ok = ok && rename(target.c_str(), op.path.c_str()) == 0;
+    return ok;
+}
+
+void* Standby::answerClients(void* arg) {
+    while (true) {
+        int sock = accept(clientFd, nullptr, nullptr);
+        if (sock == -1) {
+            if (promoteRequested) break;
+            continue;
+        }
+        char buffer[256] = {0};
+        while (recv(sock, buffer, sizeof(buffer) - 1, 0) > 0) {
+            string request(buffer);
+            memset(buffer, 0, sizeof(buffer));
+            if (request.rfind("HELLO", 0) == 0) {
+                Wire::sendAll(sock, string("HELLO ") + CODEC_RAW);
+                continue;
+            }
+            if (request == "METRICS") Wire::sendFrame(sock, Metrics::render(), false);
+            else Wire::sendAll(sock, "Error: This server is a standby.\n");
+            break;
+        }
+        close(sock);
+    }
+    return nullptr;
+}
+
+static void requestPromotion(int) {
+    Standby::promote();
+}
+
+// Returns false when the primary went away or rejected us.
+bool Standby::follow(int fd, long long promoteAfterMs, long long& lastHeard) {
+    if (!Wire::sendAll(fd, "SUBSCRIBE " + to_string(epoch) + " " + to_string(appliedSeq) + "\n")) return false;
+    Metrics::set("repl_primary_connected", 1);
+
+    long long windowStart = Metrics::nowMs();
+    unsigned long long windowRecords = 0;
+    unsigned long long primarySeq = appliedSeq;
+    string line;
+    while (!promoteRequested) {
+        pollfd pfd{fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, 200);
+        long long now = Metrics::nowMs();
+        if (ready == 0) {
+            if (promoteAfterMs > 0 && now - lastHeard > promoteAfterMs) break;
+            continue;
+        }
+        if (ready < 0 || !Wire::recvLine(fd, line)) break;
+        lastHeard = now;
+
+        if (line.rfind("STREAM ", 0) == 0) {
+            unsigned long long streamEpoch = 0, first = 0;
+            istringstream(line.substr(7)) >> streamEpoch >> first;
+            if (streamEpoch != epoch && epoch != 0)
+                cout << "[!] Primary restarted; following its new stream from record " << first << ".\n";
+            epoch = streamEpoch;
+            appliedSeq = first - 1;
+            primarySeq = max(primarySeq, appliedSeq);
+            savePosition();
+        } else if (line.rfind("REC ", 0) == 0) {
+            unsigned long long seq = 0;
+            long long shippedMs = 0;
+            istringstream(line.substr(4)) >> seq >> shippedMs;
+            string body;
+            vector<ReplicationOp> ops;
+            if (!Wire::recvFrame(fd, body) || !Replicator::decode(body, ops)) break;
+            for (const ReplicationOp& op : ops) {
+                if (!apply(op)) cerr << "Error: Failed to apply replicated change to " << op.path << endl;
+            }
+            appliedSeq = seq;
+            primarySeq = max(primarySeq, seq);
+            savePosition();
+            if (!Wire::sendAll(fd, "ACK " + to_string(seq) + "\n")) break;
+
+            ++windowRecords;
+            Metrics::add("repl_applied_records_total");
+            Metrics::add("repl_applied_bytes_total", body.size());
+            Metrics::set("repl_applied_seq", appliedSeq);
+            Metrics::set("repl_apply_lag_ms", now - shippedMs);
+        } else if (line.rfind("PING ", 0) == 0) {
+            primarySeq = strtoull(line.c_str() + 5, nullptr, 10);
+            if (primarySeq <= appliedSeq) Metrics::set("repl_apply_lag_ms", 0);
+        } else if (line.rfind("Error:", 0) == 0) {
+            cerr << "[!] Primary refused replication: " << line << endl;
+            sleep(1);
+            break;
+        }
+        Metrics::set("repl_lag_records", primarySeq > appliedSeq ? primarySeq - appliedSeq : 0);
+
+        if (now - windowStart >= 10000) {
+            Metrics::set("repl_apply_rate", windowRecords * 1000 / (now - windowStart));
+            if (windowRecords)
+                cout << "[+] Standby at record " << appliedSeq << ", " << windowRecords * 1000 / (now - windowStart) << " records/s.\n";
+            windowStart = now;
+            windowRecords = 0;
+        }
+    }
+    Metrics::set("repl_primary_connected", 0);
+    return false;
+}
+
+void Standby::run(const string& address, long long promoteAfterMs, int port) {
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGUSR1, requestPromotion);
+    loadPosition();
+    ResultStore::open(1);
+    cout << "[+] Standby following " << address << " from record " << appliedSeq << endl;
+
+    // Until promotion the client port only answers METRICS
+    clientFd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(clientFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(clientFd, (sockaddr*)&addr, sizeof(addr)) == 0 && listen(clientFd, SOMAXCONN) == 0) {
+        pthread_t thread;
+        pthread_create(&thread, nullptr, answerClients, nullptr);
+        pthread_detach(thread);
+    } else {
+        cerr << "[!] Port " << port << " is busy, standby metrics are not served.\n";
+        close(clientFd);
+        clientFd = -1;
+    }
+
+    long long lastHeard = Metrics::nowMs();
+    while (!promoteRequested) {
+        int fd = Replicator::connectTo(address);
+        if (fd != -1) {
+            follow(fd, promoteAfterMs, lastHeard);
+            close(fd);
+        }
+        if (promoteAfterMs > 0 && Metrics::nowMs() - lastHeard > promoteAfterMs) break;
+        usleep(200 * 1000);
+    }
+
+    promoteRequested = true;
+    if (clientFd != -1) {
+        shutdown(clientFd, SHUT_RDWR);
+        close(clientFd);
+    }
+    if (positionFd != -1) close(positionFd);
+    cout << "[+] Promoting standby at record " << appliedSeq << ".\n";
+}
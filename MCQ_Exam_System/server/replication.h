@@ -0,0 +1,116 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstring>
+#include <cstdint>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include "wire.h"
+#include "metrics.h"
+#include "io_backend.h"
+
+using namespace std;
+
+#define REPL_BACKLOG_BYTES (64 * 1024 * 1024)
+#define REPL_SEMISYNC_TIMEOUT_MS 1000
+#define REPL_HEARTBEAT_MS 1000
+#define REPLICA_POSITION_FILE "../data/results/replica.pos"
+
+// One change to a file under ../data: 'A' appends data, 'P' replaces the
+// whole file with data, 'U' removes it.
+struct ReplicationOp {
+    char kind;
+    string path;
+    string data;
+};
+
+// Primary side of warm standby replication. Every durable write (submission
+// log, result files, session journals, registrations, uploaded exams) is
+// also shipped as a numbered record into an in-memory backlog, which a
+// connected standby streams from. In semi-sync mode a submission is only
+// acknowledged to the student once the standby has acked its record, or
+// after REPL_SEMISYNC_TIMEOUT_MS, when the primary drops to async until the
+// standby catches up again.
+class Replicator {
+private:
+    struct Record {
+        unsigned long long seq;
+        long long shippedMs;
+        string body;
+    };
+
+    static bool enabled;
+    static bool semiSync;
+    static bool degraded;
+    static bool standbyConnected;
+    static unsigned long long epoch;
+    static unsigned long long lastSeq;
+    static unsigned long long ackedSeq;
+    static deque<Record> backlog;
+    static size_t backlogBytes;
+    static unsigned long long shippedBytes;
+    static unsigned long long semiSyncTimeouts;
+    static bool streamAlive;
+    static int listenFd;
+    static pthread_mutex_t replMutex;
+    static pthread_cond_t replCond;
+
+    static void* acceptLoop(void* arg);
+    static void* ackReader(void* arg);
+    static void streamTo(int fd);
+    static void collect();
+
+public:
+    static bool start(const string& address, bool semiSync);
+    static bool active() { return enabled; }
+    static unsigned long long ship(const vector<ReplicationOp>& ops);
+    static unsigned long long ship(const vector<AppendOp>& appends);
+    static unsigned long long append(const string& path, const string& data);
+    static unsigned long long putFile(const string& path);
+    static unsigned long long remove(const string& path);
+    static bool waitForStandby(unsigned long long seq);
+
+    static string encode(const vector<ReplicationOp>& ops);
+    static bool decode(const string& body, vector<ReplicationOp>& ops);
+    static int listenOn(const string& address);
+    static int connectTo(const string& address);
+};
+
+// Standby side: follows a primary, applies its records to the local data
+// directory (the standby is simply run from another checkout, so its
+// ../data is its own) and remembers the last applied record in
+// REPLICA_POSITION_FILE. run() returns once the standby promotes itself,
+// after promoteAfterMs without hearing from the primary (0 disables) or on
+// SIGUSR1; the caller then starts a normal server on the replicated data.
+class Standby {
+private:
+    static unsigned long long epoch;
+    static unsigned long long appliedSeq;
+    static volatile bool promoteRequested;
+    static int clientFd;
+    static int positionFd;
+
+    static void loadPosition();
+    static void savePosition();
+    static bool safePath(const string& path);
+    static bool apply(const ReplicationOp& op);
+    static bool follow(int fd, long long promoteAfterMs, long long& lastHeard);
+    static void* answerClients(void* arg);
+
+public:
+    static void run(const string& address, long long promoteAfterMs, int port);
+    static void promote() { promoteRequested = true; }
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include "report_cache.h"
+#include "metrics.h"
+
+ReportCache::Shard ReportCache::shards[REPORT_CACHE_SHARDS];
+unordered_map<uint32_t, ReportCache::Leaderboard> ReportCache::leaderboards;
+pthread_mutex_t ReportCache::leaderboardMutex = PTHREAD_MUTEX_INITIALIZER;
+
+ReportCache::Shard& ReportCache::shardOf(const string& key) {
+    return shards[hash<string>()(key) % REPORT_CACHE_SHARDS];
+}
+
+// Hit ratios in percent, next to the raw counters
+void ReportCache::start() {
+    Metrics::addCollector([]() {
+        const char* caches[] = {"report_cache", "leaderboard_cache"};
+        for (const char* cache : caches) {
+            string name(cache);
+            long long hits = Metrics::get(name + "_hits_total"), misses = Metrics::get(name + "_misses_total");
+            Metrics::set(name + "_hit_ratio_pct", hits + misses > 0 ? hits * 100 / (hits + misses) : 0);
+        }
+        size_t bytes = 0;
+        for (Shard& shard : shards) {
+            pthread_mutex_lock(&shard.mutex);
+            bytes += shard.bytes;
+            pthread_mutex_unlock(&shard.mutex);
+        }
+        Metrics::set("report_cache_bytes", bytes);
+    });
+}
+
+bool ReportCache::findReport(const string& key, string& report) {
+    Shard& shard = shardOf(key);
+    pthread_mutex_lock(&shard.mutex);
+    auto it = shard.entries.find(key);
+    bool found = it != shard.entries.end();
+    if (found) {
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second.second);
+        report = it->second.first;
+    }
+    pthread_mutex_unlock(&shard.mutex);
+    Metrics::add(found ? "report_cache_hits_total" : "report_cache_misses_total");
+    return found;
+}
+
+void ReportCache::storeReport(const string& key, const string& report) {
+    const size_t limit = REPORT_CACHE_BYTES / REPORT_CACHE_SHARDS;
+    size_t size = key.size() + report.size();
+    if (size > limit) return;
+    Shard& shard = shardOf(key);
+    long long evicted = 0;
+    pthread_mutex_lock(&shard.mutex);
+    auto it = shard.entries.find(key);
+    if (it != shard.entries.end()) {
+        // Two viewers rendered the same report at once; keep the first
+        pthread_mutex_unlock(&shard.mutex);
+        return;
+    }
+    while (shard.bytes + size > limit && !shard.lru.empty()) {
+        const string& victim = shard.lru.back();
+        shard.bytes -= victim.size() + shard.entries[victim].first.size();
+        shard.entries.erase(victim);
+        shard.lru.pop_back();
+        evicted++;
+    }
+    shard.lru.push_front(key);
+    shard.entries[key] = make_pair(report, shard.lru.begin());
+    shard.bytes += size;
+    pthread_mutex_unlock(&shard.mutex);
+    if (evicted > 0) Metrics::add("report_cache_evictions_total", evicted);
+}
+
+bool ReportCache::findLeaderboard(const string& examName, string& page) {
+    uint32_t examId = Symbols::exams.intern(examName);
+    if (examId == SYMBOL_NONE) return false;
+    pthread_mutex_lock(&leaderboardMutex);
+    auto it = leaderboards.find(examId);
+    bool found = it != leaderboards.end() && it->second.expiresMs > Metrics::nowMs();
+    if (found) page = it->second.page;
+    pthread_mutex_unlock(&leaderboardMutex);
+    Metrics::add(found ? "leaderboard_cache_hits_total" : "leaderboard_cache_misses_total");
+    return found;
+}
+
+void ReportCache::storeLeaderboard(const string& examName, const string& page) {
+    uint32_t examId = Symbols::exams.intern(examName);
+    if (examId == SYMBOL_NONE) return;
+    pthread_mutex_lock(&leaderboardMutex);
+    leaderboards[examId] = Leaderboard{page, Metrics::nowMs() + LEADERBOARD_CACHE_TTL_MS};
+    pthread_mutex_unlock(&leaderboardMutex);
+}
+
+void ReportCache::invalidateLeaderboard(const string& examName) {
+    uint32_t examId = Symbols::exams.find(examName);
+    if (examId == SYMBOL_NONE) return;
+    pthread_mutex_lock(&leaderboardMutex);
+    leaderboards.erase(examId);
+    pthread_mutex_unlock(&leaderboardMutex);
+}
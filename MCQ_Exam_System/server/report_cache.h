@@ -0,0 +1,59 @@
+#ifndef REPORT_CACHE_H
+#define REPORT_CACHE_H
+
+#include <iostream>
+#include <string>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <pthread.h>
+
+#include "symbols.h"
+
+using namespace std;
+
+#define REPORT_CACHE_SHARDS 16
+#define REPORT_CACHE_BYTES (64 * 1024 * 1024)  // across all shards
+#define LEADERBOARD_CACHE_TTL_MS 2000
+
+// Rendered pages for post-exam result browsing, which is mostly the same
+// pages viewed again and again.
+//
+// Reports are rendered parts of an attempt's details that never change once
+// graded, kept in an LRU bounded by bytes and split into shards by key hash
+// so concurrent viewers rarely share a lock. Callers put everything the
+// content depends on into the key.
+//
+// Leaderboard pages change with every submission. The submission queue
+// drops an exam's page once results it graded are on disk; the short TTL
+// covers submissions graded by other shards.
+class ReportCache {
+private:
+    struct Shard {
+        pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+        list<string> lru;  // most recently used first
+        unordered_map<string, pair<string, list<string>::iterator>> entries;
+        size_t bytes = 0;
+    };
+    struct Leaderboard {
+        string page;
+        long long expiresMs;
+    };
+
+    static Shard shards[REPORT_CACHE_SHARDS];
+    static unordered_map<uint32_t, Leaderboard> leaderboards;  // by exam id
+    static pthread_mutex_t leaderboardMutex;
+
+    static Shard& shardOf(const string& key);
+
+public:
+    static void start();
+    static bool findReport(const string& key, string& report);
+    static void storeReport(const string& key, const string& report);
+    static bool findLeaderboard(const string& examName, string& page);
+    static void storeLeaderboard(const string& examName, const string& page);
+    static void invalidateLeaderboard(const string& examName);
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include "response_times.h"
+#include <sstream>
+#include <cmath>
+#include "metrics.h"
+#include "result_store.h"
+#include "replication.h"
+
+vector<ResponseTimes::Exam*> ResponseTimes::exams;
+pthread_mutex_t ResponseTimes::timesMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Seconds under RESPONSE_EXACT_SECONDS get a bucket each; above, each power
+// of two is split into RESPONSE_SUB_BUCKETS by the next three bits
+int ResponseTimes::bucketOf(int seconds) {
+    if (seconds < RESPONSE_EXACT_SECONDS) return max(seconds, 0);
+    int power = 63 - __builtin_clzll(seconds);
+    int bucket = RESPONSE_EXACT_SECONDS + (power - 6) * RESPONSE_SUB_BUCKETS + ((seconds >> (power - 3)) & 7);
+    return min(bucket, RESPONSE_BUCKETS - 1);
+}
+
+int ResponseTimes::bucketStart(int bucket) {
+    if (bucket < RESPONSE_EXACT_SECONDS) return bucket;
+    int group = (bucket - RESPONSE_EXACT_SECONDS) / RESPONSE_SUB_BUCKETS;
+    int sub = (bucket - RESPONSE_EXACT_SECONDS) % RESPONSE_SUB_BUCKETS;
+    return (RESPONSE_SUB_BUCKETS + sub) << (group + 3);
+}
+
+// Smallest time with at least q of the answers at or below its bucket
+int ResponseTimes::quantile(const Sketch& sketch, double q) {
+    uint32_t target = max<uint32_t>(1, ceil(q * sketch.total));
+    uint32_t seen = 0;
+    for (int bucket = 0; bucket < RESPONSE_BUCKETS; ++bucket) {
+        seen += sketch.counts[bucket];
+        if (seen >= target) return bucketStart(bucket);
+    }
+    return bucketStart(RESPONSE_BUCKETS - 1);
+}
+
+// Must be called with timesMutex held
+ResponseTimes::Exam*& ResponseTimes::slot(uint32_t examId) {
+    if (examId >= exams.size()) exams.resize(examId + 1, nullptr);
+    return exams[examId];
+}
+
+string ResponseTimes::flagsPath(const string& examName) {
+    return "../data/results/exam_" + examName + "_flags.txt";
+}
+
+string ResponseTimes::flagLine(const string& studentId, time_t at, const string& kind, const string& detail) {
+    Metrics::add("anomaly_flags_total");
+    return to_string(at) + "|" + studentId + "|" + kind + "|" + detail + "\n";
+}
+
+// Runs on the submission queue worker. marks, answers (-1: not attempted)
+// and times are per question.
+void ResponseTimes::check(const string& studentId, const string& examName, time_t at, const vector<int>& marks,
+                          const vector<int>& answers, const vector<int>& times, vector<AppendOp>& writes) {
+    int fast = 0;
+    ostringstream detail;
+    uint32_t examId = Symbols::exams.intern(examName), student = Symbols::users.intern(studentId);
+    if (examId == SYMBOL_NONE || student == SYMBOL_NONE) return;
+    pthread_mutex_lock(&timesMutex);
+    Exam*& known = slot(examId);
+    if (!known) known = new Exam();
+    Exam& exam = *known;
+    // A student's attempts are graded in order, so an older one is a regrade
+    time_t& last = exam.lastAdded[student];
+    bool add = at > last;
+    if (add) last = at;
+    if (exam.questions.size() < times.size()) exam.questions.resize(times.size());
+    for (size_t q = 0; q < times.size(); ++q) {
+        if (answers[q] == -1) continue;
+        Sketch& sketch = exam.questions[q];
+        if (marks[q] > 0 && sketch.total >= ANOMALY_MIN_SAMPLES) {
+            int low = quantile(sketch, 0.05), median = quantile(sketch, 0.5);
+            if (times[q] < low && times[q] * ANOMALY_FAST_DIVISOR < median) {
+                detail << (fast++ ? ", " : "") << "Q" << q + 1 << " " << times[q] << "s (median " << median << "s)";
+            }
+        }
+        // Checked before it is added, so an attempt is never measured against itself
+        if (!add) continue;
+        sketch.counts[bucketOf(times[q])]++;
+        sketch.total++;
+    }
+    pthread_mutex_unlock(&timesMutex);
+
+    if (fast >= ANOMALY_FAST_MIN) {
+        writes.push_back({flagsPath(examName), flagLine(studentId, at, "FAST_CORRECT", to_string(fast) + " fast correct answers: " + detail.str())});
+        cout << "[!] " << studentId << " flagged on '" << examName << "': " << fast << " implausibly fast correct answers.\n";
+    }
+}
+
+// Called at commit with how many of the answers were given in the exam's
+// final ANOMALY_FINAL_SECONDS
+void ResponseTimes::lateAnswers(const string& studentId, const string& examName, int late, int answered) {
+    if (late < ANOMALY_BURST_MIN || late * ANOMALY_BURST_SHARE < answered) return;
+    string detail = to_string(late) + " of " + to_string(answered) + " answers in the last " + to_string(ANOMALY_FINAL_SECONDS) + " s";
+    vector<AppendOp> writes = {{flagsPath(examName), flagLine(studentId, time(nullptr), "LATE_BURST", detail)}};
+    if (!ResultStore::appendBatch(writes)) {
+        cerr << "[!] Could not record a flag for " << studentId << " on '" << examName << "'.\n";
+        return;
+    }
+    Replicator::ship(writes);
+    cout << "[!] " << studentId << " flagged on '" << examName << "': " << detail << ".\n";
+}
+
+// Count of flags and the most recent ANOMALY_FLAGS_SHOWN, for the
+// instructor summary; empty if the exam has none
+string ResponseTimes::flagSummary(const string& examName) {
+    string content;
+    if (!ResultStore::read(flagsPath(examName), content) || content.empty()) return "";
+    vector<string> lines;
+    istringstream in(content);
+    string line;
+    while (getline(in, line)) {
+        if (!line.empty()) lines.push_back(line);
+    }
+    string out = "  Flagged: " + to_string(lines.size()) + (lines.size() > ANOMALY_FLAGS_SHOWN ? ", latest:\n" : "\n");
+    for (size_t i = lines.size() > ANOMALY_FLAGS_SHOWN ? lines.size() - ANOMALY_FLAGS_SHOWN : 0; i < lines.size(); ++i) {
+        istringstream fields(lines[i]);
+        string at, student, kind, detail;
+        getline(fields, at, '|');
+        getline(fields, student, '|');
+        getline(fields, kind, '|');
+        getline(fields, detail);
+        time_t when = atoll(at.c_str());
+        tm local;
+        localtime_r(&when, &local);
+        char stamp[32];
+        strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M", &local);
+        out += "    " + string(stamp) + " " + student + " " + kind + ": " + detail + "\n";
+    }
+    return out;
+}
+
+// Snapshot section: per exam by name, each question's histogram and each
+// student's latest attempt added, so the checks do not start over cold
+// after a restart
+void ResponseTimes::save(SnapshotWriter& out) {
+    string encoded;
+    SnapshotWriter writer(encoded);
+    uint64_t count = 0;
+    pthread_mutex_lock(&timesMutex);
+    for (uint32_t id = 0; id < exams.size(); ++id) {
+        if (!exams[id]) continue;
+        count++;
+        writer.str(Symbols::exams.name(id));
+        writer.u64(exams[id]->questions.size());
+        for (const Sketch& sketch : exams[id]->questions) {
+            writer.u64(sketch.total);
+            for (uint32_t bucketCount : sketch.counts) writer.i32(bucketCount);
+        }
+        writer.u64(exams[id]->lastAdded.size());
+        for (const auto& student : exams[id]->lastAdded) {
+            writer.str(Symbols::users.name(student.first));
+            writer.u64(student.second);
+        }
+    }
+    pthread_mutex_unlock(&timesMutex);
+    out.u64(count);
+    out.str(encoded);
+}
+
+// Runs at startup, before any grading
+bool ResponseTimes::restore(SnapshotReader& in) {
+    uint64_t count = in.u64();
+    string encoded = in.str();
+    if (!in.ok) return false;
+    SnapshotReader reader(encoded);
+    vector<pair<uint32_t, Exam*>> restored;
+    for (uint64_t i = 0; i < count && reader.ok; ++i) {
+        uint32_t id = Symbols::exams.intern(reader.str());
+        Exam* exam = new Exam();
+        uint64_t questions = reader.u64();
+        for (uint64_t q = 0; q < questions && reader.ok; ++q) {
+            Sketch sketch;
+            sketch.total = reader.u64();
+            for (uint32_t& bucketCount : sketch.counts) bucketCount = reader.i32();
+            exam->questions.push_back(sketch);
+        }
+        uint64_t students = reader.u64();
+        for (uint64_t j = 0; j < students && reader.ok; ++j) {
+            uint32_t student = Symbols::users.intern(reader.str());
+            exam->lastAdded[student] = reader.u64();
+        }
+        restored.push_back(make_pair(id, exam));
+    }
+    if (!reader.done()) {
+        for (auto& known : restored) delete known.second;
+        return false;
+    }
+    pthread_mutex_lock(&timesMutex);
+    for (auto& known : restored) {
+        Exam*& exam = slot(known.first);
+        delete exam;
+        exam = known.second;
+    }
+    pthread_mutex_unlock(&timesMutex);
+    return true;
+}
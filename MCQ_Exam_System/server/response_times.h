@@ -0,0 +1,73 @@
+#ifndef RESPONSE_TIMES_H
+#define RESPONSE_TIMES_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <ctime>
+#include <pthread.h>
+
+#include "snapshot.h"
+#include "symbols.h"
+#include "io_backend.h"
+
+using namespace std;
+
+#define RESPONSE_EXACT_SECONDS 64  // one bucket per second below this
+#define RESPONSE_SUB_BUCKETS 8     // per power of two above it, so within 12.5%
+#define RESPONSE_BUCKETS (RESPONSE_EXACT_SECONDS + 10 * RESPONSE_SUB_BUCKETS)  // up to 18 hours
+
+#define ANOMALY_MIN_SAMPLES 30    // answers a question needs before anyone is judged against it
+#define ANOMALY_FAST_DIVISOR 4    // fast: under the 5th percentile and a quarter of the median
+#define ANOMALY_FAST_MIN 3        // fast correct answers that flag an attempt
+#define ANOMALY_FINAL_SECONDS 30
+#define ANOMALY_BURST_MIN 5       // answers in the final seconds that flag an attempt,
+#define ANOMALY_BURST_SHARE 4     // if also at least a quarter of those given
+#define ANOMALY_FLAGS_SHOWN 10
+
+// Per-question response times of every exam as fixed-size log-bucketed
+// histograms: exact to the second under a minute, within 12.5% above, and
+// RESPONSE_BUCKETS counters per question however many attempts there are.
+// Adding a time is one increment; a quantile is one pass over the buckets.
+//
+// Each graded submission is checked against the times of the attempts
+// before it, then added; one regraded after a restart is only checked, as
+// its times are in already. Attempts that look wrong are appended as
+// "<unix time>|<student>|<kind>|<detail>" lines to the exam's
+// exam_<exam>_flags.txt in ResultStore, which the instructor summary reads:
+//   FAST_CORRECT  several correct answers faster than 95% of all answers
+//                 to the question and under a quarter of its median
+//   LATE_BURST    many answers given in the exam's final seconds
+class ResponseTimes {
+private:
+    struct Sketch {
+        uint32_t total = 0;
+        uint32_t counts[RESPONSE_BUCKETS] = {};
+    };
+    struct Exam {
+        vector<Sketch> questions;
+        unordered_map<uint32_t, time_t> lastAdded;  // by Symbols::users id
+    };
+
+    static vector<Exam*> exams;  // by Symbols::exams id
+    static pthread_mutex_t timesMutex;
+
+    static int bucketOf(int seconds);
+    static int bucketStart(int bucket);
+    static int quantile(const Sketch& sketch, double q);
+    static Exam*& slot(uint32_t examId);
+    static string flagsPath(const string& examName);
+    static string flagLine(const string& studentId, time_t at, const string& kind, const string& detail);
+
+public:
+    static void check(const string& studentId, const string& examName, time_t at, const vector<int>& marks,
+                      const vector<int>& answers, const vector<int>& times, vector<AppendOp>& writes);
+    static void lateAnswers(const string& studentId, const string& examName, int late, int answered);
+    static string flagSummary(const string& examName);
+    static void save(SnapshotWriter& out);
+    static bool restore(SnapshotReader& in);
+};
+
+#endif
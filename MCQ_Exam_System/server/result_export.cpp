@@ -0,0 +1,268 @@
+#include "result_export.h"
+#include "metrics.h"
+#include <charconv>
+
+// Output buffer in front of the sink
+class ExportWriter {
+private:
+    const ResultExport::Sink& sink;
+    string out;
+
+public:
+    bool ok = true;
+    long long bytes = 0;
+
+    ExportWriter(const ResultExport::Sink& sink) : sink(sink) { out.reserve(EXPORT_BUFFER_BYTES + 1024); }
+    void put(const char* data, size_t length) {
+        out.append(data, length);
+        if (out.size() >= EXPORT_BUFFER_BYTES) flush();
+    }
+    void put(const string& value) { put(value.data(), value.size()); }
+    void put(char c) { put(&c, 1); }
+    void number(long long value) {
+        char text[24];
+        put(text, to_chars(text, text + sizeof(text), value).ptr - text);
+    }
+    template <typename T> void raw(T value) { put(reinterpret_cast<const char*>(&value), sizeof(value)); }
+    template <typename T> void column(const vector<T>& values) {
+        put(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+    }
+    void flush() {
+        if (ok && !out.empty()) {
+            ok = sink(out.data(), out.size());
+            bytes += out.size();
+        }
+        out.clear();
+    }
+};
+
+// Rows of the columnar format waiting to be written
+struct ColumnGroup {
+    uint32_t rows = 0, questions = 0;
+    vector<uint32_t> studentEnds, timeEnds;
+    string students, times;
+    vector<int32_t> marks, total, attempted, wrong, timeSpent;
+    vector<vector<int8_t>> questionMarks, questionAnswers;
+    vector<vector<int32_t>> questionTimes;
+
+    void reset(uint32_t count) {
+        rows = 0;
+        questions = count;
+        studentEnds.clear(), timeEnds.clear(), students.clear(), times.clear();
+        marks.clear(), total.clear(), attempted.clear(), wrong.clear(), timeSpent.clear();
+        questionMarks.assign(count, vector<int8_t>());
+        questionAnswers.assign(count, vector<int8_t>());
+        questionTimes.assign(count, vector<int32_t>());
+    }
+
+    void add(const ExportRow& row) {
+        rows++;
+        students += row.student;
+        studentEnds.push_back(students.size());
+        times += row.submittedAt;
+        timeEnds.push_back(times.size());
+        marks.push_back(row.marks);
+        total.push_back(row.total);
+        attempted.push_back(row.attempted);
+        wrong.push_back(row.wrong);
+        timeSpent.push_back(row.timeSpent);
+        for (uint32_t q = 0; q < questions; ++q) {
+            bool present = q < row.questionMarks.size();
+            questionMarks[q].push_back(present ? row.questionMarks[q] : 0);
+            questionAnswers[q].push_back(present ? row.questionAnswers[q] : -1);
+            questionTimes[q].push_back(present ? row.questionTimes[q] : 0);
+        }
+    }
+
+    void write(ExportWriter& out) {
+        if (rows == 0) return;
+        out.raw<uint32_t>(rows);
+        out.raw<uint32_t>(questions);
+        out.column(studentEnds);
+        out.put(students);
+        out.column(timeEnds);
+        out.put(times);
+        out.column(marks);
+        out.column(total);
+        out.column(attempted);
+        out.column(wrong);
+        out.column(timeSpent);
+        for (uint32_t q = 0; q < questions; ++q) {
+            out.column(questionMarks[q]);
+            out.column(questionAnswers[q]);
+            out.column(questionTimes[q]);
+        }
+        reset(questions);
+    }
+};
+
+static const char* parseNumber(const char* p, const char* end, int& value) {
+    bool negative = p < end && *p == '-';
+    if (negative) ++p;
+    value = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) value = value * 10 + (*p - '0');
+    if (negative) value = -value;
+    return p;
+}
+
+// Next '|'-separated field of [p, end); p moves past the separator
+static string nextField(const char*& p, const char* end) {
+    const char* bar = static_cast<const char*>(memchr(p, '|', end - p));
+    const char* stop = bar ? bar : end;
+    string field(p, stop);
+    p = bar ? bar + 1 : end;
+    return field;
+}
+
+static void csvField(ExportWriter& out, const string& value) {
+    if (value.find_first_of(",\"\n") == string::npos) {
+        out.put(value);
+        return;
+    }
+    out.put('"');
+    for (char c : value) {
+        if (c == '"') out.put('"');
+        out.put(c);
+    }
+    out.put('"');
+}
+
+static void csvHeader(ExportWriter& out, int questions) {
+    out.put(string("student,submitted_at,marks,total_marks,questions,attempted,wrong,time_s"));
+    for (int q = 1; q <= questions; ++q) {
+        string n = to_string(q);
+        out.put(",q" + n + "_marks,q" + n + "_answer,q" + n + "_time_s");
+    }
+    out.put('\n');
+}
+
+static void csvRow(ExportWriter& out, const ExportRow& row) {
+    csvField(out, row.student);
+    out.put(',');
+    out.put(row.submittedAt);
+    for (int value : {row.marks, row.total, row.questions, row.attempted, row.wrong, row.timeSpent}) {
+        out.put(',');
+        out.number(value);
+    }
+    for (size_t q = 0; q < row.questionMarks.size(); ++q) {
+        out.put(',');
+        out.number(row.questionMarks[q]);
+        out.put(',');
+        if (row.questionAnswers[q] >= 0) out.put(static_cast<char>('A' + row.questionAnswers[q]));
+        out.put(',');
+        out.number(row.questionTimes[q]);
+    }
+    out.put('\n');
+}
+
+bool ResultExport::formatKnown(const string& format) {
+    return format == "csv" || format == "columnar";
+}
+
+// Every attempt at the exam, in storage order, until visitRow returns false.
+// The row is reused from attempt to attempt, so parsing does not allocate.
+bool ResultExport::forEachAttempt(const string& examName, const function<bool(const ExportRow&)>& visitRow) {
+    const string prefix = "student_", suffix = "_" + examName + "_performance.txt";
+    ExportRow row;
+
+    auto wants = [&](const string& key) {
+        return key.size() > prefix.size() + suffix.size() && key.compare(0, prefix.size(), prefix) == 0 &&
+               key.compare(key.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+
+    // A record holds whole attempts: "START", the summary line, "END", then
+    // one "Q<i>|<marks>|<answer or NA>|<time>s" line per question
+    auto visit = [&](const string& key, const char* data, size_t length) {
+        row.student = key.substr(prefix.size(), key.size() - prefix.size() - suffix.size());
+        const char* p = data;
+        const char* end = data + length;
+        bool keep = false, summaryNext = false;
+        while (p < end) {
+            const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+            const char* lineEnd = newline ? newline : end;
+            size_t n = lineEnd - p;
+            if (n == 5 && memcmp(p, "START", 5) == 0) {
+                if (keep && !visitRow(row)) return false;
+                keep = false;
+                summaryNext = true;
+            } else if (summaryNext) {
+                summaryNext = false;
+                row.submittedAt = nextField(p, lineEnd);
+                // Keys of different exams can collide when names contain '_'
+                keep = nextField(p, lineEnd) == examName;
+                int* fields[] = {&row.marks, &row.total, &row.questions, &row.attempted, &row.wrong, &row.timeSpent};
+                for (int* field : fields) {
+                    p = parseNumber(p, lineEnd, *field);
+                    if (p < lineEnd) ++p;
+                }
+                row.questionMarks.clear();
+                row.questionAnswers.clear();
+                row.questionTimes.clear();
+            } else if (keep && n > 0 && *p == 'Q') {
+                int marks, time;
+                const char* q = static_cast<const char*>(memchr(p, '|', n));
+                if (q) {
+                    q = parseNumber(q + 1, lineEnd, marks) + 1;
+                    int answer = q < lineEnd && *q >= 'A' && *q <= 'Z' && (q + 1 == lineEnd || q[1] == '|') ? *q - 'A' : -1;
+                    const char* bar = q < lineEnd ? static_cast<const char*>(memchr(q, '|', lineEnd - q)) : nullptr;
+                    parseNumber(bar ? bar + 1 : lineEnd, lineEnd, time);
+                    row.questionMarks.push_back(marks);
+                    row.questionAnswers.push_back(answer);
+                    row.questionTimes.push_back(time);
+                }
+            }
+            p = newline ? newline + 1 : end;
+        }
+        return !keep || visitRow(row);
+    };
+
+    return ResultStore::forEach(wants, visit);
+}
+
+bool ResultExport::run(const string& examName, const string& format, int questions, const Sink& sink, ExportReport& report) {
+    long long started = Metrics::nowMs();
+    bool csv = format == "csv";
+    bool headerWritten = false;
+    ExportWriter out(sink);
+    ColumnGroup group;
+    report = ExportReport();
+
+    if (!csv) {
+        out.raw<uint32_t>(EXPORT_COLUMNAR_MAGIC);
+        out.raw<uint32_t>(EXPORT_COLUMNAR_VERSION);
+        out.raw<uint32_t>(examName.size());
+        out.put(examName);
+    }
+
+    auto emit = [&](const ExportRow& row) {
+        report.attempts++;
+        if (csv) {
+            // Without a question count from the catalog the first attempt decides
+            if (!headerWritten) csvHeader(out, questions > 0 ? questions : row.questionMarks.size());
+            headerWritten = true;
+            csvRow(out, row);
+            return out.ok;
+        }
+        uint32_t count = row.questionMarks.size();
+        if (group.rows == EXPORT_GROUP_ROWS || (group.rows > 0 && group.questions != count)) group.write(out);
+        if (group.rows == 0) group.reset(count);
+        group.add(row);
+        return out.ok;
+    };
+
+    bool ok = forEachAttempt(examName, emit);
+    if (csv && !headerWritten) csvHeader(out, max(questions, 0));
+    if (!csv) {
+        group.write(out);
+        out.raw<uint32_t>(0);
+        out.raw<uint32_t>(0);
+        out.raw<uint64_t>(report.attempts);
+    }
+    out.flush();
+
+    report.bytes = out.bytes;
+    report.elapsedMs = Metrics::nowMs() - started;
+    Metrics::add("exports_total");
+    Metrics::add("export_bytes_total", report.bytes);
+    return ok && out.ok;
+}
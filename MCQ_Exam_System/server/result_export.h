@@ -0,0 +1,59 @@
+#ifndef RESULT_EXPORT_H
+#define RESULT_EXPORT_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+
+#include "result_store.h"
+
+using namespace std;
+
+#define EXPORT_BUFFER_BYTES (256 * 1024)
+#define EXPORT_GROUP_ROWS 4096
+#define EXPORT_COLUMNAR_MAGIC 0x5843514du  // "MQCX"
+#define EXPORT_COLUMNAR_VERSION 1
+
+// One attempt with its per-question marks, answers (0 = A, -1 not
+// attempted) and times
+struct ExportRow {
+    string student, submittedAt;
+    int marks = 0, total = 0, questions = 0, attempted = 0, wrong = 0, timeSpent = 0;
+    vector<int> questionMarks, questionAnswers, questionTimes;
+};
+
+struct ExportReport {
+    long long attempts = 0;
+    long long bytes = 0;
+    long long elapsedMs = 0;
+};
+
+// Every attempt at one exam with its per-question marks, answers and times,
+// streamed from the performance records in ResultStore in storage order.
+// Output goes to a sink in EXPORT_BUFFER_BYTES pieces, and the columnar
+// format holds at most EXPORT_GROUP_ROWS rows before writing them out, so
+// memory stays flat however many attempts the exam has.
+//
+// "csv": a header, then one row per attempt: student, submitted_at, marks,
+// total_marks, questions, attempted, wrong, time_s, then q<i>_marks,
+// q<i>_answer (A-D, empty if not attempted), q<i>_time_s per question.
+//
+// "columnar": little-endian binary. A header (magic, version, u32 length and
+// the exam name), then row groups: u32 rows, u32 questions, and the columns
+// in the CSV order, less "questions". String columns are u32 end offsets
+// followed by the bytes; numbers are i32, except per-question marks and
+// answers, which are i8 (answer 0 = A, -1 not attempted). A group header of
+// 0 rows and 0 questions ends the stream, followed by the u64 row count.
+class ResultExport {
+public:
+    typedef function<bool(const char* data, size_t length)> Sink;
+
+    static bool formatKnown(const string& format);
+    static bool forEachAttempt(const string& examName, const function<bool(const ExportRow&)>& visitRow);
+    static bool run(const string& examName, const string& format, int questions, const Sink& sink, ExportReport& report);
+};
+
+#endif
@@ -0,0 +1,879 @@
+#include "result_store.h"
+#include "metrics.h"
+
+#include <fstream>
+#include <set>
+#include <tuple>
+#include <cerrno>
+
+int ResultStore::self = 1;
+bool ResultStore::opened = false;
+ResultStore::Segment* ResultStore::merged = nullptr;
+vector<ResultStore::Segment*> ResultStore::segments;
+ResultStore::Segment* ResultStore::active = nullptr;
+bool ResultStore::appendable = true;
+unordered_map<string, uint64_t> ResultStore::legacy;
+unsigned long long ResultStore::generation = 0;
+map<int, unsigned long long> ResultStore::covered;
+bool ResultStore::legacyAbsorbed = false;
+struct timespec ResultStore::dirStamp = {0, 0};
+pthread_rwlock_t ResultStore::storeLock = PTHREAD_RWLOCK_INITIALIZER;
+pthread_mutex_t ResultStore::appendMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool preadAll(int fd, char* buffer, size_t length, uint64_t offset) {
+    while (length > 0) {
+        ssize_t n = pread(fd, buffer, length, offset);
+        if (n <= 0) return false;
+        buffer += n;
+        length -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n <= 0) return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Write to a temporary file, fsync it and rename it into place
+static bool replaceFile(const string& path, const string& content) {
+    string tmpPath = path + ".tmp";
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) return false;
+    bool ok = writeAll(fd, content.data(), content.size()) && fsync(fd) == 0;
+    close(fd);
+    ok = ok && rename(tmpPath.c_str(), path.c_str()) == 0;
+    if (!ok) unlink(tmpPath.c_str());
+    return ok;
+}
+
+uint64_t ResultStore::hashKey(const string& key) {
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : key) h = (h ^ c) * 1099511628211ULL;
+    return h;
+}
+
+uint32_t ResultStore::checksum(const string& key, const char* data, size_t length) {
+    uint32_t h = 2166136261u;
+    for (unsigned char c : key) h = (h ^ c) * 16777619u;
+    for (size_t i = 0; i < length; ++i) h = (h ^ (unsigned char)data[i]) * 16777619u;
+    return h;
+}
+
+string ResultStore::keyOf(const string& path) {
+    return path.substr(path.rfind('/') + 1);
+}
+
+// Flat .txt files directly in the results directory. Logs, journals,
+// snapshots and the store itself stay ordinary files.
+bool ResultStore::owns(const string& path) {
+    size_t prefix = strlen(RESULTS_DIR);
+    if (path.compare(0, prefix, RESULTS_DIR) != 0) return false;
+    string name = path.substr(prefix);
+    return name.size() > 4 && name.size() < 65536 && name.find('/') == string::npos &&
+           name.compare(name.size() - 4, 4, ".txt") == 0;
+}
+
+string ResultStore::segmentPath(int writer, unsigned long long seq) {
+    return string(RESULT_STORE_DIR) + "seg_" + to_string(writer) + "_" + to_string(seq) + ".dat";
+}
+
+string ResultStore::mergedPath(unsigned long long generation) {
+    return string(RESULT_STORE_DIR) + "merged_" + to_string(generation) + ".dat";
+}
+
+string ResultStore::indexPath(const string& dataPath) {
+    return dataPath.substr(0, dataPath.size() - 4) + ".idx";
+}
+
+// MANIFEST: "generation <g>", "legacy <0|1>", then "covered <writer> <seq>"
+// for every writer whose segments up to seq are in the merged segment.
+bool ResultStore::readManifest(unsigned long long& gen, bool& absorbed, map<int, unsigned long long>& cov) {
+    ifstream file(string(RESULT_STORE_DIR) + "MANIFEST");
+    if (!file.is_open()) return false;
+    string word;
+    gen = 0;
+    absorbed = false;
+    cov.clear();
+    while (file >> word) {
+        if (word == "generation") file >> gen;
+        else if (word == "legacy") file >> absorbed;
+        else if (word == "covered") {
+            int writer;
+            unsigned long long seq;
+            if (file >> writer >> seq) cov[writer] = seq;
+        }
+    }
+    return gen > 0;
+}
+
+bool ResultStore::writeManifest(unsigned long long gen, bool absorbed, const map<int, unsigned long long>& cov) {
+    string content = "generation " + to_string(gen) + "\nlegacy " + (absorbed ? "1" : "0") + "\n";
+    for (const auto& entry : cov) content += "covered " + to_string(entry.first) + " " + to_string(entry.second) + "\n";
+    return replaceFile(string(RESULT_STORE_DIR) + "MANIFEST", content);
+}
+
+// Orders by (hash, key, writer); ties are left to the caller
+int ResultStore::compareEntries(const ResultIndexEntry& a, const char* poolA, const ResultIndexEntry& b, const char* poolB) {
+    if (a.hash != b.hash) return a.hash < b.hash ? -1 : 1;
+    int c = memcmp(poolA + a.keyOffset, poolB + b.keyOffset, min(a.keyLength, b.keyLength));
+    if (c != 0) return c;
+    if (a.keyLength != b.keyLength) return a.keyLength < b.keyLength ? -1 : 1;
+    if (a.writer != b.writer) return a.writer < b.writer ? -1 : 1;
+    return 0;
+}
+
+bool ResultStore::writeIndex(const string& path, vector<ResultIndexEntry>& entries, const string& pool) {
+    const char* keys = pool.data();
+    sort(entries.begin(), entries.end(), [keys](const ResultIndexEntry& a, const ResultIndexEntry& b) {
+        int c = compareEntries(a, keys, b, keys);
+        return c != 0 ? c < 0 : a.dataOffset < b.dataOffset;
+    });
+    ResultIndexHeader header{RESULT_INDEX_MAGIC, 0, entries.size(), pool.size()};
+    string content(reinterpret_cast<const char*>(&header), sizeof(header));
+    content.append(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(ResultIndexEntry));
+    content += pool;
+    return replaceFile(path, content);
+}
+
+bool ResultStore::mapIndex(Segment* segment) {
+    int fd = ::open(indexPath(segment->path).c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    struct stat st, data;
+    void* index = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && fstat(segment->fd, &data) == 0 && (size_t)st.st_size >= sizeof(ResultIndexHeader))
+        index = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (index == MAP_FAILED) return false;
+
+    const ResultIndexHeader* header = static_cast<const ResultIndexHeader*>(index);
+    const ResultIndexEntry* entries = reinterpret_cast<const ResultIndexEntry*>(header + 1);
+    uint64_t room = (st.st_size - sizeof(ResultIndexHeader)) / sizeof(ResultIndexEntry);
+    bool valid = header->magic == RESULT_INDEX_MAGIC && header->count <= room &&
+                 sizeof(ResultIndexHeader) + header->count * sizeof(ResultIndexEntry) + header->poolBytes == (uint64_t)st.st_size;
+    for (uint64_t i = 0; valid && i < header->count; ++i) {
+        valid = entries[i].keyOffset + entries[i].keyLength <= header->poolBytes &&
+                entries[i].dataOffset + entries[i].length <= (uint64_t)data.st_size;
+    }
+    if (!valid) {
+        cerr << "[!] Ignoring corrupt index " << indexPath(segment->path) << "\n";
+        munmap(index, st.st_size);
+        return false;
+    }
+    segment->index = index;
+    segment->indexSize = st.st_size;
+    segment->entries = entries;
+    segment->count = header->count;
+    segment->pool = reinterpret_cast<const char*>(entries + header->count);
+    segment->size = data.st_size;
+    segment->live.clear();
+    return true;
+}
+
+ResultStore::Segment* ResultStore::openSegment(const string& path, int writer, unsigned long long seq, bool create) {
+    int fd = ::open(path.c_str(), create ? O_RDONLY | O_CREAT : O_RDONLY, 0644);
+    if (fd == -1) return nullptr;
+    Segment* segment = new Segment();
+    segment->path = path;
+    segment->fd = fd;
+    segment->writer = writer;
+    segment->seq = seq;
+    return segment;
+}
+
+void ResultStore::closeSegment(Segment* segment) {
+    if (segment->sealed()) munmap(segment->index, segment->indexSize);
+    close(segment->fd);
+    delete segment;
+}
+
+// Index the complete records past what is already indexed. A record that is
+// torn or still being written stops the scan; the next one resumes there.
+void ResultStore::scan(Segment* segment) {
+    struct stat st;
+    if (fstat(segment->fd, &st) == -1 || (uint64_t)st.st_size <= segment->size) return;
+    string tail(st.st_size - segment->size, '\0');
+    if (!preadAll(segment->fd, &tail[0], tail.size(), segment->size)) return;
+
+    size_t pos = 0;
+    while (tail.size() - pos >= sizeof(ResultRecordHeader)) {
+        ResultRecordHeader header;
+        memcpy(&header, tail.data() + pos, sizeof(header));
+        size_t body = (size_t)header.keyLength + header.dataLength;
+        if (header.magic != RESULT_RECORD_MAGIC || tail.size() - pos - sizeof(header) < body) break;
+        string key = tail.substr(pos + sizeof(header), header.keyLength);
+        const char* data = tail.data() + pos + sizeof(header) + header.keyLength;
+        if (checksum(key, data, header.dataLength) != header.checksum) break;
+        segment->live[key].emplace_back(segment->size + pos + sizeof(header) + header.keyLength, header.dataLength);
+        pos += sizeof(header) + body;
+    }
+    segment->size += pos;
+}
+
+// Writes and syncs the index of a segment nothing is appended to any more.
+// Only reads the live map, which only appends change.
+bool ResultStore::writeSealIndex(Segment* segment) {
+    vector<ResultIndexEntry> entries;
+    string pool;
+    for (const auto& key : segment->live) {
+        uint64_t keyOffset = pool.size();
+        uint64_t hash = hashKey(key.first);
+        pool += key.first;
+        for (const auto& extent : key.second) {
+            entries.push_back(ResultIndexEntry{hash, extent.first, extent.second, (uint16_t)segment->writer,
+                                               (uint16_t)key.first.size(), keyOffset});
+        }
+    }
+    return writeIndex(indexPath(segment->path), entries, pool);
+}
+
+bool ResultStore::seal(Segment* segment) {
+    return writeSealIndex(segment) && mapIndex(segment);
+}
+
+// Seal the active segment and start the next one. Called with appendMutex
+// held; the index is written before storeLock is taken, so readers only wait
+// for it to be mapped. If the next segment cannot be created the active one
+// stays as it is.
+bool ResultStore::rotate() {
+    unsigned long long seq = active->seq + 1;
+    Segment* next = openSegment(segmentPath(self, seq), self, seq, true);
+    if (!next) {
+        cerr << "[!] Failed to create " << segmentPath(self, seq) << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    bool indexed = writeSealIndex(active);
+    pthread_rwlock_wrlock(&storeLock);
+    if (!indexed || !mapIndex(active)) cerr << "[!] Failed to seal " << active->path << ", it is rescanned on the next start\n";
+    segments.push_back(next);
+    active = next;
+    pthread_rwlock_unlock(&storeLock);
+    Metrics::add("results_segments_sealed_total");
+    return true;
+}
+
+void ResultStore::findEntries(const Segment* segment, const string& key, uint64_t hash, vector<Extent>& out,
+                              unsigned long long rank) {
+    if (!segment->sealed()) {
+        auto it = segment->live.find(key);
+        if (it == segment->live.end()) return;
+        for (const auto& extent : it->second)
+            out.push_back(Extent{segment->writer, rank, extent.first, extent.second, const_cast<Segment*>(segment)});
+        return;
+    }
+    const ResultIndexEntry* end = segment->entries + segment->count;
+    const ResultIndexEntry* it = lower_bound(segment->entries, end, hash,
+                                             [](const ResultIndexEntry& e, uint64_t h) { return e.hash < h; });
+    for (; it != end && it->hash == hash; ++it) {
+        if (it->keyLength == key.size() && memcmp(segment->pool + it->keyOffset, key.data(), key.size()) == 0)
+            out.push_back(Extent{it->writer, rank, it->dataOffset, it->length, const_cast<Segment*>(segment)});
+    }
+}
+
+// All extents of a key in content order. Called with storeLock held.
+void ResultStore::lookup(const string& key, vector<Extent>& extents) {
+    uint64_t hash = hashKey(key);
+    auto it = legacy.find(key);
+    if (it != legacy.end()) extents.push_back(Extent{0, 0, 0, it->second, nullptr});
+    if (merged) findEntries(merged, key, hash, extents, 1);
+    for (Segment* segment : segments) findEntries(segment, key, hash, extents, 2 + segment->seq);
+    sort(extents.begin(), extents.end(), [](const Extent& a, const Extent& b) {
+        if (a.writer != b.writer) return a.writer < b.writer;
+        if (a.rank != b.rank) return a.rank < b.rank;
+        return a.offset < b.offset;
+    });
+}
+
+// Bring the segment list in line with the directory: a new MANIFEST and
+// merged segment, peer segments that were created or sealed, and files a
+// compaction removed. Called with storeLock held for writing.
+void ResultStore::relist() {
+    unsigned long long gen;
+    bool absorbed;
+    map<int, unsigned long long> cov;
+    if (readManifest(gen, absorbed, cov) && gen != generation) {
+        Segment* next = openSegment(mergedPath(gen), 0, gen, false);
+        if (next && mapIndex(next)) {
+            if (merged) closeSegment(merged);
+            merged = next;
+            generation = gen;
+            covered = cov;
+            legacyAbsorbed = absorbed;
+            if (absorbed) legacy.clear();
+            segments.erase(remove_if(segments.begin(), segments.end(), [](Segment* segment) {
+                auto it = covered.find(segment->writer);
+                bool gone = segment != active && it != covered.end() && segment->seq <= it->second;
+                if (gone) closeSegment(segment);
+                return gone;
+            }), segments.end());
+        } else if (next) {
+            closeSegment(next);
+        }
+    }
+
+    DIR* dir = opendir(RESULT_STORE_DIR);
+    if (!dir) return;
+    set<string> present;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        int writer;
+        unsigned long long seq;
+        char suffix[8];
+        if (sscanf(entry->d_name, "seg_%d_%llu.%7s", &writer, &seq, suffix) != 3 || strcmp(suffix, "dat") != 0) continue;
+        string path = string(RESULT_STORE_DIR) + entry->d_name;
+        present.insert(path);
+        auto it = covered.find(writer);
+        if (it != covered.end() && seq <= it->second) continue;
+
+        auto known = find_if(segments.begin(), segments.end(), [&path](Segment* s) { return s->path == path; });
+        if (known != segments.end()) {
+            // A peer sealed it: switch from the scanned records to its index
+            if (!(*known)->sealed() && writer != self) mapIndex(*known);
+            continue;
+        }
+        Segment* segment = openSegment(path, writer, seq, false);
+        if (!segment) continue;
+        if (!mapIndex(segment)) scan(segment);
+        segments.push_back(segment);
+    }
+    closedir(dir);
+
+    segments.erase(remove_if(segments.begin(), segments.end(), [&present](Segment* segment) {
+        bool gone = segment != active && !present.count(segment->path);
+        if (gone) closeSegment(segment);
+        return gone;
+    }), segments.end());
+}
+
+// Catch up with other processes before a read. Nearly always two stats.
+void ResultStore::sync() {
+    if (!opened) return;
+    struct stat st;
+    bool changed = stat(RESULT_STORE_DIR, &st) == 0 &&
+                   (st.st_mtim.tv_sec != dirStamp.tv_sec || st.st_mtim.tv_nsec != dirStamp.tv_nsec);
+    bool grown = false;
+    pthread_rwlock_rdlock(&storeLock);
+    for (Segment* segment : segments) {
+        struct stat seg;
+        if (segment == active || segment->sealed()) continue;
+        if (fstat(segment->fd, &seg) == 0 && (uint64_t)seg.st_size > segment->size) grown = true;
+    }
+    pthread_rwlock_unlock(&storeLock);
+    if (!changed && !grown) return;
+
+    pthread_rwlock_wrlock(&storeLock);
+    if (changed) {
+        dirStamp = st.st_mtim;
+        relist();
+    }
+    for (Segment* segment : segments) {
+        if (segment != active && !segment->sealed()) scan(segment);
+    }
+    pthread_rwlock_unlock(&storeLock);
+}
+
+bool ResultStore::open(int writer) {
+    if (opened) return true;
+    self = writer;
+    mkdir(RESULTS_DIR, 0755);
+    mkdir(RESULT_STORE_DIR, 0755);
+
+    // Only the process holding the compaction lock may delete leftovers
+    int lockFd = ::open((string(RESULT_STORE_DIR) + "compact.lock").c_str(), O_RDWR | O_CREAT, 0644);
+    bool exclusive = lockFd != -1 && flock(lockFd, LOCK_EX | LOCK_NB) == 0;
+
+    pthread_rwlock_wrlock(&storeLock);
+    struct stat st;
+    if (stat(RESULT_STORE_DIR, &st) == 0) dirStamp = st.st_mtim;
+    relist();
+
+    // Our segments from the previous run, except the last one, are sealed
+    // already; the last one gets its index now and we start a new one
+    unsigned long long lastSeq = covered.count(self) ? covered[self] : 0;
+    for (Segment* segment : segments) {
+        if (segment->writer != self || self == 0) continue;
+        lastSeq = max(lastSeq, segment->seq);
+        if (!segment->sealed() && !seal(segment)) cerr << "[!] Failed to seal " << segment->path << "\n";
+    }
+    if (self > 0) active = openSegment(segmentPath(self, lastSeq + 1), self, lastSeq + 1, true);
+    if (active) segments.push_back(active);
+    exclusive = exclusive && self > 0;
+
+    DIR* dir = opendir(RESULTS_DIR);
+    struct dirent* entry;
+    while (dir && (entry = readdir(dir)) != nullptr) {
+        string path = string(RESULTS_DIR) + entry->d_name;
+        if (!owns(path) || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        // Left behind by a compaction that absorbed them and stopped before deleting
+        if (legacyAbsorbed) {
+            if (exclusive) unlink(path.c_str());
+            continue;
+        }
+        legacy[entry->d_name] = st.st_size;
+    }
+    if (dir) closedir(dir);
+
+    if (exclusive && (dir = opendir(RESULT_STORE_DIR)) != nullptr) {
+        while ((entry = readdir(dir)) != nullptr) {
+            string name = entry->d_name;
+            int segWriter;
+            unsigned long long seq;
+            char suffix[8];
+            bool stale = name.size() > 4 && name.compare(name.size() - 4, 4, ".tmp") == 0;
+            if (sscanf(name.c_str(), "merged_%llu.%7s", &seq, suffix) == 2) stale = stale || seq != generation;
+            if (sscanf(name.c_str(), "seg_%d_%llu.%7s", &segWriter, &seq, suffix) == 3) {
+                auto it = covered.find(segWriter);
+                stale = stale || (it != covered.end() && seq <= it->second);
+            }
+            if (stale) unlink((string(RESULT_STORE_DIR) + name).c_str());
+        }
+        closedir(dir);
+    }
+    size_t segmentCount = segments.size(), legacyCount = legacy.size();
+    pthread_rwlock_unlock(&storeLock);
+    if (lockFd != -1) close(lockFd);
+
+    if (!active && self > 0) {
+        cerr << "[!] Failed to open a result segment in " << RESULT_STORE_DIR << "\n";
+        return false;
+    }
+    opened = true;
+    if (self == 0) return true;
+    cout << "[+] Result store: " << segmentCount << " segments, merged generation " << generation
+         << ", " << legacyCount << " pre-store files." << endl;
+
+    Metrics::addCollector([]() {
+        pthread_rwlock_rdlock(&storeLock);
+        Metrics::set("results_segments", segments.size());
+        Metrics::set("results_legacy_files", legacy.size());
+        Metrics::set("results_merged_generation", generation);
+        pthread_rwlock_unlock(&storeLock);
+    });
+
+    pthread_t thread;
+    pthread_create(&thread, nullptr, compactor, nullptr);
+    pthread_detach(thread);
+    return true;
+}
+
+// Result files go to the active segment as one write. Anything else is
+// refused up front: it could never be written, and failing the batch for it
+// after the records went in would make every retry append them again.
+bool ResultStore::appendBatch(const vector<AppendOp>& ops) {
+    string batch;
+    vector<tuple<string, uint64_t, uint32_t>> added;  // key, offset in the batch, length
+    for (const AppendOp& op : ops) {
+        if (!owns(op.path)) {
+            cerr << "[!] Not a result file, dropping the write to " << op.path << "\n";
+            continue;
+        }
+        string key = keyOf(op.path);
+        ResultRecordHeader header{RESULT_RECORD_MAGIC, (uint16_t)self, (uint16_t)key.size(), (uint32_t)op.data.size(),
+                                  checksum(key, op.data.data(), op.data.size())};
+        batch.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        batch += key;
+        added.emplace_back(key, batch.size(), op.data.size());
+        batch += op.data;
+    }
+    if (batch.empty()) return true;
+    if (!opened || !active) {
+        cerr << "[!] Result store is not open for writing, dropping " << added.size() << " result writes\n";
+        return false;
+    }
+
+    pthread_mutex_lock(&appendMutex);
+    // After a write that could not be undone nothing goes into that segment
+    // again; appends are refused until the next one can be created
+    if (!appendable && !(appendable = rotate())) {
+        pthread_mutex_unlock(&appendMutex);
+        cerr << "[!] No writable result segment, refusing " << added.size() << " result writes\n";
+        return false;
+    }
+    uint64_t base = active->size;
+    bool written = IoBackend::get()->appendBatch({AppendOp{active->path, batch}});
+    if (written) {
+        pthread_rwlock_wrlock(&storeLock);
+        for (const auto& record : added) active->live[get<0>(record)].emplace_back(base + get<1>(record), get<2>(record));
+        active->size += batch.size();
+        pthread_rwlock_unlock(&storeLock);
+        if (active->size >= RESULT_SEGMENT_BYTES) rotate();
+    } else if (truncate(active->path.c_str(), base) != 0) {
+        // Part of a record may be left behind, and offsets past it would be wrong
+        cerr << "[!] Failed to undo a partial write to " << active->path << ": " << strerror(errno) << "\n";
+        appendable = rotate();
+    }
+    pthread_mutex_unlock(&appendMutex);
+
+    if (written) Metrics::add("results_appended_bytes_total", batch.size());
+    return written;
+}
+
+// `length` bytes of an extent, starting `skip` bytes into it. Called with
+// storeLock held.
+bool ResultStore::readExtent(const Extent& extent, const string& key, uint64_t skip, uint64_t length, char* out) {
+    if (extent.segment) return preadAll(extent.segment->fd, out, length, extent.offset + skip);
+    int fd = ::open((RESULTS_DIR + key).c_str(), O_RDONLY);
+    bool ok = fd != -1 && preadAll(fd, out, length, skip);
+    if (fd != -1) close(fd);
+    return ok;
+}
+
+// Appends the content of a result file from `offset` on to `content`.
+// False if it has never been written.
+bool ResultStore::read(const string& path, string& content, uint64_t offset) {
+    string key = keyOf(path);
+    size_t start = content.size();
+    bool ok = false, found = false;
+    // A compaction in another process may delete a pre-store file between
+    // sync() and the read; the second try sees its MANIFEST
+    for (int attempt = 0; attempt < 2 && !ok; ++attempt) {
+        content.resize(start);
+        sync();
+        vector<Extent> extents;
+        pthread_rwlock_rdlock(&storeLock);
+        lookup(key, extents);
+        found = !extents.empty();
+        ok = true;
+        uint64_t position = 0;
+        for (const Extent& extent : extents) {
+            uint64_t from = max(position, offset), end = position + extent.length;
+            position = end;
+            if (!ok || end <= from) continue;
+            size_t at = content.size();
+            content.resize(at + (end - from));
+            ok = readExtent(extent, key, from - (end - extent.length), end - from, &content[at]);
+        }
+        pthread_rwlock_unlock(&storeLock);
+    }
+    if (!ok) {
+        cerr << "[!] Failed to read result " << key << "\n";
+        content.resize(start);
+    }
+    return ok && found;
+}
+
+// Like read() from an offset, but the offset is per writer: each writer's
+// part of a key only grows, even through compaction, so this stays a tail
+// read when several processes append to the key. Appends the new bytes in
+// writer order and moves the offsets past them.
+bool ResultStore::readNew(const string& path, map<int, uint64_t>& offsets, string& content) {
+    string key = keyOf(path);
+    size_t start = content.size();
+    map<int, uint64_t> reached;
+    bool ok = false, found = false;
+    for (int attempt = 0; attempt < 2 && !ok; ++attempt) {
+        content.resize(start);
+        reached.clear();
+        sync();
+        vector<Extent> extents;
+        pthread_rwlock_rdlock(&storeLock);
+        lookup(key, extents);
+        found = !extents.empty();
+        ok = true;
+        for (const Extent& extent : extents) {
+            uint64_t& position = reached[extent.writer];
+            auto known = offsets.find(extent.writer);
+            uint64_t from = max(position, known == offsets.end() ? 0 : known->second), end = position + extent.length;
+            position = end;
+            if (!ok || end <= from) continue;
+            size_t at = content.size();
+            content.resize(at + (end - from));
+            ok = readExtent(extent, key, from - (end - extent.length), end - from, &content[at]);
+        }
+        pthread_rwlock_unlock(&storeLock);
+    }
+    if (!ok) {
+        cerr << "[!] Failed to read result " << key << "\n";
+        content.resize(start);
+        return false;
+    }
+    for (const auto& writer : reached) offsets[writer.first] = max(offsets[writer.first], writer.second);
+    return found;
+}
+
+// Visits every record of the keys `wants` accepts in storage order: the
+// pre-store files, then the merged segment, then each writer's segments.
+// Segment files are read sequentially through one RESULT_SCAN_BUFFER_BYTES
+// buffer, so memory does not grow with the store; only a record larger than
+// that is read on its own. Descriptors are duplicated up front, so a
+// compaction finishing meanwhile does not pull files out from under the scan.
+bool ResultStore::forEach(const function<bool(const string& key)>& wants,
+                          const function<bool(const string& key, const char* data, size_t length)>& visit) {
+    struct Source {
+        int fd;
+        uint64_t size;
+    };
+    vector<Source> sources;
+    vector<string> legacyKeys;
+    sync();
+    pthread_rwlock_rdlock(&storeLock);
+    for (const auto& file : legacy) {
+        if (wants(file.first)) legacyKeys.push_back(file.first);
+    }
+    if (merged) sources.push_back(Source{dup(merged->fd), merged->size});
+    vector<Segment*> ordered(segments);
+    sort(ordered.begin(), ordered.end(), [](const Segment* a, const Segment* b) {
+        return a->writer != b->writer ? a->writer < b->writer : a->seq < b->seq;
+    });
+    for (Segment* segment : ordered) sources.push_back(Source{dup(segment->fd), segment->size});
+    pthread_rwlock_unlock(&storeLock);
+
+    bool ok = true;
+    string content;
+    for (const string& key : legacyKeys) {
+        content.clear();
+        int fd = ::open((RESULTS_DIR + key).c_str(), O_RDONLY);
+        struct stat st;
+        if (fd != -1 && fstat(fd, &st) == 0) {
+            content.resize(st.st_size);
+            content.resize(preadAll(fd, &content[0], content.size(), 0) ? content.size() : 0);
+        }
+        if (fd != -1) close(fd);
+        if (ok && !content.empty()) ok = visit(key, content.data(), content.size());
+    }
+
+    string buffer(RESULT_SCAN_BUFFER_BYTES, '\0');
+    for (const Source& source : sources) {
+        uint64_t pos = 0;
+        while (ok && source.fd != -1 && pos < source.size) {
+            size_t filled = min<uint64_t>(buffer.size(), source.size - pos);
+            if (!preadAll(source.fd, &buffer[0], filled, pos)) break;
+            size_t at = 0;
+            while (ok && filled - at >= sizeof(ResultRecordHeader)) {
+                ResultRecordHeader header;
+                memcpy(&header, buffer.data() + at, sizeof(header));
+                size_t record = sizeof(header) + header.keyLength + header.dataLength;
+                if (header.magic != RESULT_RECORD_MAGIC) {
+                    cerr << "[!] Stopping the scan of a segment at a bad record\n";
+                    pos = source.size;
+                    at = 0;
+                    break;
+                }
+                if (record > filled - at && at > 0) break;  // refill from here
+                if (record > filled - at) {
+                    // Bigger than the buffer
+                    string large(record - sizeof(header), '\0');
+                    if (!preadAll(source.fd, &large[0], large.size(), pos + sizeof(header))) break;
+                    string key = large.substr(0, header.keyLength);
+                    if (wants(key)) ok = visit(key, large.data() + header.keyLength, header.dataLength);
+                    at = record;
+                    break;
+                }
+                string key(buffer.data() + at + sizeof(header), header.keyLength);
+                if (wants(key)) ok = visit(key, buffer.data() + at + sizeof(header) + header.keyLength, header.dataLength);
+                at += record;
+            }
+            if (at == 0) break;  // a partial header at the end
+            pos += at;
+        }
+    }
+    for (const Source& source : sources) {
+        if (source.fd != -1) close(source.fd);
+    }
+    return ok;
+}
+
+// Merge the previous merged segment, every sealed segment and the pre-store
+// files into the next generation. Runs in whichever process gets the lock.
+bool ResultStore::compact() {
+    int lockFd = ::open((string(RESULT_STORE_DIR) + "compact.lock").c_str(), O_RDWR | O_CREAT, 0644);
+    if (lockFd == -1) return false;
+    if (flock(lockFd, LOCK_EX | LOCK_NB) == -1) {
+        close(lockFd);
+        return false;
+    }
+    sync();
+
+    struct Source {
+        const ResultIndexEntry* entries;
+        uint64_t count;
+        const char* pool;
+        int fd;  // -1 for pre-store files
+        unsigned long long rank;
+        uint64_t pos = 0;
+    };
+    vector<Source> sources;
+    vector<string> inputs;
+    vector<ResultIndexEntry> legacyEntries;
+    string legacyPool;
+    map<int, unsigned long long> nextCovered;
+    uint64_t sealedBytes = 0, mergedBytes = 0;
+    unsigned long long gen;
+
+    // Sealed segments and the merged one are immutable and only unmapped by
+    // relist(), which needs the compaction lock to see a new generation, so
+    // they are read below without holding storeLock
+    pthread_rwlock_rdlock(&storeLock);
+    gen = generation;
+    nextCovered = covered;
+    bool absorbed = legacyAbsorbed || !legacy.empty();
+    size_t legacyFiles = legacy.size();
+    // Index lengths are 32 bit, so a large file becomes several entries
+    for (const auto& file : legacy) {
+        uint64_t at = 0;
+        do {
+            uint32_t length = min<uint64_t>(file.second - at, RESULT_MERGED_RECORD_BYTES);
+            legacyEntries.push_back(ResultIndexEntry{hashKey(file.first), at, length, 0, (uint16_t)file.first.size(),
+                                                     legacyPool.size()});
+            at += length;
+        } while (at < file.second);
+        legacyPool += file.first;
+    }
+    if (merged) {
+        sources.push_back(Source{merged->entries, merged->count, merged->pool, merged->fd, 1});
+        mergedBytes = merged->size;
+    }
+    // A writer's segments are covered up to a seq, so stop below the first
+    // one that is not sealed (its active one, or one whose seal failed)
+    map<int, unsigned long long> firstOpen;
+    for (Segment* segment : segments) {
+        if (segment->sealed()) continue;
+        auto it = firstOpen.find(segment->writer);
+        if (it == firstOpen.end() || segment->seq < it->second) firstOpen[segment->writer] = segment->seq;
+    }
+    for (Segment* segment : segments) {
+        auto open = firstOpen.find(segment->writer);
+        if (!segment->sealed() || (open != firstOpen.end() && segment->seq > open->second)) continue;
+        sources.push_back(Source{segment->entries, segment->count, segment->pool, segment->fd, 2 + segment->seq});
+        inputs.push_back(segment->path);
+        sealedBytes += segment->size;
+        nextCovered[segment->writer] = max(nextCovered[segment->writer], segment->seq);
+    }
+    pthread_rwlock_unlock(&storeLock);
+
+    if (legacyEntries.empty() && (inputs.empty() || sealedBytes < max<uint64_t>(RESULT_COMPACT_MIN_BYTES, mergedBytes / 2))) {
+        close(lockFd);
+        return false;
+    }
+    long long started = Metrics::nowMs();
+    const char* keys = legacyPool.data();
+    sort(legacyEntries.begin(), legacyEntries.end(), [keys](const ResultIndexEntry& a, const ResultIndexEntry& b) {
+        int c = compareEntries(a, keys, b, keys);
+        return c != 0 ? c < 0 : a.dataOffset < b.dataOffset;
+    });
+    sources.push_back(Source{legacyEntries.data(), legacyEntries.size(), legacyPool.data(), -1, 0});
+
+    string outPath = mergedPath(gen + 1), tmpPath = outPath + ".tmp";
+    int outFd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = outFd != -1;
+    vector<ResultIndexEntry> outEntries;
+    string outPool, out, groupKey, groupData;
+    uint64_t outSize = 0, groupHash = 0;
+    int groupWriter = -1;
+    bool groupWritten = false;
+
+    // Each (key, writer) group is written as it is read, in records of at
+    // most RESULT_MERGED_RECORD_BYTES with its extents in content order, so
+    // neither memory nor a record's 32 bit length limits how large it gets
+    auto flush = [&]() {
+        if (groupWriter == -1 || (groupData.empty() && groupWritten)) return;
+        ResultRecordHeader header{RESULT_RECORD_MAGIC, (uint16_t)groupWriter, (uint16_t)groupKey.size(),
+                                  (uint32_t)groupData.size(), checksum(groupKey, groupData.data(), groupData.size())};
+        out.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        out += groupKey;
+        outEntries.push_back(ResultIndexEntry{groupHash, outSize + sizeof(header) + groupKey.size(), (uint32_t)groupData.size(),
+                                              (uint16_t)groupWriter, (uint16_t)groupKey.size(), outPool.size()});
+        outPool += groupKey;
+        out += groupData;
+        outSize += sizeof(header) + groupKey.size() + groupData.size();
+        groupData.clear();
+        groupWritten = true;
+        if (out.size() >= (1 << 20)) {
+            ok = ok && writeAll(outFd, out.data(), out.size());
+            out.clear();
+        }
+    };
+
+    while (ok) {
+        int best = -1;
+        for (size_t i = 0; i < sources.size(); ++i) {
+            if (sources[i].pos == sources[i].count) continue;
+            if (best == -1) {
+                best = i;
+                continue;
+            }
+            const Source& a = sources[i];
+            const Source& b = sources[best];
+            int c = compareEntries(a.entries[a.pos], a.pool, b.entries[b.pos], b.pool);
+            if (c < 0 || (c == 0 && (a.rank < b.rank || (a.rank == b.rank && a.entries[a.pos].dataOffset < b.entries[b.pos].dataOffset))))
+                best = i;
+        }
+        if (best == -1) break;
+        Source& source = sources[best];
+        const ResultIndexEntry& entry = source.entries[source.pos++];
+        string key(source.pool + entry.keyOffset, entry.keyLength);
+        if (key != groupKey || entry.writer != groupWriter) {
+            flush();
+            groupKey = key;
+            groupHash = entry.hash;
+            groupWriter = entry.writer;
+            groupWritten = false;
+        }
+        int fd = source.fd != -1 ? source.fd : ::open((RESULTS_DIR + key).c_str(), O_RDONLY);
+        ok = fd != -1;
+        for (uint64_t copied = 0; ok && copied < entry.length;) {
+            if (groupData.size() == RESULT_MERGED_RECORD_BYTES) flush();
+            size_t at = groupData.size(), take = min<uint64_t>(entry.length - copied, RESULT_MERGED_RECORD_BYTES - at);
+            groupData.resize(at + take);
+            ok = preadAll(fd, &groupData[at], take, entry.dataOffset + copied);
+            copied += take;
+        }
+        if (source.fd == -1 && fd != -1) close(fd);
+    }
+    flush();
+    if (outFd != -1) {
+        ok = ok && writeAll(outFd, out.data(), out.size()) && fsync(outFd) == 0;
+        close(outFd);
+    }
+    ok = ok && rename(tmpPath.c_str(), outPath.c_str()) == 0 && writeIndex(indexPath(outPath), outEntries, outPool);
+    // The MANIFEST rename is the commit point
+    ok = ok && writeManifest(gen + 1, absorbed, nextCovered);
+    if (!ok) {
+        cerr << "[!] Compaction of the result store failed, keeping generation " << gen << "\n";
+        unlink(tmpPath.c_str());
+        unlink(outPath.c_str());
+        unlink(indexPath(outPath).c_str());
+        close(lockFd);
+        return false;
+    }
+
+    pthread_rwlock_wrlock(&storeLock);
+    relist();
+    bool switched = generation == gen + 1;
+    pthread_rwlock_unlock(&storeLock);
+    // Not switched: the new generation is picked up (and the inputs deleted)
+    // on the next start
+    if (switched) {
+        for (const string& path : inputs) {
+            unlink(path.c_str());
+            unlink(indexPath(path).c_str());
+        }
+        if (gen > 0) {
+            unlink(mergedPath(gen).c_str());
+            unlink(indexPath(mergedPath(gen)).c_str());
+        }
+        for (const ResultIndexEntry& entry : legacyEntries)
+            unlink((RESULTS_DIR + string(legacyPool.data() + entry.keyOffset, entry.keyLength)).c_str());
+    }
+    close(lockFd);
+
+    Metrics::add("results_compactions_total");
+    Metrics::set("results_merged_bytes", outSize);
+    cout << "[+] Compacted " << inputs.size() << " segments and " << legacyFiles << " pre-store files into "
+         << outPath << " (" << outSize / 1024 << " KB) in " << Metrics::nowMs() - started << " ms." << endl;
+    return true;
+}
+
+void* ResultStore::compactor(void*) {
+    while (true) {
+        usleep(RESULT_COMPACT_CHECK_MS * 1000);
+        compact();
+    }
+    return nullptr;
+}
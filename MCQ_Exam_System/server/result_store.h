@@ -0,0 +1,156 @@
+#ifndef RESULT_STORE_H
+#define RESULT_STORE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "io_backend.h"
+
+using namespace std;
+
+#define RESULTS_DIR "../data/results/"
+#define RESULT_STORE_DIR "../data/results/store/"
+#define RESULT_SEGMENT_BYTES (16 * 1024 * 1024)
+#define RESULT_COMPACT_MIN_BYTES (4 * RESULT_SEGMENT_BYTES)
+#define RESULT_COMPACT_CHECK_MS 10000
+#define RESULT_SCAN_BUFFER_BYTES (1024 * 1024)
+#define RESULT_MERGED_RECORD_BYTES RESULT_SEGMENT_BYTES  // larger (key, writer) groups take several records
+#define RESULT_RECORD_MAGIC 0x43455252u  // "RREC"
+#define RESULT_INDEX_MAGIC 0x58444952u   // "RIDX"
+
+// A segment is a sequence of records: this header, the key, then the data.
+struct ResultRecordHeader {
+    uint32_t magic;
+    uint16_t writer;
+    uint16_t keyLength;
+    uint32_t dataLength;
+    uint32_t checksum;  // of key and data
+};
+
+// Index of a sealed segment: a header, `count` entries sorted by (hash, key,
+// writer, offset), then the key bytes the entries point into.
+struct ResultIndexHeader {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t poolBytes;
+};
+
+struct ResultIndexEntry {
+    uint64_t hash;
+    uint64_t dataOffset;
+    uint32_t length;
+    uint16_t writer;
+    uint16_t keyLength;
+    uint64_t keyOffset;
+};
+
+// Result "files" (leaderboards, attempt lists, performance reports, the exam
+// log) kept as records in a few large segment files instead of one small
+// file each. Callers still name them by their old path under RESULTS_DIR;
+// the file name is the key, and a key's content is all of its records
+// concatenated, so it only ever grows.
+//
+// Every server process (writer: shard + 1) appends to its own active
+// segment, seg_<writer>_<seq>.dat, and seals it with a sorted index
+// (.idx, mmapped for lookups) once it reaches RESULT_SEGMENT_BYTES. Other
+// processes tail active segments they do not own. A background compactor
+// (one process at a time) merges the previous merged segment, all sealed
+// segments and any pre-store result files into merged_<generation>.dat,
+// with each key's data from each writer in as few records as possible
+// (RESULT_MERGED_RECORD_BYTES at most), and commits it by renaming
+// MANIFEST. Only that commit takes the write lock, so reads go on during
+// compaction; the inputs are deleted afterwards.
+//
+// Content from different writers is ordered by writer, so a key written by
+// several shards (a student's attempt list) groups each shard's appends.
+class ResultStore {
+private:
+    struct Segment {
+        string path;
+        int fd = -1;
+        int writer = 0;               // 0 for the merged segment
+        unsigned long long seq = 0;   // the generation for the merged segment
+        uint64_t size = 0;            // bytes indexed so far
+        void* index = MAP_FAILED;     // sealed: the mmapped index
+        size_t indexSize = 0;
+        const ResultIndexEntry* entries = nullptr;
+        uint64_t count = 0;
+        const char* pool = nullptr;
+        unordered_map<string, vector<pair<uint64_t, uint32_t>>> live;  // not sealed yet
+        bool sealed() const { return index != MAP_FAILED; }
+    };
+
+    struct Extent {
+        int writer;
+        unsigned long long rank;  // 0 a pre-store file, 1 the merged segment, 2 + seq a segment
+        uint64_t offset;
+        uint64_t length;
+        Segment* segment;         // null for a pre-store file
+    };
+
+    static int self;
+    static bool opened;
+    static Segment* merged;
+    static vector<Segment*> segments;
+    static Segment* active;
+    static bool appendable;  // false after a partial write to active
+    static unordered_map<string, uint64_t> legacy;  // pre-store result files and their sizes
+    static unsigned long long generation;
+    static map<int, unsigned long long> covered;     // per writer, the last seq in the merged segment
+    static bool legacyAbsorbed;
+    static struct timespec dirStamp;
+    static pthread_rwlock_t storeLock;
+    static pthread_mutex_t appendMutex;
+
+    static uint64_t hashKey(const string& key);
+    static uint32_t checksum(const string& key, const char* data, size_t length);
+    static string keyOf(const string& path);
+    static string segmentPath(int writer, unsigned long long seq);
+    static string mergedPath(unsigned long long generation);
+    static string indexPath(const string& dataPath);
+    static bool readManifest(unsigned long long& generation, bool& legacyAbsorbed, map<int, unsigned long long>& covered);
+    static bool writeManifest(unsigned long long generation, bool legacyAbsorbed, const map<int, unsigned long long>& covered);
+    static bool writeIndex(const string& path, vector<ResultIndexEntry>& entries, const string& pool);
+    static bool mapIndex(Segment* segment);
+    static int compareEntries(const ResultIndexEntry& a, const char* poolA, const ResultIndexEntry& b, const char* poolB);
+    static Segment* openSegment(const string& path, int writer, unsigned long long seq, bool create);
+    static void closeSegment(Segment* segment);
+    static void scan(Segment* segment);
+    static bool writeSealIndex(Segment* segment);
+    static bool seal(Segment* segment);
+    static bool rotate();
+    static void findEntries(const Segment* segment, const string& key, uint64_t hash, vector<Extent>& out, unsigned long long rank);
+    static void lookup(const string& key, vector<Extent>& extents);
+    static bool readExtent(const Extent& extent, const string& key, uint64_t skip, uint64_t length, char* out);
+    static void relist();
+    static void sync();
+    static bool compact();
+    static void* compactor(void* arg);
+
+public:
+    // writer 0 opens the store read-only
+    static bool open(int writer);
+    static bool owns(const string& path);
+    static bool appendBatch(const vector<AppendOp>& ops);
+    static bool read(const string& path, string& content, uint64_t offset = 0);
+    static bool readNew(const string& path, map<int, uint64_t>& offsets, string& content);
+    static bool forEach(const function<bool(const string& key)>& wants,
+                        const function<bool(const string& key, const char* data, size_t length)>& visit);
+};
+
+#endif
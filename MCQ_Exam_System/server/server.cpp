@@ -1,17 +1,37 @@
 #include "server.h"
 #include <cctype>
+#include <csignal>
 #define INT_MIN -1000
 
 static vector<string> exams;
-map<int, string> Server::socketToUsername;
+atomic<uint32_t>* Server::socketUsers = nullptr;
+size_t Server::socketUserSlots = 0;
+map<int, bool> Server::socketCompression;
+pthread_mutex_t Server::connMutex = PTHREAD_MUTEX_INITIALIZER;
+long long Server::studentsOnline = 0;
+TimerWheel Server::timers;
+map<int, pair<unsigned long long, unsigned long long>> Server::idleTimers;
+unsigned long long Server::idleToken = 0;
+unordered_map<uint64_t, ExamSession> Server::examSessions;
+pthread_mutex_t Server::sessionMutex = PTHREAD_MUTEX_INITIALIZER;
+time_t Server::examListMtime = 0;
+off_t Server::examListSize = 0;
+pthread_mutex_t Server::examsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+Server::Server(int port, const string& ioBackend, int shard, int shards) : ioBackend(ioBackend), shard(shard), shards(shards) {
 
-Server::Server(int port) {
     server_socket = socket(AF_INET, SOCK_STREAM, 0);
     if (server_socket == -1) {
         cerr << "Error: Could not create server socket\n";
         exit(EXIT_FAILURE);
     }
 
+    // Allow an immediate restart while old connections sit in TIME_WAIT
+    int reuse = 1;
+    setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    // Shard processes each bind the port and the kernel spreads connections over them
+    if (shards > 1) setsockopt(server_socket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+
     sockaddr_in server_addr{};
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
@@ -22,39 +42,522 @@ Server::Server(int port) {
         exit(EXIT_FAILURE);
     }
 
-    if (listen(server_socket, 5) == -1) {
+    if (listen(server_socket, SOMAXCONN) == -1) {
         cerr << "Error: Could not listen for connections\n";
         exit(EXIT_FAILURE);
     }
-    cout << "[+] Server started on port " << port << endl;
+    // Descriptors stay below the limit, so the table never grows under readers
+    rlimit files{};
+    getrlimit(RLIMIT_NOFILE, &files);
+    socketUserSlots = files.rlim_cur == RLIM_INFINITY ? 1 << 20 : min<rlim_t>(files.rlim_cur, 1 << 20);
+    socketUsers = new atomic<uint32_t>[socketUserSlots];
+    for (size_t i = 0; i < socketUserSlots; ++i) socketUsers[i].store(SYMBOL_NONE, memory_order_relaxed);
+    if (shards > 1)
+        cout << "[+] Shard " << shard << "/" << shards << " started on port " << port << endl;
+    else
+        cout << "[+] Server started on port " << port << endl;
 }
 
 void Server::start() {
+    signal(SIGPIPE, SIG_IGN);  // a client vanishing mid-send must not kill the server
     AuthManager();
-    ExamManager em;
-    exams = em.load_exam_metadata("../data/exams/exam_list.txt");
+    ResultStore::open(shard + 1);
+    if (shards > 1) Snapshot::configure("../data/results/state_" + to_string(shard) + ".snap");
+    addSnapshotSections();
+    Snapshot::load();
+    listExams();
+    ShardRouter::configure(shard, shards);
+    if (shards > 1) {
+        SubmissionQueue::configure("../data/results/submissions_" + to_string(shard) + ".log", shard, shards);
+        ShardRouter::listen(handleShardMessage);
+    }
+    // Recovery rewrites the submission log, so it must run before the I/O
+    // backend opens its fixed files
+    if (!SubmissionQueue::recover()) exit(EXIT_FAILURE);
+    if (shard == 0) AttemptIndex::backfill();
+    IoBackend::select(ioBackend);
+    SubmissionQueue::start(gradeSubmission);
+    timers.start();
+    Metrics::addCollector([]() { Metrics::set("send_timeouts_total", Wire::sendTimeouts); });
+    ReportCache::start();
+    configureLiveMonitor();
+    recoverSessions();
+    Snapshot::start(SNAPSHOT_INTERVAL_MS);
     while (true) {
         int client_socket = accept(server_socket, nullptr, nullptr);
+        if (client_socket == -1) continue;
+        if (!RateLimiter::allowConnection(peerAddress(client_socket))) {
+            close(client_socket);
+            continue;
+        }
+        // Writes to a client that stopped reading block, then give up
+        int sendBuffer = SEND_BUFFER_BYTES;
+        timeval sendTimeout{SEND_TIMEOUT_MS / 1000, (SEND_TIMEOUT_MS % 1000) * 1000};
+        setsockopt(client_socket, SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+        setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+        TrafficCapture::opened(client_socket);
+        // Each thread gets its own copy; a shared stack slot is overwritten by the next accept
         pthread_t thread;
-        pthread_create(&thread, nullptr, handle_client, &client_socket);
+        pthread_create(&thread, nullptr, handle_client, new int(client_socket));
         pthread_detach(thread);
     }
 }
 
-void Server::receiveStudentAnswers(int sock, const string& examName) {
-    char buffer[256] = {0};
-    int bytesReceived = recv(sock, buffer, sizeof(buffer), 0);
-    if (bytesReceived <= 0) {
-        cerr << "Error: Failed to receive answers from client.\n";
-        return;
+// Every connection has an idle timer; when it fires the socket is shut
+// down, which wakes the handler thread blocked in recv so it can clean up.
+void Server::touchConnection(int sock, long long timeoutMs) {
+    pthread_mutex_lock(&connMutex);
+    auto it = idleTimers.find(sock);
+    if (it != idleTimers.end()) timers.cancel(it->second.first);
+    unsigned long long token = ++idleToken;
+    unsigned long long timerId = timers.schedule(timeoutMs, [sock, token] { expireConnection(sock, token); });
+    idleTimers[sock] = make_pair(timerId, token);
+    pthread_mutex_unlock(&connMutex);
+}
+
+string Server::peerAddress(int sock) {
+    sockaddr_in peer{};
+    socklen_t length = sizeof(peer);
+    char address[INET_ADDRSTRLEN] = "unknown";
+    if (getpeername(sock, (sockaddr*)&peer, &length) == 0) inet_ntop(AF_INET, &peer.sin_addr, address, sizeof(address));
+    return address;
+}
+
+// Paces the logged in user's requests to RATE_REQUEST_PER_SEC. False if
+// they are so far over it that the connection should be dropped.
+bool Server::throttle(int sock) {
+    long long delayMs = RateLimiter::requestDelayMs(userOf(sock));
+    if (delayMs > RATE_MAX_DELAY_MS) {
+        cerr << "[!] " << username(sock) << " is flooding requests, closing the connection.\n";
+        return false;
+    }
+    if (delayMs > 0) usleep(delayMs * 1000);
+    return true;
+}
+
+void Server::stopIdleTimer(int sock) {
+    pthread_mutex_lock(&connMutex);
+    auto it = idleTimers.find(sock);
+    if (it != idleTimers.end()) {
+        timers.cancel(it->second.first);
+        idleTimers.erase(it);
+    }
+    pthread_mutex_unlock(&connMutex);
+}
+
+void Server::expireConnection(int sock, unsigned long long token) {
+    // The token guards against the fd having been closed and reused meanwhile
+    pthread_mutex_lock(&connMutex);
+    auto it = idleTimers.find(sock);
+    if (it != idleTimers.end() && it->second.second == token) {
+        idleTimers.erase(it);
+        shutdown(sock, SHUT_RDWR);
+        Metrics::add("connections_expired_total");
+        cout << "[!] Closing idle connection " << sock << endl;
+    }
+    pthread_mutex_unlock(&connMutex);
+}
+
+// Instructors may upload through any shard, so the list is reloaded
+// whenever exam_list.txt changes. Callers get a snapshot.
+vector<string> Server::listExams() {
+    struct stat st{};
+    stat("../data/exams/exam_list.txt", &st);
+    pthread_mutex_lock(&examsMutex);
+    // The list is append-only, so the size changes even within one mtime second
+    if (st.st_mtime != examListMtime || st.st_size != examListSize || exams.empty()) {
+        ExamManager em;
+        exams = em.load_exam_metadata("../data/exams/exam_list.txt");
+        examListMtime = st.st_mtime;
+        examListSize = st.st_size;
+    }
+    vector<string> snapshot = exams;
+    pthread_mutex_unlock(&examsMutex);
+    return snapshot;
+}
+
+// Catalog entries of the exams (all of them if `instructor` is empty). The
+// entries point into `exams`, which must outlive the catalog.
+void Server::examCatalog(const vector<string>& exams, const string& instructor, ExamCatalog& catalog) {
+    catalog.exams.clear();
+    for (const string& exam : exams) {
+        ExamEntry entry;
+        size_t start = 0;
+        while (start < exam.size()) {
+            size_t end = exam.find('\n', start);
+            if (end == string::npos) end = exam.size();
+            string_view line(exam.data() + start, end - start);
+            size_t colon = line.find(": ");
+            if (colon != string_view::npos) {
+                string_view key = line.substr(0, colon), value = line.substr(colon + 2);
+                if (key == "Exam Name") entry.name = value;
+                else if (key == "Duration (minutes)") entry.durationMinutes = atoi(string(value).c_str());
+                else if (key == "Total Questions") entry.questions = atoi(string(value).c_str());
+                else if (key == "Instructor") entry.instructor = value;
+            }
+            start = end + 1;
+        }
+        if (instructor.empty() || entry.instructor == instructor) catalog.exams.push_back(entry);
+    }
+}
+
+int Server::examDurationSeconds(const string& examName) {
+    for (const auto& exam : listExams()) {
+        if (exam.find("Exam Name: " + examName + "\n") == string::npos) continue;
+        size_t pos = exam.find("Duration (minutes):");
+        if (pos != string::npos) return atoi(exam.c_str() + pos + 19) * 60;
+    }
+    return 3 * 60 * 60;  // unknown exam: generous upper bound
+}
+
+void Server::beginSession(int sock, const string& studentId, const string& examName, time_t startedAt) {
+    uint64_t key = sessionKey(Symbols::users.intern(studentId), Symbols::exams.intern(examName));
+    pthread_mutex_lock(&sessionMutex);
+    auto it = examSessions.find(key);
+    if (it != examSessions.end()) {
+        it->second.sock = sock;  // resumed
+    } else {
+        time_t deadline = startedAt + examDurationSeconds(examName) + SESSION_GRACE_SECONDS;
+        time_t remaining = max<time_t>(0, deadline - time(nullptr));
+        unsigned long long timerId = timers.schedule(remaining * 1000ULL, [key] { expireSession(key); });
+        examSessions[key] = ExamSession{sock, deadline, timerId, false, 0, {}};
+    }
+    pthread_mutex_unlock(&sessionMutex);
+}
+
+// claim=true marks the session as being submitted (false if the deadline got
+// there first); claim=false hands it back after a failed submission.
+bool Server::claimSession(uint64_t key, bool claim) {
+    pthread_mutex_lock(&sessionMutex);
+    auto it = examSessions.find(key);
+    bool claimed = it != examSessions.end() && it->second.submitted != claim;
+    if (claimed) it->second.submitted = claim;
+    pthread_mutex_unlock(&sessionMutex);
+    return claimed;
+}
+
+// Called when the connection leaves the exam, submitted or not. Returns the
+// receipt if the deadline submitted it while connected.
+unsigned long long Server::releaseSession(uint64_t key) {
+    unsigned long long receipt = 0;
+    pthread_mutex_lock(&sessionMutex);
+    auto it = examSessions.find(key);
+    if (it != examSessions.end()) {
+        if (it->second.submitted) {
+            receipt = it->second.receipt;
+            timers.cancel(it->second.timerId);
+            examSessions.erase(it);
+        } else {
+            it->second.sock = -1;  // deadline still applies
+        }
     }
-    string data(buffer);
-    if (data.substr(0, 7) != "ANSWERS") {
-        cerr << "Invalid data received format.\n";
+    pthread_mutex_unlock(&sessionMutex);
+    return receipt;
+}
+
+void Server::expireSession(uint64_t key) {
+    pthread_mutex_lock(&sessionMutex);
+    auto it = examSessions.find(key);
+    if (it == examSessions.end() || it->second.submitted || time(nullptr) < it->second.deadline) {
+        pthread_mutex_unlock(&sessionMutex);
         return;
     }
+    it->second.submitted = true;
+    // The connection may leave and drop the session while this submits
+    map<int, time_t> answeredAt = it->second.answeredAt;
+    time_t deadline = it->second.deadline;
+    pthread_mutex_unlock(&sessionMutex);
+
+    const string& studentId = Symbols::users.name(key >> 32);
+    const string& examName = Symbols::exams.name(key & 0xffffffffu);
+    map<int, AnswerEvent> state;
+    unsigned long long receipt = submitFromJournal(studentId, examName, state);
+    if (receipt) flagLateAnswers(answeredAt, deadline, studentId, examName, state);
+    cout << "[!] Time is up for " << studentId << " on '" << examName << "', auto-submitted #" << receipt << ".\n";
+
+    pthread_mutex_lock(&sessionMutex);
+    it = examSessions.find(key);
+    if (it != examSessions.end()) {
+        if (it->second.sock != -1) {
+            // Still connected: the connection's thread stops reading, sends
+            // the receipt and ends the exam. Only that thread writes to it.
+            it->second.receipt = receipt;
+            shutdown(it->second.sock, SHUT_RD);
+        } else {
+            examSessions.erase(it);
+        }
+    }
+    pthread_mutex_unlock(&sessionMutex);
+}
+
+unsigned long long Server::submitFromJournal(const string& studentId, const string& examName, map<int, AnswerEvent>& state) {
+    SessionJournal::replay(studentId, examName, state);
+    unsigned long long receipt = SubmissionQueue::enqueue(studentId, examName, state);
+    if (receipt) {
+        unlink(SessionJournal::pathFor(studentId, examName).c_str());
+        Replicator::remove(SessionJournal::pathFor(studentId, examName));
+    }
+    return receipt;
+}
+
+void Server::noteAnswer(uint64_t key, int question) {
+    time_t now = time(nullptr);
+    pthread_mutex_lock(&sessionMutex);
+    auto it = examSessions.find(key);
+    if (it != examSessions.end()) it->second.answeredAt[question] = now;
+    pthread_mutex_unlock(&sessionMutex);
+}
+
+// The session's answer times and its deadline (0 if it has none)
+time_t Server::answerTimes(uint64_t key, map<int, time_t>& answeredAt) {
+    time_t deadline = 0;
+    pthread_mutex_lock(&sessionMutex);
+    auto it = examSessions.find(key);
+    if (it != examSessions.end()) {
+        answeredAt = it->second.answeredAt;
+        deadline = it->second.deadline;
+    }
+    pthread_mutex_unlock(&sessionMutex);
+    return deadline;
+}
+
+// Called once the session is submitted, by COMMIT or by the deadline, with
+// the answers that went in
+void Server::flagLateAnswers(const map<int, time_t>& answeredAt, time_t deadline, const string& studentId,
+                             const string& examName, const map<int, AnswerEvent>& state) {
+    time_t finalSeconds = deadline - SESSION_GRACE_SECONDS - ANOMALY_FINAL_SECONDS;
+    int late = 0, answered = 0;
+    for (auto& entry : state) {
+        if (entry.second.option == -1) continue;
+        answered++;
+        auto at = answeredAt.find(entry.first);
+        if (at != answeredAt.end() && at->second >= finalSeconds) late++;
+    }
+    ResponseTimes::lateAnswers(studentId, examName, late, answered);
+}
 
-    string studentId = socketToUsername[sock];
+// The catalog is only valid for the exam_list.txt it was read from;
+// listExams() re-reads it if the file has changed since.
+void Server::addSnapshotSections() {
+    Snapshot::addSection(SNAPSHOT_CATALOG, "catalog", [](SnapshotWriter& out) {
+        pthread_mutex_lock(&examsMutex);
+        out.u64(examListMtime);
+        out.u64(examListSize);
+        out.u64(exams.size());
+        for (const string& exam : exams) out.str(exam);
+        pthread_mutex_unlock(&examsMutex);
+    }, [](SnapshotReader& in) {
+        time_t mtime = in.u64();
+        off_t size = in.u64();
+        uint64_t count = in.u64();
+        vector<string> restored;
+        for (uint64_t i = 0; i < count && in.ok; ++i) restored.push_back(in.str());
+        if (!in.ok) return false;
+        pthread_mutex_lock(&examsMutex);
+        exams.swap(restored);
+        examListMtime = mtime;
+        examListSize = size;
+        pthread_mutex_unlock(&examsMutex);
+        return true;
+    });
+    Snapshot::addSection(SNAPSHOT_EXAM_STATS, "exam_stats", ExamStats::save, ExamStats::restore);
+    Snapshot::addSection(SNAPSHOT_STUDENT_PROGRESS, "student_progress", StudentProgress::save, StudentProgress::restore);
+    Snapshot::addSection(SNAPSHOT_RESPONSE_TIMES, "response_times", ResponseTimes::save, ResponseTimes::restore);
+}
+
+// Exams that were in progress when the server stopped keep their original
+// deadline; the ones already past it are submitted right away.
+void Server::recoverSessions() {
+    for (const string& path : SessionJournal::list()) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) continue;
+        string studentId, examName;
+        time_t startedAt;
+        bool valid = SessionJournal::readHeader(fd, studentId, examName, startedAt);
+        close(fd);
+        // Each shard resumes only the exams it owns
+        if (valid && ShardRouter::owns(examName)) beginSession(-1, studentId, examName, startedAt);
+    }
+}
+
+// Streams "EVENT <question>,<option>,<seconds>" lines into the session journal
+// until "COMMIT". An unfinished session is resumed from its journal.
+void Server::receiveStudentAnswers(int sock, const string& examName) {
+    const string& studentId = username(sock);
+    uint64_t key = sessionKey(Symbols::users.intern(studentId), Symbols::exams.intern(examName));
+
+    SessionJournal journal;
+    if (!journal.open(studentId, examName))
+        cerr << "Error: Unable to open session journal for " << studentId << ".\n";
+
+    map<int, AnswerEvent> state;
+    SessionJournal::replay(studentId, examName, state);
+
+    string resume;
+    for (auto& entry : state) {
+        const AnswerEvent& e = entry.second;
+        resume += to_string(e.question) + "," + to_string(e.option) + "," + to_string(e.timeSpent) + "\n";
+    }
+    if (!Wire::sendFrame(sock, resume, compressionEnabled(sock))) return;
+    if (!state.empty())
+        cout << "[+] Resuming " << studentId << " on '" << examName << "' with " << state.size() << " saved answers.\n";
+
+    // The exam deadline replaces the idle timeout while the session runs
+    stopIdleTimer(sock);
+    time_t startedAt = journal.started() ? journal.started() : time(nullptr);
+    beginSession(sock, studentId, examName, startedAt);
+
+    string line;
+    bool finished = false;
+    while (!finished && Wire::recvLine(sock, line)) {
+        if (line.rfind("EVENT ", 0) == 0) {
+            AnswerEvent e;
+            char delim;
+            istringstream eventStream(line.substr(6));
+            if (!(eventStream >> e.question >> delim >> e.option >> delim >> e.timeSpent)) continue;
+            // The client sends its answer to a question on every move away from it
+            auto known = state.find(e.question);
+            if (known == state.end() || known->second.option != e.option) noteAnswer(key, e.question);
+            state[e.question] = e;
+            journal.append(e);
+        } else if (line == "COMMIT") {
+            // Already submitted, by the deadline timer or another connection of this student
+            if (!claimSession(key, true)) {
+                Wire::sendAll(sock, "Error: This exam has already been submitted.\n");
+                finished = true;
+                continue;
+            }
+
+            // Acknowledge as soon as the submission is durable; grading runs on the queue worker
+            unsigned long long receipt = SubmissionQueue::enqueue(studentId, examName, state);
+            if (receipt == 0) {
+                claimSession(key, false);
+                Wire::sendAll(sock, "Error: Submission could not be recorded, please submit again.\n");
+                continue;
+            }
+            journal.discard();
+            Wire::sendAll(sock, "RECEIPT " + to_string(receipt) + "\n");
+            map<int, time_t> answeredAt;
+            time_t deadline = answerTimes(key, answeredAt);
+            flagLateAnswers(answeredAt, deadline, studentId, examName, state);
+            cout << "[+] Submission #" << receipt << " queued for " << studentId << " on '" << examName << "'.\n";
+            finished = true;
+        }
+    }
+    unsigned long long receipt = releaseSession(key);
+    if (receipt)
+        Wire::sendAll(sock, "RECEIPT " + to_string(receipt) + "\n");
+    else if (!finished)
+        cerr << "[!] " << studentId << " left '" << examName << "' without committing.\n";
+    touchConnection(sock);
+}
+
+// Another student's receipt is as unknown as one never handed out
+string Server::submissionStatus(unsigned long long receipt, const string& studentId) {
+    SubmissionStatus status;
+    if (!SubmissionQueue::status(receipt, status) || status.studentId != studentId) return "UNKNOWN\n";
+    if (!status.graded) return "PENDING\n";
+    return "GRADED " + to_string(status.marks) + " " + to_string(status.totalMarks) + "\n";
+}
+
+// "RESULT <receipt>" -> "PENDING", "GRADED <marks> <total>" or "UNKNOWN".
+// Receipts are numbered per shard, so another shard's are looked up there.
+void Server::sendSubmissionStatus(int sock, const string& request) {
+    unsigned long long receipt = strtoull(request.c_str() + 7, nullptr, 10);
+    int owner = receipt % ShardRouter::shards();
+    string studentId = username(sock);
+    string reply;
+    if (owner == ShardRouter::shard())
+        reply = submissionStatus(receipt, studentId);
+    else if (!ShardRouter::forward(owner, "RESULT " + to_string(receipt) + "|" + studentId, reply))
+        reply = "PENDING\n";  // owner is restarting, the client polls again
+    Wire::sendAll(sock, reply);
+}
+
+// Passes the client connection to the shard owning examName. The owner sends
+// the paper and runs the exam; this process must not touch the socket again.
+// The message carrying the fd stays queued for the owner's listener after we
+// give up waiting, so once it is sent the connection is the owner's even
+// without a reply. It only stays here if it never reached the owner, or the
+// owner answered that it did not take it.
+bool Server::handOff(int sock, const string& examName, const string& cachedVersion) {
+    int owner = ShardRouter::ownerOf(examName);
+    string message = "HANDOFF " + string(compressionEnabled(sock) ? "1" : "0") + "|" + cachedVersion + "|" +
+                     username(sock) + "|" + examName;
+    string reply;
+    bool sent;
+    bool answered = ShardRouter::forward(owner, message, reply, sock, &sent);
+    if (!sent || (answered && reply != "OK")) {
+        cerr << "[!] Shard " << owner << " did not take over '" << examName << "', serving it here.\n";
+        return false;
+    }
+    if (!answered)
+        cerr << "[!] Shard " << owner << " has not answered the hand-off of " << username(sock) << ", leaving it the connection.\n";
+    else
+        cout << "[>] " << username(sock) << " handed off to shard " << owner << " for '" << examName << "'.\n";
+    return true;
+}
+
+// "HANDOFF <compression>|<paper version>|<student>|<exam>" with the client fd,
+// or "RESULT <receipt>|<student>".
+string Server::handleShardMessage(const string& message, int passedFd) {
+    if (message.rfind("HANDOFF ", 0) == 0 && passedFd != -1) {
+        istringstream iss(message.substr(8));
+        string compression;
+        HandedOffClient* client = new HandedOffClient{passedFd, "", "", "", false};
+        getline(iss, compression, '|');
+        getline(iss, client->cachedVersion, '|');
+        getline(iss, client->username, '|');
+        getline(iss, client->examName);
+        client->compression = compression == "1";
+
+        pthread_t thread;
+        pthread_create(&thread, nullptr, handle_handed_off, client);
+        pthread_detach(thread);
+        return "OK";
+    }
+    if (passedFd != -1) close(passedFd);
+    if (message.rfind("RESULT ", 0) == 0) {
+        size_t bar = message.find('|');
+        if (bar == string::npos) return "UNKNOWN\n";
+        return submissionStatus(strtoull(message.c_str() + 7, nullptr, 10), message.substr(bar + 1));
+    }
+    if (message == "LIVE") return LiveMonitor::localState();
+    return "ERROR";
+}
+
+void* Server::handle_handed_off(void* arg) {
+    HandedOffClient* client = (HandedOffClient*)arg;
+    int sock = client->sock;
+    string username = client->username;
+    TrafficCapture::opened(sock);
+    if (!bindUser(sock, username)) {
+        cerr << "[!] User table is full, dropping handed-off " << username << ".\n";
+        delete client;
+        closeConnection(sock, username, false);
+        return nullptr;
+    }
+    pthread_mutex_lock(&connMutex);
+    socketCompression[sock] = client->compression;
+    pthread_mutex_unlock(&connMutex);
+    touchConnection(sock);
+
+    studentOnline(1);
+    ExamManager exam_manager;
+    serveExam(sock, exam_manager, client->examName, client->cachedVersion);
+    delete client;
+
+    bool handedOff = serveStudent(sock, username);
+    studentOnline(-1);
+    closeConnection(sock, username, handedOff);
+    return nullptr;
+}
+
+// Runs on the submission queue worker, one submission at a time.
+bool Server::gradeSubmission(const Submission& submission, SubmissionStatus& status, vector<AppendOp>& writes) {
+    const string& studentId = submission.studentId;
+    const string& examName = submission.examName;
+    const map<int, AnswerEvent>& answers = submission.answers;
 
     // Load correct answers
     string answerFile = "../data/exams/answers_" + examName + ".txt";
@@ -69,8 +572,6 @@ void Server::receiveStudentAnswers(int sock, const string& examName) {
     }
     answerIn.close();
 
-    istringstream dataStream(data.substr(8));
-    string entry;
     int totalQuestions = correctAnswers.size();
     vector<int> perQuestionMarks(totalQuestions, 0);
     vector<int> perQuestionTime(totalQuestions, 0);
@@ -79,11 +580,10 @@ void Server::receiveStudentAnswers(int sock, const string& examName) {
     int attemptedCount = 0, wrongCount = 0;
     const int positiveMark = 4, negativeMark = -1;
 
-while (getline(dataStream, entry)) {
-    int qIdx, answer, timeSpent;
-    char delim;
-    istringstream entryStream(entry);
-    entryStream >> qIdx >> delim >> answer >> delim >> timeSpent;
+for (auto& entry : answers) {
+    int qIdx = entry.second.question, answer = entry.second.option, timeSpent = entry.second.timeSpent;
+    if (qIdx < 0 || qIdx >= totalQuestions) continue;
+    if (answer < -1 || answer > 3) answer = -1;
     int marks = 0;
     if (answer != -1) {
         attemptedCount++;
@@ -104,27 +604,28 @@ while (getline(dataStream, entry)) {
 }
 
 
-    string currDateTime = getCurrentDateTime();
+    string currDateTime = formatDateTime(submission.submittedAt);
     // Leaderboard file
     string leaderboardFile = "../data/results/exam_" + examName + "_leaderboard.txt";
-    ofstream leaderboardOut(leaderboardFile, ios::app);
+    ostringstream leaderboardOut;
     leaderboardOut << studentId << " " << totalMarks << " "
                    << attemptedCount << " " << wrongCount << " "
                    << totalTimeSpent << "\n";
-    leaderboardOut.close();
+    writes.push_back({leaderboardFile, leaderboardOut.str()});
 
     // Student performance file (append for multiple attempts)
     string perfFile = "../data/results/student_" + studentId + "_attempts.txt";
-    ofstream perfOut(perfFile, ios::app);
+    ostringstream perfOut;
     perfOut << examName << "|";
     perfOut << currDateTime << "|";
     perfOut << totalMarks << "|";
     perfOut << totalQuestions*4 << "|";
-    perfOut << "../data/results/student_"+studentId+"_"+examName+"_performance.txt\n";
-    perfOut.close();
+    perfOut << "../data/results/student_"+studentId+"_"+examName+"_performance.txt|";
+    perfOut << totalTimeSpent << "|" << attemptedCount << "\n";
+    writes.push_back({perfFile, perfOut.str()});
 
     string scoreFile = "../data/results/student_"+studentId+"_"+examName+"_performance.txt";
-    ofstream scoreOut(scoreFile, ios::app);
+    ostringstream scoreOut;
     scoreOut << "START\n";
     scoreOut << currDateTime << "|";
     scoreOut << examName + "|";
@@ -143,159 +644,374 @@ while (getline(dataStream, entry)) {
         }
         scoreOut << perQuestionTime[i] << "s\n";
     }
-    scoreOut.close();
+    writes.push_back({scoreFile, scoreOut.str()});
 
     // Student attempt history
-    string attemptFile = "../data/results/exam_log.txt";
-    ofstream attemptOut(attemptFile, ios::app);
-    attemptOut <<studentId<<": " <<examName << ": " << getCurrentDateTime() << "\n";
-    attemptOut.close();
+    writes.push_back({EXAM_LOG_FILE, studentId + ": " + examName + ": " + currDateTime + "\n"});
+    AttemptIndex::record(studentId, examName, submission.submittedAt, totalMarks, totalQuestions * 4, writes);
+    ResponseTimes::check(studentId, examName, submission.submittedAt, perQuestionMarks, perQuestionAnswer, perQuestionTime, writes);
 
     cout << "[✔] Evaluation complete for " << studentId << " on '" << examName << "'.\n";
+    LiveMonitor::recordGraded(examName, totalMarks, perQuestionAnswer);
+    status.marks = totalMarks;
+    status.totalMarks = totalQuestions * 4;
+    return totalQuestions > 0;
+}
+
+// Score summary of every exam the instructor uploaded, from the aggregates
+// ExamStats keeps current; no result file is rescanned.
+string Server::instructorSummary(const string& instructor) {
+    ostringstream out;
+    out << fixed << setprecision(1);
+    out << "\n========== Student Performance ==========\n";
+    bool any = false;
+    for (const auto& exam : listExams()) {
+        if (exam.find("Instructor: " + instructor + "\n") == string::npos) continue;
+        size_t pos = exam.find("Exam Name: ");
+        if (pos == string::npos) continue;
+        string examName = exam.substr(pos + 11, exam.find('\n', pos) - pos - 11);
+        any = true;
+
+        out << "\n" << examName << "\n";
+        ExamSummary summary;
+        if (!ExamStats::summary(examName, summary)) {
+            out << "  No attempts yet.\n";
+            continue;
+        }
+        out << ResponseTimes::flagSummary(examName);
+        out << "  Attempts: " << summary.attempts << " by " << summary.students << " students\n";
+        out << "  Mean " << summary.mean << " | Min " << summary.min << " | P25 " << summary.p25
+            << " | Median " << summary.median << " | P75 " << summary.p75 << " | P90 " << summary.p90
+            << " | Max " << summary.max << "\n";
+        out << ExamStats::chart(examName, false);
+
+        vector<LeaderboardEntry> leaders = ExamStats::top(examName, 3);
+        out << "  Top: ";
+        for (size_t i = 0; i < leaders.size(); ++i)
+            out << (i ? ", " : "") << Symbols::users.name(leaders[i].student) << " (" << leaders[i].marks << ")";
+        out << "\n";
+    }
+    if (!any) out << "\nNo exams uploaded yet.\n";
+    return out.str();
 }
 
 string Server::getCurrentDateTime() {
-    time_t now = time(nullptr);
-    tm* localTime = localtime(&now);
+    return formatDateTime(time(nullptr));
+}
+
+string Server::formatDateTime(time_t when) {
+    tm localTime;
+    localtime_r(&when, &localTime);
 
     ostringstream oss;
-    oss << put_time(localTime, "%Y-%m-%d %H:%M:%S");
+    oss << put_time(&localTime, "%Y-%m-%d %H:%M:%S");
     return oss.str();
 }
 
-void Server::handleStudentExamRequest(int sock, ExamManager exam) {
-    char buffer[1024] = {0};
-    int bytesReceived = recv(sock, buffer, sizeof(buffer), 0);
-    if (bytesReceived <= 0) {
+// Returns false once the connection has been handed to another shard.
+bool Server::handleStudentExamRequest(int sock, const ExamCatalog& catalog) {
+    string buffer;
+    ExamSelection selection;
+    if (!recvMessage(sock, buffer, selection)) {
         cerr << "Error: Failed to receive exam selection from client.\n";
-        return;
+        return true;
     }
 
-    int examNumber = atoi(buffer);
-
-    if(examNumber==0) return;
+    if (selection.number == 0) return true;
 
-    
-    // Validate exam number
-    if (examNumber < 1 || examNumber > exams.size()) {
-        string errorMsg = "Error: Invalid exam selection";
-        send(sock, errorMsg.c_str(), errorMsg.size(), 0);
-        return;
+    // Validate against the catalog the student was shown
+    if (selection.number > catalog.exams.size()) {
+        string errorMsg = "Error: Invalid exam selection\n";
+        Wire::sendAll(sock, errorMsg);
+        return true;
     }
+    string selectedExamName(catalog.exams[selection.number - 1].name);
+    string cachedVersion(selection.cachedVersion.empty() ? "0" : selection.cachedVersion);
+    ExamManager exam;
 
-    // Extract exam name from the exams
-    string selectedExamName;
-    istringstream iss(exams[examNumber - 1]);
-    string line;
-    
-    while (getline(iss, line)) {
-        if (line.find("Exam Name:") != string::npos) {
-            selectedExamName = line.substr(line.find(":") + 2);
-            break;
-        }
-    }
+    // Sessions, deadlines and grading of an exam all live on its owner shard
+    if (!ShardRouter::owns(selectedExamName) && handOff(sock, selectedExamName, cachedVersion))
+        return false;
 
-    // Send questions for the selected exam
-    if(examNumber!=-1){
-        exam.sendExamQuestions(sock, selectedExamName);
-        cout << "[+] question paper send successfully !\n";
-    }
-    else{
-        cout << "[+] client already have question paper\n";
+    serveExam(sock, exam, selectedExamName, cachedVersion);
+    return true;
+}
+
+void Server::serveExam(int sock, ExamManager& exam, const string& selectedExamName, const string& cachedVersion) {
+    // Send questions for the selected exam, or just confirm the client's copy
+    if (!exam.sendExamQuestions(sock, selectedExamName, cachedVersion, compressionEnabled(sock))) {
+        cerr << "Error: Failed to send question paper for '" << selectedExamName << "'.\n";
+        return;
     }
     
-    memset(buffer, 0, sizeof(buffer));
-    recv(sock, buffer, sizeof(buffer), 0);
+    char buffer[1024] = {0};
+    if (Wire::receive(sock, buffer, sizeof(buffer) - 1, 0) <= 0) return;
+    touchConnection(sock);
     string response(buffer);
 
     if (response == "y" || response == "Y") {
         cout << "[+] Student confirmed to start the exam.\n";
-        sleep(3);
         receiveStudentAnswers(sock, selectedExamName);
     } else {
         cout << "[!] Student decided not to start the exam.\n";
     }
 }
 
-bool Server::handle_authentication(int sock, const string& command, const string& user_type, const string& username, const string& password) {
-    if (command == "LOGIN") {
+// "HELLO <codec>..." lists what the client can decode; reply with the codec
+// this connection will use for large responses.
+void Server::negotiate(int sock, const string& request) {
+    istringstream iss(request.substr(5));
+    string codec;
+    bool compression = false;
+    while (iss >> codec) {
+        if (codec == CODEC_LZ1) compression = true;
+    }
+
+    pthread_mutex_lock(&connMutex);
+    socketCompression[sock] = compression;
+    pthread_mutex_unlock(&connMutex);
+
+    string reply = string("HELLO ") + (compression ? CODEC_LZ1 : CODEC_RAW);
+    Wire::sendAll(sock, reply);
+}
+
+bool Server::compressionEnabled(int sock) {
+    pthread_mutex_lock(&connMutex);
+    auto it = socketCompression.find(sock);
+    bool enabled = it != socketCompression.end() && it->second;
+    pthread_mutex_unlock(&connMutex);
+    return enabled;
+}
+
+// False if the user table is full, in which case the login is refused.
+// Entries are read by other threads (throttling, hand-off, the deadline).
+bool Server::bindUser(int sock, const string& username) {
+    uint32_t id = Symbols::users.intern(username);
+    if ((size_t)sock < socketUserSlots) socketUsers[sock].store(id, memory_order_release);
+    return id != SYMBOL_NONE;
+}
+
+uint32_t Server::userOf(int sock) {
+    return (size_t)sock < socketUserSlots ? socketUsers[sock].load(memory_order_acquire) : SYMBOL_NONE;
+}
+
+const string& Server::username(int sock) {
+    static const string nobody;
+    uint32_t id = userOf(sock);
+    return id == SYMBOL_NONE ? nobody : Symbols::users.name(id);
+}
+
+bool Server::handle_authentication(int sock, AuthCommand command, const string& user_type, const string& username, const string& password) {
+    AuthReply reply;
+    reply.command = command;
+    if (command == AUTH_LOGIN) {
         if (AuthManager::authenticate_user(username, password, user_type)) {
-            send(sock, "AUTHENTICATION_SUCCESS", strlen("AUTHENTICATION_SUCCESS"), 0);
+            reply.ok = 1;
             cout << username << " logged in successfully as " << user_type << endl;
-            return true;
         } else {
-            send(sock, "AUTHENTICATION_FAILED", strlen("AUTHENTICATION_FAILED"), 0);
             cerr << "Authentication failed for " << username << endl;
-            return false;
         }
-    } else if (command == "REGISTER") {
+    } else if (command == AUTH_REGISTER) {
         if (AuthManager::register_user(username, password, user_type)) {
-            send(sock, "REGISTER_SUCCESS", strlen("REGISTER_SUCCESS"), 0);
+            reply.ok = 1;
             cout << username << " registered successfully as " << user_type << endl;
-            return true;
         } else {
-            send(sock, "REGISTER_FAILED", strlen("REGISTER_FAILED"), 0);
             cerr << "Registration failed for " << username << endl;
-            return false;
         }
-        
     }
-    return false;
+    Codec::send(sock, reply);
+    return reply.ok;
 }
 
+// Details and per-question table of the attempt started at `timestamp`,
+// from the student's performance file for the exam
+bool Server::renderAttempt(const string& perfContent, const string& selectedTimestamp, string& formatted) {
+    istringstream perfFile(perfContent);
+    string line;
+    bool found = false;
+    while (getline(perfFile, line)) {
+        if (line == "START") {
+            string summaryLine;
+            if (!getline(perfFile, summaryLine)) break;
+
+            stringstream ss(summaryLine);
+            string timestamp, examName, marksObtained, totalMarks, totalQuestions, attempted, wrong, totalTime;
+            getline(ss, timestamp, '|');
+            cout << "time stamp: "<<timestamp<<endl;
+            if (timestamp != selectedTimestamp) {
+                // skip this block
+                while (getline(perfFile, line) && line != "START");
+                    // skip lines until next START or EOF
+                if (line == "START") {
+                    perfFile.seekg(-line.length()-1, ios::cur); // rewind to let outer loop re-process START
+                }
+                continue;
+            }
+
+            // Matched
+            found = true;
+            getline(ss, examName, '|');
+            getline(ss, marksObtained, '|');
+            getline(ss, totalMarks, '|');
+            getline(ss, totalQuestions, '|');
+            getline(ss, attempted, '|');
+            getline(ss, wrong, '|');
+            getline(ss, totalTime, '|');
+
+            formatted = "\n========== Attempt Details ==========\n\n";
+            formatted += "Exam: " + examName + "\n";
+            formatted += "Attempt Date: " + timestamp + "\n\n";
+            formatted += "Total Marks Obtained   : " + marksObtained + " / " + totalMarks + "\n";
+            formatted += "Total Questions        : " + totalQuestions + "\n";
+            formatted += "Attempted Questions    : " + attempted + "\n";
+            formatted += "Wrong Answers          : " + wrong + "\n";
+            formatted += "Total Time Spent       : " + totalTime + "s\n\n";
+
+            formatted += "Qno.    status     marks     answer     time\n";
+            formatted += "--------------------------------------------\n";
+            // Read until END
+            while (getline(perfFile, line) && line != "END");
+
+            // After END comes per-question
+            int qNum = 1;
+            while (getline(perfFile, line)) {
+                if (line == "START") break;
+            
+                stringstream qss(line);
+                string questionStr, markStr, optStr, timeStr;
+                
+                getline(qss, questionStr, '|');
+                getline(qss, markStr, '|');
+                getline(qss, optStr, '|');
+                getline(qss, timeStr, 's');      
+            
+                formatted += questionStr + ": ";
+                if (optStr == "NA") {
+                    formatted += "not_attempted     -         -        "+ timeStr + "s\n";
+                } else {
+                    int mark = stoi(markStr);  // Convert marks string to integer
+                    string status = (mark == -1) ? "     wrong    " : "   attempted  ";
+                    formatted += status;
+                    formatted += (mark > 0 ? "   +" : "   ") + markStr + "         ";
+                    formatted += optStr + "        " + timeStr + "s\n";
+                }
+            }
+            break;
+        }
+    }
+    return found;
+}
+
+// The question paper appended to attempt details, rendered once per version
+// of the questions file and shared by every attempt at it
+string Server::examPaper(const string& examName) {
+    string examFilePath = "../data/exams/questions_" + examName + ".txt";
+    struct stat st;
+    if (stat(examFilePath.c_str(), &st) == -1)
+        return "\n[Warning] Unable to load original exam paper: " + examFilePath + "\n";
+    string key = "paper|" + examName + "|" + to_string(st.st_mtime) + "|" + to_string(st.st_size);
+    string formatted;
+    if (ReportCache::findReport(key, formatted)) return formatted;
+
+    ifstream examFile(examFilePath);
+    if (!examFile.is_open())
+        return "\n[Warning] Unable to load original exam paper: " + examFilePath + "\n";
+    formatted += "\n========== Exam Questions ==========\n";
+    string qLine;
+    int qNum = 1;
+    while (getline(examFile, qLine)) {
+        if (qLine.empty()) {
+            formatted += "\n";  // preserve spacing between questions
+            continue;
+        }
+
+        if (qLine[0] == ' ') {
+            // Likely a question line (starts with space), so prepend Q number
+            formatted += "Q" + to_string(qNum++) + "." + qLine + "\n";
+        } else {
+            // Likely an option line
+            formatted += qLine + "\n";
+        }
+    }
+    formatted += "===========================================\n";
+    examFile.close();
+    ReportCache::storeReport(key, formatted);
+    return formatted;
+}
+
+// The landing page comes from the student's materialized progress; the
+// attempts file is only read for the exam the student opens.
 void Server::handleViewPerformance(int clientSock, const string& studentId) {
     string filename = "../data/results/student_" + studentId + "_attempts.txt";
-    ifstream file(filename);
-    if (!file.is_open()) {
+    vector<ExamProgress> progress;
+    if (!StudentProgress::view(studentId, progress)) {
         string err = "[!] No exam data found for student.";
         err += "\n[0] Back to Main Menu\n--------------------------------------\n";
         err += "Select an exam to view performance: ";
-        send(clientSock, err.c_str(), err.size() + 1, 0);
+        Wire::sendFrame(clientSock, err, compressionEnabled(clientSock));
         return;
     }
 
-    map<string, vector<tuple<string, string, string>>> examMap;
-    string line;
-    while (getline(file, line)) {
-        stringstream ss(line);
-        string examName, timestamp, marksObtained, totalMarks, perfPath;
-        getline(ss, examName, '|');
-        getline(ss, timestamp, '|');
-        getline(ss, marksObtained, '|');
-        getline(ss, totalMarks, '|');
-        getline(ss, perfPath);
-
-        examMap[examName].emplace_back(timestamp, marksObtained, totalMarks + "|" + perfPath);
-    }
-    file.close();
-
     while (true) {
-        string dashboard = "\n========== Attempted Exams ==========\n\n";
-        vector<string> examNames;
-        int index = 1;
-        for (auto& pair : examMap) {
-            dashboard += "[" + to_string(index++) + "] " + pair.first + " (" + to_string(pair.second.size()) + " attempts)\n";
-            examNames.push_back(pair.first);
+        ostringstream overview;
+        overview << fixed << setprecision(1);
+        overview << "\n========== Your Progress ==========\n\n";
+        overview << left << setw(20) << "Exam" << right << setw(9) << "Attempts" << setw(11) << "Best"
+                 << setw(11) << "Latest" << setw(9) << "Average" << setw(9) << "Change" << setw(12) << "Time/Q" << "\n";
+        overview << string(81, '-') << "\n";
+        for (const ExamProgress& exam : progress) {
+            string best = to_string(exam.best) + "/" + to_string(exam.outOf);
+            string latest = to_string(exam.latest) + "/" + to_string(exam.outOf);
+            string change = exam.attempts > 1 ? (exam.latest >= exam.first ? "+" : "") + to_string(exam.latest - exam.first) : "-";
+            ostringstream perQuestion;
+            perQuestion << fixed << setprecision(1);
+            if (exam.answered > 0) perQuestion << (double)exam.secondsSum / exam.answered << "s";
+            else perQuestion << "-";
+            overview << left << setw(20) << exam.exam << right << setw(9) << exam.attempts << setw(11) << best
+                     << setw(11) << latest << setw(9) << (double)exam.marksSum / exam.attempts << setw(9) << change
+                     << setw(12) << perQuestion.str() << "\n";
         }
+        string dashboard = overview.str();
+        dashboard += "\n(Change: latest attempt against the first; Time/Q: average seconds per answered question)\n";
+        dashboard += "\n========== Attempted Exams ==========\n\n";
+        int index = 1;
+        for (const ExamProgress& exam : progress)
+            dashboard += "[" + to_string(index++) + "] " + exam.exam + " (" + to_string(exam.attempts) + " attempts)\n";
         dashboard += "\n[0] Back to Main Menu\n--------------------------------------\n";
         dashboard += "select from above: ";
 
-        send(clientSock, dashboard.c_str(), dashboard.size() + 1, 0);
+        Wire::sendFrame(clientSock, dashboard, compressionEnabled(clientSock));
 
         char examChoiceBuf[10] = {0};
-        int bytesReceived = recv(clientSock, examChoiceBuf, sizeof(examChoiceBuf), 0);
+        int bytesReceived = Wire::receive(clientSock, examChoiceBuf, sizeof(examChoiceBuf), 0);
         if (bytesReceived <= 0) {
             cerr << "Error: Failed to receive exam selection from client.\n";
             return;
         }
+        touchConnection(clientSock);
         int examChoice = atoi(examChoiceBuf);
         cout << "exam choice: "<< examChoice<<endl;
 
         if (examChoice == 0) break;
-        if (examChoice < 1 || examChoice > examNames.size()) break;
+        if (examChoice < 1 || examChoice > progress.size()) break;
 
-        string selectedExam = examNames[examChoice - 1];
-        auto& attempts = examMap[selectedExam];
+        const string& selectedExam = progress[examChoice - 1].exam;
+        vector<tuple<string, string, string>> attempts;
+        string attemptsContent;
+        ResultStore::read(filename, attemptsContent);
+        istringstream file(attemptsContent);
+        string attemptLine;
+        while (getline(file, attemptLine)) {
+            stringstream ss(attemptLine);
+            string examName, timestamp, marksObtained, totalMarks, perfPath;
+            getline(ss, examName, '|');
+            if (examName != selectedExam) continue;
+            getline(ss, timestamp, '|');
+            getline(ss, marksObtained, '|');
+            getline(ss, totalMarks, '|');
+            getline(ss, perfPath, '|');
+            attempts.emplace_back(timestamp, marksObtained, totalMarks + "|" + perfPath);
+        }
 
         string attemptList = "\n=============="+selectedExam+" attempts==============\n\n";
         // attemptList += "You attempted \"" + selectedExam + "\" " + to_string(attempts.size()) + " times:\n";
@@ -311,10 +1027,11 @@ void Server::handleViewPerformance(int clientSock, const string& studentId) {
         attemptList += "--------------------------------------------------------\n";
         attemptList += "Select an attempt to view details: ";
 
-        send(clientSock, attemptList.c_str(), attemptList.size() + 1, 0);
+        Wire::sendFrame(clientSock, attemptList, compressionEnabled(clientSock));
         
         char attemptChoiceBuf[10] = {0};
-        recv(clientSock, attemptChoiceBuf, sizeof(attemptChoiceBuf), 0);
+        if (Wire::receive(clientSock, attemptChoiceBuf, sizeof(attemptChoiceBuf), 0) <= 0) return;
+        touchConnection(clientSock);
         int attemptChoice = atoi(attemptChoiceBuf);
 
         if (attemptChoice == 0) continue;
@@ -324,197 +1041,106 @@ void Server::handleViewPerformance(int clientSock, const string& studentId) {
         string perfFilePath = get<2>(attempts[attemptChoice - 1]);
         perfFilePath = perfFilePath.substr(perfFilePath.find('|') + 1);
 
-        ifstream perfFile(perfFilePath);
-        if (!perfFile.is_open()) {
-            string error = "Error: Performance file not found.\n";
-            attemptList += "\n[0] Back to Exam List\n";
-            error += "--------------------------------------------------------\n";
-            error += "select from above: ";
-            send(clientSock, error.c_str(), error.size() + 1, 0);
-            continue;
+        // A graded attempt never changes, so its details are rendered once
+        string reportKey = "attempt|" + studentId + "|" + selectedExam + "|" + selectedTimestamp;
+        string formatted;
+        bool found = ReportCache::findReport(reportKey, formatted);
+        if (!found) {
+            string perfContent;
+            if (!ResultStore::read(perfFilePath, perfContent)) {
+                string error = "Error: Performance file not found.\n";
+                attemptList += "\n[0] Back to Exam List\n";
+                error += "--------------------------------------------------------\n";
+                error += "select from above: ";
+                Wire::sendFrame(clientSock, error, compressionEnabled(clientSock));
+                continue;
+            }
+            found = renderAttempt(perfContent, selectedTimestamp, formatted);
+            if (found) ReportCache::storeReport(reportKey, formatted);
         }
 
-        string formatted, line;
-        bool found = false;
-        while (getline(perfFile, line)) {
-            if (line == "START") {
-                string summaryLine;
-                if (!getline(perfFile, summaryLine)) break;
-
-                stringstream ss(summaryLine);
-                string timestamp, examName, marksObtained, totalMarks, totalQuestions, attempted, wrong, totalTime;
-                getline(ss, timestamp, '|');
-                cout << "time stamp: "<<timestamp<<endl;
-                if (timestamp != selectedTimestamp) {
-                    // skip this block
-                    while (getline(perfFile, line) && line != "START");
-                        // skip lines until next START or EOF
-                    if (line == "START") {
-                        perfFile.seekg(-line.length()-1, ios::cur); // rewind to let outer loop re-process START
-                    }
-                    continue;
-                }
-
-                // Matched
-                found = true;
-                getline(ss, examName, '|');
-                getline(ss, marksObtained, '|');
-                getline(ss, totalMarks, '|');
-                getline(ss, totalQuestions, '|');
-                getline(ss, attempted, '|');
-                getline(ss, wrong, '|');
-                getline(ss, totalTime, '|');
-
-                formatted = "\n========== Attempt Details ==========\n\n";
-                formatted += "Exam: " + examName + "\n";
-                formatted += "Attempt Date: " + timestamp + "\n\n";
-                formatted += "Total Marks Obtained   : " + marksObtained + " / " + totalMarks + "\n";
-                formatted += "Total Questions        : " + totalQuestions + "\n";
-                formatted += "Attempted Questions    : " + attempted + "\n";
-                formatted += "Wrong Answers          : " + wrong + "\n";
-                formatted += "Total Time Spent       : " + totalTime + "s\n\n";
-
-                formatted += "Qno.    status     marks     answer     time\n";
-                formatted += "--------------------------------------------\n";
-                // Read until END
-                while (getline(perfFile, line) && line != "END");
-
-                // After END comes per-question
-                int qNum = 1;
-                while (getline(perfFile, line)) {
-                    if (line == "START") break;
-                
-                    stringstream qss(line);
-                    string questionStr, markStr, optStr, timeStr;
-                    
-                    getline(qss, questionStr, '|');
-                    getline(qss, markStr, '|');
-                    getline(qss, optStr, '|');
-                    getline(qss, timeStr, 's');      
-                
-                    formatted += questionStr + ": ";
-                    if (optStr == "NA") {
-                        formatted += "not_attempted     -         -        "+ timeStr + "s\n";
-                    } else {
-                        int mark = stoi(markStr);  // Convert marks string to integer
-                        string status = (mark == -1) ? "     wrong    " : "   attempted  ";
-                        formatted += status;
-                        formatted += (mark > 0 ? "   +" : "   ") + markStr + "         ";
-                        formatted += optStr + "        " + timeStr + "s\n";
-                    }
-                }
-                // here add code for adding exam paper along with stat
-                string examFilePath = "../data/exams/questions_" + examName + ".txt";
-                ifstream examFile(examFilePath);
-                if (examFile.is_open()) {
-                    formatted += "\n========== Exam Questions ==========\n";
-                    string qLine;
-                    int qNum = 1;
-                    while (getline(examFile, qLine)) {
-                        if (qLine.empty()) {
-                            formatted += "\n";  // preserve spacing between questions
-                            continue;
-                        }
-
-                        if (qLine[0] == ' ') {
-                            // Likely a question line (starts with space), so prepend Q number
-                            formatted += "Q" + to_string(qNum++) + "." + qLine + "\n";
-                        } else {
-                            // Likely an option line
-                            formatted += qLine + "\n";
-                        }
-                    }
-                    formatted += "===========================================\n";
-                    examFile.close();
-                } else {
-                    formatted += "\n[Warning] Unable to load original exam paper: " + examFilePath + "\n";
-                }
-                formatted += "[1] View Leaderboard for this Exam\n";
-                formatted += "[0] Back to Exam List\n";
-                formatted += "-------------------------------------------\n";
-                formatted +="Select from above option: ";
-                break;
+        if (found) {
+            string marksObtained = get<1>(attempts[attemptChoice - 1]);
+            // Where this attempt stands among everyone's, from the in-memory aggregates
+            ExamSummary summary;
+            if (ExamStats::summary(selectedExam, summary)) {
+                int marks = atoi(marksObtained.c_str());
+                ostringstream compare;
+                compare << fixed << setprecision(1);
+                compare << "\n========== How You Compare ==========\n\n";
+                compare << "Attempts So Far        : " << summary.attempts << " by " << summary.students << " students\n";
+                compare << "Your Percentile        : " << ExamStats::percentile(selectedExam, marks) << "\n";
+                compare << "Mean / Median Score    : " << summary.mean << " / " << summary.median << "\n";
+                compare << "Lowest / Highest Score : " << summary.min << " / " << summary.max << "\n\n";
+                compare << "Score distribution:\n" << ExamStats::chart(selectedExam, true, marks);
+                formatted += compare.str();
             }
+            formatted += examPaper(selectedExam);
+            formatted += "[1] View Leaderboard for this Exam\n";
+            formatted += "[0] Back to Exam List\n";
+            formatted += "-------------------------------------------\n";
+            formatted +="Select from above option: ";
         }
 
-        perfFile.close();
-
         if (!found) {
             string err = "Error: Attempt not found.\n";
             err += "[0] Back to Exam List\n";
             err += "-------------------------------------------\n";
             err += "Select from above option: ";
-            send(clientSock, err.c_str(), err.size() + 1, 0);
+            Wire::sendFrame(clientSock, err, compressionEnabled(clientSock));
         } else {
-            send(clientSock, formatted.c_str(), formatted.size() + 1, 0);
+            Wire::sendFrame(clientSock, formatted, compressionEnabled(clientSock));
         }
 
         char leaderboardbuf[10] = {0};
-        bytesReceived = recv(clientSock, leaderboardbuf, sizeof(leaderboardbuf), 0);
+        bytesReceived = Wire::receive(clientSock, leaderboardbuf, sizeof(leaderboardbuf), 0);
         if (bytesReceived <= 0) {
             cerr << "Error: Failed to receive exam selection from client.\n";
             return;
         }
+        touchConnection(clientSock);
         int leaderboard = atoi(leaderboardbuf);
         cout << "exam choice: "<< leaderboardbuf<<endl;
 
         if(leaderboard==0 || leaderboard!=1) continue;
-        string leaderboardList = "../data/results/exam_" + selectedExam + "_leaderboard.txt";
-        ifstream leaderboardFile(leaderboardList);  
-        if (!leaderboardFile.is_open()) {
-            formatted += "\n[✖] Could not open leaderboard file.\n";
-        } else {
-            vector<vector<string>> students;
-    
-            string line;
-            while (getline(leaderboardFile, line)) {
-                stringstream ss(line);
-                string uname, marksStr, attStr, wrongStr, timeStr;
-                ss >> uname >> marksStr >> attStr >> wrongStr >> timeStr;
-    
-                vector<string> entry = { uname, marksStr, attStr, wrongStr, timeStr };
-                students.push_back(entry);
-            }
-            leaderboardFile.close();
-    
-            // Sort students based on: marks desc, wrong asc, time asc
-            sort(students.begin(), students.end(), [](const vector<string>& a, const vector<string>& b) {
-                int ma = stoi(a[1]), mb = stoi(b[1]);
-                int wa = stoi(a[3]), wb = stoi(b[3]);
-                int ta = stoi(a[4]), tb = stoi(b[4]);
-    
-                if (ma != mb) return ma > mb;
-                if (wa != wb) return wa < wb;
-                return ta < tb;
-            });
-    
-            // Find rank of this user
-            int yourRank = -1;
-            for (int i = 0; i < students.size(); ++i) {
-                if (students[i][0] == studentId) {
-                    yourRank = i + 1;
-                    break;
+        // Top 3 and rank come from the in-memory leaderboard, no re-sort of the
+        // file; the top 3 table is the same for everyone and briefly cached
+        string page;
+        if (!ReportCache::findLeaderboard(selectedExam, page)) {
+            vector<LeaderboardEntry> leaders = ExamStats::top(selectedExam, 3);
+            if (!leaders.empty()) {
+                page = "\n========= Leaderboard: "+ selectedExam+" =========\n\n";
+                page += "Rank  Student ID     Marks   Time(s)\n";
+                page += "---------------------------------------------------\n";
+                int shownRank = 0;
+                for (int i = 0; i < leaders.size(); ++i) {
+                    // Equal marks, wrong answers and time share a rank, as in rank()
+                    bool tied = i > 0 && leaders[i].marks == leaders[i - 1].marks &&
+                                leaders[i].wrong == leaders[i - 1].wrong && leaders[i].timeSpent == leaders[i - 1].timeSpent;
+                    if (!tied) shownRank = i + 1;
+                    page += to_string(shownRank) + "     ";
+                    const string& leader = Symbols::users.name(leaders[i].student);
+                    page += leader;
+                    int spaceLen = 17 - leader.length();
+                    page += string(max(spaceLen, 1), ' ');
+                    page += to_string(leaders[i].marks) + "      ";
+                    page += to_string(leaders[i].timeSpent) + "\n";
                 }
+                page += "---------------------------------------------------\n";
+                ReportCache::storeLeaderboard(selectedExam, page);
             }
-    
-            formatted += "\n========= Leaderboard: "+ selectedExam+" =========\n\n";
-            formatted += "Rank  Student ID     Marks   Time(s)\n";
-            formatted += "---------------------------------------------------\n";
-            for (int i = 0; i < min(3, (int)students.size()); ++i) {
-                formatted += to_string(i + 1) + "     ";
-                formatted += students[i][0];
-                int spaceLen = 17 - students[i][0].length();
-                formatted += string(spaceLen, ' ');
-                formatted += students[i][1] + "      ";
-                formatted += students[i][4] + "\n";
-            }
-            formatted += "---------------------------------------------------\n";
+        }
+        if (page.empty()) {
+            formatted += "\n[!] No attempts yet.\n";
+        } else {
+            int yourRank = ExamStats::rank(selectedExam, Symbols::users.intern(studentId));
+            formatted += page;
             if (yourRank != -1)
                 formatted += "Your rank: " + to_string(yourRank) + "\n";
             else
                 formatted += "[!] You didn't participate in this exam.\n";
         }
-        send(clientSock, formatted.c_str(), formatted.size() + 1, 0);
+        Wire::sendFrame(clientSock, formatted, compressionEnabled(clientSock));
         break;
     }
 }
@@ -522,142 +1148,419 @@ void Server::handleViewPerformance(int clientSock, const string& studentId) {
 void* Server::handle_client(void* client_socket) {
     
     int sock = *(int*)client_socket;
+    delete (int*)client_socket;
     char buffer[1024] = {0};
-    string command, user_type, username, password;
+    string user_type, username, password, message;
+    string address = peerAddress(sock);
     int attempts=0;
+    bool authenticated = false, negotiated = false;
+    touchConnection(sock, AUTH_TIMEOUT_MS);
     while(attempts < 5){
+        // Login and registration are AuthRequest messages; HELLO, METRICS
+        // and exit are plain text
+        bool closed;
+        if (Codec::messageNext(sock, closed)) {
+            AuthRequest auth;
+            if (!recvMessage(sock, message, auth, AUTH_TIMEOUT_MS)) break;
+            user_type = auth.role == ROLE_INSTRUCTOR ? "instructor" : "student";
+            username = string(auth.username);
+            password = string(auth.password);
+            if (auth.command == AUTH_LOGIN && !RateLimiter::allowAuth(address, username)) {
+                AuthReply refused;
+                refused.command = auth.command;
+                Codec::send(sock, refused);
+                cerr << "[!] Too many failed logins for " << username << " from " << address << ", closing.\n";
+                break;
+            }
+            if (!AuthManager::valid_username(username)) {
+                AuthReply refused;
+                refused.command = auth.command;
+                Codec::send(sock, refused);
+                cerr << "[!] Rejected an invalid username from " << address << ".\n";
+                cout<< "[!] Only " << 4 - attempts++ << "left\n\n";
+                continue;
+            }
+            if (Symbols::users.full() && Symbols::users.find(username) == SYMBOL_NONE) {
+                AuthReply refused;
+                refused.command = auth.command;
+                Codec::send(sock, refused);
+                cerr << "[!] User table is full, refusing " << username << ".\n";
+                break;
+            }
+            if (handle_authentication(sock, auth.command, user_type, username, password)) {
+                if (!bindUser(sock, username)) {
+                    cerr << "[!] User table is full, closing the connection of " << username << ".\n";
+                    break;
+                }
+                authenticated = true;
+                touchConnection(sock);
+                break;
+            }
+            // A taken username on registration is not a guess
+            if (auth.command == AUTH_LOGIN) RateLimiter::authFailed(address, username);
+            cout<< "[!] Only " << 4 - attempts++ << "left\n\n";
+            continue;
+        }
+        if (closed) break;
         memset(buffer, 0, sizeof(buffer));
-        recv(sock, buffer, sizeof(buffer), 0);
+        if (Wire::receive(sock, buffer, sizeof(buffer) - 1, 0) <= 0) break;
+        touchConnection(sock, AUTH_TIMEOUT_MS);
         string request(buffer);
         if(request=="exit") break;
-        istringstream iss(request);
-        iss >> command >> user_type >> username >> password;
-        if(handle_authentication(sock, command, user_type, username, password)){
-            Server::socketToUsername[sock] = username;
-            break;
+        // Once per connection; a repeat counts like an unknown command
+        if (request.rfind("HELLO", 0) == 0 && !negotiated) {
+            negotiate(sock, request);
+            negotiated = true;
+            continue;
+        }
+        if (request == "METRICS") {
+            Wire::sendFrame(sock, Metrics::render(), compressionEnabled(sock));
+            continue;
         }
-        cout<< "[!] Only " << 4 - attempts++ << "left\n\n";
+        attempts++;  // not a command the server knows
     }
 
+    bool handedOff = false;
     ExamManager exam_manager;
+    // Running out of attempts must not open the menu of the last role tried
+    if (!authenticated) user_type.clear();
     if (user_type == "student") {
-        while (true){
-            memset(buffer, 0, sizeof(buffer));
-            int bytes_received = recv(sock, buffer, sizeof(buffer), 0);
-            if (bytes_received <= 0) break;
-            buffer[bytes_received] = '\0';
-            string request(buffer);
-            
-            if (request == "1") {
-                string all_exams;
-                int qno = 1;
-                for (auto& exam : exams) {
-                    string formattedExam;
-                    istringstream iss(exam);
-                    string line;
-                    
-                    while (getline(iss, line)) 
-                        formattedExam += line + " | ";
-        
-                    if (!formattedExam.empty() && formattedExam.back() == ' ')
-                        formattedExam.pop_back();
-
-                    all_exams += to_string(qno) + ". " + formattedExam + "\n";
-                    qno++;
-                }
-            
-                if (all_exams.empty())
-                    all_exams = "No exams available.";
-                
-                send(sock, all_exams.c_str(), all_exams.size(), 0);
-                if(all_exams!="No exams available.")
-                    handleStudentExamRequest(sock, exam_manager);
-            }
-            
-            else if (request == "2") {
-                handleViewPerformance(sock, username);
-            }
-            else if(request == "3") break;
-        }
+        studentOnline(1);
+        handedOff = serveStudent(sock, username);
+        studentOnline(-1);
     }
     else if (user_type == "instructor") {
         while (true){
             memset(buffer, 0, sizeof(buffer));
-            int bytes_received = recv(sock, buffer, sizeof(buffer), 0);
+            int bytes_received = Wire::receive(sock, buffer, sizeof(buffer) - 1, 0);
+            if (bytes_received <= 0 || !throttle(sock)) break;
+            touchConnection(sock);
             buffer[bytes_received] = '\0';
             string request(buffer);
             string response = "";
 
             if (request == "1") {
-                memset(buffer, 0, sizeof(buffer));
-                recv(sock, buffer, sizeof(buffer), 0);
-                string examData(buffer);
-            
-                size_t pos1 = examData.find("|");
-                size_t pos2 = examData.find("|", pos1 + 1);
-            
-                if (pos1 == string::npos || pos2 == string::npos) {
-                    response = "Error: Invalid format. Use 'Exam Name | Duration | FileName'";
+                ExamUpload upload;
+                if (!recvMessage(sock, message, upload)) break;
+                string examName(upload.name);
+                string fileName(upload.fileName);
+
+                // '|' separates fields in exam_list.txt, ',' exams in an attempt history query
+                if (examName.empty() || examName.find_first_of("|\n,") != string::npos || fileName.empty()) {
+                    response = "Error: Invalid exam name or file name.";
                 } else {
-                    string examName = examData.substr(0, pos1);  
-                    int examDuration = atoi(examData.substr(pos1 + 1, pos2 - pos1 - 1).c_str());
-                    string examFileName = "../data/exams/" + examData.substr(pos2 + 1);
-                    
-                    if (exam_manager.parse_exam(examFileName, examName, username, examDuration)) {
-                        exams = exam_manager.load_exam_metadata("../data/exams/exam_list.txt");
+                    string examFileName = "../data/exams/" + fileName;
+
+                    if (Symbols::exams.full() && Symbols::exams.find(examName) == SYMBOL_NONE) {
+                        response = "Error: The server cannot take more exams.";
+                    } else if (exam_manager.parse_exam(examFileName, examName, username, upload.durationMinutes)) {
+                        listExams();
+                        Symbols::exams.intern(examName);
                         response = "Exam successfully uploaded!"; 
                     } else {
                         response = "Error: Invalid exam format!";
                     }
                 }
-                send(sock,response.c_str(),response.size(),0);
+                Wire::sendAll(sock, response);
             }
             else if(request == "2"){
-                send(sock, "upload exam sheet...", strlen("upload exam sheet..."), 0);
+                Wire::sendAll(sock, "upload exam sheet...");
             }
             else if (request == "3"){
-                send(sock, "student performance...", strlen("student performance..."), 0);
+                Wire::sendFrame(sock, instructorSummary(username), compressionEnabled(sock));
             }
             else if (request == "4") {
-                string all_exams;
-                int qno = 1;  // Start numbering from 1
-            
-                for (const auto& exam : exams) {
-                    istringstream iss(exam);
-                    ostringstream filteredExam;
-                    string line;
-                    string instructor_name;
-                    bool include_exam = false;
-            
-                    while (getline(iss, line)) {
-                        if (line.find("Instructor:") != string::npos) {
-                            instructor_name = line.substr(line.find(":") + 2);  // Extract instructor name
-                            if (instructor_name == username) {
-                                include_exam = true;  // Match found, include this exam
-                            }
-                        }
-                        if (line.find("Instructor:") != std::string::npos)
-                            continue;
-                        filteredExam << line << " | ";
-                    }
-            
-                    if (include_exam) {
-                        all_exams += to_string(qno++) + ". " + filteredExam.str() + "\n";
-                    }
-                }
+                vector<string> exams = listExams();
+                ExamCatalog catalog;
+                examCatalog(exams, username, catalog);
+                Codec::send(sock, catalog);
+            }
             
-                if (all_exams.empty()) {
-                    all_exams = "No exams available for this instructor.\n";
+            else if (request == "6") {
+                // Bulk student import: the CSV arrives as one frame
+                string csv, reply;
+                ImportReport report;
+                if (!Wire::recvFrame(sock, csv)) break;
+                touchConnection(sock);
+                if (AuthManager::import_students(csv, report)) {
+                    ostringstream out;
+                    out << "Imported " << report.imported << " of " << report.rows << " students ("
+                        << report.duplicates << " duplicates, " << report.invalid << " invalid) in "
+                        << report.elapsedMs << " ms";
+                    if (report.elapsedMs > 0) out << ", " << report.imported * 1000 / report.elapsedMs << " students/s";
+                    reply = out.str() + ".\n";
+                } else {
+                    reply = "Error: Import failed, no students were added.\n";
                 }
-            
-                all_exams += "\0";
-                send(sock, all_exams.c_str(), all_exams.size(), 0);
+                Wire::sendFrame(sock, reply, compressionEnabled(sock));
             }
-            
-            else if (response=="5") break;
+            else if (request == "7") {
+                handleExport(sock, username);
+            }
+            else if (request == "8") {
+                if (!handleMonitor(sock, username)) break;
+            }
+            else if (request == "9") {
+                if (!handleAttemptHistory(sock, username)) break;
+            }
+            else if (request == "5") break;
         }
     }
-    close(sock);
-    cout << "[-] client[ "<<username<<" ] disconnected!"<<endl;
+    closeConnection(sock, username, handedOff);
     return nullptr;
 }
+
+// Question count of an exam from the catalog, or -1 if there is no such
+// exam (uploaded by `instructor`, unless that is empty).
+int Server::examQuestions(const string& examName, const string& instructor) {
+    for (const auto& exam : listExams()) {
+        if (exam.find("Exam Name: " + examName + "\n") == string::npos) continue;
+        if (!instructor.empty() && exam.find("Instructor: " + instructor + "\n") == string::npos) continue;
+        size_t pos = exam.find("Total Questions:");
+        return pos == string::npos ? 0 : atoi(exam.c_str() + pos + 16);
+    }
+    return -1;
+}
+
+// "<format>|<exam name>" from the client, then the export as a stream of
+// frames ended by an empty one, then a one-line report frame.
+void Server::handleExport(int sock, const string& instructor) {
+    char buffer[1024] = {0};
+    if (Wire::receive(sock, buffer, sizeof(buffer) - 1, 0) <= 0) return;
+    touchConnection(sock);
+    string request(buffer);
+    size_t bar = request.find('|');
+    string format = request.substr(0, bar);
+    string examName = bar == string::npos ? "" : request.substr(bar + 1);
+    int questions = examQuestions(examName, instructor);
+
+    bool compress = compressionEnabled(sock);
+    ExportReport report;
+    string reply;
+    if (!ResultExport::formatKnown(format)) {
+        reply = "Error: Unknown export format '" + format + "'.\n";
+    } else if (questions < 0) {
+        reply = "Error: You have no exam named '" + examName + "'.\n";
+    } else {
+        bool sent = true;
+        auto toSocket = [sock, compress, &sent](const char* data, size_t length) {
+            touchConnection(sock);
+            return sent = Wire::sendFrame(sock, string(data, length), compress);
+        };
+        bool exported = ResultExport::run(examName, format, questions, toSocket, report);
+        if (!exported) cerr << "[!] Export of '" << examName << "' for " << instructor << " did not complete\n";
+        // Only a dead connection is left without the closing frames
+        if (!sent) return;
+        if (exported) {
+            ostringstream out;
+            out << "Exported " << report.attempts << " attempts (" << report.bytes << " bytes) in " << report.elapsedMs << " ms";
+            if (report.elapsedMs > 0) out << ", " << report.bytes / 1000 / report.elapsedMs << " MB/s";
+            reply = out.str() + ".\n";
+            cout << "[+] " << instructor << ": " << reply;
+        } else {
+            reply = "Error: Could not read the results of '" + examName + "', the export is incomplete.\n";
+        }
+    }
+    Wire::sendFrame(sock, "", false);
+    Wire::sendFrame(sock, reply, compress);
+}
+
+void Server::studentOnline(int delta) {
+    pthread_mutex_lock(&connMutex);
+    studentsOnline += delta;
+    pthread_mutex_unlock(&connMutex);
+}
+
+// What the live view needs from the server: sessions in progress, students
+// connected and the exams of an instructor
+void Server::configureLiveMonitor() {
+    LiveMonitor::configure([](map<string, LiveExam>& state) {
+        pthread_mutex_lock(&sessionMutex);
+        for (const auto& session : examSessions) {
+            if (!session.second.submitted) state[Symbols::exams.name(session.first & 0xffffffffu)].inProgress++;
+        }
+        pthread_mutex_unlock(&sessionMutex);
+    }, []() {
+        pthread_mutex_lock(&connMutex);
+        long long count = studentsOnline;
+        pthread_mutex_unlock(&connMutex);
+        return count;
+    }, instructorExams);
+}
+
+vector<string> Server::instructorExams(const string& instructor) {
+    vector<string> names;
+    for (const auto& exam : listExams()) {
+        size_t pos = exam.find("Exam Name: ");
+        if (pos == string::npos || exam.find("Instructor: " + instructor + "\n") == string::npos) continue;
+        names.push_back(exam.substr(pos + 11, exam.find('\n', pos) - pos - 11));
+    }
+    return names;
+}
+
+// Live view until the client sends STOP. The publisher thread writes the
+// updates; this thread only waits, keeping the idle timer from firing while
+// the instructor watches. The view ends with an empty frame. False if the
+// connection is gone.
+bool Server::handleMonitor(int sock, const string& instructor) {
+    LiveMonitor::subscribe(sock, instructor, compressionEnabled(sock));
+    cout << "[+] " << instructor << " is watching live exams.\n";
+    bool stopped = false;
+    while (LiveMonitor::healthy(sock)) {
+        pollfd pfd{sock, POLLIN, 0};
+        int ready = poll(&pfd, 1, 1000);
+        if (ready == 0 || (ready == -1 && errno == EINTR)) {
+            touchConnection(sock);
+            continue;
+        }
+        char buffer[64];
+        stopped = ready > 0 && (pfd.revents & POLLIN) && Wire::receive(sock, buffer, sizeof(buffer), 0) > 0;
+        break;
+    }
+    string unsent;
+    bool ok = LiveMonitor::unsubscribe(sock, unsent) && stopped;
+    touchConnection(sock);
+    return ok && Wire::sendAll(sock, unsent) && Wire::sendFrame(sock, "", false);
+}
+
+// An AttemptQuery from the client, answered with one report frame. Students'
+// attempts are only listed for the instructor's own exams. False if the
+// connection is gone.
+bool Server::handleAttemptHistory(int sock, const string& instructor) {
+    string buffer;
+    AttemptQuery query;
+    if (!recvMessage(sock, buffer, query)) return false;
+    long long started = Metrics::nowMs();
+    vector<string> ownList = instructorExams(instructor);
+    set<string> own(ownList.begin(), ownList.end());
+
+    vector<string> names;
+    istringstream list{string(query.names)};
+    string name;
+    while (getline(list, name, ',')) {
+        name.erase(0, name.find_first_not_of(' '));
+        name.erase(name.find_last_not_of(' ') + 1);
+        if (!name.empty()) names.push_back(name);
+    }
+
+    vector<AttemptRecord> attempts;
+    string error;
+    if (query.from >= query.to) {
+        error = "Error: The time range is empty.\n";
+    } else if (query.kind == QUERY_BY_EXAM) {
+        if (names.size() != 1 || !own.count(names[0])) error = "Error: You have no exam named '" + string(query.names) + "'.\n";
+        else AttemptIndex::query(QUERY_BY_EXAM, names[0], query.from, query.to, attempts);
+    } else if (names.empty() || names.size() > HISTORY_MAX_STUDENTS) {
+        error = "Error: Give between 1 and " + to_string(HISTORY_MAX_STUDENTS) + " usernames.\n";
+    } else {
+        for (const string& student : names) {
+            vector<AttemptRecord> theirs;
+            AttemptIndex::query(QUERY_BY_STUDENT, student, query.from, query.to, theirs);
+            for (AttemptRecord& attempt : theirs) {
+                if (own.count(attempt.exam)) attempts.push_back(move(attempt));
+            }
+        }
+        stable_sort(attempts.begin(), attempts.end(), [](const AttemptRecord& a, const AttemptRecord& b) { return a.at < b.at; });
+    }
+    if (!error.empty()) return Wire::sendFrame(sock, error, compressionEnabled(sock));
+
+    ostringstream out;
+    out << "\n========== Attempts " << formatDateTime(query.from) << " to " << formatDateTime(query.to) << " ==========\n\n";
+    out << left << setw(21) << "Submitted" << setw(17) << "Student" << setw(21) << "Exam" << "Marks\n";
+    out << "-------------------------------------------------------------------\n";
+    for (size_t i = 0; i < attempts.size() && i < HISTORY_MAX_ROWS; ++i) {
+        const AttemptRecord& attempt = attempts[i];
+        out << setw(21) << formatDateTime(attempt.at) << setw(17) << attempt.student << setw(21) << attempt.exam;
+        if (attempt.totalMarks < 0) out << "-\n";
+        else out << attempt.marks << " / " << attempt.totalMarks << "\n";
+    }
+    if (attempts.size() > HISTORY_MAX_ROWS) out << "... and " << attempts.size() - HISTORY_MAX_ROWS << " more\n";
+    out << "-------------------------------------------------------------------\n";
+    out << attempts.size() << " attempts, found in " << Metrics::nowMs() - started << " ms.\n";
+    return Wire::sendFrame(sock, out.str(), compressionEnabled(sock));
+}
+
+// --export from the command line: no owner check, to a file or stdout
+bool Server::exportResults(const string& examName, const string& format, const string& path) {
+    if (!ResultExport::formatKnown(format)) {
+        cerr << "[!] Unknown export format '" << format << "', use csv or columnar.\n";
+        return false;
+    }
+    int questions = examQuestions(examName, "");
+    if (questions < 0) cerr << "[!] '" << examName << "' is not in the exam catalog, exporting whatever results it has.\n";
+    int fd = path.empty() ? STDOUT_FILENO : open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        cerr << "[!] Cannot write " << path << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    ResultStore::open(0);
+    auto toFile = [fd](const char* data, size_t length) {
+        while (length > 0) {
+            ssize_t n = write(fd, data, length);
+            if (n <= 0) return false;
+            data += n;
+            length -= n;
+        }
+        return true;
+    };
+    ExportReport report;
+    bool ok = ResultExport::run(examName, format, max(questions, 0), toFile, report);
+    if (fd != STDOUT_FILENO) close(fd);
+    cerr << "[+] Exported " << report.attempts << " attempts of '" << examName << "' (" << report.bytes
+         << " bytes) in " << report.elapsedMs << " ms." << endl;
+    return ok;
+}
+
+bool Server::scanCollusion(const string& examName, size_t top, const string& path) {
+    int questions = examQuestions(examName, "");
+    if (questions < 0) cerr << "[!] '" << examName << "' is not in the exam catalog, scanning whatever results it has.\n";
+    ResultStore::open(0);
+    return CollusionScan::run(examName, max(questions, 0), top, path);
+}
+
+// Main menu of a logged in student. Returns true if the connection was
+// handed to another shard part way through.
+bool Server::serveStudent(int sock, const string& username) {
+    char buffer[1024] = {0};
+    while (true){
+        memset(buffer, 0, sizeof(buffer));
+        int bytes_received = Wire::receive(sock, buffer, sizeof(buffer) - 1, 0);
+        if (bytes_received <= 0 || !throttle(sock)) break;
+        touchConnection(sock);
+        buffer[bytes_received] = '\0';
+        string request(buffer);
+        
+        if (request == "1") {
+            // The student answers with an ExamSelection unless there is nothing to pick
+            vector<string> exams = listExams();
+            ExamCatalog catalog;
+            examCatalog(exams, "", catalog);
+            if (!Codec::send(sock, catalog)) break;
+            if (!catalog.exams.empty() && !handleStudentExamRequest(sock, catalog))
+                return true;
+        }
+        
+        else if (request == "2") {
+            handleViewPerformance(sock, username);
+        }
+        else if (request.rfind("RESULT ", 0) == 0) {
+            sendSubmissionStatus(sock, request);
+        }
+        else if(request == "3") break;
+    }
+    return false;
+}
+
+// After a hand-off only this process's descriptor is closed; the connection
+// stays open on the shard that took it over.
+void Server::closeConnection(int sock, const string& username, bool handedOff) {
+    stopIdleTimer(sock);
+    TrafficCapture::closed(sock);
+    if ((size_t)sock < socketUserSlots) socketUsers[sock].store(SYMBOL_NONE, memory_order_release);
+    pthread_mutex_lock(&connMutex);
+    socketCompression.erase(sock);
+    pthread_mutex_unlock(&connMutex);
+    close(sock);
+    if (!handedOff)
+        cout << "[-] client[ "<<username<<" ] disconnected!"<<endl;
+}
@@ -17,25 +17,163 @@
 #include <ctime>
 #include <iomanip>
 #include <unordered_set>
+#include <set>
+#include <poll.h>
+#include <cerrno>
+#include <sys/resource.h>
+#include <arpa/inet.h>
 
 #include "auth.h"
 #include "exam_manager.h"
+#include "wire.h"
+#include "messages.h"
+#include "session_journal.h"
+#include "submission_queue.h"
+#include "timer_wheel.h"
+#include "shard_router.h"
+#include "replication.h"
+#include "metrics.h"
+#include "exam_stats.h"
+#include "student_progress.h"
+#include "report_cache.h"
+#include "response_times.h"
+#include "snapshot.h"
+#include "result_store.h"
+#include "result_export.h"
+#include "collusion_scan.h"
+#include "live_monitor.h"
+#include "traffic_capture.h"
+#include "symbols.h"
+#include "rate_limiter.h"
+#include "attempt_index.h"
 
 using namespace std;
 
+#define IDLE_TIMEOUT_MS (10 * 60 * 1000)
+#define AUTH_TIMEOUT_MS (2 * 60 * 1000)  // idle limit until the client has logged in
+#define READ_DEADLINE_MS 10000           // to finish a message once it has started arriving
+// A client that stops reading holds at most this much of the kernel's
+// memory, and a send to it gives up after SEND_TIMEOUT_MS
+#define SEND_BUFFER_BYTES (256 * 1024)
+#define SEND_TIMEOUT_MS 10000
+#define HISTORY_MAX_STUDENTS 1000  // per attempt history query
+#define HISTORY_MAX_ROWS 1000      // listed; the rest are only counted
+#define SESSION_GRACE_SECONDS 30
+
+// An exam in progress, keyed by the student and exam ids. It outlives the
+// connection so a crashed client can resume, and the deadline timer
+// auto-submits whatever was journaled if the student never commits.
+struct ExamSession {
+    int sock;          // -1 while the student is disconnected
+    time_t deadline;
+    unsigned long long timerId;
+    bool submitted;    // claimed by COMMIT or by the deadline
+    unsigned long long receipt;  // of the deadline's submission, for the connection to send
+    map<int, time_t> answeredAt;  // when each answer last changed, on this server
+};
+
+// A student connection moving to the shard that owns the selected exam.
+struct HandedOffClient {
+    int sock;
+    string username;
+    string examName;
+    string cachedVersion;
+    bool compression;
+};
+
 class Server {
 public:
-    Server(int port);
+    Server(int port, const string& ioBackend = "sync", int shard = 0, int shards = 1);
     void start();
-    static map<int, string> socketToUsername;
-    
+    static bool exportResults(const string& examName, const string& format, const string& path);
+    static bool scanCollusion(const string& examName, size_t top, const string& path);
+
 private:
     int server_socket;
+    string ioBackend;
+    int shard;
+    int shards;
+    static atomic<uint32_t>* socketUsers;  // by descriptor: who logged in on it
+    static size_t socketUserSlots;
+    static map<int, bool> socketCompression;
+    static pthread_mutex_t connMutex;
+    static long long studentsOnline;
+
+    static time_t examListMtime;
+    static off_t examListSize;
+    static pthread_mutex_t examsMutex;
+
+    static vector<string> listExams();
+    static void examCatalog(const vector<string>& exams, const string& instructor, ExamCatalog& catalog);
+    static void negotiate(int sock, const string& request);
+    static bool compressionEnabled(int sock);
+
+    static TimerWheel timers;
+    static map<int, pair<unsigned long long, unsigned long long>> idleTimers;  // sock -> (timer id, token)
+    static unsigned long long idleToken;
+    static unordered_map<uint64_t, ExamSession> examSessions;
+    static pthread_mutex_t sessionMutex;
+
+    static uint64_t sessionKey(uint32_t student, uint32_t exam) { return (uint64_t)student << 32 | exam; }
+    static bool bindUser(int sock, const string& username);
+    static uint32_t userOf(int sock);
+    static const string& username(int sock);
+
+    static void touchConnection(int sock, long long timeoutMs = IDLE_TIMEOUT_MS);
+    static string peerAddress(int sock);
+    static bool throttle(int sock);
+
+    // Waits up to timeoutMs for a message to start, then READ_DEADLINE_MS
+    // for the rest of it, so a client cannot hold a reader with a message
+    // it never finishes
+    template <typename M> static bool recvMessage(int sock, string& buffer, M& message, long long timeoutMs = IDLE_TIMEOUT_MS) {
+        bool closed;
+        Codec::messageNext(sock, closed);
+        if (closed) return false;
+        touchConnection(sock, READ_DEADLINE_MS);
+        bool ok = Codec::recv(sock, buffer, message);
+        touchConnection(sock, timeoutMs);
+        return ok;
+    }
+    static void stopIdleTimer(int sock);
+    static void expireConnection(int sock, unsigned long long token);
+    static int examDurationSeconds(const string& examName);
+    static void beginSession(int sock, const string& studentId, const string& examName, time_t startedAt);
+    static bool claimSession(uint64_t key, bool claim);
+    static unsigned long long releaseSession(uint64_t key);
+    static void expireSession(uint64_t key);
+    static unsigned long long submitFromJournal(const string& studentId, const string& examName, map<int, AnswerEvent>& state);
+    static void noteAnswer(uint64_t key, int question);
+    static time_t answerTimes(uint64_t key, map<int, time_t>& answeredAt);
+    static void flagLateAnswers(const map<int, time_t>& answeredAt, time_t deadline, const string& studentId,
+                                const string& examName, const map<int, AnswerEvent>& state);
+    static void recoverSessions();
+    static void addSnapshotSections();
     static void receiveStudentAnswers(int sock, const string& examName);
-    static bool handle_authentication(int sock, const string& command, const string& user_type, const string& username, const string& password);    
+    static bool gradeSubmission(const Submission& submission, SubmissionStatus& status, vector<AppendOp>& writes);
+    static string submissionStatus(unsigned long long receipt, const string& studentId);
+    static void sendSubmissionStatus(int sock, const string& request);
+    static bool handOff(int sock, const string& examName, const string& cachedVersion);
+    static string handleShardMessage(const string& message, int passedFd);
+    static void* handle_handed_off(void* client);
+    static bool handle_authentication(int sock, AuthCommand command, const string& user_type, const string& username, const string& password);
     static void* handle_client(void* client_socket);
-    static void handleStudentExamRequest(int sock, ExamManager exam);
+    static bool handleStudentExamRequest(int sock, const ExamCatalog& catalog);
+    static void serveExam(int sock, ExamManager& exam, const string& examName, const string& cachedVersion);
+    static bool serveStudent(int sock, const string& username);
+    static void closeConnection(int sock, const string& username, bool handedOff);
+    static string instructorSummary(const string& instructor);
+    static int examQuestions(const string& examName, const string& instructor);
+    static void handleExport(int sock, const string& instructor);
+    static void studentOnline(int delta);
+    static void configureLiveMonitor();
+    static bool handleMonitor(int sock, const string& instructor);
+    static vector<string> instructorExams(const string& instructor);
+    static bool handleAttemptHistory(int sock, const string& instructor);
     static string getCurrentDateTime();
+    static string formatDateTime(time_t when);
+    static bool renderAttempt(const string& perfContent, const string& timestamp, string& formatted);
+    static string examPaper(const string& examName);
     static void handleViewPerformance(int sock, const string& username);
     static void handleViewAttemptDetail(int sock, const string& username, const string& examName, const string& timestamp);
     static void sendAttemptTimestamps(int sock, const string& studentId, const string& selectedExam);
@@ -0,0 +1,120 @@
+#include "session_journal.h"
+#include "replication.h"
+
+SessionJournal::~SessionJournal() {
+    close();
+}
+
+string SessionJournal::pathFor(const string& studentId, const string& examName) {
+    return string(SESSIONS_DIR) + "/" + studentId + "_" + examName + ".journal";
+}
+
+// Reads the header line, leaving fd at the first record.
+bool SessionJournal::readHeader(int fd, string& studentId, string& examName, time_t& startedAt) {
+    string header;
+    char c;
+    while (read(fd, &c, 1) == 1 && c != '\n') {
+        header += c;
+        if (header.size() > 1024) return false;
+    }
+    if (header.rfind("JRNL ", 0) != 0) return false;
+
+    size_t p1 = header.find('|'), p2 = header.find('|', p1 + 1);
+    if (p1 == string::npos || p2 == string::npos) return false;
+    startedAt = atol(header.substr(5, p1 - 5).c_str());
+    studentId = header.substr(p1 + 1, p2 - p1 - 1);
+    examName = header.substr(p2 + 1);
+    return true;
+}
+
+bool SessionJournal::replay(const string& studentId, const string& examName, map<int, AnswerEvent>& state, time_t* startedAt) {
+    int rfd = ::open(pathFor(studentId, examName).c_str(), O_RDONLY);
+    if (rfd == -1) return false;
+
+    string student, exam;
+    time_t started;
+    if (!readHeader(rfd, student, exam, started)) {
+        ::close(rfd);
+        return false;
+    }
+    if (startedAt) *startedAt = started;
+
+    Record records[512];
+    ssize_t bytesRead;
+    while ((bytesRead = read(rfd, records, sizeof(records))) > 0) {
+        // A torn trailing record from a crash is ignored
+        size_t count = bytesRead / sizeof(Record);
+        for (size_t i = 0; i < count; ++i)
+            state[records[i].question] = {records[i].question, records[i].option, static_cast<int>(records[i].timeSpent)};
+    }
+    ::close(rfd);
+    return true;
+}
+
+// Paths of every journal left on disk, i.e. exams still in progress.
+vector<string> SessionJournal::list() {
+    vector<string> paths;
+    DIR* dir = opendir(SESSIONS_DIR);
+    if (!dir) return paths;
+    while (dirent* entry = readdir(dir)) {
+        string name = entry->d_name;
+        if (name.size() > 8 && name.compare(name.size() - 8, 8, ".journal") == 0)
+            paths.push_back(string(SESSIONS_DIR) + "/" + name);
+    }
+    closedir(dir);
+    return paths;
+}
+
+bool SessionJournal::open(const string& studentId, const string& examName) {
+    close();
+    mkdir(SESSIONS_DIR, 0755);
+    path = pathFor(studentId, examName);
+
+    int rfd = ::open(path.c_str(), O_RDONLY);
+    if (rfd != -1) {
+        string student, exam;
+        bool valid = readHeader(rfd, student, exam, startedAt);
+        ::close(rfd);
+        if (!valid) {
+            unlink(path.c_str());
+            Replicator::remove(path);
+        }
+    }
+
+    fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd == -1) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size == 0) {
+        startedAt = time(nullptr);
+        string header = "JRNL " + to_string(startedAt) + "|" + studentId + "|" + examName + "\n";
+        if (write(fd, header.c_str(), header.size()) != (ssize_t)header.size()) return false;
+        Replicator::append(path, header);
+    }
+    return true;
+}
+
+bool SessionJournal::append(const AnswerEvent& event) {
+    if (fd == -1 || event.question < 0 || event.question > UINT16_MAX) return false;
+
+    Record record{};
+    record.question = static_cast<uint16_t>(event.question);
+    record.option = static_cast<int8_t>(event.option);
+    record.timeSpent = event.timeSpent < 0 ? 0 : static_cast<uint32_t>(event.timeSpent);
+    if (write(fd, &record, sizeof(record)) != sizeof(record)) return false;
+    Replicator::append(path, string(reinterpret_cast<const char*>(&record), sizeof(record)));
+    return true;
+}
+
+void SessionJournal::close() {
+    if (fd != -1) ::close(fd);
+    fd = -1;
+}
+
+void SessionJournal::discard() {
+    close();
+    if (!path.empty()) {
+        unlink(path.c_str());
+        Replicator::remove(path);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef SESSION_JOURNAL_H
+#define SESSION_JOURNAL_H
+
+#include <string>
+#include <map>
+#include <vector>
+#include <ctime>
+#include <dirent.h>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+#define SESSIONS_DIR "../data/results/sessions"
+
+// One answer change streamed by the client while the exam is running. The
+// question and option are original (unshuffled) indices, option -1 means
+// cleared, and timeSpent is the running total for that question.
+struct AnswerEvent {
+    int question;
+    int option;
+    int timeSpent;
+};
+
+// Append-only per (student, exam) file: a "JRNL <start>|<student>|<exam>"
+// header line followed by fixed 8 byte answer events. Replaying it gives the
+// latest answer per question, so an unfinished exam survives a client or
+// server crash. The journal is discarded once the exam is submitted.
+class SessionJournal {
+private:
+#pragma pack(push, 1)
+    struct Record {
+        uint16_t question;
+        int8_t option;
+        uint8_t reserved;
+        uint32_t timeSpent;
+    };
+#pragma pack(pop)
+
+    int fd = -1;
+    string path;
+    time_t startedAt = 0;
+
+public:
+    ~SessionJournal();
+    static string pathFor(const string& studentId, const string& examName);
+    static bool readHeader(int fd, string& studentId, string& examName, time_t& startedAt);
+    static bool replay(const string& studentId, const string& examName, map<int, AnswerEvent>& state, time_t* startedAt = nullptr);
+    static vector<string> list();
+
+    bool open(const string& studentId, const string& examName);
+    time_t started() const { return startedAt; }
+    bool append(const AnswerEvent& event);
+    void close();
+    void discard();
+};
+
+#endif
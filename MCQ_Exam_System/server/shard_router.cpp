@@ -0,0 +1,154 @@
+#include "shard_router.h"
+
+int ShardRouter::self = 0;
+int ShardRouter::count = 1;
+vector<pair<uint32_t, int>> ShardRouter::ring;
+ShardHandler ShardRouter::handler = nullptr;
+int ShardRouter::listenFd = -1;
+
+uint32_t ShardRouter::hash(const string& key) {
+    // FNV-1a, 32 bit
+    uint32_t h = 2166136261u;
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 16777619u;
+    }
+    // Names like "Quiz1".."Quiz9" differ only in the last byte and would land
+    // next to each other on the ring; a final avalanche spreads them out.
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+void ShardRouter::configure(int shard, int shards) {
+    self = shard;
+    count = max(1, shards);
+    ring.clear();
+    for (int s = 0; s < count; ++s) {
+        for (int v = 0; v < SHARD_VNODES; ++v)
+            ring.push_back(make_pair(hash("shard-" + to_string(s) + "#" + to_string(v)), s));
+    }
+    sort(ring.begin(), ring.end());
+}
+
+// Adding or removing a shard only moves the exams whose points fall next to
+// that shard's points on the ring.
+int ShardRouter::ownerOf(const string& examName) {
+    if (count <= 1) return 0;
+    auto it = lower_bound(ring.begin(), ring.end(), make_pair(hash(examName), 0));
+    if (it == ring.end()) it = ring.begin();
+    return it->second;
+}
+
+string ShardRouter::socketPath(int shard) {
+    return string(SHARD_RUN_DIR) + "/shard_" + to_string(shard) + ".sock";
+}
+
+bool ShardRouter::listen(ShardHandler h) {
+    handler = h;
+    mkdir(SHARD_RUN_DIR, 0755);
+    string path = socketPath(self);
+    unlink(path.c_str());
+
+    listenFd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (listenFd == -1 || bind(listenFd, (sockaddr*)&addr, sizeof(addr)) == -1 || ::listen(listenFd, SOMAXCONN) == -1) {
+        cerr << "Error: Could not listen on " << path << endl;
+        return false;
+    }
+
+    pthread_t thread;
+    pthread_create(&thread, nullptr, listener, nullptr);
+    pthread_detach(thread);
+    return true;
+}
+
+// Messages are handled inline: a hand-off only starts a thread for the
+// connection, and lookups answer from memory.
+void* ShardRouter::listener(void* arg) {
+    while (true) {
+        int peer = accept(listenFd, nullptr, nullptr);
+        if (peer == -1) continue;
+
+        char buffer[1024];
+        char control[CMSG_SPACE(sizeof(int))];
+        iovec iov{buffer, sizeof(buffer) - 1};
+        msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(peer, &msg, 0);
+        if (n > 0) {
+            int passedFd = -1;
+            cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+                memcpy(&passedFd, CMSG_DATA(cmsg), sizeof(int));
+
+            string reply = handler(string(buffer, n), passedFd);
+            send(peer, reply.c_str(), reply.size(), MSG_NOSIGNAL);
+        }
+        close(peer);
+    }
+    return nullptr;
+}
+
+int ShardRouter::connectTo(int shard) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd == -1) return -1;
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath(shard).c_str(), sizeof(addr.sun_path) - 1);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    // A shard that is restarting must not stall the forwarding thread for long
+    timeval timeout{2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+bool ShardRouter::forward(int shard, const string& message, string& reply, int passFd, bool* sent) {
+    if (sent) *sent = false;
+    int fd = connectTo(shard);
+    if (fd == -1) return false;
+
+    iovec iov{(void*)message.data(), message.size()};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    char control[CMSG_SPACE(sizeof(int))];
+    if (passFd != -1) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &passFd, sizeof(int));
+    }
+
+    bool ok = false;
+    if (sendmsg(fd, &msg, MSG_NOSIGNAL) == (ssize_t)message.size()) {
+        if (sent) *sent = true;
+        string buffer(SHARD_REPLY_MAX, '\0');
+        ssize_t n = recv(fd, &buffer[0], buffer.size(), 0);
+        if (n > 0) {
+            reply.assign(buffer, 0, n);
+            ok = true;
+        }
+    }
+    close(fd);
+    return ok;
+}
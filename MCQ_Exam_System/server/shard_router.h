@@ -0,0 +1,59 @@
+#ifndef SHARD_ROUTER_H
+#define SHARD_ROUTER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define SHARD_RUN_DIR "../data/run"
+#define SHARD_VNODES 64
+#define SHARD_REPLY_MAX (64 * 1024)
+
+// Handles a message from another shard. passedFd is the client connection
+// sent along with it (or -1); the returned string is the reply.
+typedef string (*ShardHandler)(const string& message, int passedFd);
+
+// Exam affinity for multi-process mode. Every exam is owned by one shard,
+// picked by consistent hashing of its name over SHARD_VNODES points per
+// shard, and only the owner runs its sessions, deadlines and grading. Shards
+// talk over SOCK_SEQPACKET Unix sockets in SHARD_RUN_DIR: a connection can
+// be handed to the owner (the fd travels as SCM_RIGHTS), and small requests
+// such as receipt lookups are forwarded and answered with one message.
+class ShardRouter {
+private:
+    static int self;
+    static int count;
+    static vector<pair<uint32_t, int>> ring;  // (point, shard), sorted
+    static ShardHandler handler;
+    static int listenFd;
+
+    static uint32_t hash(const string& key);
+    static string socketPath(int shard);
+    static int connectTo(int shard);
+    static void* listener(void* arg);
+
+public:
+    static void configure(int shard, int shards);
+    static bool enabled() { return count > 1; }
+    static int shard() { return self; }
+    static int shards() { return count; }
+    static int ownerOf(const string& examName);
+    static bool owns(const string& examName) { return ownerOf(examName) == self; }
+
+    static bool listen(ShardHandler handler);
+    // `sent` (if given) tells whether the message, and passFd with it, reached
+    // the shard even when no reply came back in time
+    static bool forward(int shard, const string& message, string& reply, int passFd = -1, bool* sent = nullptr);
+};
+
+#endif
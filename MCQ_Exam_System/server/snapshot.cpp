@@ -0,0 +1,142 @@
+#include "snapshot.h"
+#include "metrics.h"
+
+string Snapshot::path = SNAPSHOT_PATH;
+vector<Snapshot::Section> Snapshot::sections;
+pthread_mutex_t Snapshot::snapshotMutex = PTHREAD_MUTEX_INITIALIZER;
+
+void Snapshot::configure(const string& snapshotPath) {
+    path = snapshotPath;
+}
+
+void Snapshot::addSection(uint32_t id, const string& name, function<void(SnapshotWriter&)> save,
+                          function<bool(SnapshotReader&)> restore) {
+    pthread_mutex_lock(&snapshotMutex);
+    sections.push_back(Section{id, name, save, restore});
+    pthread_mutex_unlock(&snapshotMutex);
+}
+
+// FNV-1a style, but a word at a time: it runs over every byte at startup
+uint64_t Snapshot::checksum(const string& data) {
+    uint64_t h = 14695981039346656037ULL;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data.data() + i, sizeof(word));
+        h = (h ^ word) * 1099511628211ULL;
+    }
+    for (; i < data.size(); ++i) h = (h ^ (unsigned char)data[i]) * 1099511628211ULL;
+    return h ^ (h >> 29);
+}
+
+// File layout: magic, version, creation time, section count, then per
+// section its id, name, payload checksum and length-prefixed payload.
+bool Snapshot::load() {
+    long long started = Metrics::nowMs();
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    struct stat st;
+    fstat(fd, &st);
+    string content(st.st_size, '\0');
+    ssize_t got = 0, n;
+    while (got < st.st_size && (n = read(fd, &content[got], st.st_size - got)) > 0) got += n;
+    close(fd);
+    content.resize(got);
+
+    SnapshotReader file(content);
+    if (file.u64() != SNAPSHOT_MAGIC || file.u64() != SNAPSHOT_VERSION) {
+        cerr << "[!] Ignoring " << path << ": not a snapshot of this version.\n";
+        return false;
+    }
+    long long createdMs = file.u64();
+    uint64_t count = file.u64();
+
+    pthread_mutex_lock(&snapshotMutex);
+    vector<Section> known = sections;
+    pthread_mutex_unlock(&snapshotMutex);
+
+    int restored = 0;
+    for (uint64_t i = 0; i < count && file.ok; ++i) {
+        uint32_t id = file.u64();
+        string name = file.str();
+        uint64_t sum = file.u64();
+        string payload = file.str();
+        if (!file.ok) break;
+        if (checksum(payload) != sum) {
+            cerr << "[!] Snapshot section " << name << " is corrupt, rebuilding it from the data files.\n";
+            continue;
+        }
+        for (Section& section : known) {
+            if (section.id != id) continue;
+            SnapshotReader reader(payload);
+            if (section.restore(reader) && reader.done()) restored++;
+            else cerr << "[!] Could not restore snapshot section " << name << ", rebuilding it from the data files.\n";
+        }
+    }
+    cout << "[+] Restored " << restored << " sections from " << path << " ("
+         << (Metrics::nowMs() - createdMs) / 1000 << " s old) in " << Metrics::nowMs() - started << " ms." << endl;
+    return restored > 0;
+}
+
+bool Snapshot::save() {
+    long long started = Metrics::nowMs();
+    pthread_mutex_lock(&snapshotMutex);
+    vector<Section> current = sections;
+    pthread_mutex_unlock(&snapshotMutex);
+
+    // Each section is serialized under its component's own lock, so it is
+    // consistent with the file offsets it records
+    string content;
+    SnapshotWriter file(content);
+    file.u64(SNAPSHOT_MAGIC);
+    file.u64(SNAPSHOT_VERSION);
+    file.u64(Metrics::nowMs());
+    file.u64(current.size());
+    for (Section& section : current) {
+        string payload;
+        SnapshotWriter writer(payload);
+        section.save(writer);
+        file.u64(section.id);
+        file.str(section.name);
+        file.u64(checksum(payload));
+        file.str(payload);
+    }
+
+    string tmpPath = path + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd != -1;
+    for (size_t written = 0; ok && written < content.size();) {
+        ssize_t n = write(fd, content.data() + written, content.size() - written);
+        ok = n > 0;
+        if (ok) written += n;
+    }
+    if (fd != -1) {
+        ok = ok && fsync(fd) == 0;
+        close(fd);
+    }
+    ok = ok && rename(tmpPath.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        cerr << "[!] Failed to write snapshot " << path << "\n";
+        return false;
+    }
+    Metrics::add("snapshots_written_total");
+    Metrics::set("snapshot_bytes", content.size());
+    Metrics::set("snapshot_write_ms", Metrics::nowMs() - started);
+    return true;
+}
+
+void* Snapshot::run(void* arg) {
+    long long intervalMs = *static_cast<long long*>(arg);
+    delete static_cast<long long*>(arg);
+    while (true) {
+        usleep(intervalMs * 1000);
+        save();
+    }
+    return nullptr;
+}
+
+void Snapshot::start(long long intervalMs) {
+    pthread_t thread;
+    pthread_create(&thread, nullptr, run, new long long(intervalMs));
+    pthread_detach(thread);
+}
@@ -0,0 +1,111 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+#define SNAPSHOT_PATH "../data/results/state.snap"
+#define SNAPSHOT_MAGIC 0x5053434du  // "MCSP"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_INTERVAL_MS 30000
+
+// Section ids. New sections get new ids; a reader skips ids it does not know.
+#define SNAPSHOT_CATALOG 1
+#define SNAPSHOT_EXAM_STATS 2
+#define SNAPSHOT_STUDENT_PROGRESS 3
+#define SNAPSHOT_RESPONSE_TIMES 4
+
+// Little helpers for section payloads: fixed-width integers and
+// length-prefixed strings, native byte order (snapshots never leave the host).
+class SnapshotWriter {
+private:
+    string& out;
+
+public:
+    SnapshotWriter(string& out) : out(out) {}
+    void u64(uint64_t value) { out.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+    void i32(int32_t value) { out.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+    void str(const string& value) {
+        u64(value.size());
+        out += value;
+    }
+};
+
+class SnapshotReader {
+private:
+    const string& in;
+    size_t pos = 0;
+
+public:
+    bool ok = true;
+    SnapshotReader(const string& in) : in(in) {}
+    uint64_t u64() {
+        uint64_t value = 0;
+        if (in.size() - pos < sizeof(value)) ok = false;
+        if (ok) memcpy(&value, in.data() + pos, sizeof(value));
+        if (ok) pos += sizeof(value);
+        return value;
+    }
+    int32_t i32() {
+        int32_t value = 0;
+        if (in.size() - pos < sizeof(value)) ok = false;
+        if (ok) memcpy(&value, in.data() + pos, sizeof(value));
+        if (ok) pos += sizeof(value);
+        return value;
+    }
+    string str() {
+        uint64_t length = u64();
+        if (in.size() - pos < length) ok = false;
+        if (!ok) return "";
+        pos += length;
+        return in.substr(pos - length, length);
+    }
+    bool done() { return ok && pos == in.size(); }
+};
+
+// Periodic snapshot of the in-memory state that is otherwise rebuilt from
+// the text files (exam catalog, leaderboards and score distributions), so a
+// restart is back to full speed without re-reading them. Components register
+// a section; one built from ResultStore keys records how far into each
+// writer's part of them it had read, so on restore it only has to fold in
+// what those keys gained since. Sections are checksummed and written to a
+// temporary file that is fsynced and renamed over the previous snapshot, so
+// a crash leaves either the old or the new one. A bad or unknown section is
+// skipped and that component rebuilds from text as before. Users are not included: UserStore keeps its own compiled image.
+class Snapshot {
+private:
+    struct Section {
+        uint32_t id;
+        string name;
+        function<void(SnapshotWriter&)> save;
+        function<bool(SnapshotReader&)> restore;
+    };
+
+    static string path;
+    static vector<Section> sections;
+    static pthread_mutex_t snapshotMutex;
+
+    static uint64_t checksum(const string& data);
+    static void* run(void* arg);
+
+public:
+    static void configure(const string& path);
+    static void addSection(uint32_t id, const string& name, function<void(SnapshotWriter&)> save,
+                           function<bool(SnapshotReader&)> restore);
+    static bool load();
+    static bool save();
+    static void start(long long intervalMs);
+};
+
+#endif
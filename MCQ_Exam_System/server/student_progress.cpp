@@ -0,0 +1,193 @@
+#include "student_progress.h"
+#include <sstream>
+#include "metrics.h"
+#include "result_store.h"
+
+vector<StudentProgress::Student*> StudentProgress::students;
+pthread_mutex_t StudentProgress::progressMutex = PTHREAD_MUTEX_INITIALIZER;
+
+string StudentProgress::attemptsPath(const string& studentId) {
+    return "../data/results/student_" + studentId + "_attempts.txt";
+}
+
+// One "<exam>|<date time>|<marks>|<total>|<performance file>|<seconds>|<answered>"
+// line; lines written before the last two fields existed have no time.
+// Writers are folded one after another, so attempts are placed by their
+// timestamp, not by the order they are read in.
+void StudentProgress::add(Student& student, const string& line) {
+    istringstream fields(line);
+    string examName, at, marks, total, perfPath, seconds, answered;
+    if (!getline(fields, examName, '|') || !getline(fields, at, '|') || !getline(fields, marks, '|') ||
+        !getline(fields, total, '|') || examName.empty())
+        return;
+    int obtained = atoi(marks.c_str());
+    bool timed = getline(fields, perfPath, '|') && getline(fields, seconds, '|') && getline(fields, answered);
+
+    auto it = lower_bound(student.exams.begin(), student.exams.end(), examName,
+                          [](const ExamProgress& exam, const string& name) { return exam.exam < name; });
+    if (it == student.exams.end() || it->exam != examName) {
+        it = student.exams.insert(it, ExamProgress());
+        it->exam = examName;
+        it->best = obtained;
+        it->firstAt = at;
+        it->first = obtained;
+    }
+    ExamProgress& exam = *it;
+    exam.attempts++;
+    exam.marksSum += obtained;
+    if (timed) {
+        exam.secondsSum += atoll(seconds.c_str());
+        exam.answered += atoll(answered.c_str());
+    }
+    exam.best = max(exam.best, obtained);
+    if (at < exam.firstAt) {
+        exam.firstAt = at;
+        exam.first = obtained;
+    }
+    if (at >= exam.latestAt) {
+        exam.latestAt = at;
+        exam.latest = obtained;
+        exam.outOf = atoi(total.c_str());
+    }
+}
+
+// Must be called with progressMutex held
+StudentProgress::Student*& StudentProgress::slot(uint32_t studentId) {
+    if (studentId >= students.size()) students.resize(studentId + 1, nullptr);
+    return students[studentId];
+}
+
+// Folds in whatever was appended to the attempts file since the last view.
+// The read happens outside progressMutex; if another view of the same
+// student folded in the meantime, this one's read is dropped and the next
+// view picks up from where that one got to.
+bool StudentProgress::view(const string& studentId, vector<ExamProgress>& exams) {
+    uint32_t id = Symbols::users.intern(studentId);
+    if (id == SYMBOL_NONE) return false;
+    map<int, uint64_t> consumed;
+    pthread_mutex_lock(&progressMutex);
+    Student* known = slot(id);
+    if (known) consumed = known->consumed;
+    pthread_mutex_unlock(&progressMutex);
+
+    map<int, uint64_t> start = consumed;
+    string tail;
+    bool appended = ResultStore::readNew(attemptsPath(studentId), consumed, tail);
+
+    pthread_mutex_lock(&progressMutex);
+    Student*& student = slot(id);
+    if (appended && (student ? student->consumed : map<int, uint64_t>()) == start) {
+        if (!student) student = new Student();
+        // Results are appended a batch at a time, so every writer's part ends on a line
+        istringstream lines(tail);
+        string line;
+        int added = 0;
+        while (getline(lines, line)) {
+            add(*student, line);
+            added++;
+        }
+        student->consumed.swap(consumed);
+        Metrics::add("progress_attempts_folded_total", added);
+    }
+    bool found = student && !student->exams.empty();
+    if (found) exams = student->exams;
+    pthread_mutex_unlock(&progressMutex);
+    return found;
+}
+
+// Snapshot section: per student by name, the per-writer positions in the
+// attempts file and the exam counters. A restart then only folds in the
+// attempts made since the snapshot.
+void StudentProgress::encode(const Student& student, string& out) {
+    SnapshotWriter writer(out);
+    writer.u64(student.consumed.size());
+    for (auto& writerOffset : student.consumed) {
+        writer.i32(writerOffset.first);
+        writer.u64(writerOffset.second);
+    }
+    writer.u64(student.exams.size());
+    for (const ExamProgress& exam : student.exams) {
+        writer.str(exam.exam);
+        writer.i32(exam.attempts);
+        writer.i32(exam.first);
+        writer.i32(exam.best);
+        writer.i32(exam.latest);
+        writer.i32(exam.outOf);
+        writer.u64(exam.marksSum);
+        writer.u64(exam.secondsSum);
+        writer.u64(exam.answered);
+        writer.str(exam.firstAt);
+        writer.str(exam.latestAt);
+    }
+}
+
+bool StudentProgress::decode(SnapshotReader& reader, Student& student) {
+    uint64_t writers = reader.u64();
+    for (uint64_t i = 0; i < writers && reader.ok; ++i) {
+        int writer = reader.i32();
+        student.consumed[writer] = reader.u64();
+    }
+    uint64_t count = reader.u64();
+    for (uint64_t i = 0; i < count && reader.ok; ++i) {
+        ExamProgress exam;
+        exam.exam = reader.str();
+        exam.attempts = reader.i32();
+        exam.first = reader.i32();
+        exam.best = reader.i32();
+        exam.latest = reader.i32();
+        exam.outOf = reader.i32();
+        exam.marksSum = reader.u64();
+        exam.secondsSum = reader.u64();
+        exam.answered = reader.u64();
+        exam.firstAt = reader.str();
+        exam.latestAt = reader.str();
+        student.exams.push_back(exam);
+    }
+    return reader.ok;
+}
+
+// Students are never freed, so the pointers stay valid between lock holds
+void StudentProgress::save(SnapshotWriter& out) {
+    vector<pair<uint32_t, Student*>> current;
+    pthread_mutex_lock(&progressMutex);
+    for (uint32_t id = 0; id < students.size(); ++id) {
+        if (students[id]) current.push_back(make_pair(id, students[id]));
+    }
+    pthread_mutex_unlock(&progressMutex);
+
+    out.u64(current.size());
+    for (auto& known : current) {
+        string encoded;
+        pthread_mutex_lock(&progressMutex);
+        encode(*known.second, encoded);
+        pthread_mutex_unlock(&progressMutex);
+        out.str(Symbols::users.name(known.first));
+        out.str(encoded);
+    }
+}
+
+// Runs at startup, before any view
+bool StudentProgress::restore(SnapshotReader& in) {
+    vector<pair<uint32_t, Student*>> restored;
+    uint64_t count = in.u64();
+    for (uint64_t i = 0; i < count && in.ok; ++i) {
+        uint32_t id = Symbols::users.intern(in.str());
+        string encoded = in.str();
+        SnapshotReader reader(encoded);
+        Student* student = new Student();
+        if (!decode(reader, *student) || !reader.done()) in.ok = false;
+        restored.push_back(make_pair(id, student));
+    }
+    if (!in.ok) {
+        for (auto& known : restored) delete known.second;
+        return false;
+    }
+    pthread_mutex_lock(&progressMutex);
+    for (auto& known : restored) {
+        Student*& student = slot(known.first);
+        delete student;
+        student = known.second;
+    }
+    pthread_mutex_unlock(&progressMutex);
+    return true;
+}
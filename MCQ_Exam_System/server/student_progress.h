@@ -0,0 +1,55 @@
+#ifndef STUDENT_PROGRESS_H
+#define STUDENT_PROGRESS_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <pthread.h>
+
+#include "snapshot.h"
+#include "symbols.h"
+
+using namespace std;
+
+// One exam on a student's landing page
+struct ExamProgress {
+    string exam;
+    int attempts = 0;
+    int first = 0, best = 0, latest = 0;  // marks
+    int outOf = 0;                        // total marks of the latest attempt
+    long long marksSum = 0;
+    long long secondsSum = 0;             // time spent, over attempts that recorded it
+    long long answered = 0;               // questions answered in those attempts
+    string firstAt, latestAt;
+};
+
+// Per-student aggregates behind the performance dashboard, folded forward
+// from the student's attempts file in ResultStore. Each attempt is one line
+// there and updates its exam's counters in place, and a view only reads
+// what each writer appended since the last one, so the landing page costs
+// one lookup however many attempts the student has made.
+class StudentProgress {
+private:
+    struct Student {
+        map<int, uint64_t> consumed;  // bytes folded in, per ResultStore writer
+        vector<ExamProgress> exams;   // sorted by exam name
+    };
+
+    static vector<Student*> students;  // by Symbols::users id, null if never viewed
+    static pthread_mutex_t progressMutex;
+
+    static string attemptsPath(const string& studentId);
+    static void add(Student& student, const string& line);
+    static Student*& slot(uint32_t studentId);
+    static void encode(const Student& student, string& out);
+    static bool decode(SnapshotReader& reader, Student& student);
+
+public:
+    static bool view(const string& studentId, vector<ExamProgress>& exams);
+    static void save(SnapshotWriter& out);
+    static bool restore(SnapshotReader& in);
+};
+
+#endif
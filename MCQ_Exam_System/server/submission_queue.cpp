@@ -0,0 +1,219 @@
+#include "submission_queue.h"
+#include "replication.h"
+#include "result_store.h"
+#include "report_cache.h"
+
+int SubmissionQueue::logFd = -1;
+string SubmissionQueue::logPath = SUBMISSION_LOG;
+unsigned long long SubmissionQueue::nextId = 0;
+unsigned long long SubmissionQueue::idOffset = 0;
+unsigned long long SubmissionQueue::idStride = 1;
+deque<Submission> SubmissionQueue::pending;
+unordered_map<unsigned long long, SubmissionStatus> SubmissionQueue::results;
+deque<unsigned long long> SubmissionQueue::resultOrder;
+Grader SubmissionQueue::grader = nullptr;
+pthread_mutex_t SubmissionQueue::queueMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t SubmissionQueue::queueCond = PTHREAD_COND_INITIALIZER;
+
+// "SUBMIT <id>|<unix time>|<student>|<exam>|<question>,<option>,<seconds>;..."
+string SubmissionQueue::encode(const Submission& submission) {
+    string entry = "SUBMIT " + to_string(submission.id) + "|" + to_string(submission.submittedAt) + "|" + submission.studentId + "|" + submission.examName + "|";
+    for (auto& answer : submission.answers) {
+        const AnswerEvent& e = answer.second;
+        entry += to_string(e.question) + "," + to_string(e.option) + "," + to_string(e.timeSpent) + ";";
+    }
+    return entry + "\n";
+}
+
+bool SubmissionQueue::decode(const string& line, Submission& submission) {
+    istringstream iss(line.substr(7));
+    string id, submittedAt, answers;
+    if (!getline(iss, id, '|') || !getline(iss, submittedAt, '|') || !getline(iss, submission.studentId, '|') ||
+        !getline(iss, submission.examName, '|')) return false;
+    getline(iss, answers);
+
+    // The last line may be torn by a crash
+    char* end;
+    submission.id = strtoull(id.c_str(), &end, 10);
+    if (id.empty() || *end) return false;
+    submission.submittedAt = strtoll(submittedAt.c_str(), &end, 10);
+    if (submittedAt.empty() || *end) return false;
+    submission.answers.clear();
+    istringstream answerStream(answers);
+    string item;
+    while (getline(answerStream, item, ';')) {
+        AnswerEvent e;
+        char delim;
+        istringstream itemStream(item);
+        if (itemStream >> e.question >> delim >> e.option >> delim >> e.timeSpent)
+            submission.answers[e.question] = e;
+    }
+    return true;
+}
+
+void SubmissionQueue::configure(const string& path, unsigned long long offset, unsigned long long stride) {
+    logPath = path;
+    idStride = max(1ULL, stride);
+    idOffset = offset % idStride;
+}
+
+// Re-queues everything that was acknowledged but never graded, then rewrites
+// the log with just those entries so it does not grow without bound. The
+// new log is fsynced before it replaces the old one; if it cannot be
+// written the old log is kept and startup fails, since dropping it would
+// lose those submissions and the receipt id high-water mark.
+bool SubmissionQueue::recover() {
+    map<unsigned long long, Submission> unfinished;
+    ifstream in(logPath);
+    string line;
+    while (getline(in, line)) {
+        if (line.rfind("SUBMIT ", 0) == 0) {
+            Submission submission;
+            if (decode(line, submission)) {
+                nextId = max(nextId, submission.id);
+                unfinished[submission.id] = submission;
+            }
+        } else if (line.rfind("DONE ", 0) == 0) {
+            char* end;
+            unsigned long long id = strtoull(line.c_str() + 5, &end, 10);
+            if (end == line.c_str() + 5 || *end) continue;
+            nextId = max(nextId, id);
+            unfinished.erase(id);
+        }
+    }
+    in.close();
+
+    // Keep the id high-water mark so receipts stay unique across restarts
+    string content = "DONE " + to_string(nextId) + "\n";
+    for (auto& entry : unfinished) content += encode(entry.second);
+
+    string tmpPath = logPath + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd != -1;
+    for (size_t done = 0; ok && done < content.size();) {
+        ssize_t n = write(fd, content.data() + done, content.size() - done);
+        ok = n > 0;
+        if (ok) done += n;
+    }
+    ok = ok && fsync(fd) == 0;
+    if (fd != -1 && close(fd) != 0) ok = false;
+    ok = ok && rename(tmpPath.c_str(), logPath.c_str()) == 0;
+    if (!ok) {
+        cerr << "Error: Unable to rewrite " << logPath << ": " << strerror(errno) << endl;
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    Replicator::putFile(logPath);
+
+    for (auto& entry : unfinished) {
+        pending.push_back(entry.second);
+        results[entry.first].studentId = entry.second.studentId;
+        resultOrder.push_back(entry.first);
+    }
+    if (!unfinished.empty())
+        cout << "[+] Re-queued " << unfinished.size() << " ungraded submissions.\n";
+    return true;
+}
+
+bool SubmissionQueue::start(Grader g) {
+    grader = g;
+
+    logFd = open(logPath.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (logFd == -1) {
+        cerr << "Error: Unable to open " << logPath << endl;
+        return false;
+    }
+
+    pthread_t thread;
+    pthread_create(&thread, nullptr, worker, nullptr);
+    pthread_detach(thread);
+    return true;
+}
+
+unsigned long long SubmissionQueue::enqueue(const string& studentId, const string& examName, const map<int, AnswerEvent>& answers) {
+    Submission submission{0, time(nullptr), studentId, examName, answers};
+
+    pthread_mutex_lock(&queueMutex);
+    nextId += 1 + (idOffset + idStride - (nextId + 1) % idStride) % idStride;
+    submission.id = nextId;
+    string entry = encode(submission);
+    if (logFd == -1 || write(logFd, entry.c_str(), entry.size()) != (ssize_t)entry.size()) {
+        pthread_mutex_unlock(&queueMutex);
+        cerr << "Error: Unable to record submission for " << studentId << endl;
+        return 0;
+    }
+    // Shipped under the lock so the standby sees the log in the same order
+    unsigned long long record = Replicator::append(logPath, entry);
+    pending.push_back(submission);
+    results[submission.id].studentId = studentId;
+    resultOrder.push_back(submission.id);
+    pthread_cond_signal(&queueCond);
+    pthread_mutex_unlock(&queueMutex);
+
+    Metrics::add("submissions_received_total");
+    Replicator::waitForStandby(record);
+    return submission.id;
+}
+
+bool SubmissionQueue::status(unsigned long long id, SubmissionStatus& status) {
+    pthread_mutex_lock(&queueMutex);
+    auto it = results.find(id);
+    bool found = it != results.end();
+    if (found) status = it->second;
+    pthread_mutex_unlock(&queueMutex);
+    return found;
+}
+
+void SubmissionQueue::backoff(long long& delayMs, const char* what) {
+    delayMs = delayMs ? min<long long>(delayMs * 2, PERSIST_RETRY_MAX_MS) : 100;
+    Metrics::add("submission_persist_retries_total");
+    cerr << "Error: Failed to persist " << what << ", retrying in " << delayMs << " ms\n";
+    usleep(delayMs * 1000);
+}
+
+void* SubmissionQueue::worker(void* arg) {
+    while (true) {
+        vector<Submission> batch;
+        pthread_mutex_lock(&queueMutex);
+        while (pending.empty()) pthread_cond_wait(&queueCond, &queueMutex);
+        while (!pending.empty() && batch.size() < GRADING_BATCH) {
+            batch.push_back(move(pending.front()));
+            pending.pop_front();
+        }
+        pthread_mutex_unlock(&queueMutex);
+
+        vector<AppendOp> writes;
+        vector<SubmissionStatus> graded(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (!grader(batch[i], graded[i], writes))
+                cerr << "Error: Grading failed for submission " << batch[i].id << endl;
+            graded[i].graded = true;
+        }
+
+        // Results must be on disk before the submissions are marked done.
+        // Grading again would count the attempts twice, so the same writes
+        // are retried.
+        long long delayMs = 0;
+        while (!ResultStore::appendBatch(writes)) backoff(delayMs, "results");
+        Replicator::ship(writes);
+        for (const Submission& submission : batch) ReportCache::invalidateLeaderboard(submission.examName);
+        string done;
+        for (const Submission& submission : batch) done += "DONE " + to_string(submission.id) + "\n";
+        delayMs = 0;
+        while (!IoBackend::get()->appendBatch({AppendOp{logPath, done}})) backoff(delayMs, "the submission log");
+        Replicator::append(logPath, done);
+        Metrics::add("submissions_graded_total", batch.size());
+
+        pthread_mutex_lock(&queueMutex);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            graded[i].studentId = batch[i].studentId;
+            results[batch[i].id] = graded[i];
+        }
+        while (resultOrder.size() > MAX_TRACKED_RESULTS) {
+            results.erase(resultOrder.front());
+            resultOrder.pop_front();
+        }
+        pthread_mutex_unlock(&queueMutex);
+    }
+    return nullptr;
+}
@@ -0,0 +1,83 @@
+#ifndef SUBMISSION_QUEUE_H
+#define SUBMISSION_QUEUE_H
+
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <map>
+#include <deque>
+#include <unordered_map>
+#include <pthread.h>
+#include <ctime>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "session_journal.h"
+#include "io_backend.h"
+
+using namespace std;
+
+#define SUBMISSION_LOG "../data/results/submissions.log"
+#define MAX_TRACKED_RESULTS 100000
+#define GRADING_BATCH 64
+#define PERSIST_RETRY_MAX_MS 5000  // backoff cap while result or log appends keep failing
+
+struct Submission {
+    unsigned long long id;
+    time_t submittedAt;
+    string studentId;
+    string examName;
+    map<int, AnswerEvent> answers;
+};
+
+struct SubmissionStatus {
+    string studentId;  // receipts are sequential, so only the owner may look one up
+    bool graded = false;
+    int marks = 0;
+    int totalMarks = 0;
+};
+
+// Grades one submission and adds the result file appends it needs to writes.
+typedef bool (*Grader)(const Submission& submission, SubmissionStatus& status, vector<AppendOp>& writes);
+
+// Durable hand-off between the connection threads and grading. enqueue()
+// appends the submission to SUBMISSION_LOG and returns a receipt id right
+// away; a single worker thread grades whatever has queued up (up to
+// GRADING_BATCH at a time), persists all their results with one
+// IoBackend::appendBatch, then logs "DONE <id>" for each. Both appends are
+// retried until they succeed, so a graded batch is never dropped or graded
+// twice while the server runs. Submissions without
+// a DONE line are re-queued on startup. In multi-process mode every shard
+// keeps its own log and hands out ids congruent to its shard number, so a
+// receipt tells which shard graded it.
+class SubmissionQueue {
+private:
+    static int logFd;
+    static string logPath;
+    static unsigned long long nextId;
+    static unsigned long long idOffset;
+    static unsigned long long idStride;
+    static deque<Submission> pending;
+    static unordered_map<unsigned long long, SubmissionStatus> results;
+    static deque<unsigned long long> resultOrder;
+    static Grader grader;
+    static pthread_mutex_t queueMutex;
+    static pthread_cond_t queueCond;
+
+    static string encode(const Submission& submission);
+    static bool decode(const string& line, Submission& submission);
+    static void backoff(long long& delayMs, const char* what);
+    static void* worker(void* arg);
+
+public:
+    static void configure(const string& path, unsigned long long offset, unsigned long long stride);
+    static const string& log() { return logPath; }
+    static bool recover();
+    static bool start(Grader grader);
+    static unsigned long long enqueue(const string& studentId, const string& examName, const map<int, AnswerEvent>& answers);
+    static bool status(unsigned long long id, SubmissionStatus& status);
+};
+
+#endif
@@ -0,0 +1,49 @@
+#include "symbols.h"
+#include "metrics.h"
+
+SymbolTable Symbols::users;
+SymbolTable Symbols::exams;
+
+SymbolTable::SymbolTable() : count(0), chunks() {
+    pthread_rwlock_init(&indexLock, nullptr);
+}
+
+uint32_t SymbolTable::find(string_view name) {
+    pthread_rwlock_rdlock(&indexLock);
+    auto it = index.find(name);
+    uint32_t id = it == index.end() ? SYMBOL_NONE : it->second;
+    pthread_rwlock_unlock(&indexLock);
+    return id;
+}
+
+uint32_t SymbolTable::intern(string_view name) {
+    uint32_t id = find(name);
+    if (id != SYMBOL_NONE) return id;
+
+    pthread_rwlock_wrlock(&indexLock);
+    auto it = index.find(name);
+    if (it != index.end()) {
+        id = it->second;
+    } else {
+        id = count.load(memory_order_relaxed);
+        if ((id >> SYMBOL_CHUNK_BITS) >= SYMBOL_CHUNKS) {
+            pthread_rwlock_unlock(&indexLock);
+            Metrics::add("symbols_full_total");
+            return SYMBOL_NONE;
+        }
+        string*& chunk = chunks[id >> SYMBOL_CHUNK_BITS];
+        if (!chunk) chunk = new string[1 << SYMBOL_CHUNK_BITS];
+        string& stored = chunk[id & ((1 << SYMBOL_CHUNK_BITS) - 1)];
+        stored = name;
+        index.emplace(string_view(stored), id);
+        // Publishes the name before anyone can be handed its id
+        count.store(id + 1, memory_order_release);
+        Metrics::add("symbols_interned_total");
+    }
+    pthread_rwlock_unlock(&indexLock);
+    return id;
+}
+
+const string& SymbolTable::name(uint32_t id) const {
+    return chunks[id >> SYMBOL_CHUNK_BITS][id & ((1 << SYMBOL_CHUNK_BITS) - 1)];
+}
@@ -0,0 +1,50 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <pthread.h>
+
+using namespace std;
+
+#define SYMBOL_NONE 0xffffffffu
+#define SYMBOL_CHUNK_BITS 12  // names per chunk: 4096
+#define SYMBOL_CHUNKS 4096    // so at most 16M names per table
+
+// Dense 32 bit ids for names, handed out in first-seen order and never
+// reused, so structures keyed by a name can be flat arrays indexed by its
+// id. Names live in fixed chunks that never move: name() takes no lock and
+// its reference stays valid for the life of the process. Lookups by name
+// share a read lock; only a new name takes the write lock.
+// Ids are per process. Anything written to disk or sent to another shard
+// carries the name. Once a table is full, intern() of a new name returns
+// SYMBOL_NONE and callers refuse or skip whatever needed the id.
+class SymbolTable {
+private:
+    pthread_rwlock_t indexLock;
+    unordered_map<string_view, uint32_t> index;  // views into the chunks
+    atomic<uint32_t> count;
+    string* chunks[SYMBOL_CHUNKS];
+
+public:
+    SymbolTable();
+    uint32_t intern(string_view name);  // SYMBOL_NONE if the table is full
+    uint32_t find(string_view name);  // SYMBOL_NONE if never interned
+    const string& name(uint32_t id) const;
+    uint32_t size() const { return count.load(memory_order_acquire); }
+    bool full() const { return size() >= (uint32_t)SYMBOL_CHUNKS << SYMBOL_CHUNK_BITS; }
+};
+
+// Interned at login and upload; other names are interned on first use.
+class Symbols {
+public:
+    static SymbolTable users;
+    static SymbolTable exams;
+};
+
+#endif
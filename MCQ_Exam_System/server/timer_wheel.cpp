@@ -0,0 +1,143 @@
+#include "timer_wheel.h"
+
+TimerWheel::~TimerWheel() {
+    for (auto& entry : timers) delete entry.second;
+}
+
+uint64_t TimerWheel::nowMs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+// Places a timer by how far away it is: level 0 holds the next 256 ticks,
+// each higher level covers 256 times the range of the one below.
+void TimerWheel::link(Timer* timer) {
+    uint64_t expires = timer->expires;
+    uint64_t delta = expires > currentTick ? expires - currentTick : 0;
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1)))) ++level;
+    if (level == LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * LEVELS)))
+        expires = currentTick + (1ULL << (SLOT_BITS * LEVELS)) - 1;  // clamp to the wheel's range
+    if (delta == 0) expires = currentTick;
+
+    int index = (expires >> (SLOT_BITS * level)) & (SLOTS - 1);
+    timer->level = level;
+    timer->index = index;
+    Timer*& head = slots[level][index];
+    timer->prev = nullptr;
+    timer->next = head;
+    if (head) head->prev = timer;
+    head = timer;
+}
+
+void TimerWheel::unlink(Timer* timer) {
+    if (timer->prev) timer->prev->next = timer->next;
+    else slots[timer->level][timer->index] = timer->next;
+    if (timer->next) timer->next->prev = timer->prev;
+    timer->prev = timer->next = nullptr;
+}
+
+// Moves every timer in a higher level slot down to where it now belongs.
+// Returns the slot index so the caller knows whether this level wrapped.
+int TimerWheel::cascade(int level, int index) {
+    Timer* timer = slots[level][index];
+    slots[level][index] = nullptr;
+    while (timer) {
+        Timer* next = timer->next;
+        link(timer);
+        timer = next;
+    }
+    return index;
+}
+
+void TimerWheel::advance(vector<function<void()>>& expired) {
+    int index = currentTick & (SLOTS - 1);
+    if (index == 0) {
+        for (int level = 1; level < LEVELS; ++level) {
+            if (cascade(level, (currentTick >> (SLOT_BITS * level)) & (SLOTS - 1)) != 0) break;
+        }
+    }
+
+    Timer* timer = slots[0][index];
+    slots[0][index] = nullptr;
+    while (timer) {
+        Timer* next = timer->next;
+        timers.erase(timer->id);
+        expired.push_back(move(timer->callback));
+        delete timer;
+        timer = next;
+    }
+    ++currentTick;
+}
+
+void* TimerWheel::run(void* arg) {
+    TimerWheel* wheel = static_cast<TimerWheel*>(arg);
+    pthread_cond_t tickCond;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&tickCond, &attr);
+
+    vector<function<void()>> expired;
+    while (true) {
+        pthread_mutex_lock(&wheel->wheelMutex);
+        uint64_t targetTick = (nowMs() - wheel->startMs) / TIMER_TICK_MS;
+        while (wheel->currentTick <= targetTick) wheel->advance(expired);
+
+        // Wait for the next tick boundary; nothing signals this condition
+        uint64_t wakeMs = wheel->startMs + wheel->currentTick * TIMER_TICK_MS;
+        timespec wake;
+        wake.tv_sec = wakeMs / 1000;
+        wake.tv_nsec = (wakeMs % 1000) * 1000000;
+        if (expired.empty()) pthread_cond_timedwait(&tickCond, &wheel->wheelMutex, &wake);
+        pthread_mutex_unlock(&wheel->wheelMutex);
+
+        for (auto& callback : expired) callback();
+        expired.clear();
+    }
+    return nullptr;
+}
+
+void TimerWheel::start() {
+    startMs = nowMs();
+    pthread_t thread;
+    pthread_create(&thread, nullptr, run, this);
+    pthread_detach(thread);
+}
+
+unsigned long long TimerWheel::schedule(unsigned long long delayMs, function<void()> callback) {
+    pthread_mutex_lock(&wheelMutex);
+    Timer* timer = new Timer{++nextId, 0, move(callback), 0, 0, nullptr, nullptr};
+    // Round up so a timer never fires early
+    uint64_t elapsed = startMs ? nowMs() - startMs : 0;
+    timer->expires = (elapsed + delayMs + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    if (timer->expires < currentTick) timer->expires = currentTick;
+    timers[timer->id] = timer;
+    link(timer);
+    unsigned long long id = timer->id;
+    pthread_mutex_unlock(&wheelMutex);
+    return id;
+}
+
+bool TimerWheel::cancel(unsigned long long id) {
+    pthread_mutex_lock(&wheelMutex);
+    auto it = timers.find(id);
+    if (it == timers.end()) {
+        pthread_mutex_unlock(&wheelMutex);
+        return false;
+    }
+    Timer* timer = it->second;
+    timers.erase(it);
+    unlink(timer);
+    pthread_mutex_unlock(&wheelMutex);
+    delete timer;
+    return true;
+}
+
+size_t TimerWheel::size() {
+    pthread_mutex_lock(&wheelMutex);
+    size_t count = timers.size();
+    pthread_mutex_unlock(&wheelMutex);
+    return count;
+}
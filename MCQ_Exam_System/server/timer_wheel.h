@@ -0,0 +1,58 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <iostream>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <ctime>
+#include <cstdint>
+#include <pthread.h>
+
+using namespace std;
+
+#define TIMER_TICK_MS 100
+
+// Hierarchical timing wheel (4 levels of 256 slots, 100 ms ticks). Timers
+// live in intrusive per-slot lists, so schedule and cancel are O(1); a timer
+// is only touched again when its slot comes up or its level cascades. A
+// single thread advances the wheel and runs expired callbacks outside the
+// lock, so callbacks may schedule or cancel other timers.
+class TimerWheel {
+private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 8;
+    static const int SLOTS = 1 << SLOT_BITS;
+
+    struct Timer {
+        unsigned long long id;
+        uint64_t expires;  // in ticks
+        function<void()> callback;
+        int level, index;  // slot the timer is linked into
+        Timer* prev;
+        Timer* next;
+    };
+
+    Timer* slots[LEVELS][SLOTS] = {};
+    unordered_map<unsigned long long, Timer*> timers;
+    uint64_t currentTick = 0;
+    unsigned long long nextId = 0;
+    uint64_t startMs = 0;
+    pthread_mutex_t wheelMutex = PTHREAD_MUTEX_INITIALIZER;
+
+    static uint64_t nowMs();
+    void link(Timer* timer);
+    void unlink(Timer* timer);
+    int cascade(int level, int index);
+    void advance(vector<function<void()>>& expired);
+    static void* run(void* arg);
+
+public:
+    ~TimerWheel();
+    void start();
+    unsigned long long schedule(unsigned long long delayMs, function<void()> callback);
+    bool cancel(unsigned long long id);
+    size_t size();
+};
+
+#endif
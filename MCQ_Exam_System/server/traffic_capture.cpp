@@ -0,0 +1,172 @@
+#include "traffic_capture.h"
+#include "metrics.h"
+#include <random>
+#include <cstdio>
+#include <cerrno>
+
+int TrafficCapture::fd = -1;
+string TrafficCapture::buffer;
+map<int, TrafficCapture::Connection> TrafficCapture::connections;
+unsigned long long TrafficCapture::nextId = 0;
+long long TrafficCapture::lastUs = 0;
+unsigned long long TrafficCapture::salt = 0;
+pthread_mutex_t TrafficCapture::captureMutex = PTHREAD_MUTEX_INITIALIZER;
+
+long long TrafficCapture::nowUs() {
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+void TrafficCapture::putVarint(unsigned long long value) {
+    while (value >= 0x80) {
+        buffer += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    buffer += static_cast<char>(value);
+}
+
+// An existing capture is never overwritten: a shard the supervisor restarts
+// after a crash, or a server started again with the same --capture, records
+// to the next free PATH.1, PATH.2, ... so what was captured before is kept.
+bool TrafficCapture::start(const string& path) {
+    string target = path;
+    fd = open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    for (int n = 1; fd == -1 && errno == EEXIST; ++n) {
+        target = path + "." + to_string(n);
+        fd = open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    }
+    if (fd == -1) {
+        cerr << "[!] Cannot open capture file " << target << ".\n";
+        return false;
+    }
+    // A fresh salt per capture: pseudonyms cannot be matched across files
+    random_device seed;
+    salt = (static_cast<unsigned long long>(seed()) << 32) | seed();
+
+    lastUs = nowUs();
+    uint32_t header[2] = {CAPTURE_MAGIC, CAPTURE_VERSION};
+    buffer.append(reinterpret_cast<const char*>(header), sizeof(header));
+    buffer.append(reinterpret_cast<const char*>(&lastUs), sizeof(lastUs));
+    buffer.reserve(CAPTURE_BUFFER_BYTES + 64 * 1024);
+    Wire::tap = tap;
+    cout << "[+] Recording client traffic to " << target << ".\n";
+    return true;
+}
+
+// Called with captureMutex held
+void TrafficCapture::record(int kind, const Connection& connection, const char* data, size_t length) {
+    long long now = nowUs();
+    buffer += static_cast<char>(kind);
+    putVarint(connection.id);
+    putVarint(max(0LL, now - lastUs));
+    lastUs = max(lastUs, now);
+    if (kind == CAPTURE_DATA || kind == CAPTURE_REPLY) putVarint(length);
+    if (kind == CAPTURE_DATA) buffer.append(data, length);
+    Metrics::add("capture_records_total");
+    if (buffer.size() >= CAPTURE_BUFFER_BYTES) flush();
+}
+
+void TrafficCapture::flush() {
+    size_t bytes = buffer.size();
+    for (size_t done = 0; done < buffer.size();) {
+        ssize_t n = write(fd, buffer.data() + done, buffer.size() - done);
+        if (n <= 0) {
+            cerr << "[!] Capture write failed, recording stopped.\n";
+            Wire::tap = nullptr;
+            break;
+        }
+        done += n;
+    }
+    buffer.clear();
+    Metrics::add("capture_bytes_total", bytes);
+}
+
+// FNV-1a over the salt and the name
+string TrafficCapture::pseudonym(string_view username) {
+    unsigned long long hash = 14695981039346656037ULL ^ salt;
+    for (char c : username) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "u%012llx", hash & 0xffffffffffffULL);
+    return name;
+}
+
+void TrafficCapture::opened(int sock) {
+    if (fd == -1) return;
+    pthread_mutex_lock(&captureMutex);
+    Connection& connection = connections[sock];
+    connection = Connection();
+    connection.id = nextId++;
+    record(CAPTURE_OPEN, connection, nullptr, 0);
+    pthread_mutex_unlock(&captureMutex);
+}
+
+void TrafficCapture::closed(int sock) {
+    if (fd == -1) return;
+    pthread_mutex_lock(&captureMutex);
+    auto it = connections.find(sock);
+    if (it != connections.end()) {
+        record(CAPTURE_CLOSE, it->second, nullptr, 0);
+        connections.erase(it);
+        flush();
+    }
+    pthread_mutex_unlock(&captureMutex);
+}
+
+// Before login the bytes are held until a whole binary message is in, so
+// the AuthRequest can be rewritten. Text commands (HELLO, METRICS) are read
+// whole by the server and pass straight through.
+void TrafficCapture::inbound(Connection& connection, const char* data, size_t length) {
+    if (connection.authenticated) {
+        if (connection.student) record(CAPTURE_DATA, connection, data, length);
+        return;
+    }
+    string& pending = connection.pending;
+    pending.append(data, length);
+    while (!pending.empty()) {
+        if (pending[0] != MESSAGE_MARK) {
+            record(CAPTURE_DATA, connection, pending.data(), pending.size());
+            pending.clear();
+            return;
+        }
+        uint32_t body;
+        if (pending.size() < MESSAGE_HEADER_SIZE) return;
+        memcpy(&body, pending.data() + 2, sizeof(body));
+        size_t size = MESSAGE_HEADER_SIZE + body;
+        if (pending.size() < size) return;
+
+        AuthRequest auth;
+        if (Codec::decode(pending.data(), size, auth)) {
+            string name = pseudonym(auth.username);
+            auth.username = name;
+            auth.password = name;
+            connection.student = auth.role != ROLE_INSTRUCTOR;
+            string rewritten;
+            Codec::append(auth, rewritten);
+            record(CAPTURE_DATA, connection, rewritten.data(), rewritten.size());
+        } else {
+            record(CAPTURE_DATA, connection, pending.data(), size);
+        }
+        pending.erase(0, size);
+    }
+}
+
+void TrafficCapture::tap(int sock, const char* data, size_t length, bool isInbound) {
+    pthread_mutex_lock(&captureMutex);
+    auto it = connections.find(sock);
+    if (it != connections.end()) {
+        Connection& connection = it->second;
+        if (isInbound) {
+            inbound(connection, data, length);
+        } else if (connection.authenticated ? connection.student : true) {
+            record(CAPTURE_REPLY, connection, nullptr, length);
+            AuthReply reply;
+            if (!connection.authenticated && Codec::decode(data, length, reply) && reply.ok)
+                connection.authenticated = true;
+        }
+    }
+    pthread_mutex_unlock(&captureMutex);
+}
@@ -0,0 +1,70 @@
+#ifndef TRAFFIC_CAPTURE_H
+#define TRAFFIC_CAPTURE_H
+
+#include <iostream>
+#include <string>
+#include <map>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "messages.h"
+
+using namespace std;
+
+#define CAPTURE_MAGIC 0x4354514du  // "MQTC"
+#define CAPTURE_VERSION 1
+#define CAPTURE_BUFFER_BYTES (256 * 1024)
+
+// Record kinds. Each record is the kind byte, the connection id and the
+// microseconds since the previous record (both varints), then for
+// CAPTURE_DATA a varint length and the bytes the server read, and for
+// CAPTURE_REPLY only the varint length of what it wrote.
+#define CAPTURE_OPEN 1
+#define CAPTURE_DATA 2
+#define CAPTURE_REPLY 3
+#define CAPTURE_CLOSE 4
+
+// Records what clients send, with arrival times and per-connection ids, to
+// a compact file that TrafficReplay plays back against another build. The
+// header is the magic, the version and the capture's start time (u64 us).
+//
+// Usernames are replaced by keyed-hash pseudonyms ("u" and 12 hex digits,
+// stable within one capture) and passwords by the same pseudonym, so a
+// replay can register the users it logs in as. Students are recorded in
+// full; instructor connections only up to the login, since imports and
+// exports carry other people's names. Hooked in through Wire::tap, so it
+// costs one branch per socket call when off.
+class TrafficCapture {
+private:
+    struct Connection {
+        unsigned long long id;
+        bool authenticated = false;
+        bool student = true;
+        string pending;  // login bytes held back until the whole message is in
+    };
+
+    static int fd;
+    static string buffer;
+    static map<int, Connection> connections;
+    static unsigned long long nextId;
+    static long long lastUs;
+    static unsigned long long salt;
+    static pthread_mutex_t captureMutex;
+
+    static long long nowUs();
+    static void putVarint(unsigned long long value);
+    static void record(int kind, const Connection& connection, const char* data, size_t length);
+    static string pseudonym(string_view username);
+    static void inbound(Connection& connection, const char* data, size_t length);
+    static void flush();
+    static void tap(int sock, const char* data, size_t length, bool inbound);
+
+public:
+    static bool start(const string& path);
+    static void opened(int sock);
+    static void closed(int sock);
+};
+
+#endif
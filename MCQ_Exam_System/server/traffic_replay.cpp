@@ -0,0 +1,283 @@
+#include "traffic_replay.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <ctime>
+#include <csignal>
+#include <cstring>
+
+vector<TrafficReplay::Session> TrafficReplay::sessions;
+sockaddr_in TrafficReplay::target;
+double TrafficReplay::speed = 1;
+long long TrafficReplay::startUs = 0;
+pthread_mutex_t TrafficReplay::statsMutex = PTHREAD_MUTEX_INITIALIZER;
+vector<long long> TrafficReplay::latencies;
+long long TrafficReplay::sent = 0;
+long long TrafficReplay::timeouts = 0;
+long long TrafficReplay::errors = 0;
+
+long long TrafficReplay::nowUs() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static bool getVarint(const char*& p, const char* end, unsigned long long& value) {
+    value = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char byte = *p++;
+        value |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// Events point into the mapped file, which stays mapped for the whole run
+bool TrafficReplay::load(const char* data, size_t size) {
+    uint32_t header[2];
+    if (size < sizeof(header) + sizeof(long long)) return false;
+    memcpy(header, data, sizeof(header));
+    if (header[0] != CAPTURE_MAGIC || header[1] != CAPTURE_VERSION) return false;
+
+    map<unsigned long long, size_t> index;
+    const char* p = data + sizeof(header) + sizeof(long long);
+    const char* end = data + size;
+    long long at = 0;
+    while (p < end) {
+        int kind = *p++;
+        unsigned long long id, delta, length = 0;
+        if (!getVarint(p, end, id) || !getVarint(p, end, delta)) return false;
+        if ((kind == CAPTURE_DATA || kind == CAPTURE_REPLY) && !getVarint(p, end, length)) return false;
+        if (kind == CAPTURE_DATA && length > static_cast<size_t>(end - p)) return false;
+        at += delta;
+
+        auto it = index.find(id);
+        if (it == index.end()) {
+            // A connection still open when the capture ended may lack CAPTURE_OPEN
+            it = index.emplace(id, sessions.size()).first;
+            sessions.push_back(Session());
+            sessions.back().id = id;
+        }
+        vector<ReplayEvent>& events = sessions[it->second].events;
+        if (kind == CAPTURE_REPLY) {
+            for (auto e = events.rbegin(); e != events.rend(); ++e) {
+                if (e->kind == CAPTURE_DATA) {
+                    e->replyBytes += length;
+                    break;
+                }
+            }
+        } else if (kind == CAPTURE_OPEN || kind == CAPTURE_DATA || kind == CAPTURE_CLOSE) {
+            events.push_back(ReplayEvent{kind, at, p, kind == CAPTURE_DATA ? static_cast<size_t>(length) : 0, 0});
+        }
+        if (kind == CAPTURE_DATA) p += length;
+    }
+    return true;
+}
+
+int TrafficReplay::connectTarget() {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1) return -1;
+    if (connect(sock, reinterpret_cast<sockaddr*>(&target), sizeof(target)) == -1) {
+        close(sock);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
+
+// The capture set each password to the pseudonym
+void TrafficReplay::seedUsers() {
+    map<string, AuthRequest> users;
+    for (const Session& session : sessions) {
+        for (const ReplayEvent& event : session.events) {
+            AuthRequest auth;
+            if (event.kind == CAPTURE_DATA && Codec::decode(event.data, event.length, auth)) users[string(auth.username)] = auth;
+        }
+    }
+    int registered = 0, existing = 0;
+    string buffer;
+    for (auto& entry : users) {
+        AuthRequest auth = entry.second;
+        auth.command = AUTH_REGISTER;
+        AuthReply reply;
+        int sock = connectTarget();
+        if (sock == -1 || !Codec::send(sock, auth) || !Codec::recv(sock, buffer, reply)) {
+            cerr << "[!] Could not register replay users.\n";
+            if (sock != -1) close(sock);
+            return;
+        }
+        close(sock);
+        (reply.ok ? registered : existing)++;
+    }
+    cout << "[+] Registered " << registered << " users (" << existing << " already there).\n";
+}
+
+void* TrafficReplay::play(void* arg) {
+    Session& session = *static_cast<Session*>(arg);
+    int sock = -1;
+    char scratch[64 * 1024];
+    long long mySent = 0, myTimeouts = 0, myErrors = 0;
+    vector<long long> mine;
+
+    for (const ReplayEvent& event : session.events) {
+        if (speed > 0) {
+            long long wait = startUs + static_cast<long long>(event.atUs / speed) - nowUs();
+            if (wait > 0) usleep(wait);
+        }
+        if (event.kind == CAPTURE_CLOSE) break;
+        if (sock == -1 && (sock = connectTarget()) == -1) {
+            myErrors++;
+            break;
+        }
+        if (event.kind != CAPTURE_DATA) continue;
+
+        // Whatever is left of earlier answers is not part of this one
+        while (recv(sock, scratch, sizeof(scratch), MSG_DONTWAIT) > 0) {}
+
+        const char* data = event.data;
+        string login;
+        AuthRequest auth;
+        if (Codec::decode(event.data, event.length, auth) && auth.command == AUTH_REGISTER) {
+            auth.command = AUTH_LOGIN;
+            Codec::append(auth, login);
+            data = login.data();
+        }
+
+        long long sentAt = nowUs();
+        if (!Wire::sendAll(sock, data, event.length)) {
+            myErrors++;
+            break;
+        }
+        mySent++;
+        if (event.replyBytes == 0) {
+            if (event.length > 0 && event.data[event.length - 1] != '\n') usleep(REPLAY_SETTLE_US);
+            continue;
+        }
+
+        size_t got = 0;
+        bool hungUp = false;
+        while (got < event.replyBytes) {
+            pollfd pfd{sock, POLLIN, 0};
+            if (poll(&pfd, 1, got == 0 ? REPLAY_REPLY_TIMEOUT_MS : REPLAY_QUIET_MS) <= 0) break;
+            ssize_t n = recv(sock, scratch, min(sizeof(scratch), event.replyBytes - got), 0);
+            if (n <= 0) {
+                hungUp = true;
+                break;
+            }
+            if (got == 0) mine.push_back(nowUs() - sentAt);
+            got += n;
+        }
+        if (got == 0) myTimeouts++;
+        if (hungUp) {
+            myErrors++;
+            break;
+        }
+    }
+    if (sock != -1) close(sock);
+
+    pthread_mutex_lock(&statsMutex);
+    latencies.insert(latencies.end(), mine.begin(), mine.end());
+    sent += mySent;
+    timeouts += myTimeouts;
+    errors += myErrors;
+    pthread_mutex_unlock(&statsMutex);
+    return nullptr;
+}
+
+map<string, double> TrafficReplay::report(long long elapsedUs) {
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [](double p) {
+        return latencies.empty() ? 0.0 : static_cast<double>(latencies[min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))]);
+    };
+    map<string, double> values;
+    values["connections"] = sessions.size();
+    values["requests"] = sent;
+    values["answered"] = latencies.size();
+    values["timeouts"] = timeouts;
+    values["errors"] = errors;
+    values["elapsed_ms"] = elapsedUs / 1000;
+    values["throughput_rps"] = elapsedUs > 0 ? sent * 1e6 / elapsedUs : 0;
+    values["latency_p50_us"] = percentile(0.50);
+    values["latency_p90_us"] = percentile(0.90);
+    values["latency_p99_us"] = percentile(0.99);
+    values["latency_max_us"] = latencies.empty() ? 0 : latencies.back();
+    return values;
+}
+
+// `pace` is "1", "10" (times real time) or "max". The report is printed as
+// "<name> <value>" lines and saved to reportPath; with a baseline report
+// each line also shows the change against it.
+bool TrafficReplay::run(const string& path, const string& address, const string& pace, const string& reportPath,
+                        const string& baselinePath) {
+    speed = pace == "max" ? 0 : atof(pace.c_str());
+    if (pace != "max" && speed <= 0) {
+        cerr << "[!] --speed must be a positive factor or \"max\".\n";
+        return false;
+    }
+    size_t colon = address.rfind(':');
+    target = sockaddr_in{};
+    target.sin_family = AF_INET;
+    target.sin_port = htons(atoi(address.c_str() + colon + 1));
+    string host = colon == string::npos || colon == 0 ? "127.0.0.1" : address.substr(0, colon);
+    if (colon == string::npos || inet_pton(AF_INET, host.c_str(), &target.sin_addr) != 1) {
+        cerr << "[!] --target must be <ipv4>:<port>.\n";
+        return false;
+    }
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        cerr << "[!] Cannot open capture " << path << ".\n";
+        return false;
+    }
+    void* mapped = st.st_size > 0 ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapped == MAP_FAILED || !load(static_cast<const char*>(mapped), st.st_size)) {
+        cerr << "[!] " << path << " is not a readable capture.\n";
+        if (mapped != MAP_FAILED) munmap(mapped, st.st_size);
+        return false;
+    }
+    cout << "[+] Replaying " << sessions.size() << " connections from " << path << " at "
+         << (speed > 0 ? pace + "x" : string("full speed")) << ".\n";
+
+    signal(SIGPIPE, SIG_IGN);
+    seedUsers();
+
+    vector<pthread_t> threads(sessions.size());
+    startUs = nowUs();
+    size_t started = 0;
+    int error = 0;
+    while (started < sessions.size() && (error = pthread_create(&threads[started], nullptr, play, &sessions[started])) == 0) started++;
+    for (size_t i = 0; i < started; ++i) pthread_join(threads[i], nullptr);
+    if (error) {
+        // Fewer connections than captured would not measure the same load
+        cerr << "[!] Could not start replay thread " << started + 1 << " of " << sessions.size() << ": " << strerror(error) << ".\n";
+        munmap(mapped, st.st_size);
+        return false;
+    }
+    map<string, double> values = report(nowUs() - startUs);
+    munmap(mapped, st.st_size);
+
+    map<string, double> baseline;
+    ifstream in(baselinePath);
+    string name;
+    double value;
+    while (!baselinePath.empty() && in >> name >> value) baseline[name] = value;
+
+    ofstream out;
+    if (!reportPath.empty()) out.open(reportPath);
+    cout << fixed << setprecision(0);
+    for (const auto& entry : values) {
+        cout << entry.first << " " << entry.second;
+        auto it = baseline.find(entry.first);
+        if (it != baseline.end()) {
+            cout << "  (baseline " << it->second;
+            if (it->second != 0) cout << ", " << showpos << setprecision(1) << (entry.second - it->second) * 100 / it->second << "%" << noshowpos << setprecision(0);
+            cout << ")";
+        }
+        cout << "\n";
+        if (out.is_open()) out << entry.first << " " << fixed << setprecision(0) << entry.second << "\n";
+    }
+    return errors == 0;
+}
@@ -0,0 +1,73 @@
+#ifndef TRAFFIC_REPLAY_H
+#define TRAFFIC_REPLAY_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "traffic_capture.h"
+
+using namespace std;
+
+#define REPLAY_REPLY_TIMEOUT_MS 5000
+// An answer shorter than the recorded one is taken as complete after this
+// long without more bytes
+#define REPLAY_QUIET_MS 50
+// Pause after a chunk nobody answered that is not a whole line: the server
+// reads menu choices with a single recv, so two of them must not arrive as one
+#define REPLAY_SETTLE_US 1000
+
+struct ReplayEvent {
+    int kind;
+    long long atUs;  // since the capture started
+    const char* data;
+    size_t length;
+    size_t replyBytes;  // what the server wrote back before the next chunk
+};
+
+// Plays a TrafficCapture file against a server: one thread per recorded
+// connection sends its chunks at the recorded offsets divided by `speed`
+// (0: as fast as possible), and never before it has read as much of the
+// answer to the previous chunk as the capture recorded. Latency is the time
+// from sending an answered chunk to the first byte back.
+//
+// Every user in the capture is registered first and registrations are
+// replayed as logins, so the target only needs the exams and the same
+// capture can be played against it again.
+class TrafficReplay {
+private:
+    struct Session {
+        unsigned long long id = 0;
+        vector<ReplayEvent> events;
+    };
+
+    static vector<Session> sessions;
+    static sockaddr_in target;
+    static double speed;
+    static long long startUs;
+    static pthread_mutex_t statsMutex;
+    static vector<long long> latencies;
+    static long long sent, timeouts, errors;
+
+    static long long nowUs();
+    static bool load(const char* data, size_t size);
+    static int connectTarget();
+    static void seedUsers();
+    static void* play(void* arg);
+    static map<string, double> report(long long elapsedUs);
+
+public:
+    static bool run(const string& path, const string& address, const string& pace, const string& reportPath,
+                    const string& baselinePath);
+};
+
+#endif
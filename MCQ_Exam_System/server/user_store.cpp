@@ -0,0 +1,374 @@
+#include "user_store.h"
+#include "metrics.h"
+
+static uint64_t fmix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+UserStore::UserStore(const string& textPath) : textPath(textPath) {
+    imagePath = textPath.substr(0, textPath.rfind('.')) + ".db";
+    pthread_mutex_init(&storeMutex, nullptr);
+}
+
+uint64_t UserStore::keyOf(const string& username) {
+    // FNV-1a, 64 bit, with an avalanche so similar names spread over buckets
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : username) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return fmix64(h);
+}
+
+uint64_t UserStore::slot(uint64_t key, uint32_t displacement, uint64_t count) {
+    if (displacement & USER_DIRECT_SLOT) return displacement & ~USER_DIRECT_SLOT;
+    return fmix64(key ^ (displacement * 0x9e3779b97f4a7c15ULL)) % count;
+}
+
+// Hash and displace: keys are split into buckets of about
+// USER_KEYS_PER_BUCKET, and each bucket, largest first, gets the smallest
+// displacement that puts all of its keys on free slots. Buckets of one key
+// come last and store the index of a free slot directly, which saves the
+// long searches for the last few free slots. Every slot ends up used exactly
+// once. Fails only if two users share a key.
+bool UserStore::compile(vector<UserRecord>& users, uint64_t covered, uint64_t sourceInode, string& out) {
+    uint64_t count = users.size();
+    if (count >= USER_DIRECT_SLOT) return false;
+    uint64_t buckets = max<uint64_t>(1, (count + USER_KEYS_PER_BUCKET - 1) / USER_KEYS_PER_BUCKET);
+
+    vector<uint32_t> start(buckets + 1, 0), members(count);
+    for (const UserRecord& user : users) start[user.key % buckets + 1]++;
+    for (uint64_t b = 0; b < buckets; ++b) start[b + 1] += start[b];
+    vector<uint32_t> next(start.begin(), start.end() - 1);
+    for (uint64_t i = 0; i < count; ++i) members[next[users[i].key % buckets]++] = i;
+
+    vector<uint32_t> bucketOrder(buckets);
+    for (uint64_t b = 0; b < buckets; ++b) bucketOrder[b] = b;
+    sort(bucketOrder.begin(), bucketOrder.end(), [&](uint32_t a, uint32_t b) {
+        return start[a + 1] - start[a] > start[b + 1] - start[b];
+    });
+
+    size_t tableOffset = (sizeof(UserImageHeader) + buckets * sizeof(uint32_t) + 7) & ~(size_t)7;
+    out.assign(tableOffset + count * sizeof(UserRecord), '\0');
+    UserImageHeader* header = reinterpret_cast<UserImageHeader*>(&out[0]);
+    header->magic = USER_IMAGE_MAGIC;
+    header->version = USER_IMAGE_VERSION;
+    header->count = count;
+    header->buckets = buckets;
+    header->covered = covered;
+    header->sourceInode = sourceInode;
+    uint32_t* displacements = reinterpret_cast<uint32_t*>(&out[0] + sizeof(UserImageHeader));
+    UserRecord* table = reinterpret_cast<UserRecord*>(&out[0] + tableOffset);
+
+    vector<char> taken(count, 0);
+    vector<uint64_t> slots;
+    uint64_t nextFree = 0;
+    for (uint32_t b : bucketOrder) {
+        uint32_t from = start[b], to = start[b + 1];
+        if (from == to) break;
+        if (to - from == 1) {
+            while (taken[nextFree]) nextFree++;
+            taken[nextFree] = 1;
+            displacements[b] = USER_DIRECT_SLOT | nextFree;
+            table[nextFree] = users[members[from]];
+            continue;
+        }
+        uint32_t displacement = 0;
+        while (true) {
+            slots.clear();
+            bool fits = true;
+            for (uint32_t m = from; fits && m < to; ++m) {
+                uint64_t s = slot(users[members[m]].key, displacement, count);
+                fits = !taken[s] && std::find(slots.begin(), slots.end(), s) == slots.end();
+                slots.push_back(s);
+            }
+            if (fits) break;
+            if (++displacement == USER_DIRECT_SLOT) return false;
+        }
+        displacements[b] = displacement;
+        for (uint32_t m = from; m < to; ++m) {
+            taken[slots[m - from]] = 1;
+            table[slots[m - from]] = users[members[m]];
+        }
+    }
+    return true;
+}
+
+void UserStore::unmapImage() {
+    if (image != MAP_FAILED) munmap(image, imageSize);
+    image = MAP_FAILED;
+    imageSize = 0;
+    imageInode = 0;
+    header = nullptr;
+    displacements = nullptr;
+    records = nullptr;
+}
+
+// Maps the image if it is intact and was compiled from the current text
+// file; the delta then only needs what was written after it.
+bool UserStore::mapImage() {
+    int fd = ::open(imagePath.c_str(), O_RDONLY);
+    if (fd == -1) return false;
+    struct stat st, text;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(UserImageHeader)) {
+        close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) return false;
+
+    const UserImageHeader* h = static_cast<const UserImageHeader*>(mapped);
+    uint64_t size = st.st_size;
+    bool valid = h->magic == USER_IMAGE_MAGIC && h->version == USER_IMAGE_VERSION && h->buckets > 0 &&
+                 h->buckets <= size / sizeof(uint32_t) && h->count <= size / sizeof(UserRecord);
+    size_t tableOffset = valid ? (sizeof(UserImageHeader) + h->buckets * sizeof(uint32_t) + 7) & ~(size_t)7 : 0;
+    valid = valid && size == tableOffset + h->count * sizeof(UserRecord) &&
+            stat(textPath.c_str(), &text) == 0 && (uint64_t)text.st_ino == h->sourceInode &&
+            (uint64_t)text.st_size >= h->covered;
+    if (!valid) {
+        munmap(mapped, st.st_size);
+        return false;
+    }
+
+    unmapImage();
+    image = mapped;
+    imageSize = st.st_size;
+    imageInode = st.st_ino;
+    header = h;
+    displacements = reinterpret_cast<const uint32_t*>(static_cast<const char*>(mapped) + sizeof(UserImageHeader));
+    records = reinterpret_cast<const UserRecord*>(static_cast<const char*>(mapped) + tableOffset);
+    consumed = h->covered;
+    delta.clear();
+    return true;
+}
+
+// Folds in the lines appended to the text file since the last call. A line
+// still being written is left for the next one.
+void UserStore::readTail() {
+    int fd = ::open(textPath.c_str(), O_RDONLY);
+    if (fd == -1) return;
+    struct stat st;
+    fstat(fd, &st);
+    if (st.st_size <= consumed) {
+        close(fd);
+        return;
+    }
+    string tail(st.st_size - consumed, '\0');
+    ssize_t got = pread(fd, &tail[0], tail.size(), consumed);
+    close(fd);
+    tail.resize(got > 0 ? got : 0);
+    size_t complete = tail.rfind('\n');
+    if (complete == string::npos) return;
+
+    const char* p = tail.data();
+    const char* end = p + complete + 1;
+    while (p < end) {
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        const char* nameStart = p;
+        while (nameStart < eol && (*nameStart == ' ' || *nameStart == '\t')) nameStart++;
+        const char* nameEnd = nameStart;
+        while (nameEnd < eol && *nameEnd != ' ' && *nameEnd != '\t') nameEnd++;
+        char* passwordEnd;
+        uint64_t password = strtoull(nameEnd, &passwordEnd, 10);
+        // Anything but a hash_password() value could never match at login
+        if (nameEnd > nameStart && passwordEnd > nameEnd && passwordEnd <= eol) {
+            string name(nameStart, nameEnd);
+            auto it = delta.find(keyOf(name));
+            // The first of two names sharing a key keeps it
+            if (it == delta.end()) delta.emplace(keyOf(name), make_pair(name, password));
+            else if (it->second.first == name) it->second.second = password;
+            else cerr << "[!] Ignoring " << name << " in " << textPath << ": its key is taken by " << it->second.first << "\n";
+        }
+        p = eol + 1;
+    }
+    consumed += complete + 1;
+}
+
+void UserStore::reopen() {
+    unmapImage();
+    delta.clear();
+    consumed = 0;
+
+    struct stat st;
+    if (stat(textPath.c_str(), &st) == -1) {
+        cerr << "Warning: " << textPath << " not found. Creating a new one." << endl;
+        int fd = ::open(textPath.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd == -1) {
+            cerr << "Error: Unable to create file " << textPath << endl;
+            return;
+        }
+        close(fd);
+        stat(textPath.c_str(), &st);
+    }
+    textInode = st.st_ino;
+    mapImage();
+    readTail();
+}
+
+// Picks up lines and images written by other server processes.
+void UserStore::refreshLocked() {
+    struct stat text, img;
+    if (stat(textPath.c_str(), &text) == -1 || text.st_ino != textInode || text.st_size < consumed) {
+        // Replaced or truncated: start over
+        reopen();
+    } else {
+        if (stat(imagePath.c_str(), &img) == 0 && img.st_ino != imageInode) mapImage();
+        readTail();
+    }
+    maybeMerge();
+}
+
+bool UserStore::findLocked(const string& username, uint64_t& password) {
+    uint64_t key = keyOf(username);
+    auto it = delta.find(key);
+    if (it != delta.end()) {
+        if (it->second.first != username) return false;
+        password = it->second.second;
+        return true;
+    }
+    if (!header || header->count == 0) return false;
+    uint64_t s = slot(key, displacements[key % header->buckets], header->count);
+    if (s >= header->count || records[s].key != key) return false;
+    const UserRecord& record = records[s];
+    password = record.password;
+    return true;
+}
+
+// Whether username, or another name with its key, is a user already
+bool UserStore::takenLocked(const string& username) {
+    uint64_t password;
+    return delta.count(keyOf(username)) || findLocked(username, password);
+}
+
+void UserStore::maybeMerge() {
+    if (merging || delta.size() < USER_DELTA_MERGE_ENTRIES) return;
+    merging = true;
+    pthread_t thread;
+    pthread_create(&thread, nullptr, mergeThread, this);
+    pthread_detach(thread);
+}
+
+void* UserStore::mergeThread(void* arg) {
+    static_cast<UserStore*>(arg)->merge();
+    return nullptr;
+}
+
+// Compiles the current image plus the delta into a new image. Only one
+// process compiles at a time; the others map its result on their next refresh.
+void UserStore::merge() {
+    long long started = Metrics::nowMs();
+    string lockPath = imagePath + ".lock";
+    int mergeLock = ::open(lockPath.c_str(), O_RDWR | O_CREAT, 0644);
+    if (mergeLock == -1 || flock(mergeLock, LOCK_EX | LOCK_NB) == -1) {
+        if (mergeLock != -1) close(mergeLock);
+        pthread_mutex_lock(&storeMutex);
+        merging = false;
+        pthread_mutex_unlock(&storeMutex);
+        return;
+    }
+
+    // Registrations and imports write under an exclusive lock on the text
+    // file, so holding a shared one makes the snapshot exactly its first
+    // `covered` bytes.
+    int textLock = ::open(textPath.c_str(), O_RDONLY);
+    if (textLock != -1) flock(textLock, LOCK_SH);
+    pthread_mutex_lock(&storeMutex);
+    refreshLocked();
+    uint64_t covered = consumed, sourceInode = textInode;
+    bool needed = delta.size() >= USER_DELTA_MERGE_ENTRIES;
+    vector<UserRecord> users;
+    if (needed) {
+        uint64_t imaged = header ? header->count : 0;
+        users.reserve(imaged + delta.size());
+        for (uint64_t i = 0; i < imaged; ++i) {
+            if (!delta.count(records[i].key)) users.push_back(records[i]);
+        }
+        for (auto& user : delta) users.push_back(UserRecord{user.first, user.second.second});
+    }
+    pthread_mutex_unlock(&storeMutex);
+    if (textLock != -1) close(textLock);
+
+    string compiled;
+    bool ok = needed && compile(users, covered, sourceInode, compiled);
+    if (ok) {
+        string tmpPath = imagePath + ".tmp";
+        int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ok = fd != -1;
+        for (size_t written = 0; ok && written < compiled.size();) {
+            ssize_t n = write(fd, compiled.data() + written, compiled.size() - written);
+            ok = n > 0;
+            if (ok) written += n;
+        }
+        if (fd != -1) {
+            ok = ok && fsync(fd) == 0;
+            close(fd);
+        }
+        ok = ok && rename(tmpPath.c_str(), imagePath.c_str()) == 0;
+        if (!ok) cerr << "[!] Failed to write user image " << imagePath << "\n";
+    }
+
+    pthread_mutex_lock(&storeMutex);
+    if (ok && mapImage()) {
+        readTail();
+        Metrics::add("user_image_merges_total");
+        cout << "[+] Compiled " << users.size() << " users into " << imagePath << " in "
+             << Metrics::nowMs() - started << " ms." << endl;
+    }
+    merging = false;
+    pthread_mutex_unlock(&storeMutex);
+    close(mergeLock);
+}
+
+void UserStore::open() {
+    pthread_mutex_lock(&storeMutex);
+    reopen();
+    cout << "[+] " << textPath << ": " << (header ? header->count : 0) << " users mapped, "
+         << delta.size() << " in the delta log" << endl;
+    maybeMerge();
+    pthread_mutex_unlock(&storeMutex);
+}
+
+void UserStore::refresh() {
+    pthread_mutex_lock(&storeMutex);
+    refreshLocked();
+    pthread_mutex_unlock(&storeMutex);
+}
+
+bool UserStore::find(const string& username, uint64_t& password) {
+    pthread_mutex_lock(&storeMutex);
+    bool found = findLocked(username, password);
+    pthread_mutex_unlock(&storeMutex);
+    return found;
+}
+
+bool UserStore::taken(const string& username) {
+    pthread_mutex_lock(&storeMutex);
+    bool known = takenLocked(username);
+    pthread_mutex_unlock(&storeMutex);
+    return known;
+}
+
+// Adds a user being appended to the text file, unless the name or its key
+// is taken.
+bool UserStore::insert(const string& username, uint64_t password) {
+    pthread_mutex_lock(&storeMutex);
+    bool added = !takenLocked(username);
+    if (added) {
+        delta.emplace(keyOf(username), make_pair(username, password));
+        maybeMerge();
+    }
+    pthread_mutex_unlock(&storeMutex);
+    return added;
+}
+
+void UserStore::reserve(size_t users) {
+    pthread_mutex_lock(&storeMutex);
+    delta.reserve(delta.size() + users);
+    pthread_mutex_unlock(&storeMutex);
+}
@@ -0,0 +1,97 @@
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+#define USER_IMAGE_MAGIC 0x3153554du  // "MUS1"
+#define USER_IMAGE_VERSION 1
+#define USER_KEYS_PER_BUCKET 2
+#define USER_DELTA_MERGE_ENTRIES 4096
+#define USER_DIRECT_SLOT 0x80000000u  // displacement flag: the low bits are the slot
+
+// Layout of a compiled user image: this header, one 32 bit displacement per
+// bucket, padding to 8 bytes, then one UserRecord per user.
+struct UserImageHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;        // users, and slots in the table
+    uint64_t buckets;
+    uint64_t covered;      // bytes of the text file compiled into the image
+    uint64_t sourceInode;  // inode of that text file
+};
+
+struct UserRecord {
+    uint64_t key;       // 64 bit hash of the username
+    uint64_t password;  // hash_password() value
+};
+
+// The users of one role. The text file ("username hashedpass" lines) stays
+// the append-only source of truth that registrations, imports and
+// replication write to. Every USER_DELTA_MERGE_ENTRIES new lines a background
+// thread compiles it into an image next to it (students.txt ->
+// students.db): a minimal perfect hash over the username hashes with
+// fixed-width records, 18 bytes per user. Startup mmaps the image and only
+// parses the text written after it was compiled, so it costs the same for
+// ten users or ten million. Usernames themselves are not kept in the image,
+// so a name whose 64 bit hash is already taken, in the image or the delta,
+// cannot be added; the delta is keyed by that hash and keeps the name to
+// tell the two apart.
+// Images are derived data and are not replicated; a standby compiles its own.
+class UserStore {
+private:
+    string textPath, imagePath;
+    pthread_mutex_t storeMutex;
+
+    void* image = MAP_FAILED;
+    size_t imageSize = 0;
+    ino_t imageInode = 0;
+    const UserImageHeader* header = nullptr;
+    const uint32_t* displacements = nullptr;
+    const UserRecord* records = nullptr;
+
+    ino_t textInode = 0;
+    off_t consumed = 0;                       // bytes of the text file in the image or the delta
+    unordered_map<uint64_t, pair<string, uint64_t>> delta;  // users not in the image yet: key -> name, password
+    bool merging = false;
+
+    static uint64_t slot(uint64_t key, uint32_t displacement, uint64_t count);
+    bool mapImage();
+    void unmapImage();
+    void reopen();
+    void readTail();
+    void refreshLocked();
+    bool findLocked(const string& username, uint64_t& password);
+    bool takenLocked(const string& username);
+    void maybeMerge();
+    static void* mergeThread(void* arg);
+    void merge();
+
+public:
+    UserStore(const string& textPath);
+    static uint64_t keyOf(const string& username);
+    static bool compile(vector<UserRecord>& users, uint64_t covered, uint64_t sourceInode, string& out);
+
+    void open();
+    void refresh();
+    bool find(const string& username, uint64_t& password);
+    bool taken(const string& username);
+    bool insert(const string& username, uint64_t password);
+    void reserve(size_t users);
+};
+
+#endif